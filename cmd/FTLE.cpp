@@ -1,55 +1,58 @@
 #include "FTLE.hpp"
 #include "UnsteadyTracer.hpp"
+#include "FlowMapCache.hpp"
 #include <vtkImageData.h>
 #include <vtkFloatArray.h>
 #include <vtkPointData.h>
 #include "AmiraWriter.hpp"
+#include "AsyncWriter.hpp"
 
 namespace vispro
 {
-	void FTLE::Compute(const char* basePath, const char* ftlePath, const Eigen::Vector3i& resolution, double stepSize, double startTime, double duration)
+	double FTLE::Compute(const char* basePath, const char* ftlePath, const Eigen::Vector3i& resolution, double stepSize, double startTime, double duration, bool useBricks, Quantization::EStorage storage, double errorBound, AsyncWriter* writer, int sortInterval, FlowMapCache* flowMaps, int numThreads)
 	{
-		// allocate the tracer, which reads the header of the data set
-		UnsteadyTracer tracer(basePath);
-		Eigen::AlignedBox3d bounds = tracer.GetBounds();
+		// allocate the tracer, which reads the header of the data set, unless the flow map is composed
+		std::unique_ptr<UnsteadyTracer> tracer;
+		if (!flowMaps) {
+			tracer = std::make_unique<UnsteadyTracer>(basePath);
+			tracer->SetUseBricks(useBricks);
+			tracer->SetSortInterval(sortInterval);
+			tracer->SetNumThreads(numThreads);
+		}
+		Eigen::AlignedBox3d bounds = flowMaps ? flowMaps->GetBounds() : tracer->GetBounds();
 		Eigen::Vector3d spacing(
 			(bounds.max()[0] - bounds.min()[0]) / (resolution[0] - 1.),
 			(bounds.max()[1] - bounds.min()[1]) / (resolution[1] - 1.),
 			(bounds.max()[2] - bounds.min()[2]) / (resolution[2] - 1.));
 
-		// allocate output field
-		vtkNew<vtkImageData> ftle;
-		ftle->SetDimensions(resolution.data());
-		ftle->SetOrigin(bounds.min().data());
-		ftle->SetSpacing(spacing.data());
-		vtkNew<vtkFloatArray> mArray;
+		// allocate output field, or take a flushed one from the writer
+		vtkSmartPointer<vtkImageData> ftle = writer ?
+			writer->AcquireField(resolution.data(), bounds.min().data(), spacing.data(), { "ftle" }) :
+			AsyncWriter::AllocateField(resolution.data(), bounds.min().data(), spacing.data(), { "ftle" });
+		vtkFloatArray* mArray = dynamic_cast<vtkFloatArray*>(ftle->GetPointData()->GetArray("ftle"));
 		int64_t numPoints = (int64_t)resolution.prod();
-		mArray->SetNumberOfComponents(1);
-		mArray->SetNumberOfTuples(numPoints);
-		mArray->SetName("ftle");
-		ftle->GetPointData()->AddArray(mArray);
 
 		if (mArray->GetNumberOfTuples() != numPoints) {
 			std::cerr << "Expected: " << numPoints << "Found: " << mArray->GetNumberOfTuples();
-			return;
+			return 0;
 		}
 		else {
 			std::cout << numPoints;
 		}
 
-		// create the seed points on a regular grid
-		std::vector<Eigen::Vector3d> particles(numPoints);
-		std::vector<int> inDomain(numPoints, 1);
+		// create the seed points on a regular grid, the index of a particle in the set is its grid point
+		ParticleSet particles;
+		particles.Reserve(numPoints);
 		for (int iz = 0; iz < resolution[2]; ++iz)
 			for (int iy = 0; iy < resolution[1]; ++iy)
 				for (int ix = 0; ix < resolution[0]; ++ix)
-				{
-					Eigen::Vector3d pos = bounds.min() + Eigen::Vector3d(ix, iy, iz).cwiseProduct(spacing);
-					particles[((int64_t)iz * resolution.y() + iy) * resolution.x() + ix] = pos;
-				}
+					particles.Add(bounds.min() + Eigen::Vector3d(ix, iy, iz).cwiseProduct(spacing));
 
-		// trace the particles
-		tracer.Flowmap(particles, inDomain, stepSize, startTime, duration);
+		// trace the particles, the tracer of the flow maps counts the reads of all calls
+		const double ioWaitBefore = flowMaps ? flowMaps->GetTracer().GetIoWaitSeconds() : 0;
+		if (flowMaps) flowMaps->Flowmap(particles, stepSize, startTime, duration);
+		else tracer->Flowmap(particles, stepSize, startTime, duration);
+		const double ioWaitSeconds = (flowMaps ? flowMaps->GetTracer().GetIoWaitSeconds() : tracer->GetIoWaitSeconds()) - ioWaitBefore;
 
 		// compute the FTLE values
 		for (int iz = 0; iz < resolution[2]; ++iz) {
@@ -64,17 +67,17 @@ namespace vispro
 					int iz1 = std::min(iz + 1, resolution[2] - 1);
 
 					double ftle = 0;
-					if (inDomain[((int64_t)iz * resolution[1] + iy) * resolution[0] + ix0] &&
-						inDomain[((int64_t)iz * resolution[1] + iy) * resolution[0] + ix1] &&
-						inDomain[((int64_t)iz * resolution[1] + iy0) * resolution[0] + ix] &&
-						inDomain[((int64_t)iz * resolution[1] + iy1) * resolution[0] + ix] &&
-						inDomain[((int64_t)iz0 * resolution[1] + iy) * resolution[0] + ix] &&
-						inDomain[((int64_t)iz1 * resolution[1] + iy) * resolution[0] + ix])
+					if (particles.IsActive(((int64_t)iz * resolution[1] + iy) * resolution[0] + ix0) &&
+						particles.IsActive(((int64_t)iz * resolution[1] + iy) * resolution[0] + ix1) &&
+						particles.IsActive(((int64_t)iz * resolution[1] + iy0) * resolution[0] + ix) &&
+						particles.IsActive(((int64_t)iz * resolution[1] + iy1) * resolution[0] + ix) &&
+						particles.IsActive(((int64_t)iz0 * resolution[1] + iy) * resolution[0] + ix) &&
+						particles.IsActive(((int64_t)iz1 * resolution[1] + iy) * resolution[0] + ix))
 					{
 						// compute flow map gradient via finite differences
-						Eigen::Vector3d phix = (particles[((int64_t)iz * resolution[1] + iy) * resolution[0] + ix1] - particles[((int64_t)iz * resolution[1] + iy) * resolution[0] + ix0]) / (((int64_t)ix1 - ix0) * spacing[0]);
-						Eigen::Vector3d phiy = (particles[((int64_t)iz * resolution[1] + iy1) * resolution[0] + ix] - particles[((int64_t)iz * resolution[1] + iy0) * resolution[0] + ix]) / (((int64_t)iy1 - iy0) * spacing[1]);
-						Eigen::Vector3d phiz = (particles[((int64_t)iz1 * resolution[1] + iy) * resolution[0] + ix] - particles[((int64_t)iz0 * resolution[1] + iy) * resolution[0] + ix]) / (((int64_t)iz1 - iz0) * spacing[2]);
+						Eigen::Vector3d phix = (particles.GetPosition(((int64_t)iz * resolution[1] + iy) * resolution[0] + ix1) - particles.GetPosition(((int64_t)iz * resolution[1] + iy) * resolution[0] + ix0)) / (((int64_t)ix1 - ix0) * spacing[0]);
+						Eigen::Vector3d phiy = (particles.GetPosition(((int64_t)iz * resolution[1] + iy1) * resolution[0] + ix) - particles.GetPosition(((int64_t)iz * resolution[1] + iy0) * resolution[0] + ix)) / (((int64_t)iy1 - iy0) * spacing[1]);
+						Eigen::Vector3d phiz = (particles.GetPosition(((int64_t)iz1 * resolution[1] + iy) * resolution[0] + ix) - particles.GetPosition(((int64_t)iz0 * resolution[1] + iy) * resolution[0] + ix)) / (((int64_t)iz1 - iz0) * spacing[2]);
 						Eigen::Matrix3d phiT;
 						phiT << phix, phiy, phiz;
 						phiT.transposeInPlace();
@@ -89,6 +92,8 @@ namespace vispro
 		}
 
 		// write the result to file
-		AmiraWriter::WriteScalarField(ftlePath, "ftle", ftle);
+		if (writer) writer->WriteScalarField(ftlePath, "ftle", ftle, storage, errorBound);
+		else AmiraWriter::WriteScalarField(ftlePath, "ftle", ftle, storage, errorBound);
+		return ioWaitSeconds;
 	}
 }
\ No newline at end of file
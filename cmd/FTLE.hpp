@@ -1,14 +1,27 @@
 #pragma once
 
 #include <Eigen/Eigen>
+#include "Quantization.hpp"
 
 namespace vispro
 {
+	class AsyncWriter;
+	class FlowMapCache;
+
 	// Class that computes the finite-time Lyapunov exponent.
 	class FTLE
 	{
 	public:
 		// Receives the output path of the *.am files, as well the desired grid resolution and numerical integration parameters.
-		static void Compute(const char* basePath, const char* ftlePath, const Eigen::Vector3i& resolution, double stepSize, double startTime, double duration);
+		// If useBricks is set, the velocity is sampled from the bricked files (*.amb), which decodes only the visited bricks.
+		// The output can be stored in a compact type or compressed with an absolute error bound, since it is only used for visualization.
+		// If a writer is given, the output is written in the background and its buffer is reused.
+		// A positive sort interval sorts the particles spatially every that many integration steps (see UnsteadyTracer::SetSortInterval).
+		// If a flow map cache is given, the flow map is composed from its cached time steps instead, which the calls for consecutive start times share.
+		// Its tracer integrates the time steps, so useBricks, the sort interval and the number of threads do not apply then.
+		// The number of threads advect the particles, zero or less uses all hardware threads (see UnsteadyTracer::SetNumThreads).
+		// Returns the time that the tracer waited for reads of the velocity, in seconds (see UnsteadyTracer::GetIoWaitSeconds).
+		static double Compute(const char* basePath, const char* ftlePath, const Eigen::Vector3i& resolution, double stepSize, double startTime, double duration, bool useBricks = false,
+			Quantization::EStorage storage = Quantization::EStorage::Float, double errorBound = 0, AsyncWriter* writer = nullptr, int sortInterval = 0, FlowMapCache* flowMaps = nullptr, int numThreads = 0);
 	};
 }
\ No newline at end of file
@@ -6,16 +6,17 @@
 #include <Eigen/Dense>
 #include "AmiraReader.hpp"
 #include "AmiraWriter.hpp"
+#include "AsyncWriter.hpp"
 
 namespace vispro
 {
-    void FeatureFlow::Compute(const char* velocityPathPrev, const char* velocityPathCurr, const char* velocityPathNext, int deltaSteps, const char* featureFlowPath) {
+    void FeatureFlow::Compute(const char* velocityPathPrev, const char* velocityPathCurr, const char* velocityPathNext, int deltaSteps, const char* featureFlowPath, AsyncWriter* writer) {
         vtkSmartPointer<vtkImageData> velocityImagePrev =
-            AmiraReader::ReadField(velocityPathPrev, "velocity");
+            AmiraReader::ReadFieldMapped(velocityPathPrev, "velocity");
         vtkSmartPointer<vtkImageData> velocityImageCurr =
-            AmiraReader::ReadField(velocityPathCurr, "velocity");
+            AmiraReader::ReadFieldMapped(velocityPathCurr, "velocity");
         vtkSmartPointer<vtkImageData> velocityImageNext =
-            AmiraReader::ReadField(velocityPathNext, "velocity");
+            AmiraReader::ReadFieldMapped(velocityPathNext, "velocity");
 
         if (!velocityImagePrev || !velocityImageCurr || !velocityImageNext) {
             throw std::runtime_error("Failed to read input velocity fields.");
@@ -40,10 +41,11 @@ namespace vispro
             throw std::runtime_error("Failed to retrieve velocity arrays.");
         }
  
-        vtkSmartPointer<vtkImageData> featureFlowImage = vtkSmartPointer<vtkImageData>::New();
-        featureFlowImage->SetDimensions(velocityImageCurr->GetDimensions());
-        featureFlowImage->SetOrigin(velocityImageCurr->GetOrigin());
-        featureFlowImage->SetSpacing(velocityImageCurr->GetSpacing());
+        // allocate output field, or take a flushed one from the writer
+        const std::vector<std::string> arrayNames = { "feature_flowU", "feature_flowV", "feature_flowW" };
+        vtkSmartPointer<vtkImageData> featureFlowImage = writer ?
+            writer->AcquireField(velocityImageCurr->GetDimensions(), velocityImageCurr->GetOrigin(), velocityImageCurr->GetSpacing(), arrayNames) :
+            AsyncWriter::AllocateField(velocityImageCurr->GetDimensions(), velocityImageCurr->GetOrigin(), velocityImageCurr->GetSpacing(), arrayNames);
 
         /*int64_t numPoints = (int64_t)featureFlowImage->GetDimensions()[0] 
             * featureFlowImage->GetDimensions()[1] 
@@ -52,25 +54,9 @@ namespace vispro
         int* res = featureFlowImage->GetDimensions();
         int64_t numPoints = static_cast<int64_t>(res[0] * res[1] * res[2]);
 
-        vtkSmartPointer<vtkFloatArray> featureFlowArrayU = vtkSmartPointer<vtkFloatArray>::New();
-        vtkSmartPointer<vtkFloatArray> featureFlowArrayV = vtkSmartPointer<vtkFloatArray>::New();
-        vtkSmartPointer<vtkFloatArray> featureFlowArrayW = vtkSmartPointer<vtkFloatArray>::New();
-
-        featureFlowArrayU->SetNumberOfComponents(1);
-        featureFlowArrayV->SetNumberOfComponents(1);
-        featureFlowArrayW->SetNumberOfComponents(1);
-
-        featureFlowArrayU->SetNumberOfTuples(numPoints);
-        featureFlowArrayV->SetNumberOfTuples(numPoints);
-        featureFlowArrayW->SetNumberOfTuples(numPoints);
-
-        featureFlowArrayU->SetName("feature_flowU");
-        featureFlowArrayV->SetName("feature_flowV");
-        featureFlowArrayW->SetName("feature_flowW");
-
-        featureFlowImage->GetPointData()->AddArray(featureFlowArrayU);
-        featureFlowImage->GetPointData()->AddArray(featureFlowArrayV);
-        featureFlowImage->GetPointData()->AddArray(featureFlowArrayW);
+        vtkFloatArray* featureFlowArrayU = vtkFloatArray::SafeDownCast(featureFlowImage->GetPointData()->GetArray("feature_flowU"));
+        vtkFloatArray* featureFlowArrayV = vtkFloatArray::SafeDownCast(featureFlowImage->GetPointData()->GetArray("feature_flowV"));
+        vtkFloatArray* featureFlowArrayW = vtkFloatArray::SafeDownCast(featureFlowImage->GetPointData()->GetArray("feature_flowW"));
 
         /*featureFlowArray->SetNumberOfComponents(velocityDataCurr->GetNumberOfComponents());
         featureFlowArray->SetNumberOfTuples(velocityDataCurr->GetNumberOfTuples());
@@ -151,6 +137,7 @@ namespace vispro
             }
         }
         
-        AmiraWriter::WriteVectorField(featureFlowPath, "feature_flowU", "feature_flowV", "feature_flowW", featureFlowImage);
+        if (writer) writer->WriteVectorField(featureFlowPath, "feature_flowU", "feature_flowV", "feature_flowW", featureFlowImage);
+        else AmiraWriter::WriteVectorField(featureFlowPath, "feature_flowU", "feature_flowV", "feature_flowW", featureFlowImage);
     }
 }
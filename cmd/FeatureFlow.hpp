@@ -2,9 +2,12 @@
 
 namespace vispro {
 
+	class AsyncWriter;
+
 	class FeatureFlow {
 	public:
-		static void Compute(const char* velocityPathPrev, const char* velocityPathCurr, const char* velocityPathNext, int deltaSteps, const char* featureFlowPath);
+		// If a writer is given, the output is written in the background and its buffer is reused.
+		static void Compute(const char* velocityPathPrev, const char* velocityPathCurr, const char* velocityPathNext, int deltaSteps, const char* featureFlowPath, AsyncWriter* writer = nullptr);
 	};
 
 } // namespace vispro
@@ -0,0 +1,141 @@
+#include "FlowMapCache.hpp"
+#include <cmath>
+#include <limits>
+
+namespace vispro
+{
+	// Distance in time steps within which a time counts as being on a time step, so that rounding of the start times does not trace tiny parts directly.
+	static const double TimeStepTolerance = 1e-6;
+
+	FlowMapCache::FlowMapCache(const std::string& basePath, const Eigen::Vector3i& resolution) :
+		mTracer(basePath), mResolution(resolution.cwiseMax(Eigen::Vector3i(2, 2, 2))), mNumIntegrated(0)
+	{
+		mSpacing = mTracer.GetBounds().sizes().cwiseQuotient((mResolution - Eigen::Vector3i(1, 1, 1)).cast<double>());
+	}
+
+	UnsteadyTracer& FlowMapCache::GetTracer() { return mTracer; }
+	const Eigen::AlignedBox3d& FlowMapCache::GetBounds() const { return mTracer.GetBounds(); }
+	int FlowMapCache::GetNumIntegrated() const { return mNumIntegrated; }
+
+	void FlowMapCache::Flowmap(ParticleSet& particles, double stepSize, double startTime, double duration)
+	{
+		// nothing to do
+		if (stepSize == 0) return;
+
+		// make sure we are in the temporal domain
+		const UnsteadyTracer::TimeSeriesDescription& desc = mTracer.GetDesc();
+		const int direction = stepSize > 0 ? 1 : -1;
+		const double endTime = startTime + direction * duration;
+		const double lastTime = desc.StartTime + (desc.NumTimeSteps - 1.) * desc.TemporalSpacing;
+		if (std::min(startTime, endTime) < desc.StartTime || lastTime < std::max(startTime, endTime)) {
+			particles.DeactivateAll();
+			return;
+		}
+
+		// find the whole time steps that are composed, which are traversed in the direction of the step size
+		const double startStep = (startTime - desc.StartTime) / desc.TemporalSpacing;
+		const double endStep = (endTime - desc.StartTime) / desc.TemporalSpacing;
+		const int first = direction > 0 ? (int)std::ceil(startStep - TimeStepTolerance) : (int)std::floor(startStep + TimeStepTolerance);
+		const int last = direction > 0 ? (int)std::floor(endStep + TimeStepTolerance) : (int)std::ceil(endStep - TimeStepTolerance);
+		if ((last - first) * direction <= 0) {
+			mTracer.Flowmap(particles, stepSize, startTime, duration);
+			return;
+		}
+
+		// trace up to the first time step, compose the time steps in between and trace the rest
+		const double firstTime = desc.StartTime + first * desc.TemporalSpacing;
+		const double lastStepTime = desc.StartTime + last * desc.TemporalSpacing;
+		if (std::abs(firstTime - startTime) > TimeStepTolerance * desc.TemporalSpacing)
+			mTracer.Flowmap(particles, stepSize, startTime, std::abs(firstTime - startTime));
+		for (int timeStep = first; timeStep != last; timeStep += direction)
+			Compose(particles, GetFlowMap(timeStep, stepSize));
+		if (std::abs(endTime - lastStepTime) > TimeStepTolerance * desc.TemporalSpacing)
+			mTracer.Flowmap(particles, stepSize, lastStepTime, std::abs(endTime - lastStepTime));
+
+		// keep only the flow maps of this call
+		std::map<int, FlowMap>& flowMaps = mFlowMaps[direction > 0 ? 0 : 1];
+		for (auto it = flowMaps.begin(); it != flowMaps.end();) {
+			if ((it->first - first) * direction < 0 || (last - it->first) * direction <= 0) it = flowMaps.erase(it);
+			else ++it;
+		}
+	}
+
+	const FlowMapCache::FlowMap& FlowMapCache::GetFlowMap(int timeStep, double stepSize)
+	{
+		FlowMap& flowMap = mFlowMaps[stepSize > 0 ? 0 : 1][timeStep];
+		if (!flowMap.X.empty() && flowMap.StepSize == stepSize) return flowMap;
+
+		// trace the grid points for one time step
+		const UnsteadyTracer::TimeSeriesDescription& desc = mTracer.GetDesc();
+		const Eigen::Vector3d origin = mTracer.GetBounds().min();
+		const int64_t numPoints = (int64_t)mResolution.x() * mResolution.y() * mResolution.z();
+		ParticleSet particles;
+		particles.Reserve(numPoints);
+		for (int iz = 0; iz < mResolution.z(); ++iz)
+			for (int iy = 0; iy < mResolution.y(); ++iy)
+				for (int ix = 0; ix < mResolution.x(); ++ix)
+					particles.Add(origin + Eigen::Vector3d(ix, iy, iz).cwiseProduct(mSpacing));
+		mTracer.Flowmap(particles, stepSize, desc.StartTime + timeStep * desc.TemporalSpacing, desc.TemporalSpacing);
+		++mNumIntegrated;
+
+		// store the displacements, which need less precision than the positions
+		flowMap.X.resize(numPoints);
+		flowMap.Y.resize(numPoints);
+		flowMap.Z.resize(numPoints);
+		flowMap.StepSize = stepSize;
+#ifndef _DEBUG
+#pragma omp parallel for schedule(static)
+#endif
+		for (int64_t index = 0; index < numPoints; ++index) {
+			const int ix = (int)(index % mResolution.x());
+			const int iy = (int)(index / mResolution.x() % mResolution.y());
+			const int iz = (int)(index / mResolution.x() / mResolution.y());
+			const Eigen::Vector3d displacement = particles.IsActive(index) ?
+				Eigen::Vector3d(particles.GetPosition(index) - origin - Eigen::Vector3d(ix, iy, iz).cwiseProduct(mSpacing)) :
+				Eigen::Vector3d::Constant(std::numeric_limits<double>::quiet_NaN());
+			flowMap.X[index] = (float)displacement.x();
+			flowMap.Y[index] = (float)displacement.y();
+			flowMap.Z[index] = (float)displacement.z();
+		}
+		return flowMap;
+	}
+
+	void FlowMapCache::Compose(ParticleSet& particles, const FlowMap& flowMap) const
+	{
+		const Eigen::Vector3d origin = mTracer.GetBounds().min();
+		const Eigen::Vector3d maxLocal = (mResolution - Eigen::Vector3i(1, 1, 1)).cast<double>();
+		const int64_t strideY = mResolution.x();
+		const int64_t strideZ = (int64_t)mResolution.x() * mResolution.y();
+		const int64_t* active = particles.GetActive();
+		const int64_t numActive = particles.GetNumActive();
+#ifndef _DEBUG
+#pragma omp parallel for schedule(static)
+#endif
+		for (int64_t a = 0; a < numActive; ++a) {
+			const int64_t index = active[a];
+			const Eigen::Vector3d position = particles.GetPosition(index);
+			const Eigen::Vector3d local = (position - origin).cwiseQuotient(mSpacing);
+			if (!(local.array() >= 0).all() || !(local.array() <= maxLocal.array()).all()) {
+				particles.Deactivate(index);
+				continue;
+			}
+
+			// trilinear interpolation of the displacement, corners without weight are skipped, so that particles on the faces of a cell ignore the other side
+			const Eigen::Vector3i cell = local.cast<int>().cwiseMin(mResolution - Eigen::Vector3i(2, 2, 2));
+			const Eigen::Vector3d t = local - cell.cast<double>();
+			const int64_t base = cell.z() * strideZ + cell.y() * strideY + cell.x();
+			Eigen::Vector3d displacement(0, 0, 0);
+			for (int corner = 0; corner < 8; ++corner) {
+				const double weight = (corner & 1 ? t.x() : 1 - t.x()) * (corner & 2 ? t.y() : 1 - t.y()) * (corner & 4 ? t.z() : 1 - t.z());
+				if (weight == 0) continue;
+				const int64_t offset = base + (corner & 1) + (corner & 2 ? strideY : 0) + (corner & 4 ? strideZ : 0);
+				displacement += weight * Eigen::Vector3d(flowMap.X[offset], flowMap.Y[offset], flowMap.Z[offset]);
+			}
+
+			// a grid point of the cell left the domain, so the particle may have left it, too
+			if (displacement.hasNaN()) particles.Deactivate(index);
+			else particles.SetPosition(index, position + displacement);
+		}
+		particles.Compact();
+	}
+}
\ No newline at end of file
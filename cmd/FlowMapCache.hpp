@@ -0,0 +1,60 @@
+#pragma once
+
+#include <map>
+#include <string>
+#include <vector>
+#include <Eigen/Eigen>
+#include "UnsteadyTracer.hpp"
+
+namespace vispro
+{
+	// Cache of the flow maps of single time steps on a grid, from which the flow maps of longer durations are composed by interpolation.
+	// Each flow map from one time step of the data set to the next is integrated once, so that the flow maps of consecutive start times,
+	// e.g., of an FTLE animation, share all but their first and last time step instead of being integrated from scratch. The resolution of
+	// the grid trades the accuracy of the composition for the time and memory it takes to integrate and keep the flow maps.
+	class FlowMapCache
+	{
+	public:
+		// Constructor. The flow maps are sampled on a grid with the given number of points per dimension, which spans the domain of the data set.
+		FlowMapCache(const std::string& basePath, const Eigen::Vector3i& resolution);
+
+		// Moves the active particles of a set along the flow from a start time for a certain duration, like UnsteadyTracer::Flowmap. The whole time steps
+		// in between are composed from the cached flow maps, which are integrated with the step size if they are missing. The parts before the first and after
+		// the last time step are traced directly. Particles that leave the domain, or whose cell contains a grid point that leaves it, are deactivated.
+		// Only the flow maps of the last call are kept, which are the ones that the next start time shares.
+		void Flowmap(ParticleSet& particles, double stepSize, double startTime, double duration);
+
+		// Gets the tracer that integrates the flow maps, e.g., to set the integration method. The cached flow maps are not updated.
+		UnsteadyTracer& GetTracer();
+		// Gets the bounding box of the domain.
+		const Eigen::AlignedBox3d& GetBounds() const;
+		// Gets the number of flow maps of single time steps that were integrated so far.
+		int GetNumIntegrated() const;
+
+	private:
+		// Displacement of the grid points from one time step to the next. The displacement is NaN for grid points that leave the domain.
+		struct FlowMap {
+			std::vector<float> X, Y, Z;		// components of the displacement per grid point, x fastest
+			double StepSize;				// integration step size, whose sign is the direction
+		};
+
+		// Delete the copy-constructor.
+		FlowMapCache(const FlowMapCache& other) = delete;
+
+		// Gets the flow map from a time step to the next one in the direction of the step size, which is integrated if it is not cached.
+		const FlowMap& GetFlowMap(int timeStep, double stepSize);
+		// Moves the active particles by the interpolated displacement of a flow map.
+		void Compose(ParticleSet& particles, const FlowMap& flowMap) const;
+
+		// Tracer that integrates the flow maps and the parts between whole time steps.
+		UnsteadyTracer mTracer;
+		// Number of grid points per dimension.
+		Eigen::Vector3i mResolution;
+		// Distance between adjacent grid points.
+		Eigen::Vector3d mSpacing;
+		// Cached flow maps of the forward [0] and backward [1] direction, keyed by the time step they start at.
+		std::map<int, FlowMap> mFlowMaps[2];
+		// Number of flow maps that were integrated so far.
+		int mNumIntegrated;
+	};
+}
\ No newline at end of file
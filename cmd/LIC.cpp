@@ -1,6 +1,7 @@
 #include "LIC.hpp"
 #include "AmiraReader.hpp"
 #include "AmiraWriter.hpp"
+#include "AsyncWriter.hpp"
 #include "Sampling.hpp"
 #include <vtkImageData.h>
 #include <vtkSmartPointer.h>
@@ -10,10 +11,10 @@
 
 namespace vispro
 {
-	void LineIntegralConvolution::Compute(const char* velocityPath, const char* licPath, double stepSize, int numAdvectionSteps)
+	void LineIntegralConvolution::Compute(const char* velocityPath, const char* licPath, double stepSize, int numAdvectionSteps, Quantization::EStorage storage, double errorBound, AsyncWriter* writer, FieldView::ELayout layout, Integrator::EMethod integrator)
 	{
 		// read the file
-		vtkSmartPointer<vtkImageData> velocityImage = AmiraReader::ReadField(velocityPath, "velocity");
+		vtkSmartPointer<vtkImageData> velocityImage = AmiraReader::ReadFieldMapped(velocityPath, "velocity");
 		int* res = velocityImage->GetDimensions();
 
 		// create noise field
@@ -31,16 +32,20 @@ namespace vispro
 		for (int64_t i = 0; i < res[0] * res[1] * res[2]; ++i)
 			noiseArray->SetTuple1(i, rnd(rng));
 
-		// allocate output field
-		vtkNew<vtkImageData> licImage;
-		licImage->SetDimensions(velocityImage->GetDimensions());
-		licImage->SetOrigin(velocityImage->GetOrigin());
-		licImage->SetSpacing(velocityImage->GetSpacing());
-		vtkNew<vtkFloatArray> licArray;
-		licArray->SetNumberOfComponents(1);
-		licArray->SetNumberOfTuples((int64_t)res[0] * res[1] * res[2]);
-		licArray->SetName("lic");
-		licImage->GetPointData()->AddArray(licArray);
+		// allocate output field, or take a flushed one from the writer
+		vtkSmartPointer<vtkImageData> licImage = writer ?
+			writer->AcquireField(velocityImage->GetDimensions(), velocityImage->GetOrigin(), velocityImage->GetSpacing(), { "lic" }) :
+			AsyncWriter::AllocateField(velocityImage->GetDimensions(), velocityImage->GetOrigin(), velocityImage->GetSpacing(), { "lic" });
+		vtkFloatArray* licArray = dynamic_cast<vtkFloatArray*>(licImage->GetPointData()->GetArray("lic"));
+
+		// the samples read the values through views, which are built once and convert the values into the layout
+		const FieldView velocityView(velocityImage, layout);
+		const FieldView noiseView(noiseImage, layout);
+
+		// instantiation of the advection for the integration method
+		typedef void (*AdvectFunction)(Eigen::Vector3d&, bool&, double, const FieldView&, const Eigen::AlignedBox3d&);
+		static const AdvectFunction advectFunctions[Integrator::NumMethods] = { &Advect<Integrator::Euler>, &Advect<Integrator::RK2>, &Advect<Integrator::RK4>, &Advect<Integrator::DormandPrince> };
+		const AdvectFunction advect = advectFunctions[(int)integrator];
 
 		// compute the field
 		Eigen::Vector3d origin(licImage->GetOrigin());
@@ -55,10 +60,10 @@ namespace vispro
 					bool indomain = true;
 					for (int istep = 0; istep < numAdvectionSteps; ++istep) {
 						Eigen::Vector3d prevPos = pos;
-						Advect(pos, indomain, stepSize, velocityImage, bounds);
+						advect(pos, indomain, stepSize, velocityView, bounds);
 						if (indomain) {
 							double weight = (pos - prevPos).norm();
-							sum += Sampling::LinearSample1(pos, noiseImage) * weight;
+							sum += Sampling::LinearSample1(pos, noiseView) * weight;
 							count += weight;
 						}
 						else break;
@@ -68,10 +73,10 @@ namespace vispro
 					indomain = true;
 					for (int istep = 0; istep < numAdvectionSteps; ++istep) {
 						Eigen::Vector3d prevPos = pos;
-						Advect(pos, indomain, -stepSize, velocityImage, bounds);
+						advect(pos, indomain, -stepSize, velocityView, bounds);
 						if (indomain) {
 							double weight = (pos - prevPos).norm();
-							sum += Sampling::LinearSample1(pos, noiseImage) * weight;
+							sum += Sampling::LinearSample1(pos, noiseView) * weight;
 							count += weight;
 						}
 						else break;
@@ -85,31 +90,23 @@ namespace vispro
 		}
 
 		// write the file
-		AmiraWriter::WriteScalarField(licPath, "lic", licImage);
+		if (writer) writer->WriteScalarField(licPath, "lic", licImage, storage, errorBound);
+		else AmiraWriter::WriteScalarField(licPath, "lic", licImage, storage, errorBound);
 	}
 
-	Eigen::Vector3d LineIntegralConvolution::Sample(const Eigen::Vector3d& pos, bool& indomain, vtkImageData* velocity, const Eigen::AlignedBox3d& bounds) {
+	Eigen::Vector3d LineIntegralConvolution::Sample(const Eigen::Vector3d& pos, bool& indomain, const FieldView& velocity, const Eigen::AlignedBox3d& bounds) {
 		indomain &= bounds.contains(pos);
 		if (indomain)
 			return Sampling::LinearSample3(pos, velocity);
 		else return Eigen::Vector3d(0, 0, 0);
 	}
 
-	void LineIntegralConvolution::Advect(Eigen::Vector3d& pos, bool& indomain, double stepSize, vtkImageData* velocity, const Eigen::AlignedBox3d& bounds) {
-		Eigen::Vector3d k1 = Sample(pos, indomain, velocity, bounds);
-		if (!indomain) return;
-#if 0
-		// fourth-order Runge-Kutta
-		Eigen::Vector3d k2 = Sample(pos + 0.5 * stepSize * k1, indomain, velocity, bounds);
-		if (!indomain) return;
-		Eigen::Vector3d k3 = Sample(pos + 0.5 * stepSize * k2, indomain, velocity, bounds);
-		if (!indomain) return;
-		Eigen::Vector3d k4 = Sample(pos + stepSize * k3, indomain, velocity, bounds);
-		if (!indomain) return;
-		pos += stepSize * (k1 + 2 * k2 + 2 * k3 + k4) / (6.0);
-#else
-		// explicit euler
-		pos += stepSize * k1;
-#endif
+	template <class Method>
+	void LineIntegralConvolution::Advect(Eigen::Vector3d& pos, bool& indomain, double stepSize, const FieldView& velocity, const Eigen::AlignedBox3d& bounds) {
+		// the velocity field is steady, the time of a stage does not matter
+		Integrator::Step<Method>(pos, stepSize, [&](const Eigen::Vector3d& location, double, Eigen::Vector3d& sample) {
+			sample = Sample(location, indomain, velocity, bounds);
+			return indomain;
+		});
 	}
 }
\ No newline at end of file
@@ -1,22 +1,31 @@
 #pragma once
 
 #include <Eigen/Eigen>
+#include "Quantization.hpp"
+#include "FieldView.hpp"
+#include "Integrator.hpp"
 
 class vtkImageData;
 
 namespace vispro
 {
+	class AsyncWriter;
+
 	// Computes a line integral convolution (LIC).
 	class LineIntegralConvolution
 	{
 	public:
-		// receives the paths to the vtkImageData file of velocity (input) and the LIC path (output)
-		static void Compute(const char* velocityPath, const char* licPath, double stepSize, int numAdvectionSteps);
+		// receives the paths to the vtkImageData file of velocity (input) and the LIC path (output). The output can be stored in a compact type or compressed with an absolute error bound.
+		// If a writer is given, the output is written in the background and its buffer is reused. The velocity and the noise are sampled in the given memory layout.
+		// The streamlines are integrated with the given method.
+		static void Compute(const char* velocityPath, const char* licPath, double stepSize, int numAdvectionSteps, Quantization::EStorage storage = Quantization::EStorage::Float, double errorBound = 0, AsyncWriter* writer = nullptr,
+			FieldView::ELayout layout = FieldView::ELayout::Linear, Integrator::EMethod integrator = Integrator::EMethod::Euler);
 
 	private:
 		// Samples a given vector field and checks if the given point was inside given bounds.----
-		static Eigen::Vector3d Sample(const Eigen::Vector3d& pos, bool& indomain, vtkImageData* velocity, const Eigen::AlignedBox3d& bounds);
-		// Advects a particle to the next time step.
-		static void Advect(Eigen::Vector3d& pos, bool& indomain, double stepSize, vtkImageData* velocity, const Eigen::AlignedBox3d& bounds);
+		static Eigen::Vector3d Sample(const Eigen::Vector3d& pos, bool& indomain, const FieldView& velocity, const Eigen::AlignedBox3d& bounds);
+		// Advects a particle to the next time step with an integration method.
+		template <class Method>
+		static void Advect(Eigen::Vector3d& pos, bool& indomain, double stepSize, const FieldView& velocity, const Eigen::AlignedBox3d& bounds);
 	};
 }
\ No newline at end of file
@@ -5,26 +5,22 @@
 #include <vtkFloatArray.h>
 #include "AmiraWriter.hpp"
 #include "AmiraReader.hpp"
+#include "AsyncWriter.hpp"
 
 namespace vispro
 {
-	void Magnitude::Compute(const char* velocityPath, const char* magnitudePath)
+	void Magnitude::Compute(const char* velocityPath, const char* magnitudePath, Quantization::EStorage storage, double errorBound, AsyncWriter* writer)
 	{
 		// read the file
-		vtkSmartPointer<vtkImageData> velocityImage = AmiraReader::ReadField(velocityPath, "velocity");
+		vtkSmartPointer<vtkImageData> velocityImage = AmiraReader::ReadFieldMapped(velocityPath, "velocity");
 		vtkFloatArray* velocityArray = dynamic_cast<vtkFloatArray*>(velocityImage->GetPointData()->GetArray("velocity"));
 
-		// allocate output field
-		vtkNew<vtkImageData> magnitude;
-		magnitude->SetDimensions(velocityImage->GetDimensions());
-		magnitude->SetOrigin(velocityImage->GetOrigin());
-		magnitude->SetSpacing(velocityImage->GetSpacing());
-		vtkNew<vtkFloatArray> mArray;
+		// allocate output field, or take a flushed one from the writer
+		vtkSmartPointer<vtkImageData> magnitude = writer ?
+			writer->AcquireField(velocityImage->GetDimensions(), velocityImage->GetOrigin(), velocityImage->GetSpacing(), { "magnitude" }) :
+			AsyncWriter::AllocateField(velocityImage->GetDimensions(), velocityImage->GetOrigin(), velocityImage->GetSpacing(), { "magnitude" });
+		vtkFloatArray* mArray = dynamic_cast<vtkFloatArray*>(magnitude->GetPointData()->GetArray("magnitude"));
 		int64_t numPoints = (int64_t)magnitude->GetDimensions()[0] * magnitude->GetDimensions()[1] * magnitude->GetDimensions()[2];
-		mArray->SetNumberOfComponents(1);
-		mArray->SetNumberOfTuples(numPoints);
-		mArray->SetName("magnitude");
-		magnitude->GetPointData()->AddArray(mArray);
 		
 		// compute the field
 #ifdef _DEBUG
@@ -37,6 +33,7 @@ namespace vispro
 		}
 
 		// write the file
-		AmiraWriter::WriteScalarField(magnitudePath, "magnitude", magnitude);
+		if (writer) writer->WriteScalarField(magnitudePath, "magnitude", magnitude, storage, errorBound);
+		else AmiraWriter::WriteScalarField(magnitudePath, "magnitude", magnitude, storage, errorBound);
 	}
 }
\ No newline at end of file
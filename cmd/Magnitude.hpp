@@ -1,12 +1,18 @@
 #pragma once
 
+#include "Quantization.hpp"
+
 namespace vispro
 {
+	class AsyncWriter;
+
 	// Computes the velocity magnitude of a given time step.
 	class Magnitude
 	{
 	public:
 		// receives the paths to the vtkImageData file of velocity (input) and the magnitude path (output)
-		static void Compute(const char* velocityPath, const char* magnitudePath);
+		// The output can be stored in a compact type or compressed with an absolute error bound, since it is only used for visualization.
+		// If a writer is given, the output is written in the background and its buffer is reused.
+		static void Compute(const char* velocityPath, const char* magnitudePath, Quantization::EStorage storage = Quantization::EStorage::Float, double errorBound = 0, AsyncWriter* writer = nullptr);
 	};
 }
\ No newline at end of file
@@ -0,0 +1,215 @@
+#include "ParticleSet.hpp"
+#include <algorithm>
+
+namespace vispro
+{
+	// Number of entries of the active list that are filtered by one thread at once during the compaction.
+	static const int64_t CompactBlockSize = 16384;
+
+	// Number of bits of the quantized coordinates of the particles in the Z-order curve, which resolves the domain finer than its grid.
+	static const int MortonBits = 10;
+	// Number of bits of the Z-order index that are sorted by one pass of the radix sort.
+	static const int RadixBits = 10;
+
+	// Inserts two zero bits after each of the lower 10 bits, so that the bits of three coordinates can be interleaved.
+	static uint32_t SpreadBits(uint32_t value) {
+		value = (value | (value << 16)) & 0x030000FF;
+		value = (value | (value << 8)) & 0x0300F00F;
+		value = (value | (value << 4)) & 0x030C30C3;
+		value = (value | (value << 2)) & 0x09249249;
+		return value;
+	}
+
+	ParticleSet::ParticleSet() : mNextId(0) {}
+
+	ParticleSet::ParticleSet(const std::vector<Eigen::Vector3d>& positions) : mNextId(0)
+	{
+		Reserve((int64_t)positions.size());
+		for (const Eigen::Vector3d& position : positions)
+			Add(position);
+	}
+
+	int64_t ParticleSet::Add(const Eigen::Vector3d& position)
+	{
+		mActiveList.push_back((int64_t)mX.size());
+		mX.push_back(position.x());
+		mY.push_back(position.y());
+		mZ.push_back(position.z());
+		mIds.push_back(mNextId);
+		mActive.push_back(1);
+		return mNextId++;
+	}
+
+	void ParticleSet::Clear()
+	{
+		mX.clear();
+		mY.clear();
+		mZ.clear();
+		mIds.clear();
+		mActive.clear();
+		mActiveList.clear();
+		mNextId = 0;
+	}
+
+	void ParticleSet::Reserve(int64_t numParticles)
+	{
+		mX.reserve(numParticles);
+		mY.reserve(numParticles);
+		mZ.reserve(numParticles);
+		mIds.reserve(numParticles);
+		mActive.reserve(numParticles);
+		mActiveList.reserve(numParticles);
+	}
+
+	int64_t ParticleSet::GetSize() const { return (int64_t)mX.size(); }
+	Eigen::Vector3d ParticleSet::GetPosition(int64_t index) const { return Eigen::Vector3d(mX[index], mY[index], mZ[index]); }
+	void ParticleSet::SetPosition(int64_t index, const Eigen::Vector3d& position) {
+		mX[index] = position.x();
+		mY[index] = position.y();
+		mZ[index] = position.z();
+	}
+	int64_t ParticleSet::GetId(int64_t index) const { return mIds[index]; }
+	const double* ParticleSet::GetX() const { return mX.data(); }
+	const double* ParticleSet::GetY() const { return mY.data(); }
+	const double* ParticleSet::GetZ() const { return mZ.data(); }
+
+	bool ParticleSet::IsActive(int64_t index) const { return mActive[index] != 0; }
+	void ParticleSet::Deactivate(int64_t index) { mActive[index] = 0; }
+	void ParticleSet::DeactivateAll() {
+		std::fill(mActive.begin(), mActive.end(), 0);
+		mActiveList.clear();
+	}
+	int64_t ParticleSet::GetNumActive() const { return (int64_t)mActiveList.size(); }
+	const int64_t* ParticleSet::GetActive() const { return mActiveList.data(); }
+
+	void ParticleSet::Compact()
+	{
+		// each block is filtered twice, once to count its active particles and once to write them behind the ones of the previous blocks
+		const int64_t numEntries = (int64_t)mActiveList.size();
+		const int64_t numBlocks = (numEntries + CompactBlockSize - 1) / CompactBlockSize;
+		std::vector<int64_t> offsets(numBlocks + 1, 0);
+#ifndef _DEBUG
+#pragma omp parallel for schedule(static)
+#endif
+		for (int64_t block = 0; block < numBlocks; ++block) {
+			const int64_t end = std::min(numEntries, (block + 1) * CompactBlockSize);
+			int64_t count = 0;
+			for (int64_t entry = block * CompactBlockSize; entry < end; ++entry)
+				count += mActive[mActiveList[entry]] != 0;
+			offsets[block + 1] = count;
+		}
+		for (int64_t block = 0; block < numBlocks; ++block)
+			offsets[block + 1] += offsets[block];
+		if (offsets[numBlocks] == numEntries) return;
+
+		std::vector<int64_t> activeList(offsets[numBlocks]);
+#ifndef _DEBUG
+#pragma omp parallel for schedule(static)
+#endif
+		for (int64_t block = 0; block < numBlocks; ++block) {
+			const int64_t end = std::min(numEntries, (block + 1) * CompactBlockSize);
+			int64_t next = offsets[block];
+			for (int64_t entry = block * CompactBlockSize; entry < end; ++entry)
+				if (mActive[mActiveList[entry]]) activeList[next++] = mActiveList[entry];
+		}
+		mActiveList.swap(activeList);
+	}
+
+	void ParticleSet::RemoveInactive()
+	{
+		int64_t numLeft = 0;
+		for (int64_t index = 0; index < GetSize(); ++index) {
+			if (!mActive[index]) continue;
+			mX[numLeft] = mX[index];
+			mY[numLeft] = mY[index];
+			mZ[numLeft] = mZ[index];
+			mIds[numLeft] = mIds[index];
+			mActive[numLeft] = 1;
+			++numLeft;
+		}
+		mX.resize(numLeft);
+		mY.resize(numLeft);
+		mZ.resize(numLeft);
+		mIds.resize(numLeft);
+		mActive.resize(numLeft);
+		mActiveList.resize(numLeft);
+		for (int64_t index = 0; index < numLeft; ++index)
+			mActiveList[index] = index;
+	}
+
+	void ParticleSet::GetMortonOrder(const Eigen::AlignedBox3d& bounds, std::vector<int64_t>& order) const
+	{
+		// quantize the positions in the box, the particles outside of it are clamped to its faces
+		const int64_t numActive = GetNumActive();
+		const double maxCell = (double)((1 << MortonBits) - 1);
+		const Eigen::Vector3d scale = Eigen::Vector3d::Constant(maxCell).cwiseQuotient(bounds.sizes().cwiseMax(Eigen::Vector3d::Constant(1e-30)));
+		std::vector<uint32_t> keys(numActive), sortedKeys(numActive);
+		std::vector<int64_t> indices(numActive), sortedIndices(numActive);
+#ifndef _DEBUG
+#pragma omp parallel for schedule(static)
+#endif
+		for (int64_t a = 0; a < numActive; ++a) {
+			const Eigen::Vector3d cell = (GetPosition(mActiveList[a]) - bounds.min()).cwiseProduct(scale).cwiseMax(0.).cwiseMin(maxCell);
+			keys[a] = SpreadBits((uint32_t)cell.x()) | (SpreadBits((uint32_t)cell.y()) << 1) | (SpreadBits((uint32_t)cell.z()) << 2);
+			indices[a] = mActiveList[a];
+		}
+
+		// least-significant digit radix sort, which is stable, so particles in the same cell stay in the order of their indices
+		std::vector<int64_t> offsets(((int64_t)1 << RadixBits) + 1);
+		for (int shift = 0; shift < 3 * MortonBits; shift += RadixBits) {
+			std::fill(offsets.begin(), offsets.end(), 0);
+			for (int64_t a = 0; a < numActive; ++a)
+				++offsets[((keys[a] >> shift) & ((1 << RadixBits) - 1)) + 1];
+			for (size_t digit = 1; digit < offsets.size(); ++digit)
+				offsets[digit] += offsets[digit - 1];
+			for (int64_t a = 0; a < numActive; ++a) {
+				const int64_t next = offsets[(keys[a] >> shift) & ((1 << RadixBits) - 1)]++;
+				sortedKeys[next] = keys[a];
+				sortedIndices[next] = indices[a];
+			}
+			keys.swap(sortedKeys);
+			indices.swap(sortedIndices);
+		}
+
+		order.resize(GetSize());
+		std::copy(indices.begin(), indices.end(), order.begin());
+		int64_t next = numActive;
+		for (int64_t index = 0; index < GetSize(); ++index)
+			if (!mActive[index]) order[next++] = index;
+	}
+
+	void ParticleSet::GetIdOrder(std::vector<int64_t>& order) const
+	{
+		order.resize(GetSize());
+		for (int64_t index = 0; index < GetSize(); ++index)
+			order[index] = index;
+		std::sort(order.begin(), order.end(), [this](int64_t a, int64_t b) { return mIds[a] < mIds[b]; });
+	}
+
+	void ParticleSet::Permute(const std::vector<int64_t>& order)
+	{
+		const int64_t size = GetSize();
+		std::vector<double> x(size), y(size), z(size);
+		std::vector<int64_t> ids(size);
+		std::vector<char> active(size);
+#ifndef _DEBUG
+#pragma omp parallel for schedule(static)
+#endif
+		for (int64_t index = 0; index < size; ++index) {
+			x[index] = mX[order[index]];
+			y[index] = mY[order[index]];
+			z[index] = mZ[order[index]];
+			ids[index] = mIds[order[index]];
+			active[index] = mActive[order[index]];
+		}
+		mX.swap(x);
+		mY.swap(y);
+		mZ.swap(z);
+		mIds.swap(ids);
+		mActive.swap(active);
+
+		mActiveList.clear();
+		for (int64_t index = 0; index < size; ++index)
+			if (mActive[index]) mActiveList.push_back(index);
+	}
+}
\ No newline at end of file
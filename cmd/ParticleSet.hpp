@@ -0,0 +1,75 @@
+#pragma once
+
+#include <vector>
+#include <Eigen/Eigen>
+
+namespace vispro
+{
+	// Set of particles in structure-of-arrays layout, i.e., with one array per coordinate, so that batches of particles are read
+	// and written with unit stride. Particles keep the id that they were added with, even if the set is reordered or particles are
+	// removed. Particles that leave the domain are deactivated. The set keeps a list of the active particles, so that the advection
+	// does not walk the inactive ones, which are most of the particles late in long integrations.
+	class ParticleSet
+	{
+	public:
+		// Constructor. Creates an empty set.
+		ParticleSet();
+		// Constructor. Adds an active particle per position, the ids are the indices of the positions.
+		explicit ParticleSet(const std::vector<Eigen::Vector3d>& positions);
+
+		// Adds an active particle and returns its id.
+		int64_t Add(const Eigen::Vector3d& position);
+		// Removes all particles. The ids start at zero again.
+		void Clear();
+		// Reserves memory for a number of particles.
+		void Reserve(int64_t numParticles);
+
+		// Gets the number of particles, active or not.
+		int64_t GetSize() const;
+		// Gets the position of a particle.
+		Eigen::Vector3d GetPosition(int64_t index) const;
+		// Sets the position of a particle.
+		void SetPosition(int64_t index, const Eigen::Vector3d& position);
+		// Gets the id that a particle was added with.
+		int64_t GetId(int64_t index) const;
+		// Gets the coordinates of the particles.
+		const double* GetX() const;
+		const double* GetY() const;
+		const double* GetZ() const;
+
+		// Checks whether a particle is active.
+		bool IsActive(int64_t index) const;
+		// Deactivates a particle. Threads may deactivate different particles concurrently. The particle stays in the active list until the next compaction.
+		void Deactivate(int64_t index);
+		// Deactivates all particles.
+		void DeactivateAll();
+		// Gets the number of particles in the active list.
+		int64_t GetNumActive() const;
+		// Gets the indices of the particles in the active list in ascending order.
+		const int64_t* GetActive() const;
+		// Removes the deactivated particles from the active list. The list is split into blocks that are filtered in parallel.
+		void Compact();
+		// Removes the inactive particles from the set. The remaining particles keep their order and ids.
+		void RemoveInactive();
+
+		// Computes the order that sorts the active particles along a Z-order curve through a box, followed by the inactive particles in their
+		// current order. The active list has to be compacted. Particles that are close in space are then close in memory, too, which is what the batches of the advection sample.
+		void GetMortonOrder(const Eigen::AlignedBox3d& bounds, std::vector<int64_t>& order) const;
+		// Computes the order that sorts the particles by their ids, i.e., into the order in which they were added.
+		void GetIdOrder(std::vector<int64_t>& order) const;
+		// Reorders the particles, such that the particle at index order[i] moves to index i. The particles keep their ids and the active list is rebuilt.
+		void Permute(const std::vector<int64_t>& order);
+
+	private:
+		// Coordinates of the particles.
+		std::vector<double> mX, mY, mZ;
+		// Ids of the particles.
+		std::vector<int64_t> mIds;
+		// Flags of the particles, which are nonzero for active particles.
+		std::vector<char> mActive;
+		// Indices of the active particles and of particles that were deactivated after the last compaction.
+		std::vector<int64_t> mActiveList;
+		// Id of the next particle that is added.
+		int64_t mNextId;
+	};
+}
\ No newline at end of file
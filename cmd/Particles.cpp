@@ -8,44 +8,43 @@
 
 namespace vispro
 {
-	void Particles::Compute(const char* basePath, const Eigen::AlignedBox3d& seedBox, double stepSize, int particlesReleasedPerTimeStep)
+	double Particles::Compute(const char* basePath, const Eigen::AlignedBox3d& seedBox, double stepSize, int particlesReleasedPerTimeStep, bool useBricks, double regionPadding, int sortInterval, int numThreads)
 	{
 		UnsteadyTracer tracer(basePath);
+		tracer.SetUseBricks(useBricks);
+		tracer.SetRegionPadding(regionPadding);
+		tracer.SetNumThreads(numThreads);
 		const UnsteadyTracer::TimeSeriesDescription& desc = tracer.GetDesc();
 		Eigen::AlignedBox3d clampedSeedBox = seedBox.intersection(tracer.GetBounds());
 
-		std::vector<Eigen::Vector3d> particles;
-		std::vector<int> indomain;
+		ParticleSet particles;
+		std::vector<int64_t> order;
 		for (int iTime = 0; iTime < desc.NumTimeSteps; ++iTime)
 		{
 			// physical time for this time step
 			float startTime = desc.StartTime + iTime * desc.TemporalSpacing;
 
 			// remove all the inactive particles
-			int pid = 0;
-			for (int ip = 0; ip < indomain.size(); ++ip) {
-				if (indomain[ip] == 1) {
-					particles[pid] = particles[ip];
-					indomain[pid] = indomain[ip];
-					pid++;
-				}
-			}
-			particles.resize(pid);
-			indomain.resize(pid);
+			particles.RemoveInactive();
 
 			// add new particles
-			for (int ip = 0; ip < particlesReleasedPerTimeStep; ++ip) {
-				particles.push_back(clampedSeedBox.sample());
-				indomain.push_back(1);
+			for (int ip = 0; ip < particlesReleasedPerTimeStep; ++ip)
+				particles.Add(clampedSeedBox.sample());
+
+			// sort the particles, so that the batches of the advection sample nearby velocities
+			if (sortInterval > 0 && iTime % sortInterval == 0) {
+				particles.GetMortonOrder(tracer.GetBounds(), order);
+				particles.Permute(order);
 			}
 
-			// store the particles
+			// store the particles in the order of their release
+			particles.GetIdOrder(order);
 			vtkNew<vtkPoints> points;
 			vtkNew<vtkIdList> ids;
-			points->SetNumberOfPoints(particles.size());
-			ids->SetNumberOfIds(particles.size());
-			for (size_t ip = 0; ip < particles.size(); ++ip) {
-				points->SetPoint(ip, particles[ip].data());
+			points->SetNumberOfPoints(particles.GetSize());
+			ids->SetNumberOfIds(particles.GetSize());
+			for (int64_t ip = 0; ip < particles.GetSize(); ++ip) {
+				points->SetPoint(ip, particles.GetPosition(order[ip]).data());
 				ids->SetId(ip, ip);
 			}
 			vtkNew<vtkCellArray> cellArray;
@@ -61,7 +60,8 @@ namespace vispro
 			writer->Update();
 
 			// advect all particles to the next time step
-			tracer.Flowmap(particles, indomain, stepSize, startTime, desc.TemporalSpacing);
+			tracer.Flowmap(particles, stepSize, startTime, desc.TemporalSpacing);
 		}
+		return tracer.GetIoWaitSeconds();
 	}
 }
\ No newline at end of file
@@ -9,6 +9,11 @@ namespace vispro
 	{
 	public:
 		// Receives the seed region, the numerical integration step size and the number of particles to release each time step.
-		static void Compute(const char* basePath, const Eigen::AlignedBox3d& seedBox, double stepSize, int particlesReleasedPerTimeStep);
+		// If useBricks is set, the velocity is sampled from the bricked files (*.amb), which decodes only the visited bricks.
+		// A non-negative region padding loads only a box around the particles instead of the full fields (see UnsteadyTracer::SetRegionPadding).
+		// A positive sort interval sorts the particles spatially every that many time steps, the files store them in the order of their release anyways.
+		// The number of threads advect the particles, zero or less uses all hardware threads (see UnsteadyTracer::SetNumThreads).
+		// Returns the time that the tracer waited for reads of the velocity, in seconds (see UnsteadyTracer::GetIoWaitSeconds).
+		static double Compute(const char* basePath, const Eigen::AlignedBox3d& seedBox, double stepSize, int particlesReleasedPerTimeStep, bool useBricks = false, double regionPadding = -1, int sortInterval = 0, int numThreads = 0);
 	};
 }
\ No newline at end of file
@@ -10,14 +10,16 @@
 
 namespace vispro
 {
-	void Streaklines::Compute(const char* basePath, const Eigen::AlignedBox3d& seedBox, double stepSize, int particlesReleasedPerTimeStep)
+	void Streaklines::Compute(const char* basePath, const Eigen::AlignedBox3d& seedBox, double stepSize, int particlesReleasedPerTimeStep, bool useBricks, double regionPadding, int numThreads)
 	{
 		UnsteadyTracer tracer(basePath);
+		tracer.SetUseBricks(useBricks);
+		tracer.SetRegionPadding(regionPadding);
+		tracer.SetNumThreads(numThreads);
 		const UnsteadyTracer::TimeSeriesDescription& desc = tracer.GetDesc();
 		Eigen::AlignedBox3d clampedSeedBox = seedBox.intersection(tracer.GetBounds());
 
-		std::vector<Eigen::Vector3d> particles;
-		std::vector<int> indomain;
+		ParticleSet particles;
 		for (int iTime = 0; iTime < desc.NumTimeSteps; ++iTime)
 		{
 			// physical time for this time step
@@ -41,15 +43,14 @@ namespace vispro
 				double maxz = clampedSeedBox.max().z();
 				double t = (double)ip / particlesReleasedPerTimeStep;
 				Eigen::Vector3d seed(-0.1, 0.1, minz + (maxz - minz) * t);
-				particles.push_back(seed);
-				indomain.push_back(1);
+				particles.Add(seed);
 			}
 
 			// store the particles
 			vtkNew<vtkPoints> points;
-			points->SetNumberOfPoints(particles.size());
-			for (size_t ip = 0; ip < particles.size(); ++ip) {
-				points->SetPoint(ip, particles[ip].data());
+			points->SetNumberOfPoints(particles.GetSize());
+			for (int64_t ip = 0; ip < particles.GetSize(); ++ip) {
+				points->SetPoint(ip, particles.GetPosition(ip).data());
 			}
 
 			// form triangles
@@ -92,7 +93,7 @@ namespace vispro
 			writer->Update();
 
 			// advect all particles to the next time step
-			tracer.Flowmap(particles, indomain, stepSize, startTime, desc.TemporalSpacing);
+			tracer.Flowmap(particles, stepSize, startTime, desc.TemporalSpacing);
 		}
 	}
 }
@@ -9,6 +9,9 @@ namespace vispro
 	{
 	public:
 		// Receives the seed region, the numerical integration step size and the number of particles to release each time step.
-		static void Compute(const char* basePath, const Eigen::AlignedBox3d& seedBox, double stepSize, int particlesReleasedPerTimeStep);
+		// If useBricks is set, the velocity is sampled from the bricked files (*.amb), which decodes only the visited bricks.
+		// A non-negative region padding loads only a box around the particles instead of the full fields (see UnsteadyTracer::SetRegionPadding).
+		// The number of threads advect the particles, zero or less uses all hardware threads (see UnsteadyTracer::SetNumThreads).
+		static void Compute(const char* basePath, const Eigen::AlignedBox3d& seedBox, double stepSize, int particlesReleasedPerTimeStep, bool useBricks = false, double regionPadding = -1, int numThreads = 0);
 	};
 }
@@ -4,26 +4,80 @@
 #include <vtkFloatArray.h>
 #include "AmiraReader.hpp"
 #include "Sampling.hpp"
+#include "SliceCache.hpp"
+#include <chrono>
+#include <thread>
 
 namespace vispro
 {
+	// Number of particles that are sampled together by the batched advection, which is also the chunk of particles that a thread takes at once.
+	static const int64_t BatchSize = 1024;
+	// Number of particles that a thread takes at once in the particle-wise advection.
+	static const int64_t ChunkSize = 256;
+
+	// Seconds since a point in time.
+	static double SecondsSince(const std::chrono::steady_clock::time_point& start) {
+		return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	// Allocates a velocity field on a lattice.
+	static vtkSmartPointer<vtkImageData> NewVelocityField(const Eigen::Vector3i& resolution, const double* origin, const double* spacing) {
+		vtkSmartPointer<vtkImageData> data = vtkSmartPointer<vtkImageData>::New();
+		data->SetDimensions(resolution.data());
+		data->SetOrigin(origin);
+		data->SetSpacing(spacing);
+		vtkNew<vtkFloatArray> array;
+		array->SetNumberOfComponents(3);
+		array->SetNumberOfTuples((int64_t)resolution.x() * resolution.y() * resolution.z());
+		array->SetName("velocity");
+		data->GetPointData()->AddArray(array);
+		data->GetPointData()->SetActiveScalars("velocity");
+		return data;
+	}
+
+	// Checks whether two boxes of grid points are equal.
+	static bool IsSameRegion(const Eigen::AlignedBox3i& a, const Eigen::AlignedBox3i& b) {
+		return a.min() == b.min() && a.max() == b.max();
+	}
+
 	UnsteadyTracer::TimeSeriesDescription::TimeSeriesDescription(double temporalSpacing, double startTime, int numTimeSteps) :
 		TemporalSpacing(temporalSpacing), StartTime(startTime), NumTimeSteps(numTimeSteps) 
 	{}
 
-	UnsteadyTracer::UnsteadyTracer(const std::string& basePath) : mDesc(0.1, 0, 151), mHead(0), mBasePath(basePath)
+	UnsteadyTracer::UnsteadyTracer(const std::string& basePath) : mLayout(FieldView::ELayout::Linear), mIntegrator(Integrator::EMethod::Euler), mStepControl{ 0, 0, std::numeric_limits<double>::infinity() }, mNumThreads(0), mSortInterval(0), mUseBricks(false), mRegionPadding(-1), mHead(0), mManifest(basePath),
+		mPrefetchTicket(0), mIoWaitSeconds(0), mDesc(mManifest.GetTemporalSpacing(), mManifest.GetStartTime(), mManifest.GetNumTimeSteps()), mBasePath(basePath)
 	{
-		mTime[0] = mTime[1] = mTime[2] = std::numeric_limits<double>::infinity();
-		mData[0] = vtkSmartPointer<vtkImageData>::New();
-		mData[1] = vtkSmartPointer<vtkImageData>::New();
-		mData[2] = vtkSmartPointer<vtkImageData>::New();
+		for (int i = 0; i < 4; ++i) {
+			mTime[i] = std::numeric_limits<double>::infinity();
+			mTimeStep[i] = -1;
+			mMaxSpeed[i] = 0;
+			mShared[i] = false;
+			mData[i] = vtkSmartPointer<vtkImageData>::New();
+		}
+		for (int i = 0; i < 3; ++i)
+			mBricks[i] = std::make_unique<BrickCache>();
 		mBounds.setEmpty();
-		bool success = AllocateVectorFieldsFromHeader((mBasePath + "halfcylinder-0.00.am").c_str());
+		bool success = AllocateVectorFieldsFromHeader();
 		assert(success);
 	}
 	
 	UnsteadyTracer::~UnsteadyTracer()
-	{}
+	{
+		// the reader must not write into the prefetch slot after it is gone
+		if (mTimeStep[PrefetchSlot] >= 0) mReader.Wait(mPrefetchTicket);
+	}
+
+	void UnsteadyTracer::SetUseBricks(bool useBricks) { mUseBricks = useBricks; }
+	void UnsteadyTracer::SetRegionPadding(double padding) { mRegionPadding = padding; }
+	void UnsteadyTracer::SetLayout(FieldView::ELayout layout) { mLayout = layout; }
+	void UnsteadyTracer::SetNumThreads(int numThreads) { mNumThreads = numThreads; }
+	void UnsteadyTracer::SetIntegrator(Integrator::EMethod integrator) { mIntegrator = integrator; }
+	void UnsteadyTracer::SetSortInterval(int numSteps) { mSortInterval = numSteps; }
+	void UnsteadyTracer::SetStepControl(double tolerance, double minStepSize, double maxStepSize) {
+		mStepControl = Integrator::StepControl{ tolerance, std::max(0., minStepSize), maxStepSize > 0 ? maxStepSize : std::numeric_limits<double>::infinity() };
+	}
+
+	double UnsteadyTracer::GetIoWaitSeconds() const { return mIoWaitSeconds; }
 
 	const Eigen::AlignedBox3d& UnsteadyTracer::GetBounds() const { return mBounds; }
 	const UnsteadyTracer::TimeSeriesDescription& UnsteadyTracer::GetDesc() const { return mDesc; }
@@ -33,37 +87,62 @@ namespace vispro
 		// nothing to do
 		if (stepSize == 0) return;
 
+		ParticleSet set(particles);
+		Flowmap(set, stepSize, startTime, duration);
+		for (size_t i = 0; i < particles.size(); ++i) {
+			particles[i] = set.GetPosition(i);
+			inDomain[i] = set.IsActive(i) ? 1 : 0;
+		}
+	}
+
+	void UnsteadyTracer::Flowmap(ParticleSet& particles, double stepSize, double startTime, double duration)
+	{
+		// nothing to do
+		if (stepSize == 0) return;
+
 		// make sure we are in the temporal domain
 		if ((stepSize > 0 && (startTime < mDesc.StartTime || mDesc.StartTime + (mDesc.NumTimeSteps - 1.) * mDesc.TemporalSpacing < startTime + duration)) ||
 			(stepSize < 0 && (startTime - duration < mDesc.StartTime || mDesc.StartTime + (mDesc.NumTimeSteps - 1.) * mDesc.TemporalSpacing < startTime))) {
-			for (size_t i = 0; i < particles.size(); ++i)
-				inDomain[i] = 0;
+			particles.DeactivateAll();
 			return;
 		}
 
-		// check for each particle if it is in the spatial domain (1=true, 0=false)
-		for (size_t i = 0; i < particles.size(); ++i)
-			inDomain[i] = mBounds.contains(particles[i]) ? 1 : 0;
+		// deactivate the particles that are outside of the spatial domain
+		particles.Compact();
+		const int64_t* active = particles.GetActive();
+		for (int64_t a = 0; a < particles.GetNumActive(); ++a)
+			if (!mBounds.contains(particles.GetPosition(active[a]))) particles.Deactivate(active[a]);
+		particles.Compact();
 
-		// find out which three time steps to read at the beginning
+		// find out which three time steps to read at the beginning. The first one has to be at or before the start time, or at or after it backwards,
+		// which is checked with the times of the slots, since the division may round a start time on a time step to either side
 		int t0 = std::min(std::max(0, (int)((startTime - mDesc.StartTime) / mDesc.TemporalSpacing)), mDesc.NumTimeSteps - 1);
+		if (stepSize > 0)
+			while (t0 > 0 && startTime < mDesc.StartTime + t0 * mDesc.TemporalSpacing) --t0;
+		else
+			while (t0 < mDesc.NumTimeSteps - 1 && mDesc.StartTime + t0 * mDesc.TemporalSpacing < startTime) ++t0;
 		int t1 = std::min(std::max(0, t0 + (stepSize > 0 ? 1 : -1)), mDesc.NumTimeSteps - 1);
 		int t2 = std::min(std::max(0, t0 + (stepSize > 0 ? 2 : -2)), mDesc.NumTimeSteps - 1);
-		mTime[0] = mDesc.StartTime + t0 * mDesc.TemporalSpacing;
-		mTime[1] = mDesc.StartTime + t1 * mDesc.TemporalSpacing;
-		mTime[2] = mDesc.StartTime + t2 * mDesc.TemporalSpacing;
-
-		// read the three time steps
-		char filename[256];
-		sprintf(filename, "halfcylinder-%.2f.am", mTime[0]);
-		bool success = AmiraReader::ReadField((mBasePath + filename).c_str(), dynamic_cast<vtkFloatArray*>(mData[0]->GetPointData()->GetArray(0)));
-		assert(success);
-		sprintf(filename, "halfcylinder-%.2f.am", mTime[1]);
-		success = AmiraReader::ReadField((mBasePath + filename).c_str(), dynamic_cast<vtkFloatArray*>(mData[1]->GetPointData()->GetArray(0)));
-		assert(success);
-		sprintf(filename, "halfcylinder-%.2f.am", mTime[2]);
-		success = AmiraReader::ReadField((mBasePath + filename).c_str(), dynamic_cast<vtkFloatArray*>(mData[2]->GetPointData()->GetArray(0)));
-		assert(success);
+
+		// load only the region around the particles, the bricked files are decoded on demand anyways
+		if (mRegionPadding >= 0 && !mUseBricks)
+			UpdateRegion(particles, stepSize);
+		else {
+			mIndexRegion = Eigen::AlignedBox3i(Eigen::Vector3i(0, 0, 0), mResolution - Eigen::Vector3i(1, 1, 1));
+			mRegion = mBounds;
+		}
+
+		// read the three time steps and start reading the next one
+		ReadTimeSteps({ t0, t1, t2 });
+		Prefetch(std::min(std::max(0, t0 + (stepSize > 0 ? 3 : -3)), mDesc.NumTimeSteps - 1));
+
+		// with step size control, each particle keeps its own step size and the particles are advected from one time step to the next at once
+		const bool adaptive = mIntegrator == Integrator::EMethod::DormandPrince && mStepControl.Tolerance > 0;
+		std::vector<double> stepSizes;
+		if (adaptive) stepSizes.assign(particles.GetSize(), std::min(mStepControl.MaxStepSize, std::max(mStepControl.MinStepSize, std::abs(stepSize))));
+		// original index of each particle, once they are sorted
+		std::vector<int64_t> order;
+		int numSteps = 0;
 
 		mHead = 0;
 		double time = startTime;
@@ -73,20 +152,26 @@ namespace vispro
 			while (time < startTime + duration) {
 				// perform steps until we reach the end or the central time step
 				while (time < std::min(mTime[(mHead + 1) % 3], startTime + duration)) {
-					double s = std::min(stepSize, std::min(mTime[(mHead + 1) % 3], startTime + duration) - time);
-					Advect(particles, inDomain, time, s);
+					double s = adaptive ? std::min(mTime[(mHead + 1) % 3], startTime + duration) - time : std::min(stepSize, std::min(mTime[(mHead + 1) % 3], startTime + duration) - time);
+					if (!IsInsideRegion(particles, s)) {
+						UpdateRegion(particles, s);
+						ReadTimeSteps({ mTimeStep[0], mTimeStep[1], mTimeStep[2] });
+					}
+					if (adaptive) AdvectAdaptive(particles, stepSizes, time, s);
+					else Advect(particles, time, s);
+					particles.Compact();
+					if (mSortInterval > 0 && ++numSteps % mSortInterval == 0)
+						SortParticles(particles, stepSizes, order);
 					time += s;
 				}
 				// if not yet at end, load next time step!
 				if (time < startTime + duration) {
-					// Compute the time of the next file to read
-					mTime[mHead] = mDesc.StartTime + std::min(std::max(0, t0 + 3), mDesc.NumTimeSteps - 1) * mDesc.TemporalSpacing;
-					sprintf(filename, "halfcylinder-%.2f.am", mTime[mHead]);
-					bool success = AmiraReader::ReadField((mBasePath + filename).c_str(), dynamic_cast<vtkFloatArray*>(mData[mHead]->GetPointData()->GetArray(0)));
-					assert(success);
+					// read the next time step into the slot that is no longer needed, which was usually prefetched
+					ReadTimeStep(mHead, std::min(std::max(0, t0 + 3), mDesc.NumTimeSteps - 1));
 					// move the head forward
 					mHead = (mHead + 1) % 3;
 					t0 += 1;
+					Prefetch(std::min(std::max(0, t0 + 3), mDesc.NumTimeSteps - 1));
 					time = mTime[mHead];	// set the time to the exact start time (to prevent numerical issues)
 				}
 			}
@@ -97,65 +182,396 @@ namespace vispro
 			while (time > startTime - duration) {
 				// perform steps until we reach the end or the central time step
 				while (time > std::max(mTime[(mHead + 1) % 3], startTime - duration)) {
-					double s = std::max(stepSize, std::max(mTime[(mHead + 1) % 3], startTime - duration) - time);
-					Advect(particles, inDomain, time, s);
+					double s = adaptive ? std::max(mTime[(mHead + 1) % 3], startTime - duration) - time : std::max(stepSize, std::max(mTime[(mHead + 1) % 3], startTime - duration) - time);
+					if (!IsInsideRegion(particles, s)) {
+						UpdateRegion(particles, s);
+						ReadTimeSteps({ mTimeStep[0], mTimeStep[1], mTimeStep[2] });
+					}
+					if (adaptive) AdvectAdaptive(particles, stepSizes, time, s);
+					else Advect(particles, time, s);
+					particles.Compact();
+					if (mSortInterval > 0 && ++numSteps % mSortInterval == 0)
+						SortParticles(particles, stepSizes, order);
 					time += s;
 				}
 				// if not yet at end, load next time step!
 				if (time > startTime - duration) {
-					// Compute the time of the next file to read
-					mTime[mHead] = mDesc.StartTime + std::min(std::max(0, t0 - 3), mDesc.NumTimeSteps - 1) * mDesc.TemporalSpacing;
-					sprintf(filename, "halfcylinder-%.2f.am", mTime[mHead]);
-					bool success = AmiraReader::ReadField((mBasePath + filename).c_str(), dynamic_cast<vtkFloatArray*>(mData[mHead]->GetPointData()->GetArray(0)));
-					assert(success);
+					// read the next time step into the slot that is no longer needed, which was usually prefetched
+					ReadTimeStep(mHead, std::min(std::max(0, t0 - 3), mDesc.NumTimeSteps - 1));
 					// move the head forward
 					mHead = (mHead + 1) % 3;
 					t0 -= 1;
+					Prefetch(std::min(std::max(0, t0 - 3), mDesc.NumTimeSteps - 1));
 					time = mTime[mHead];	// set the time to the exact start time (to prevent numerical issues)
 				}
 			}
 		}
+
+		// put the particles back into their order
+		if (!order.empty()) {
+			std::vector<int64_t> inverse(order.size());
+			for (size_t i = 0; i < order.size(); ++i)
+				inverse[order[i]] = i;
+			particles.Permute(inverse);
+		}
 	}
 
-	void UnsteadyTracer::Advect(std::vector<Eigen::Vector3d>& particles, std::vector<int>& inDomain, double time, double stepSize) const
+	void UnsteadyTracer::SortParticles(ParticleSet& particles, std::vector<double>& stepSizes, std::vector<int64_t>& order) const
 	{
-		int64_t numParticles = (int64_t)particles.size();
-		for (int64_t i = 0; i < numParticles; ++i) 
-		{
-			// early out?
-			int& indomain = inDomain[i];
-			if (!indomain) continue;
+		std::vector<int64_t> sortOrder;
+		particles.GetMortonOrder(mBounds, sortOrder);
+		particles.Permute(sortOrder);
+		if (!stepSizes.empty()) {
+			std::vector<double> sorted(stepSizes.size());
+			for (size_t i = 0; i < sortOrder.size(); ++i)
+				sorted[i] = stepSizes[sortOrder[i]];
+			stepSizes.swap(sorted);
+		}
+		if (order.empty()) {
+			order.swap(sortOrder);
+			return;
+		}
+		std::vector<int64_t> composed(order.size());
+		for (size_t i = 0; i < sortOrder.size(); ++i)
+			composed[i] = order[sortOrder[i]];
+		order.swap(composed);
+	}
+
+	void UnsteadyTracer::Advect(ParticleSet& particles, double time, double stepSize) const
+	{
+		typedef void (UnsteadyTracer::*AdvectFunction)(ParticleSet&, double, double) const;
+		// bricks are decoded on demand, which is done particle by particle
+		static const AdvectFunction advectParticles[Integrator::NumMethods] = {
+			&UnsteadyTracer::AdvectParticles<Integrator::Euler>, &UnsteadyTracer::AdvectParticles<Integrator::RK2>, &UnsteadyTracer::AdvectParticles<Integrator::RK4>,
+			&UnsteadyTracer::AdvectParticles<Integrator::DormandPrince> };
+		static const AdvectFunction advectBatched[Integrator::NumMethods] = {
+			&UnsteadyTracer::AdvectBatched<Integrator::Euler>, &UnsteadyTracer::AdvectBatched<Integrator::RK2>, &UnsteadyTracer::AdvectBatched<Integrator::RK4>,
+			&UnsteadyTracer::AdvectBatched<Integrator::DormandPrince> };
+		(this->*(mUseBricks ? advectParticles : advectBatched)[(int)mIntegrator])(particles, time, stepSize);
+	}
+
+	template <class Method>
+	void UnsteadyTracer::AdvectParticles(ParticleSet& particles, double time, double stepSize) const
+	{
+		// the step ends at a time step at the latest, so all stages interpolate between the same time steps
+		int i0, i1;
+		FindSlots(time, i0, i1);
+		const double interp = (time - mTime[i0]) / (mTime[i1] - mTime[i0]);
+		const double interpPerTime = 1 / (mTime[i1] - mTime[i0]);
 
+		// the bricks are decoded by the first thread that touches them, the cache is shared
+		const int numThreads = mNumThreads > 0 ? mNumThreads : std::max(1, (int)std::thread::hardware_concurrency());
+		const int64_t* active = particles.GetActive();
+		const int64_t numActive = particles.GetNumActive();
+#ifndef _DEBUG
+#pragma omp parallel for schedule(dynamic, ChunkSize) num_threads(numThreads)
+#endif
+		for (int64_t a = 0; a < numActive; ++a)
+		{
 			// numerical integration step
-			Eigen::Vector3d& pos = particles[i];
-			Eigen::Vector3d k1 = Sample(pos, time, indomain);
-			if (!indomain) continue;
-#if 0
-			// fourth-order Runge-Kutta
-			Eigen::Vector3d k2 = Sample(pos + 0.5 * stepSize * k1, time + 0.5 * stepSize, indomain);
-			if (!indomain) continue;
-			Eigen::Vector3d k3 = Sample(pos + 0.5 * stepSize * k2, time + 0.5 * stepSize, indomain);
-			if (!indomain) continue;
-			Eigen::Vector3d k4 = Sample(pos + stepSize * k3, time + stepSize, indomain);
-			if (!indomain) continue;
-			pos += stepSize * (k1 + 2 * k2 + 2 * k3 + k4) / (6.0);
-#else
-			// explicit euler
-			pos += stepSize * k1;
+			const int64_t i = active[a];
+			Eigen::Vector3d pos = particles.GetPosition(i);
+			int indomain = 1;
+			Integrator::Step<Method>(pos, stepSize, [&](const Eigen::Vector3d& position, double relativeTime, Eigen::Vector3d& velocity) {
+				velocity = Sample(position, i0, i1, relativeTime == 0 ? interp : interp + relativeTime * interpPerTime, indomain);
+				return indomain != 0;
+			});
+			if (indomain) particles.SetPosition(i, pos);
+			else particles.Deactivate(i);
+		}
+	}
+
+	template <class Method>
+	void UnsteadyTracer::AdvectBatched(ParticleSet& particles, double time, double stepSize) const
+	{
+		// all particles are at the same time and the step ends at a time step at the latest, so all stages interpolate between the same time steps
+		int i0, i1;
+		FindSlots(time, i0, i1);
+		const double interp = (time - mTime[i0]) / (mTime[i1] - mTime[i0]);
+		const double interpPerTime = 1 / (mTime[i1] - mTime[i0]);
+		const int NumStages = Method::NumStages;
+
+		// each thread collects the active particles of a chunk into a batch
+		const int numThreads = mNumThreads > 0 ? mNumThreads : std::max(1, (int)std::thread::hardware_concurrency());
+		const int64_t* active = particles.GetActive();
+		const int64_t numActive = particles.GetNumActive();
+		const int64_t numChunks = (numActive + BatchSize - 1) / BatchSize;
+#ifndef _DEBUG
+#pragma omp parallel num_threads(numThreads)
 #endif
+		{
+			// coordinates of the particles of a batch and of a stage, and the velocities of the stages
+			std::vector<int64_t> index(BatchSize);
+			std::vector<char> alive(BatchSize);
+			std::vector<double> buffer((6 + 3 * NumStages) * BatchSize);
+			double* x0 = buffer.data();
+			double* y0 = x0 + BatchSize;
+			double* z0 = y0 + BatchSize;
+			double* x = z0 + BatchSize;
+			double* y = x + BatchSize;
+			double* z = y + BatchSize;
+			double* u[NumStages], * v[NumStages], * w[NumStages];
+			for (int stage = 0; stage < NumStages; ++stage) {
+				u[stage] = z + (1 + 3 * stage) * BatchSize;
+				v[stage] = u[stage] + BatchSize;
+				w[stage] = v[stage] + BatchSize;
+			}
+#ifndef _DEBUG
+#pragma omp for schedule(dynamic)
+#endif
+			for (int64_t iChunk = 0; iChunk < numChunks; ++iChunk) {
+				// collect the particles of the chunk of the active list that are inside the spatial domain
+				const int64_t end = std::min(numActive, (iChunk + 1) * BatchSize);
+				int64_t count = 0;
+				for (int64_t next = iChunk * BatchSize; next < end; ++next) {
+					const Eigen::Vector3d pos = particles.GetPosition(active[next]);
+					if (!mBounds.contains(pos)) {
+						particles.Deactivate(active[next]);
+						continue;
+					}
+					index[count] = active[next];
+					alive[count] = 1;
+					x0[count] = pos.x();
+					y0[count] = pos.y();
+					z0[count] = pos.z();
+					++count;
+				}
+
+				// sample each stage in space and time, with the same arithmetic as Integrator::Step. Particles whose stage leaves
+				// the domain are dropped, their lanes sample the start of the step instead, which is inside the domain.
+				for (int stage = 0; stage < NumStages; ++stage) {
+					if (!Integrator::IsStageUsed<Method>(stage)) continue;
+					const double* stageX = x0, * stageY = y0, * stageZ = z0;
+					if (stage > 0) {
+						for (int64_t i = 0; i < count; ++i) {
+							Eigen::Vector3d location(x0[i], y0[i], z0[i]);
+							for (int j = 0; j < stage; ++j)
+								if (Method::A[stage][j] != 0) location += stepSize * Method::A[stage][j] * Eigen::Vector3d(u[j][i], v[j][i], w[j][i]);
+							if (!mBounds.contains(location)) {
+								alive[i] = 0;
+								location = Eigen::Vector3d(x0[i], y0[i], z0[i]);
+							}
+							x[i] = location.x();
+							y[i] = location.y();
+							z[i] = location.z();
+						}
+						stageX = x;
+						stageY = y;
+						stageZ = z;
+					}
+					const double relativeTime = Method::C[stage] * stepSize;
+					Sampling::LinearSample3(stageX, stageY, stageZ, count, mViews[i0], mViews[i1], relativeTime == 0 ? interp : interp + relativeTime * interpPerTime, u[stage], v[stage], w[stage]);
+				}
+
+				// take the step
+				for (int64_t i = 0; i < count; ++i) {
+					if (!alive[i]) {
+						particles.Deactivate(index[i]);
+						continue;
+					}
+					Eigen::Vector3d pos(x0[i], y0[i], z0[i]);
+					for (int stage = 0; stage < NumStages; ++stage)
+						if (Method::B[stage] != 0) pos += stepSize * Method::B[stage] * Eigen::Vector3d(u[stage][i], v[stage][i], w[stage][i]);
+					particles.SetPosition(index[i], pos);
+				}
+			}
 		}
 	}
 
-	Eigen::Vector3d UnsteadyTracer::Sample(const Eigen::Vector3d& position, double time, int& inDomain) const
+	void UnsteadyTracer::AdvectAdaptive(ParticleSet& particles, std::vector<double>& stepSizes, double time, double duration) const
 	{
-		// is the sample inside the spatial domain?
-		if (!mBounds.contains(position)) {
-			inDomain = 0;
-			return Eigen::Vector3d(0,0,0);
+		// the step size control needs the error estimate of the embedded method
+		if (mUseBricks) AdvectAdaptiveParticles<Integrator::DormandPrince>(particles, stepSizes, time, duration);
+		else AdvectAdaptiveBatched<Integrator::DormandPrince>(particles, stepSizes, time, duration);
+	}
+
+	template <class Method>
+	void UnsteadyTracer::AdvectAdaptiveParticles(ParticleSet& particles, std::vector<double>& stepSizes, double time, double duration) const
+	{
+		// the steps end at the event at the latest, so all stages interpolate between the same time steps
+		int i0, i1;
+		FindSlots(time, i0, i1);
+		const double interp = (time - mTime[i0]) / (mTime[i1] - mTime[i0]);
+		const double interpPerTime = 1 / (mTime[i1] - mTime[i0]);
+
+		const int numThreads = mNumThreads > 0 ? mNumThreads : std::max(1, (int)std::thread::hardware_concurrency());
+		const int64_t* active = particles.GetActive();
+		const int64_t numActive = particles.GetNumActive();
+#ifndef _DEBUG
+#pragma omp parallel for schedule(dynamic, ChunkSize) num_threads(numThreads)
+#endif
+		for (int64_t a = 0; a < numActive; ++a)
+		{
+			// the first stage of a step is the last stage of the previous step
+			const int64_t i = active[a];
+			Eigen::Vector3d pos = particles.GetPosition(i);
+			int indomain = 1;
+			Eigen::Vector3d k[Method::NumStages];
+			k[0] = Sample(pos, i0, i1, interp, indomain);
+			double elapsed = 0;
+			while (indomain && (duration > 0 ? elapsed < duration : elapsed > duration)) {
+				// the last step is clipped to the event
+				const double remaining = duration - elapsed;
+				const bool clipped = stepSizes[i] >= std::abs(remaining);
+				const double stepSize = clipped ? remaining : std::copysign(stepSizes[i], remaining);
+				if (!Integrator::SampleStages<Method>(pos, stepSize, k, [&](const Eigen::Vector3d& location, double relativeTime, Eigen::Vector3d& velocity) {
+					const double t = elapsed + relativeTime;
+					velocity = Sample(location, i0, i1, t == 0 ? interp : interp + t * interpPerTime, indomain);
+					return indomain != 0;
+				})) break;
+
+				// take or retry the step, a clipped step does not tell whether the full step would have been accepted
+				double nextSize = stepSize;
+				const bool accepted = Integrator::AdaptStepSize<Method>(mStepControl, Integrator::GetError<Method>(stepSize, k), nextSize);
+				stepSizes[i] = clipped && accepted ? std::max(stepSizes[i], nextSize) : nextSize;
+				if (accepted) {
+					pos = Integrator::GetStage<Method>(pos, stepSize, k, Method::NumStages - 1);
+					k[0] = k[Method::NumStages - 1];
+					elapsed = clipped ? duration : elapsed + stepSize;
+				}
+			}
+			particles.SetPosition(i, pos);
+			if (!indomain) particles.Deactivate(i);
 		}
+	}
 
-		// determine which time steps to interpolate between
+	template <class Method>
+	void UnsteadyTracer::AdvectAdaptiveBatched(ParticleSet& particles, std::vector<double>& stepSizes, double time, double duration) const
+	{
+		// the steps end at the event at the latest, so all stages interpolate between the same time steps
 		int i0, i1;
+		FindSlots(time, i0, i1);
+		const double interp = (time - mTime[i0]) / (mTime[i1] - mTime[i0]);
+		const double interpPerTime = 1 / (mTime[i1] - mTime[i0]);
+		const int NumStages = Method::NumStages;
+
+		// each thread advects the active particles of a chunk as a batch, the particles that reached the event leave the batch
+		const int numThreads = mNumThreads > 0 ? mNumThreads : std::max(1, (int)std::thread::hardware_concurrency());
+		const int64_t* active = particles.GetActive();
+		const int64_t numActive = particles.GetNumActive();
+		const int64_t numChunks = (numActive + BatchSize - 1) / BatchSize;
+#ifndef _DEBUG
+#pragma omp parallel num_threads(numThreads)
+#endif
+		{
+			// state of the particles of a batch, the coordinates and relative times of a stage, and the velocities of the stages
+			std::vector<int64_t> index(BatchSize);
+			std::vector<char> alive(BatchSize), clipped(BatchSize);
+			std::vector<double> buffer((9 + 3 * NumStages) * BatchSize);
+			double* x0 = buffer.data();
+			double* y0 = x0 + BatchSize;
+			double* z0 = y0 + BatchSize;
+			double* elapsed = z0 + BatchSize;
+			double* h = elapsed + BatchSize;
+			double* x = h + BatchSize;
+			double* y = x + BatchSize;
+			double* z = y + BatchSize;
+			double* interps = z + BatchSize;
+			double* u[NumStages], * v[NumStages], * w[NumStages];
+			for (int stage = 0; stage < NumStages; ++stage) {
+				u[stage] = interps + (1 + 3 * stage) * BatchSize;
+				v[stage] = u[stage] + BatchSize;
+				w[stage] = v[stage] + BatchSize;
+			}
+#ifndef _DEBUG
+#pragma omp for schedule(dynamic)
+#endif
+			for (int64_t iChunk = 0; iChunk < numChunks; ++iChunk) {
+				// collect the particles of the chunk of the active list that are inside the spatial domain
+				const int64_t end = std::min(numActive, (iChunk + 1) * BatchSize);
+				int64_t count = 0;
+				for (int64_t next = iChunk * BatchSize; next < end; ++next) {
+					const Eigen::Vector3d pos = particles.GetPosition(active[next]);
+					if (!mBounds.contains(pos)) {
+						particles.Deactivate(active[next]);
+						continue;
+					}
+					index[count] = active[next];
+					alive[count] = 1;
+					x0[count] = pos.x();
+					y0[count] = pos.y();
+					z0[count] = pos.z();
+					elapsed[count] = 0;
+					++count;
+				}
+				// the first stage of a step is the last stage of the previous step
+				Sampling::LinearSample3(x0, y0, z0, count, mViews[i0], mViews[i1], interp, u[0], v[0], w[0]);
+
+				// each round tries one step per particle, with the same arithmetic as AdvectAdaptiveParticles
+				while (count > 0) {
+					// the last step is clipped to the event
+					for (int64_t i = 0; i < count; ++i) {
+						const double remaining = duration - elapsed[i];
+						clipped[i] = stepSizes[index[i]] >= std::abs(remaining);
+						h[i] = clipped[i] ? remaining : std::copysign(stepSizes[index[i]], remaining);
+					}
+
+					// sample the stages at the times of the particles, particles whose stage leaves the domain sample the start of the step instead
+					for (int stage = 1; stage < NumStages; ++stage) {
+						for (int64_t i = 0; i < count; ++i) {
+							Eigen::Vector3d location(x0[i], y0[i], z0[i]);
+							for (int j = 0; j < stage; ++j)
+								if (Method::A[stage][j] != 0) location += h[i] * Method::A[stage][j] * Eigen::Vector3d(u[j][i], v[j][i], w[j][i]);
+							if (!mBounds.contains(location)) {
+								alive[i] = 0;
+								location = Eigen::Vector3d(x0[i], y0[i], z0[i]);
+							}
+							x[i] = location.x();
+							y[i] = location.y();
+							z[i] = location.z();
+							const double t = elapsed[i] + Method::C[stage] * h[i];
+							interps[i] = t == 0 ? interp : interp + t * interpPerTime;
+						}
+						Sampling::LinearSample3(x, y, z, count, mViews[i0], mViews[i1], interps, u[stage], v[stage], w[stage]);
+					}
+
+					// take or retry the steps and move the particles that have not reached the event to the front of the batch
+					int64_t numLeft = 0;
+					for (int64_t i = 0; i < count; ++i) {
+						if (!alive[i]) {
+							particles.SetPosition(index[i], Eigen::Vector3d(x0[i], y0[i], z0[i]));
+							particles.Deactivate(index[i]);
+							continue;
+						}
+						Eigen::Vector3d k[NumStages];
+						for (int stage = 0; stage < NumStages; ++stage)
+							k[stage] = Eigen::Vector3d(u[stage][i], v[stage][i], w[stage][i]);
+						double& stepSize = stepSizes[index[i]];
+						double nextSize = h[i];
+						const bool accepted = Integrator::AdaptStepSize<Method>(mStepControl, Integrator::GetError<Method>(h[i], k), nextSize);
+						stepSize = clipped[i] && accepted ? std::max(stepSize, nextSize) : nextSize;
+						if (accepted) {
+							x0[i] = x[i];
+							y0[i] = y[i];
+							z0[i] = z[i];
+							u[0][i] = u[NumStages - 1][i];
+							v[0][i] = v[NumStages - 1][i];
+							w[0][i] = w[NumStages - 1][i];
+							elapsed[i] = clipped[i] ? duration : elapsed[i] + h[i];
+						}
+						if (duration > 0 ? elapsed[i] >= duration : elapsed[i] <= duration) {
+							particles.SetPosition(index[i], Eigen::Vector3d(x0[i], y0[i], z0[i]));
+							continue;
+						}
+						index[numLeft] = index[i];
+						alive[numLeft] = 1;
+						x0[numLeft] = x0[i];
+						y0[numLeft] = y0[i];
+						z0[numLeft] = z0[i];
+						u[0][numLeft] = u[0][i];
+						v[0][numLeft] = v[0][i];
+						w[0][numLeft] = w[0][i];
+						elapsed[numLeft] = elapsed[i];
+						++numLeft;
+					}
+					count = numLeft;
+				}
+			}
+		}
+	}
+
+	void UnsteadyTracer::FindSlots(double time, int& i0, int& i1) const
+	{
 		if (std::min(mTime[mHead], mTime[(mHead + 1) % 3]) <= time && time <= std::max(mTime[mHead], mTime[(mHead + 1) % 3])) {
 			i0 = mHead;
 			i1 = (mHead + 1) % 3;
@@ -165,34 +581,259 @@ namespace vispro
 			i0 = (mHead + 1) % 3;
 			i1 = (mHead + 2) % 3;
 		}
-		// read from vector field and interpolate
-		Eigen::Vector3d v0 = Sampling::LinearSample3(position, mData[i0]);
-		Eigen::Vector3d v1 = Sampling::LinearSample3(position, mData[i1]);
-		double interp = (time - mTime[i0]) / (mTime[i1] - mTime[i0]);
+	}
+
+	Eigen::Vector3d UnsteadyTracer::Sample(const Eigen::Vector3d& position, int i0, int i1, double interp, int& inDomain) const
+	{
+		// is the sample inside the spatial domain?
+		if (!mBounds.contains(position)) {
+			inDomain = 0;
+			return Eigen::Vector3d(0,0,0);
+		}
+
+		// read from vector field and interpolate, the slots share the lattice, so the cell is found once for both
+		if (!mUseBricks)
+			return Sampling::LinearSample3(position, mViews[i0], mViews[i1], interp);
+		Eigen::Vector3d v0 = Sampling::LinearSample3(position, mBricks[i0].get());
+		Eigen::Vector3d v1 = Sampling::LinearSample3(position, mBricks[i1].get());
 		return v0 + (v1 - v0) * interp;
 	}
 
-	bool UnsteadyTracer::AllocateVectorFieldsFromHeader(const char* path)
+	void UnsteadyTracer::ReadTimeStep(int slot, int timeStep)
 	{
-		// read the header
-		Eigen::Vector3i resolution;
-		Eigen::Vector3d spacing;
-		int numComponents;
-		bool success = AmiraReader::ReadHeader(path, mBounds, resolution, spacing, numComponents);
+		if (TakePrefetch(slot, timeStep)) return;
+		if (FindCached(slot, timeStep)) return;
+		PrepareSlot(slot, timeStep);
+		if (mUseBricks) {
+			// only the brick index is read here, the bricks are decoded on demand
+			bool success = mBricks[slot]->Open((mBasePath + TimeSeriesManifest::GetFileName("velocity", timeStep, ".amb")).c_str());
+			assert(success);
+			return;
+		}
+
+		const auto start = std::chrono::steady_clock::now();
+		vtkFloatArray* array = dynamic_cast<vtkFloatArray*>(mData[slot]->GetPointData()->GetArray(0));
+		bool success = mIndexRegion.sizes() + Eigen::Vector3i(1, 1, 1) == mResolution ?
+			mManifest.ReadField("velocity", timeStep, array) :
+			mManifest.ReadFieldRegion("velocity", timeStep, mIndexRegion, array);
 		assert(success);
+		mIoWaitSeconds += SecondsSince(start);
+		UpdateMaxSpeed(slot);
+		UpdateView(slot);
+		InsertCached(slot);
+	}
 
-		// allocate output field
+	void UnsteadyTracer::ReadTimeSteps(const int (&timeSteps)[3])
+	{
+		if (mUseBricks) {
+			for (int slot = 0; slot < 3; ++slot)
+				ReadTimeStep(slot, timeSteps[slot]);
+			return;
+		}
+
+		// the same time step may be in several slots at the end of the sequence, it is read once and copied. Cached time steps are not read.
+		std::vector<TimeSeriesManifest::BatchRead> reads;
+		int source[3];
+		for (int slot = 0; slot < 3; ++slot) {
+			const int timeStep = timeSteps[slot];
+			source[slot] = -1;
+			if (FindCached(slot, timeStep)) continue;
+			PrepareSlot(slot, timeStep);
+			source[slot] = slot;
+			for (int other = 0; other < slot; ++other)
+				if (mTimeStep[other] == timeStep) source[slot] = other;
+			if (source[slot] == slot)
+				reads.push_back(TimeSeriesManifest::BatchRead{ "velocity", timeStep, dynamic_cast<vtkFloatArray*>(mData[slot]->GetPointData()->GetArray(0)), mIndexRegion });
+		}
+		const auto start = std::chrono::steady_clock::now();
+		bool success = mManifest.ReadFields(mReader, reads);
+		assert(success);
+		mIoWaitSeconds += SecondsSince(start);
+		for (int slot = 0; slot < 3; ++slot) {
+			if (source[slot] < 0) continue;
+			if (source[slot] != slot) {
+				vtkFloatArray* array = dynamic_cast<vtkFloatArray*>(mData[slot]->GetPointData()->GetArray(0));
+				const float* values = dynamic_cast<vtkFloatArray*>(mData[source[slot]]->GetPointData()->GetArray(0))->GetPointer(0);
+				std::copy(values, values + array->GetNumberOfValues(), array->GetPointer(0));
+			}
+			UpdateMaxSpeed(slot);
+			UpdateView(slot);
+			if (source[slot] == slot) InsertCached(slot);
+		}
+
+		// the time step in flight was read for the previous region
+		if (mTimeStep[PrefetchSlot] >= 0 && !IsSameRegion(mPrefetchRegion, mIndexRegion))
+			Prefetch(mTimeStep[PrefetchSlot]);
+	}
+
+	void UnsteadyTracer::Prefetch(int timeStep)
+	{
+		// the bricked files are opened on demand, which does not take long
+		if (mUseBricks) return;
+		if (mTimeStep[PrefetchSlot] >= 0) {
+			const auto start = std::chrono::steady_clock::now();
+			mReader.Wait(mPrefetchTicket);
+			mIoWaitSeconds += SecondsSince(start);
+		}
+
+		// cached time steps are taken from the cache when they are needed
+		if (UsesSliceCache() && SliceCache::GetInstance().Contains(mBasePath, "velocity", timeStep)) {
+			mTimeStep[PrefetchSlot] = -1;
+			return;
+		}
+		PrepareSlot(PrefetchSlot, timeStep);
+		std::vector<TimeSeriesManifest::BatchRead> reads = { TimeSeriesManifest::BatchRead{ "velocity", timeStep, dynamic_cast<vtkFloatArray*>(mData[PrefetchSlot]->GetPointData()->GetArray(0)), mIndexRegion } };
+		mPrefetchTicket = mManifest.SubmitFields(mReader, reads);
+		mPrefetchRegion = mIndexRegion;
+	}
+
+	bool UnsteadyTracer::TakePrefetch(int slot, int timeStep)
+	{
+		if (mTimeStep[PrefetchSlot] < 0) return false;
+		const auto start = std::chrono::steady_clock::now();
+		const bool success = mReader.Wait(mPrefetchTicket);
+		mIoWaitSeconds += SecondsSince(start);
+		const bool match = success && mTimeStep[PrefetchSlot] == timeStep && IsSameRegion(mPrefetchRegion, mIndexRegion);
+		if (match) {
+			UpdateMaxSpeed(PrefetchSlot);
+			UpdateView(PrefetchSlot);
+			// the slot that is no longer needed becomes the next prefetch slot
+			std::swap(mTime[slot], mTime[PrefetchSlot]);
+			std::swap(mData[slot], mData[PrefetchSlot]);
+			std::swap(mViews[slot], mViews[PrefetchSlot]);
+			std::swap(mTimeStep[slot], mTimeStep[PrefetchSlot]);
+			std::swap(mMaxSpeed[slot], mMaxSpeed[PrefetchSlot]);
+			std::swap(mShared[slot], mShared[PrefetchSlot]);
+			InsertCached(slot);
+		}
+		mTimeStep[PrefetchSlot] = -1;
+		return match;
+	}
+
+	void UnsteadyTracer::PrepareSlot(int slot, int timeStep)
+	{
+		mTime[slot] = mDesc.StartTime + timeStep * mDesc.TemporalSpacing;
+		mTimeStep[slot] = timeStep;
+		if (mUseBricks) return;
+
+		// the field of the cache is replaced instead of overwritten
+		if (mShared[slot]) {
+			mData[slot] = NewVelocityField(Eigen::Vector3i(0, 0, 0), mRegion.min().data(), mData[slot]->GetSpacing());
+			mShared[slot] = false;
+		}
+
+		// resize the slot to the loaded region
+		vtkImageData* data = mData[slot];
+		vtkFloatArray* array = dynamic_cast<vtkFloatArray*>(data->GetPointData()->GetArray(0));
+		const Eigen::Vector3i size = mIndexRegion.sizes() + Eigen::Vector3i(1, 1, 1);
+		if (Eigen::Vector3i(data->GetDimensions()) != size) {
+			data->SetDimensions(size.data());
+			array->SetNumberOfTuples((int64_t)size.x() * size.y() * size.z());
+		}
+		data->SetOrigin(mRegion.min().data());
+	}
+
+	bool UnsteadyTracer::UsesSliceCache() const
+	{
+		return !mUseBricks && SliceCache::GetInstance().IsEnabled() && mIndexRegion.sizes() + Eigen::Vector3i(1, 1, 1) == mResolution;
+	}
+
+	bool UnsteadyTracer::FindCached(int slot, int timeStep)
+	{
+		if (!UsesSliceCache()) return false;
+		vtkSmartPointer<vtkImageData> data = SliceCache::GetInstance().Find(mBasePath, "velocity", timeStep);
+		if (!data) return false;
+		mTime[slot] = mDesc.StartTime + timeStep * mDesc.TemporalSpacing;
+		mTimeStep[slot] = timeStep;
+		mData[slot] = data;
+		mShared[slot] = true;
+		UpdateMaxSpeed(slot);
+		UpdateView(slot);
+		return true;
+	}
+
+	void UnsteadyTracer::InsertCached(int slot)
+	{
+		if (!UsesSliceCache()) return;
+		SliceCache::GetInstance().Insert(mBasePath, "velocity", mTimeStep[slot], mData[slot]);
+		mShared[slot] = true;
+	}
+
+	void UnsteadyTracer::UpdateMaxSpeed(int slot)
+	{
+		if (mRegionPadding < 0 || mUseBricks) return;
+
+		// remember how far a particle can travel in this time step, which determines when the region has to move
+		vtkFloatArray* array = dynamic_cast<vtkFloatArray*>(mData[slot]->GetPointData()->GetArray(0));
+		const float* values = array->GetPointer(0);
+		const int64_t numPoints = array->GetNumberOfTuples();
+		double maxSpeed2 = 0;
+		for (int64_t i = 0; i < numPoints; ++i)
+			maxSpeed2 = std::max(maxSpeed2, (double)Eigen::Vector3f(values + i * 3).squaredNorm());
+		mMaxSpeed[slot] = std::sqrt(maxSpeed2);
+	}
+
+	void UnsteadyTracer::UpdateView(int slot)
+	{
+		if (mUseBricks) return;
+		mViews[slot] = FieldView(mData[slot], mLayout);
+	}
+
+	void UnsteadyTracer::UpdateRegion(const ParticleSet& particles, double stepSize)
+	{
+		Eigen::AlignedBox3d box;
+		box.setEmpty();
+		const int64_t* active = particles.GetActive();
+		for (int64_t a = 0; a < particles.GetNumActive(); ++a)
+			box.extend(particles.GetPosition(active[a]));
+		if (box.isEmpty()) return;
+
+		// pad by twice the distance that the samples of one step reach in the current region, such that the next check succeeds
+		const double maxSpeed = std::max(mMaxSpeed[0], std::max(mMaxSpeed[1], mMaxSpeed[2]));
+		const double padding = mRegionPadding + 2 * std::abs(stepSize) * Integrator::GetReach(mIntegrator) * maxSpeed;
+		box.min() -= Eigen::Vector3d::Constant(padding);
+		box.max() += Eigen::Vector3d::Constant(padding);
+		const AmiraReader::Header* header = mManifest.FindHeader("velocity", 0);
+		mIndexRegion = AmiraReader::GetIndexRegion(*header, box.intersection(mBounds));
+		mRegion = AmiraReader::GetRegionHeader(*header, mIndexRegion).Bounds;
+	}
+
+	bool UnsteadyTracer::IsInsideRegion(const ParticleSet& particles, double stepSize) const
+	{
+		if (mRegionPadding < 0 || mUseBricks) return true;
+
+		// Any sample of an integration step is at most the reach of the method times the step and the largest speed away from the particle, since
+		// the weights of the stages may be negative. Adaptive steps up to the next event take several steps within the given duration, whose samples
+		// reach no further. Faces of the region that are on the boundary of the domain do not shrink, since particles that leave there are out of the domain anyways.
+		const double maxSpeed = std::max(mMaxSpeed[0], std::max(mMaxSpeed[1], mMaxSpeed[2]));
+		const double margin = std::abs(stepSize) * Integrator::GetReach(mIntegrator) * maxSpeed;
+		Eigen::AlignedBox3d inner = mRegion;
 		for (int i = 0; i < 3; ++i) {
-			mData[i]->SetDimensions(resolution.data());
-			mData[i]->SetOrigin(mBounds.min().data());
-			mData[i]->SetSpacing(spacing.data());
-			vtkNew<vtkFloatArray> mArray;
-			int64_t numPoints = (int64_t)mData[i]->GetDimensions()[0] * mData[i]->GetDimensions()[1] * mData[i]->GetDimensions()[2];
-			mArray->SetNumberOfComponents(3);
-			mArray->SetNumberOfTuples(numPoints);
-			mArray->SetName("velocity");
-			mData[i]->GetPointData()->AddArray(mArray);
-			mData[i]->GetPointData()->SetActiveScalars("velocity");
+			if (mIndexRegion.min()[i] > 0) inner.min()[i] += margin;
+			if (mIndexRegion.max()[i] < mResolution[i] - 1) inner.max()[i] -= margin;
+		}
+		const int64_t* active = particles.GetActive();
+		for (int64_t a = 0; a < particles.GetNumActive(); ++a)
+			if (!inner.contains(particles.GetPosition(active[a]))) return false;
+		return true;
+	}
+
+	bool UnsteadyTracer::AllocateVectorFieldsFromHeader()
+	{
+		// get the header of the first time step
+		const AmiraReader::Header* header = mManifest.FindHeader("velocity", 0);
+		if (!header) return false;
+		mBounds = header->Bounds;
+		mResolution = header->Resolution;
+		mIndexRegion = Eigen::AlignedBox3i(Eigen::Vector3i(0, 0, 0), mResolution - Eigen::Vector3i(1, 1, 1));
+		mRegion = mBounds;
+		const Eigen::Vector3i& resolution = header->Resolution;
+		const Eigen::Vector3d& spacing = header->Spacing;
+
+		// allocate output field
+		for (int i = 0; i < 4; ++i) {
+			mData[i] = NewVelocityField(resolution, mBounds.min().data(), spacing.data());
+			mViews[i] = FieldView(mData[i]);
 		}
 		return true;
 	}
@@ -1,8 +1,14 @@
 #pragma once
 
+#include <memory>
 #include <vector>
 #include <Eigen/Eigen>
 #include <vtkSmartPointer.h>
+#include "TimeSeriesManifest.hpp"
+#include "BrickCache.hpp"
+#include "FieldView.hpp"
+#include "Integrator.hpp"
+#include "ParticleSet.hpp"
 
 class vtkImageData;
 class vtkFloatArray;
@@ -25,9 +31,38 @@ namespace vispro
 		// Destructor.
 		~UnsteadyTracer();
 
+		// Traces the active particles of a set from a start time for a certain target duration. The particles will store the target positions in the end,
+		// the ones that leave the domain are deactivated at the position before their last step.
+		void Flowmap(ParticleSet& particles, double stepSize, double startTime, double duration);
 		// Traces a set of particles from a start time for a certain target duration. The particle set is modified and will store the target positions in the end.
+		// All particles are traced, the flags are overwritten with 1 for the particles that stayed in the domain and 0 otherwise.
 		void Flowmap(std::vector<Eigen::Vector3d>& particles, std::vector<int>& inDomain, double stepSize, double startTime, double duration);
 
+		// Enables sampling from the bricked velocity files (*.amb), which decodes only the bricks that particles visit, instead of reading the full fields.
+		void SetUseBricks(bool useBricks);
+		// Loads only a box around the active particles, enlarged by the padding in world space, instead of the full fields.
+		// The box is moved whenever particles could leave it within the next integration step. A negative padding reads the full fields (default).
+		void SetRegionPadding(double padding);
+		// Sets the memory layout into which the fields are converted after they are read (see FieldView::ELayout). Layouts
+		// other than the linear one (default) keep a reordered copy per time step and do not apply to the bricked files.
+		void SetLayout(FieldView::ELayout layout);
+		// Sets the number of threads that advect the particles. Zero or less uses all hardware threads (default).
+		// The traced positions do not depend on the number of threads.
+		void SetNumThreads(int numThreads);
+		// Sets the integration method of the advection (default: Euler).
+		void SetIntegrator(Integrator::EMethod integrator);
+		// Sets the step size control of the embedded Dormand-Prince method. With a positive tolerance, each particle adapts its own step size,
+		// starting from the step size of Flowmap, within the given bounds. A maximum of zero or less does not bound the step size. Other methods
+		// and a tolerance of zero or less (default) take fixed steps.
+		void SetStepControl(double tolerance, double minStepSize, double maxStepSize);
+		// Sorts the active particles along a Z-order curve every few integration steps of Flowmap, so that the particles of a batch sample nearby
+		// velocities. The particles are put back into their order before Flowmap returns. Zero or less does not sort (default).
+		void SetSortInterval(int numSteps);
+
+		// Gets the total time that Flowmap has waited for reads of the velocity, in seconds. Reads of the next time step
+		// overlap with the advection, so this is only the part of the reads that the advection could not hide.
+		double GetIoWaitSeconds() const;
+
 		// Gets the bounding box of the domain
 		const Eigen::AlignedBox3d& GetBounds() const;
 		// Gets general parameters about the time series.
@@ -37,20 +72,110 @@ namespace vispro
 		// Delete the copy-constructor.
 		UnsteadyTracer(const UnsteadyTracer& other) = delete;
 
-		// Advects a set of particles for one integration step, starting at time "time". The necesary data is assumed to be present in memory already.
-		void Advect(std::vector<Eigen::Vector3d>& particles, std::vector<int>& inDomain, double time, double stepSize) const;
-		// Samples the velocity for a certain particle and assumes that the necessary data is in memory.
-		Eigen::Vector3d Sample(const Eigen::Vector3d& position, double time, int& inDomain) const;
-		// Reads the header of a given vector field to initialize the vtkImageData objects in the ring buffer.
-		bool AllocateVectorFieldsFromHeader(const char* path);
-		// Physical time of a time step in the ring buffer.
-		double mTime[3];
-		// Vector field data of a time step in the ring buffer.
-		vtkSmartPointer<vtkImageData> mData[3];
+		// Advects the active particles for one integration step, starting at time "time". The necesary data is assumed to be present in memory already.
+		// Dispatches to the instantiation for the integration method and the storage of the fields.
+		void Advect(ParticleSet& particles, double time, double stepSize) const;
+		// Advects the particles one by one with an integration method. Used for the bricked files, which are decoded on demand. Particles that leave the domain are deactivated.
+		// The particles are distributed over the threads in chunks, which are assigned dynamically, since the chunks with particles that left the domain finish early.
+		template <class Method>
+		void AdvectParticles(ParticleSet& particles, double time, double stepSize) const;
+		// Advects the active particles in batches with an integration method, which samples the velocity of several particles at once for each stage (see Sampling::LinearSample3).
+		// Used for the fields in memory, i.e., if bricks are disabled. The results are identical to the particle-wise advection.
+		template <class Method>
+		void AdvectBatched(ParticleSet& particles, double time, double stepSize) const;
+		// Advects a set of particles with adaptive step sizes from time "time" to the next event, i.e., until the particles need the next time step
+		// of the ring buffer. The step sizes of the particles are updated. Dispatches to the storage of the fields.
+		void AdvectAdaptive(ParticleSet& particles, std::vector<double>& stepSizes, double time, double duration) const;
+		// Advects the particles one by one with adaptive step sizes. Used for the bricked files. The method has to be an embedded method whose last stage is the end of the step.
+		template <class Method>
+		void AdvectAdaptiveParticles(ParticleSet& particles, std::vector<double>& stepSizes, double time, double duration) const;
+		// Advects the particles in batches with adaptive step sizes. All particles of a batch are advected to the same event, but with their own steps, so each round
+		// samples the unfinished particles of the batch at their own times. The results are identical to the particle-wise advection.
+		template <class Method>
+		void AdvectAdaptiveBatched(ParticleSet& particles, std::vector<double>& stepSizes, double time, double duration) const;
+		// Sorts the active particles along a Z-order curve through the domain. The per-particle step sizes are reordered with them and the order
+		// is composed with the order of the previous sorts, i.e., it stores the original index of each particle.
+		void SortParticles(ParticleSet& particles, std::vector<double>& stepSizes, std::vector<int64_t>& order) const;
+		// Samples the velocity for a certain particle between two slots of the ring buffer and assumes that the necessary data is in memory.
+		Eigen::Vector3d Sample(const Eigen::Vector3d& position, int i0, int i1, double interp, int& inDomain) const;
+		// Finds the two slots of the ring buffer whose time steps enclose a time.
+		void FindSlots(double time, int& i0, int& i1) const;
+		// Reads a time step of the velocity into a slot of the ring buffer. The prefetched time step is taken if it matches, otherwise the shared cache is looked up first.
+		void ReadTimeStep(int slot, int timeStep);
+		// Starts reading a time step into the prefetch slot in the background. A read that is still in flight is waited for first.
+		void Prefetch(int timeStep);
+		// Waits for the prefetch slot and swaps it into a slot of the ring buffer if it holds the time step in the loaded region. Returns false otherwise.
+		bool TakePrefetch(int slot, int timeStep);
+		// Reads a time step into each slot of the ring buffer with a single batch, so that the reads are in flight at the same time.
+		void ReadTimeSteps(const int (&timeSteps)[3]);
+		// Resizes a slot of the ring buffer to the loaded region and sets its time. A slot that shares its field with the cache gets a field of its own.
+		void PrepareSlot(int slot, int timeStep);
+		// Checks whether the slots exchange full fields with the shared cache (see SliceCache), which is the case if the cache is enabled and the full fields are loaded.
+		bool UsesSliceCache() const;
+		// Takes a time step from the shared cache into a slot. Returns false if it is not cached.
+		bool FindCached(int slot, int timeStep);
+		// Adds the field of a slot to the shared cache after it was read.
+		void InsertCached(int slot);
+		// Determines the largest velocity magnitude in a slot after it was read.
+		void UpdateMaxSpeed(int slot);
+		// Builds the view of a slot after it was read, which converts the values into the layout.
+		void UpdateView(int slot);
+		// Fits the loaded region to the bounding box of the active particles and re-reads the time steps in the ring buffer.
+		void UpdateRegion(const ParticleSet& particles, double stepSize);
+		// Checks whether all active particles stay inside the loaded region during an integration step of the given size.
+		bool IsInsideRegion(const ParticleSet& particles, double stepSize) const;
+		// Takes the header of the first velocity field from the manifest to initialize the vtkImageData objects in the ring buffer.
+		bool AllocateVectorFieldsFromHeader();
+		// Slot after the ring buffer, into which the next time step is read while the particles are advected.
+		static const int PrefetchSlot = 3;
+		// Physical time of a time step in the ring buffer or the prefetch slot.
+		double mTime[4];
+		// Vector field data of a time step in the ring buffer or the prefetch slot.
+		vtkSmartPointer<vtkImageData> mData[4];
+		// View of the values of a time step in the ring buffer or the prefetch slot, which is what the samples read.
+		FieldView mViews[4];
+		// Memory layout of the views.
+		FieldView::ELayout mLayout;
+		// Bricked vector field of a time step in the ring buffer, used instead of mData if bricks are enabled.
+		std::unique_ptr<BrickCache> mBricks[3];
+		// Integration method of the advection.
+		Integrator::EMethod mIntegrator;
+		// Step size control of the embedded method, which is disabled if the tolerance is not positive.
+		Integrator::StepControl mStepControl;
+		// Number of threads that advect the particles, zero or less for all hardware threads.
+		int mNumThreads;
+		// Number of integration steps between two sorts of the particles, zero or less if the particles are not sorted.
+		int mSortInterval;
+		// Flag that determines whether the bricked files are sampled.
+		bool mUseBricks;
+		// Flag of a slot of the ring buffer or the prefetch slot that holds a field of the shared cache, which must not be written.
+		bool mShared[4];
+		// Time step that is stored in a slot of the ring buffer or the prefetch slot, -1 if the prefetch slot is not being read.
+		int mTimeStep[4];
+		// Largest velocity magnitude in the loaded region of a time step in the ring buffer or the prefetch slot.
+		double mMaxSpeed[4];
+		// Padding of the loaded region around the active particles. Negative if the full fields are loaded.
+		double mRegionPadding;
+		// Grid points that are loaded into the ring buffer, which are all grid points if no padding is set.
+		Eigen::AlignedBox3i mIndexRegion;
+		// Bounding box of the loaded grid points.
+		Eigen::AlignedBox3d mRegion;
+		// Number of grid points of the full fields.
+		Eigen::Vector3i mResolution;
 		// Bounding box of the domain
 		Eigen::AlignedBox3d mBounds;
 		// Head index in the ring buffer
 		int mHead;
+		// Cached headers of the time series.
+		TimeSeriesManifest mManifest;
+		// Reader that fetches several time steps at once.
+		BatchReader mReader;
+		// Read of the prefetch slot that is in flight.
+		BatchReader::Ticket mPrefetchTicket;
+		// Grid points that are read into the prefetch slot. The slot is dropped if the loaded region moved in the meantime.
+		Eigen::AlignedBox3i mPrefetchRegion;
+		// Total time spent waiting for reads.
+		double mIoWaitSeconds;
 		// General parameters about the time series.
 		const TimeSeriesDescription mDesc;
 		// Base path to the data set.
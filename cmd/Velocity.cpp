@@ -4,19 +4,100 @@
 #include <vtkSmartPointer.h>
 #include <vtkPointData.h>
 #include <vtkFloatArray.h>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
 #include "AmiraWriter.hpp"
+#include "TimeSeriesContainer.hpp"
+#include "VtiReader.hpp"
 
 namespace vispro
 {
-	void Velocity::Compute(const char* velocityPath, const char* velocityPathAm)
-	{
-		// read the file
+	// Reads a velocity file with the parallel decoder and falls back to VTK for files it does not support.
+	static vtkSmartPointer<vtkImageData> ReadVelocity(const char* velocityPath, int numThreads) {
+		vtkSmartPointer<vtkImageData> velocity = VtiReader::ReadField(velocityPath, numThreads);
+		if (velocity) return velocity;
 		vtkNew<vtkXMLImageDataReader> reader;
 		reader->SetFileName(velocityPath);
 		reader->Update();
-		vtkImageData* velocity = reader->GetOutput();
+		return reader->GetOutput();
+	}
+
+	// Runs a conversion for each input on a set of worker threads. A conversion reserves the given number of bytes per decoded
+	// byte of its input, and waits until the reservation fits into the budget. A single conversion always runs, even if it is larger.
+	// Inputs whose size cannot be determined reserve the share of the budget of a worker.
+	static void RunBatch(const std::vector<std::string>& velocityPaths, size_t memoryBudget, double bytesPerDecodedByte,
+		const std::function<void(int index, vtkImageData* velocity)>& write) {
+		if (velocityPaths.empty()) return;
+
+		// as many workers as the largest fields fit into the budget, each decoding with its share of the hardware threads
+		const int numHardwareThreads = std::max(1, (int)std::thread::hardware_concurrency());
+		std::vector<size_t> sizes(velocityPaths.size());
+		for (size_t index = 0; index < velocityPaths.size(); ++index)
+			sizes[index] = (size_t)(VtiReader::GetDecodedSize(velocityPaths[index].c_str()) * bytesPerDecodedByte);
+		const size_t fieldSize = *std::max_element(sizes.begin(), sizes.end());
+		const int numWorkers = std::max(1, std::min({ numHardwareThreads, (int)velocityPaths.size(), (int)(memoryBudget / std::max(fieldSize, (size_t)1)) }));
+		const int numThreadsPerWorker = std::max(1, numHardwareThreads / numWorkers);
+		for (size_t& size : sizes)
+			if (size == 0) size = memoryBudget / numWorkers;
+
+		std::mutex mutex;
+		std::condition_variable released;
+		size_t reserved = 0;
+		std::atomic<int> next(0);
+		std::vector<std::thread> workers;
+		for (int iWorker = 0; iWorker < numWorkers; ++iWorker) {
+			workers.emplace_back([&]() {
+				for (int index = next++; index < (int)velocityPaths.size(); index = next++) {
+					const char* path = velocityPaths[index].c_str();
+					const size_t size = sizes[index];
+					{
+						std::unique_lock<std::mutex> lock(mutex);
+						released.wait(lock, [&]() { return reserved == 0 || reserved + size <= memoryBudget; });
+						reserved += size;
+					}
+					vtkSmartPointer<vtkImageData> velocity = ReadVelocity(path, numThreadsPerWorker);
+					if (velocity) write(index, velocity);
+					velocity = nullptr;
+					{
+						std::lock_guard<std::mutex> lock(mutex);
+						reserved -= size;
+					}
+					released.notify_all();
+				}
+			});
+		}
+		for (std::thread& worker : workers)
+			worker.join();
+	}
+
+	void Velocity::Compute(const char* velocityPath, const char* velocityPathAm)
+	{
+		// read the file
+		vtkSmartPointer<vtkImageData> velocity = ReadVelocity(velocityPath, 0);
 
 		// write the file
 		AmiraWriter::WriteVectorField(velocityPathAm, "u", "v", "w", velocity);
 	}
-}
\ No newline at end of file
+
+	void Velocity::ComputeBatch(const std::vector<std::string>& velocityPaths, const std::vector<std::string>& velocityPathsAm, size_t memoryBudget)
+	{
+		// the writer streams small blocks, so only the decoded field counts
+		RunBatch(velocityPaths, memoryBudget, 1.0, [&](int index, vtkImageData* velocity) {
+			AmiraWriter::WriteVectorField(velocityPathsAm[index].c_str(), "u", "v", "w", velocity);
+		});
+	}
+
+	void Velocity::ComputeBatch(const std::vector<std::string>& velocityPaths, TimeSeriesContainer& container, size_t memoryBudget)
+	{
+		// the container serializes a time step in memory before it is appended, which holds two more copies
+		std::mutex containerMutex;
+		RunBatch(velocityPaths, memoryBudget, 3.0, [&](int index, vtkImageData* velocity) {
+			std::lock_guard<std::mutex> lock(containerMutex);
+			container.AppendVectorField(index, "u", "v", "w", velocity);
+		});
+	}
+}
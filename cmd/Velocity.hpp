@@ -1,12 +1,22 @@
 #pragma once
 
+#include <string>
+#include <vector>
+
 namespace vispro
 {
+	class TimeSeriesContainer;
+
 	// Writes the velocity of a given time step in the Amira format.
 	class Velocity
 	{
 	public:
 		// receives the paths to the vtkImageData file of velocity (input) and converts it to the Amira format (output)
 		static void Compute(const char* velocityPath, const char* velocityPathAm);
+
+		// Converts many time steps concurrently. Conversions only start while their decoded fields fit into the memory budget (in bytes).
+		static void ComputeBatch(const std::vector<std::string>& velocityPaths, const std::vector<std::string>& velocityPathsAm, size_t memoryBudget);
+		// Converts many time steps concurrently and appends them to a container. The index of a path is its time step.
+		static void ComputeBatch(const std::vector<std::string>& velocityPaths, TimeSeriesContainer& container, size_t memoryBudget);
 	};
-}
\ No newline at end of file
+}
@@ -3,32 +3,25 @@
 #include <vtkSmartPointer.h>
 #include "AmiraReader.hpp"
 #include "AmiraWriter.hpp"
+#include "AsyncWriter.hpp"
 #include <vtkPointData.h>
 #include <vtkFloatArray.h>
 
 namespace vispro
 {
-	void Vorticity::Compute(const char* velocityPath, const char* vorticityPath)
+	void Vorticity::Compute(const char* velocityPath, const char* vorticityPath, Quantization::EStorage storage, double errorBound, AsyncWriter* writer)
 	{
 		// read the input file
 		vtkSmartPointer<vtkImageData> velocityImage = 
-			AmiraReader::ReadField(velocityPath, "velocity");
+			AmiraReader::ReadFieldMapped(velocityPath, "velocity");
 		vtkFloatArray* velocityArray = 
 			dynamic_cast<vtkFloatArray*>(velocityImage->GetPointData()->GetArray("velocity"));
 
-		// allocate output
-		vtkNew<vtkImageData> vorticityImage;
-		vorticityImage->SetDimensions(velocityImage->GetDimensions());
-		vorticityImage->SetOrigin(velocityImage->GetOrigin());
-		vorticityImage->SetSpacing(velocityImage->GetSpacing());
-		vtkNew<vtkFloatArray> vorticityArray;
-		int64_t numPoints = (int64_t)vorticityImage->GetDimensions()[0]
-			* vorticityImage->GetDimensions()[1]
-			* vorticityImage->GetDimensions()[2];
-		vorticityArray->SetNumberOfTuples(numPoints);
-		vorticityArray->SetNumberOfComponents(1);
-		vorticityArray->SetName("vorticity");
-		vorticityImage->GetPointData()->AddArray(vorticityArray);
+		// allocate output, or take a flushed one from the writer
+		vtkSmartPointer<vtkImageData> vorticityImage = writer ?
+			writer->AcquireField(velocityImage->GetDimensions(), velocityImage->GetOrigin(), velocityImage->GetSpacing(), { "vorticity" }) :
+			AsyncWriter::AllocateField(velocityImage->GetDimensions(), velocityImage->GetOrigin(), velocityImage->GetSpacing(), { "vorticity" });
+		vtkFloatArray* vorticityArray = dynamic_cast<vtkFloatArray*>(vorticityImage->GetPointData()->GetArray("vorticity"));
 
 		// compute the vorticity field
 		int* res = vorticityImage->GetDimensions();
@@ -77,6 +70,7 @@ namespace vispro
 		}
 
 		// write the file
-		AmiraWriter::WriteScalarField(vorticityPath, "vorticity", vorticityImage);
+		if (writer) writer->WriteScalarField(vorticityPath, "vorticity", vorticityImage, storage, errorBound);
+		else AmiraWriter::WriteScalarField(vorticityPath, "vorticity", vorticityImage, storage, errorBound);
 	}
 }
\ No newline at end of file
@@ -1,12 +1,18 @@
 #pragma once
 
+#include "Quantization.hpp"
+
 namespace vispro
 {
+	class AsyncWriter;
+
 	// Computes the vorticity of a given time step.
 	class Vorticity
 	{
 	public:
 		// receives the paths to the vtkImageData file of velocity (input) and the vorticity path (output)
-		static void Compute(const char* velocityPath, const char* vorticityPath);
+		// The output can be stored in a compact type or compressed with an absolute error bound, since it is only used for visualization.
+		// If a writer is given, the output is written in the background and its buffer is reused.
+		static void Compute(const char* velocityPath, const char* vorticityPath, Quantization::EStorage storage = Quantization::EStorage::Float, double errorBound = 0, AsyncWriter* writer = nullptr);
 	};
 }
\ No newline at end of file
@@ -1,3 +1,4 @@
+#include <chrono>
 #include <iostream>
 #include <string>
 #include "Magnitude.hpp"
@@ -8,72 +9,187 @@
 #include "FeatureFlow.hpp"
 #include "LIC.hpp"
 #include "FTLE.hpp"
+#include "FlowMapCache.hpp"
+#include "UnsteadyTracer.hpp"
+#include "TimeSeriesManifest.hpp"
+#include "BrickedWriter.hpp"
+#include "AmiraWriter.hpp"
+#include "AsyncWriter.hpp"
+#include "ErrorBoundedCodec.hpp"
+#include "Pyramid.hpp"
+#include "SliceCache.hpp"
+#include <vtkImageData.h>
+#include <vtkPointData.h>
+#include <vtkFloatArray.h>
+#ifdef _WIN32
 #include <Windows.h>
+#endif
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
 
 static const int num_time_steps = 151;
+// Memory that the concurrent conversion of the simulation output may use for decoded fields.
+static const size_t ingest_memory_budget = (size_t)8 << 30;
+// Storage type of the derived fields, which are only visualized. The velocity is always kept as full float.
+static const vispro::Quantization::EStorage derived_storage = vispro::Quantization::EStorage::Float;
+// Absolute error bound of the derived fields if they are stored as ErrorBounded.
+static const double derived_error_bound = 1e-3;
+// Number of resolution levels that are written for each field, including the full resolution. The viewer scrubs through the coarsest one.
+static const int pyramid_levels = vispro::Pyramid::NumLevels;
+// Padding of the region around the particles that the particle tracers load from the velocity fields.
+static const double tracer_region_padding = 1.0;
+// Number of threads that advect the particles of the tracers. Zero or less uses all hardware threads, like the conversion of the velocity.
+static const int tracer_num_threads = 0;
+// Memory that the decoded velocity fields may occupy in the slice cache, which the tracers of overlapping time windows share, e.g., the FTLE of consecutive start times.
+static const size_t slice_cache_budget = (size_t)4 << 30;
+// Resolution of the grid of the cached flow maps that the FTLE of consecutive start times is composed from, relative to the FTLE grid.
+// Finer grids compose more accurately, but take longer to integrate and keep a flow map per time step in memory. The composition approximates the
+// flow map and deactivates particles near the outflow, so it is opt-in (see BenchmarkFlowMaps for its error). Zero integrates each FTLE from scratch (default).
+static const double ftle_flow_map_scale = 0;
+
+using vispro::TimeSeriesManifest;
 
 void ComputeVelocity(const std::string& basePath) {
-	// for each time step
+	TimeSeriesManifest manifest(basePath);
+	// convert all time steps concurrently
+	std::vector<std::string> pathsIn, pathsOut;
 	for (int time = 0; time < num_time_steps; ++time) {
-		char filenameIn[256];
-		char filenameOut[256];
-		sprintf(filenameIn, "halfcylinder-%.2f.vti", time * 0.1);
-		sprintf(filenameOut, "halfcylinder-%.2f.am", time * 0.1);
-		vispro::Velocity::Compute((basePath + filenameIn).c_str(), (basePath + filenameOut).c_str());
-		std::cout << "\rVelocity: " << (time + 1) << " / " << num_time_steps;
+		pathsIn.push_back(basePath + TimeSeriesManifest::GetFileName("velocity", time, ".vti"));
+		pathsOut.push_back(basePath + TimeSeriesManifest::GetFileName("velocity", time));
+	}
+	vispro::Velocity::ComputeBatch(pathsIn, pathsOut, ingest_memory_budget);
+	for (int time = 0; time < num_time_steps; ++time)
+		manifest.Update("velocity", time);
+	std::cout << "Velocity: " << num_time_steps << " / " << num_time_steps << std::endl;
+}
+
+void ComputeBricks(const std::string& basePath) {
+	TimeSeriesManifest manifest(basePath);
+	// for each time step
+	for (int time = 0; time < manifest.GetNumTimeSteps(); ++time) {
+		vtkSmartPointer<vtkImageData> velocity = manifest.ReadFieldMapped("velocity", time, "velocity");
+		std::string filenameOut = TimeSeriesManifest::GetFileName("velocity", time, ".amb");
+		vispro::BrickedWriter::WriteField((basePath + filenameOut).c_str(), "velocity", velocity,
+			32,		// brick size
+			vispro::BrickedWriter::ECodec::LZ4);
+		std::cout << "\rBricks: " << (time + 1) << " / " << manifest.GetNumTimeSteps();
+	}
+}
+
+void ComputePack(const std::string& basePath) {
+	TimeSeriesManifest manifest(basePath);
+	// packs the individual files of each field into a container
+	for (const std::string& field : TimeSeriesManifest::GetFieldNames()) {
+		vispro::TimeSeriesContainer container;
+		if (!container.OpenForAppend((basePath + TimeSeriesManifest::GetContainerName(field)).c_str())) continue;
+		for (int time = 0; time < manifest.GetNumTimeSteps(); ++time) {
+			if (!manifest.Find(field, time)) continue;
+			container.AppendFile(time, (basePath + TimeSeriesManifest::GetFileName(field, time)).c_str());
+			std::cout << "\rPack " << field << ": " << (time + 1) << " / " << manifest.GetNumTimeSteps();
+		}
+		std::cout << std::endl;
+	}
+}
+
+// Waits for the pending writes and updates the manifest entries of the written time steps, including their pyramid levels.
+void FlushOutputs(vispro::AsyncWriter& writer, TimeSeriesManifest& manifest, const std::string& field, int firstTimeStep, int endTimeStep) {
+	writer.Flush();
+	for (int time = firstTimeStep; time < endTimeStep; ++time)
+		for (int level = 0; level < pyramid_levels; ++level)
+			manifest.Update(TimeSeriesManifest::GetLevelName(field, level), time);
+}
+
+void ComputePyramid(const std::string& basePath) {
+	TimeSeriesManifest manifest(basePath);
+	// writes the coarse levels of all existing fields, keeping their storage type
+	for (const std::string& field : TimeSeriesManifest::GetFieldNames()) {
+		for (int time = 0; time < manifest.GetNumTimeSteps(); ++time) {
+			const vispro::AmiraReader::Header* header = manifest.FindHeader(field, time);
+			if (!header) continue;
+			const vispro::AmiraReader::Header fieldHeader = *header;
+			vtkSmartPointer<vtkImageData> imageData = manifest.ReadFieldMapped(field, time, field.c_str());
+			if (!imageData) continue;
+			std::vector<vtkSmartPointer<vtkImageData>> levels = vispro::Pyramid::Build(imageData, vispro::Pyramid::EFilter::Box, pyramid_levels);
+			for (int level = 1; level < pyramid_levels; ++level) {
+				const std::string levelName = TimeSeriesManifest::GetLevelName(field, level);
+				vispro::AmiraWriter::WriteScalarField((basePath + TimeSeriesManifest::GetFileName(levelName, time)).c_str(), field.c_str(), levels[level - 1],
+					fieldHeader.Storage, fieldHeader.Scale);
+				manifest.Update(levelName, time);
+			}
+			std::cout << "\rPyramid " << field << ": " << (time + 1) << " / " << manifest.GetNumTimeSteps();
+		}
+		std::cout << std::endl;
 	}
 }
 
 void ComputeMagnitude(const std::string& basePath) {
+	TimeSeriesManifest manifest(basePath);
+	vispro::AsyncWriter writer;
+	writer.SetPyramid(pyramid_levels);
 	// for each time step
-	for (int time = 0; time < num_time_steps; ++time) {
-		char filenameIn[256];
-		char filenameOut[256];
-		sprintf(filenameIn, "halfcylinder-%.2f.am", time * 0.1);
-		sprintf(filenameOut, "halfcylinder-magnitude-%.2f.am", time * 0.1);
-		vispro::Magnitude::Compute((basePath + filenameIn).c_str(), (basePath + filenameOut).c_str());
-		std::cout << "\rMagnitude: " << (time + 1) << " / " << num_time_steps;
+	for (int time = 0; time < manifest.GetNumTimeSteps(); ++time) {
+		std::string filenameIn = TimeSeriesManifest::GetFileName("velocity", time);
+		std::string filenameOut = TimeSeriesManifest::GetFileName("magnitude", time);
+		vispro::Magnitude::Compute((basePath + filenameIn).c_str(), (basePath + filenameOut).c_str(), derived_storage, derived_error_bound, &writer);
+		std::cout << "\rMagnitude: " << (time + 1) << " / " << manifest.GetNumTimeSteps();
 	}
+	FlushOutputs(writer, manifest, "magnitude", 0, manifest.GetNumTimeSteps());
 }
 
 void ComputeVorticity(const std::string& basePath) {
+	TimeSeriesManifest manifest(basePath);
+	vispro::AsyncWriter writer;
+	writer.SetPyramid(pyramid_levels);
 	// for each time step
-	for (int time = 0; time < num_time_steps; ++time) {
-		char filenameIn[256];
-		char filenameOut[256];
-		sprintf(filenameIn, "halfcylinder-%.2f.am", time * 0.1);
-		sprintf(filenameOut, "halfcylinder-vorticity-%.2f.am", time * 0.1);
-		vispro::Vorticity::Compute((basePath + filenameIn).c_str(), (basePath + filenameOut).c_str());
-		std::cout << "\rVorticity: " << (time + 1) << " / " << num_time_steps;
+	for (int time = 0; time < manifest.GetNumTimeSteps(); ++time) {
+		std::string filenameIn = TimeSeriesManifest::GetFileName("velocity", time);
+		std::string filenameOut = TimeSeriesManifest::GetFileName("vorticity", time);
+		vispro::Vorticity::Compute((basePath + filenameIn).c_str(), (basePath + filenameOut).c_str(), derived_storage, derived_error_bound, &writer);
+		std::cout << "\rVorticity: " << (time + 1) << " / " << manifest.GetNumTimeSteps();
 	}
+	FlushOutputs(writer, manifest, "vorticity", 0, manifest.GetNumTimeSteps());
 }
 
 void ComputeParticles(const std::string& basePath) {
 	Eigen::AlignedBox3d seeds(Eigen::Vector3d(-0.5, -0.5, -0.5), Eigen::Vector3d(0.5, 0.5, 0.5));
-	vispro::Particles::Compute(basePath.c_str(), seeds,
+	auto start = std::chrono::high_resolution_clock::now();
+	const double ioWaitSeconds = vispro::Particles::Compute(basePath.c_str(), seeds,
 		0.05,
-		20);
+		20,
+		false,
+		tracer_region_padding,
+		0,			// sort interval
+		tracer_num_threads);
+	std::cout << "Particles: " << std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count() << " s, "
+		<< ioWaitSeconds << " s waiting for reads" << std::endl;
 }
 
 void ComputeStreaklines(const std::string& basePath) {
 	Eigen::AlignedBox3d seeds(Eigen::Vector3d(-0.5, -0.5, -0.5), Eigen::Vector3d(0.5, 0.5, 0.5));
 	vispro::Streaklines::Compute(basePath.c_str(), seeds,
 		0.05,
-		20);
+		20,
+		false,
+		tracer_region_padding,
+		tracer_num_threads);
 }
 
 void ComputeFeatureFlow(const std::string& basePath) {
-	for (int time = 0; time < num_time_steps; ++time) {
-		char filenameIn1[256];
-		char filenameIn2[256];
-		char filenameIn3[256];
-		char filenameOut[256];
-		sprintf(filenameIn1, "halfcylinder-%.2f.am", std::max(0, time - 1) * 0.1);
-		sprintf(filenameIn2, "halfcylinder-%.2f.am", time * 0.1);
-		sprintf(filenameIn3, "halfcylinder-%.2f.am", std::min(time + 1, num_time_steps - 1) * 0.1);
-		sprintf(filenameOut, "halfcylinder-featureflow-%.2f.am", time * 0.1);
+	TimeSeriesManifest manifest(basePath);
+	vispro::AsyncWriter writer;
+	writer.SetPyramid(pyramid_levels);
+	const int numTimeSteps = manifest.GetNumTimeSteps();
+	for (int time = 0; time < numTimeSteps; ++time) {
+		std::string filenameIn1 = TimeSeriesManifest::GetFileName("velocity", std::max(0, time - 1));
+		std::string filenameIn2 = TimeSeriesManifest::GetFileName("velocity", time);
+		std::string filenameIn3 = TimeSeriesManifest::GetFileName("velocity", std::min(time + 1, numTimeSteps - 1));
+		std::string filenameOut = TimeSeriesManifest::GetFileName("featureflow", time);
 		int deltaSteps = 2;
-		if (time == 0 || time == num_time_steps - 1)
+		if (time == 0 || time == numTimeSteps - 1)
 			deltaSteps = 1;
 
 		vispro::FeatureFlow::Compute(
@@ -81,48 +197,359 @@ void ComputeFeatureFlow(const std::string& basePath) {
 			(basePath + filenameIn2).c_str(),
 			(basePath + filenameIn3).c_str(),
 			deltaSteps,
-			(basePath + filenameOut).c_str());
+			(basePath + filenameOut).c_str(),
+			&writer);
 
-		std::cout << "\rFeature Flow: " << (time + 1) << " / " << num_time_steps;
+		std::cout << "\rFeature Flow: " << (time + 1) << " / " << numTimeSteps;
 	}
+	FlushOutputs(writer, manifest, "featureflow", 0, numTimeSteps);
 	std::cout << std::endl;
 }
 
 void ComputeLIC(const std::string& basePath) {
+	TimeSeriesManifest manifest(basePath);
+	vispro::AsyncWriter writer;
+	writer.SetPyramid(pyramid_levels);
 	// for each time step
-	for (int time = 0; time < num_time_steps; ++time) {
-		char filenameIn[256];
-		char filenameOut[256];
-		sprintf(filenameIn, "halfcylinder-%.2f.am", time * 0.1);
-		sprintf(filenameOut, "halfcylinder-lic-%.2f.am", time * 0.1);
+	for (int time = 0; time < manifest.GetNumTimeSteps(); ++time) {
+		std::string filenameIn = TimeSeriesManifest::GetFileName("velocity", time);
+		std::string filenameOut = TimeSeriesManifest::GetFileName("lic", time);
 		vispro::LineIntegralConvolution::Compute((basePath + filenameIn).c_str(), (basePath + filenameOut).c_str(),
 			0.01,	// integration step size
-			20);	// number of integration steps
-		std::cout << "\rLIC: " << (time + 1) << " / " << num_time_steps;
+			20,		// number of integration steps
+			derived_storage,
+			derived_error_bound,
+			&writer);
+		std::cout << "\rLIC: " << (time + 1) << " / " << manifest.GetNumTimeSteps();
 	}
+	FlushOutputs(writer, manifest, "lic", 0, manifest.GetNumTimeSteps());
 }
 
 void ComputeFTLE(const std::string& basePath) {
+	TimeSeriesManifest manifest(basePath);
+	vispro::AsyncWriter writer;
+	writer.SetPyramid(pyramid_levels);
+	const Eigen::Vector3i resolution(640, 240, 80);
+	std::unique_ptr<vispro::FlowMapCache> flowMaps;
+	if (ftle_flow_map_scale > 0) {
+		flowMaps = std::make_unique<vispro::FlowMapCache>(basePath, (resolution.cast<double>() * ftle_flow_map_scale).cast<int>());
+		flowMaps->GetTracer().SetNumThreads(tracer_num_threads);
+	}
+	auto start = std::chrono::high_resolution_clock::now();
+	double ioWaitSeconds = 0;
 	// for each time step
 	for (int time = 50; time < 60; ++time)
 	{
-		char filenameOut[256];
-		sprintf(filenameOut, "halfcylinder-ftle-%.2f.am", time * 0.1);
-		vispro::FTLE::Compute(basePath.c_str(), (basePath + filenameOut).c_str(),
-			Eigen::Vector3i(640, 240, 80),		// grid resolution
+		std::string filenameOut = TimeSeriesManifest::GetFileName("ftle", time);
+		ioWaitSeconds += vispro::FTLE::Compute(basePath.c_str(), (basePath + filenameOut).c_str(),
+			resolution,		// grid resolution
 			-0.01,		// integration step size
 			time * 0.1,	// start time 
-			2.0);		// integration duration
-		std::cout << "\rFTLE: " << (time + 1) << " / " << num_time_steps;
+			2.0,		// integration duration
+			false,		// sample bricked velocity
+			derived_storage,
+			derived_error_bound,
+			&writer,
+			0,			// sort interval
+			flowMaps.get(),
+			tracer_num_threads);
+		std::cout << "\rFTLE: " << (time + 1) << " / " << manifest.GetNumTimeSteps();
+	}
+	FlushOutputs(writer, manifest, "ftle", 50, 60);
+	std::cout << std::endl << "FTLE: " << std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count() << " s, "
+		<< ioWaitSeconds << " s waiting for reads";
+	const vispro::SliceCache& cache = vispro::SliceCache::GetInstance();
+	std::cout << std::endl << "Slice cache: " << cache.GetNumHits() << " hits, " << cache.GetNumMisses() << " misses" << std::endl;
+}
+
+// Compresses the derived scalar fields with the error-bounded codec and reports the compression ratio, the decoding throughput and the largest error.
+void BenchmarkCompression(const std::string& basePath) {
+	TimeSeriesManifest manifest(basePath);
+	for (const std::string field : { "vorticity", "magnitude", "ftle" }) {
+		int64_t rawBytes = 0, compressedBytes = 0;
+		double decodeSeconds = 0, maxError = 0;
+		std::vector<char> compressed;
+		std::vector<float> decoded;
+		for (int time = 0; time < manifest.GetNumTimeSteps(); ++time) {
+			if (!manifest.Find(field, time)) continue;
+			vtkSmartPointer<vtkImageData> imageData = manifest.ReadField(field, time, field.c_str());
+			if (!imageData) continue;
+			vtkFloatArray* values = dynamic_cast<vtkFloatArray*>(imageData->GetPointData()->GetArray(0));
+			const Eigen::Vector3i resolution(imageData->GetDimensions());
+			const int64_t numValues = values->GetNumberOfValues();
+			vispro::ErrorBoundedCodec::Encode(values->GetPointer(0), resolution, derived_error_bound, compressed);
+
+			decoded.resize(numValues);
+			auto start = std::chrono::high_resolution_clock::now();
+			vispro::ErrorBoundedCodec::Decode(compressed.data(), (int64_t)compressed.size(), resolution, decoded.data());
+			decodeSeconds += std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+
+			for (int64_t i = 0; i < numValues; ++i)
+				maxError = std::max(maxError, (double)std::abs(decoded[i] - values->GetValue(i)));
+			rawBytes += numValues * (int64_t)sizeof(float);
+			compressedBytes += (int64_t)compressed.size();
+			std::cout << "\rCompression " << field << ": " << (time + 1) << " / " << manifest.GetNumTimeSteps();
+		}
+		if (compressedBytes == 0) continue;
+		std::cout << std::endl << field << ": ratio " << (double)rawBytes / compressedBytes
+			<< ", decode " << rawBytes / decodeSeconds / 1e9 << " GB/s"
+			<< ", max error " << maxError << " (bound " << derived_error_bound << ")" << std::endl;
+	}
+}
+
+// Traces a grid of particles with each memory layout of the velocity fields and reports the time of the conversions and the advection,
+// and how much of it was spent waiting for reads.
+// The layouts store the same values, so the traced positions have to agree exactly.
+void BenchmarkLayouts(const std::string& basePath) {
+	using Layout = vispro::FieldView::ELayout;
+	const std::pair<Layout, const char*> layouts[] = { { Layout::Linear, "linear" }, { Layout::Morton, "morton" }, { Layout::Bricked, "bricked" } };
+	std::vector<Eigen::Vector3d> reference;
+	for (const auto& layout : layouts) {
+		vispro::UnsteadyTracer tracer(basePath);
+		tracer.SetNumThreads(tracer_num_threads);
+		tracer.SetLayout(layout.first);
+		const Eigen::AlignedBox3d& bounds = tracer.GetBounds();
+		const Eigen::Vector3i seeds(160, 60, 20);
+		std::vector<Eigen::Vector3d> particles;
+		for (int z = 0; z < seeds.z(); ++z)
+			for (int y = 0; y < seeds.y(); ++y)
+				for (int x = 0; x < seeds.x(); ++x)
+					particles.push_back(bounds.min() + bounds.sizes().cwiseProduct(Eigen::Vector3d(x + 0.5, y + 0.5, z + 0.5).cwiseQuotient(seeds.cast<double>())));
+		std::vector<int> inDomain(particles.size(), 1);
+
+		auto start = std::chrono::high_resolution_clock::now();
+		tracer.Flowmap(particles, inDomain, 0.01, 5.0, 2.0);
+		const double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+
+		double maxDifference = 0;
+		if (reference.empty()) reference = particles;
+		for (size_t i = 0; i < particles.size(); ++i)
+			maxDifference = std::max(maxDifference, (particles[i] - reference[i]).norm());
+		std::cout << layout.second << ": " << seconds << " s (I/O wait " << tracer.GetIoWaitSeconds() << " s), " << particles.size() / seconds / 1e6 << " M particles/s"
+			<< ", max difference to linear " << maxDifference << std::endl;
+	}
+}
+
+// Traces a grid of particles with each integration method and several step sizes, and reports the cost per particle step without
+// the time spent waiting for reads, and the distance to a reference that is traced with RK4 and a small step size. The adaptive
+// Dormand-Prince method is traced with several tolerances, its cost is reported per particle, since the number of steps varies.
+void BenchmarkIntegrators(const std::string& basePath) {
+	const double startTime = 5.0, duration = 1.0;
+	auto trace = [&basePath, startTime, duration](vispro::Integrator::EMethod method, double stepSize, double tolerance, std::vector<Eigen::Vector3d>& particles, std::vector<int>& inDomain) {
+		vispro::UnsteadyTracer tracer(basePath);
+		tracer.SetNumThreads(tracer_num_threads);
+		tracer.SetIntegrator(method);
+		tracer.SetStepControl(tolerance, 1e-4, 0.1);
+		const Eigen::AlignedBox3d& bounds = tracer.GetBounds();
+		const Eigen::Vector3i seeds(64, 24, 8);
+		particles.clear();
+		for (int z = 0; z < seeds.z(); ++z)
+			for (int y = 0; y < seeds.y(); ++y)
+				for (int x = 0; x < seeds.x(); ++x)
+					particles.push_back(bounds.min() + bounds.sizes().cwiseProduct(Eigen::Vector3d(x + 0.5, y + 0.5, z + 0.5).cwiseQuotient(seeds.cast<double>())));
+		inDomain.assign(particles.size(), 1);
+		auto start = std::chrono::high_resolution_clock::now();
+		tracer.Flowmap(particles, inDomain, stepSize, startTime, duration);
+		return std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count() - tracer.GetIoWaitSeconds();
+	};
+
+	std::vector<Eigen::Vector3d> reference, particles;
+	std::vector<int> referenceInDomain, inDomain;
+	trace(vispro::Integrator::EMethod::RK4, 0.001, 0, reference, referenceInDomain);
+	auto printError = [&]() {
+		double maxError = 0, sumError = 0;
+		int64_t numCompared = 0;
+		for (size_t i = 0; i < particles.size(); ++i) {
+			if (!inDomain[i] || !referenceInDomain[i]) continue;
+			const double error = (particles[i] - reference[i]).norm();
+			maxError = std::max(maxError, error);
+			sumError += error;
+			++numCompared;
+		}
+		std::cout << ", mean error " << sumError / std::max<int64_t>(1, numCompared) << ", max error " << maxError << std::endl;
+	};
+	for (int method = 0; method < vispro::Integrator::NumMethods; ++method) {
+		for (double stepSize : { 0.1, 0.05, 0.025, 0.0125, 0.00625 }) {
+			const double seconds = trace((vispro::Integrator::EMethod)method, stepSize, 0, particles, inDomain);
+			const double numSteps = std::ceil(duration / stepSize) * particles.size();
+			std::cout << vispro::Integrator::GetName((vispro::Integrator::EMethod)method) << ", step size " << stepSize
+				<< ": " << seconds / numSteps * 1e9 << " ns per step";
+			printError();
+		}
+	}
+	for (double tolerance : { 1e-3, 1e-4, 1e-5, 1e-6 }) {
+		const double seconds = trace(vispro::Integrator::EMethod::DormandPrince, 0.1, tolerance, particles, inDomain);
+		std::cout << "adaptive DormandPrince, tolerance " << tolerance << ": " << seconds / particles.size() * 1e9 << " ns per particle";
+		printError();
+	}
+}
+
+// Counts the cache misses of the process on Linux. Threads that already exist are not counted, so the counter has to be opened before
+// the first parallel region. Reads -1 if the counter is not available, e.g., on Windows, which has no unprivileged hardware counters,
+// so the benchmarks only report the throughput there. The command line tool builds on Linux to measure them.
+class CacheMissCounter {
+public:
+	CacheMissCounter() : mFd(-1) {
+#ifdef __linux__
+		perf_event_attr attr = {};
+		attr.size = sizeof(attr);
+		attr.type = PERF_TYPE_HARDWARE;
+		attr.config = PERF_COUNT_HW_CACHE_MISSES;
+		attr.inherit = 1;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		mFd = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+#endif
+	}
+	~CacheMissCounter() {
+#ifdef __linux__
+		if (mFd >= 0) close(mFd);
+#endif
+	}
+	int64_t Read() const {
+		int64_t count = -1;
+#ifdef __linux__
+		if (mFd < 0 || read(mFd, &count, sizeof(count)) != sizeof(count)) count = -1;
+#endif
+		return count;
+	}
+private:
+	int mFd;
+};
+
+// Traces the particles of the FTLE and the Particles workloads with several intervals of the spatial sorting, and reports the time
+// without the time spent waiting for reads, and the cache misses. Sorting does not change the traced positions.
+void BenchmarkSorting(const std::string& basePath) {
+	CacheMissCounter counter;
+	auto report = [&counter](const char* workload, int sortInterval, double seconds, int64_t missesBefore, double numParticleSteps) {
+		const int64_t misses = counter.Read();
+		std::cout << workload << ", sort interval " << sortInterval << ": " << seconds << " s, " << numParticleSteps / seconds / 1e6 << " M particle steps/s";
+		if (misses >= 0) std::cout << ", " << (misses - missesBefore) / numParticleSteps << " cache misses per particle step";
+		std::cout << std::endl;
+	};
+
+	// the FTLE workload traces a grid backwards, the sort interval is in integration steps
+	std::vector<Eigen::Vector3d> reference;
+	for (int sortInterval : { 0, 10, 50 }) {
+		vispro::UnsteadyTracer tracer(basePath);
+		tracer.SetNumThreads(tracer_num_threads);
+		tracer.SetSortInterval(sortInterval);
+		const Eigen::AlignedBox3d& bounds = tracer.GetBounds();
+		const Eigen::Vector3i seeds(320, 120, 40);
+		vispro::ParticleSet particles;
+		for (int z = 0; z < seeds.z(); ++z)
+			for (int y = 0; y < seeds.y(); ++y)
+				for (int x = 0; x < seeds.x(); ++x)
+					particles.Add(bounds.min() + bounds.sizes().cwiseProduct(Eigen::Vector3d(x, y, z).cwiseQuotient((seeds - Eigen::Vector3i(1, 1, 1)).cast<double>())));
+
+		const int64_t missesBefore = counter.Read();
+		auto start = std::chrono::high_resolution_clock::now();
+		tracer.Flowmap(particles, -0.01, 5.0, 2.0);
+		const double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count() - tracer.GetIoWaitSeconds();
+		report("FTLE", sortInterval, seconds, missesBefore, 200. * particles.GetSize());
+
+		double maxDifference = 0;
+		if (reference.empty())
+			for (int64_t i = 0; i < particles.GetSize(); ++i) reference.push_back(particles.GetPosition(i));
+		for (int64_t i = 0; i < particles.GetSize(); ++i)
+			maxDifference = std::max(maxDifference, (particles.GetPosition(i) - reference[i]).norm());
+		std::cout << "max difference to unsorted " << maxDifference << std::endl;
+	}
+
+	// the Particles workload releases particles in a box in every time step, the sort interval is in time steps
+	for (int sortInterval : { 0, 1, 5 }) {
+		vispro::UnsteadyTracer tracer(basePath);
+		tracer.SetNumThreads(tracer_num_threads);
+		tracer.SetRegionPadding(tracer_region_padding);
+		const vispro::UnsteadyTracer::TimeSeriesDescription& desc = tracer.GetDesc();
+		const Eigen::AlignedBox3d seedBox = Eigen::AlignedBox3d(Eigen::Vector3d(-0.5, -0.5, -0.5), Eigen::Vector3d(0.5, 0.5, 0.5)).intersection(tracer.GetBounds());
+		vispro::ParticleSet particles;
+		std::vector<int64_t> order;
+		srand(0);
+		double numParticleSteps = 0, seconds = 0;
+		const int64_t missesBefore = counter.Read();
+		for (int iTime = 0; iTime < 40; ++iTime) {
+			particles.RemoveInactive();
+			for (int ip = 0; ip < 20000; ++ip)
+				particles.Add(seedBox.sample());
+			auto start = std::chrono::high_resolution_clock::now();
+			if (sortInterval > 0 && iTime % sortInterval == 0) {
+				particles.GetMortonOrder(tracer.GetBounds(), order);
+				particles.Permute(order);
+			}
+			numParticleSteps += particles.GetSize() * std::ceil(desc.TemporalSpacing / 0.05);
+			tracer.Flowmap(particles, 0.05, desc.StartTime + (50 + iTime) * desc.TemporalSpacing, desc.TemporalSpacing);
+			seconds += std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+		}
+		report("Particles", sortInterval, seconds - tracer.GetIoWaitSeconds(), missesBefore, numParticleSteps);
+	}
+}
+
+// Traces the FTLE grid for consecutive start times once from scratch and once composed from cached flow maps of several resolutions,
+// and reports the time and the distance of the composed positions to the traced ones.
+void BenchmarkFlowMaps(const std::string& basePath) {
+	const Eigen::Vector3i seeds(320, 120, 40);
+	const int numStartTimes = 10;
+	auto trace = [&](vispro::FlowMapCache* flowMaps, std::vector<std::vector<Eigen::Vector3d>>& positions, std::vector<std::vector<char>>& active) {
+		vispro::UnsteadyTracer tracer(basePath);
+		tracer.SetNumThreads(tracer_num_threads);
+		const Eigen::AlignedBox3d& bounds = tracer.GetBounds();
+		const vispro::UnsteadyTracer::TimeSeriesDescription& desc = tracer.GetDesc();
+		positions.resize(numStartTimes);
+		active.resize(numStartTimes);
+		auto start = std::chrono::high_resolution_clock::now();
+		for (int i = 0; i < numStartTimes; ++i) {
+			vispro::ParticleSet particles;
+			for (int z = 0; z < seeds.z(); ++z)
+				for (int y = 0; y < seeds.y(); ++y)
+					for (int x = 0; x < seeds.x(); ++x)
+						particles.Add(bounds.min() + bounds.sizes().cwiseProduct(Eigen::Vector3d(x, y, z).cwiseQuotient((seeds - Eigen::Vector3i(1, 1, 1)).cast<double>())));
+			const double startTime = desc.StartTime + (50 + i) * desc.TemporalSpacing;
+			if (flowMaps) flowMaps->Flowmap(particles, -0.01, startTime, 2.0);
+			else tracer.Flowmap(particles, -0.01, startTime, 2.0);
+			positions[i].resize(particles.GetSize());
+			active[i].resize(particles.GetSize());
+			for (int64_t p = 0; p < particles.GetSize(); ++p) {
+				positions[i][p] = particles.GetPosition(p);
+				active[i][p] = particles.IsActive(p);
+			}
+		}
+		return std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+	};
+
+	std::vector<std::vector<Eigen::Vector3d>> reference;
+	std::vector<std::vector<char>> referenceActive;
+	std::cout << "traced: " << trace(nullptr, reference, referenceActive) << " s" << std::endl;
+	for (double scale : { 0.25, 0.5, 1.0 }) {
+		vispro::FlowMapCache flowMaps(basePath, (seeds.cast<double>() * scale).cast<int>());
+		flowMaps.GetTracer().SetNumThreads(tracer_num_threads);
+		std::vector<std::vector<Eigen::Vector3d>> positions;
+		std::vector<std::vector<char>> active;
+		const double seconds = trace(&flowMaps, positions, active);
+		double maxDistance = 0, sumDistance = 0;
+		int64_t numCompared = 0, numLost = 0;
+		for (int i = 0; i < numStartTimes; ++i)
+			for (size_t p = 0; p < positions[i].size(); ++p) {
+				if (!referenceActive[i][p]) continue;
+				if (!active[i][p]) { ++numLost; continue; }
+				const double distance = (positions[i][p] - reference[i][p]).norm();
+				maxDistance = std::max(maxDistance, distance);
+				sumDistance += distance;
+				++numCompared;
+			}
+		std::cout << "composed, scale " << scale << ": " << seconds << " s, " << flowMaps.GetNumIntegrated() << " flow maps, mean distance " << sumDistance / std::max<int64_t>(1, numCompared)
+			<< ", max distance " << maxDistance << ", " << numLost << " particles deactivated at the boundary" << std::endl;
 	}
 }
 
 int main(int argc, char* argv[])
 {
+#ifdef _WIN32
 	AllocConsole();
 	freopen("conin$", "r", stdin);
 	freopen("conout$", "w", stdout);
 	freopen("conout$", "w", stderr);
+#endif
 	printf("Debugging Window:\n");
 
 	if (argc < 2) {
@@ -130,9 +557,13 @@ int main(int argc, char* argv[])
 		// e.g., D:/halfcylinder3d-Re320_vti/
 		return -1;
 	}
+	vispro::SliceCache::GetInstance().SetBudget(slice_cache_budget);
 
 	//Computation
 	//ComputeVelocity(argv[1]);
+	//ComputeBricks(argv[1]);
+	//ComputePack(argv[1]);
+	//ComputePyramid(argv[1]);
 	//ComputeMagnitude(argv[1]);
 	//ComputeVorticity(argv[1]);
 	//ComputeParticles(argv[1]);
@@ -140,6 +571,11 @@ int main(int argc, char* argv[])
 	ComputeFeatureFlow(argv[1]);
 	//ComputeLIC(argv[1]);
 	//ComputeFTLE(argv[1]);
+	//BenchmarkCompression(argv[1]);
+	//BenchmarkLayouts(argv[1]);
+	//BenchmarkIntegrators(argv[1]);
+	//BenchmarkSorting(argv[1]);
+	//BenchmarkFlowMaps(argv[1]);
 
 
 	return 0;
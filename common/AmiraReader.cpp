@@ -1,5 +1,12 @@
 #include "AmiraReader.hpp"
+#include "ErrorBoundedCodec.hpp"
+#include "MappedFile.hpp"
+#include "RandomAccessFile.hpp"
 #include <fstream>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
 #include <vtkImageData.h>
 #include <vtkPointData.h>
 #include <vtkFloatArray.h>
@@ -12,58 +19,436 @@ namespace vispro
 		return buffer;
 	}
 
-	vtkSmartPointer<vtkImageData> AmiraReader::ReadField(const char* path, const char* fieldName)
-	{
-		// read the header
-		Eigen::AlignedBox3d bounds;
-		Eigen::Vector3i resolution;
-		Eigen::Vector3d spacing;
-		int numComponents;
-		if (!ReadHeader(path, bounds, resolution, spacing, numComponents)) return nullptr;
-		
-		// allocate output field
+	// We read the first 2k bytes into memory to parse the header.
+	// The fixed buffer size looks a bit like a hack, and it is one, but it gets the job done.
+	static void ReadHeaderBuffer(FILE* fp, char (&buffer)[2048]) {
+		size_t numRead = fread(buffer, sizeof(char), 2047, fp);
+		buffer[numRead] = '\0'; //The following string routines prefer null-terminated strings
+	}
+
+	// Creates the vtkImageData for the lattice in the header and attaches the (already sized) array to it.
+	static vtkSmartPointer<vtkImageData> CreateField(const AmiraReader::Header& header, vtkFloatArray* array, const char* fieldName) {
 		vtkNew<vtkImageData> field;
-		field->SetDimensions(resolution.data());
-		field->SetOrigin(bounds.min().data());
-		field->SetSpacing(spacing.data());
-		vtkNew<vtkFloatArray> mArray;
-		int64_t numPoints = (int64_t)field->GetDimensions()[0] * field->GetDimensions()[1] * field->GetDimensions()[2];
-		mArray->SetNumberOfComponents(numComponents);
-		mArray->SetNumberOfTuples(numPoints);
-		mArray->SetName(fieldName);
-		field->GetPointData()->AddArray(mArray);
+		field->SetDimensions(header.Resolution.data());
+		field->SetOrigin(header.Bounds.min().data());
+		field->SetSpacing(header.Spacing.data());
+		array->SetName(fieldName);
+		field->GetPointData()->AddArray(array);
 		// conditional field settings
-		if (numComponents ==1)
+		if (header.NumComponents == 1)
 			field->GetPointData()->SetActiveScalars(fieldName);
-		else 
+		else
 			field->GetPointData()->SetActiveVectors(fieldName);
+		return field;
+	}
+
+	// Mappings of all fields that were read with ReadFieldMapped, indexed by the pointer that was handed to VTK.
+	static std::mutex sMappingsMutex;
+	static std::unordered_map<void*, std::unique_ptr<MappedFile>> sMappings;
+
+	// Called by VTK when a mapped array is released. VTK does not own the memory, we only drop the mapping.
+	static void ReleaseMapping(void* data) {
+		std::lock_guard<std::mutex> lock(sMappingsMutex);
+		sMappings.erase(data);
+	}
+
+	// Reads the data section of an open file into an array.
+	static bool ReadData(FILE* fp, const AmiraReader::Header& header, vtkFloatArray* output) {
+		fseek(fp, (long)header.DataOffset, SEEK_SET);
+		const size_t numValues = output->GetNumberOfValues();
+		if (header.Storage == Quantization::EStorage::ErrorBounded) {
+			// the compressed stream is read in chunks and decoded straight into the output
+			if ((int64_t)numValues != (int64_t)header.Resolution.prod()) return false;
+			auto read = [fp, &header](void* buffer, int64_t size, int64_t offset) {
+				return fseek(fp, (long)(header.DataOffset + offset), SEEK_SET) == 0 && fread(buffer, 1, (size_t)size, fp) == (size_t)size;
+			};
+			return ErrorBoundedCodec::Decode(read, header.Resolution, output->GetPointer(0));
+		}
+		if (header.Storage == Quantization::EStorage::Float) {
+			const size_t actRead = fread((void*)output->GetPointer(0), sizeof(float), numValues, fp);
+			return numValues == actRead;
+		}
+		// compact storage types are read in one piece and decoded afterwards
+		const size_t valueSize = Quantization::GetSize(header.Storage);
+		std::vector<char> encoded(numValues * valueSize);
+		if (fread(encoded.data(), valueSize, numValues, fp) != numValues) return false;
+		Quantization::Decode(header.Storage, encoded.data(), numValues, header.Scale, header.Bias, output->GetPointer(0));
+		return true;
+	}
+
+	// Reads the data section of a field that is embedded at an offset of a larger file.
+	static bool ReadData(const RandomAccessFile& file, int64_t offset, const AmiraReader::Header& header, vtkFloatArray* output) {
+		const int64_t numValues = output->GetNumberOfValues();
+		const int64_t dataOffset = offset + header.DataOffset;
+		if (header.Storage == Quantization::EStorage::ErrorBounded) {
+			if (numValues != (int64_t)header.Resolution.prod()) return false;
+			auto read = [&file, dataOffset](void* buffer, int64_t size, int64_t offset) { return file.ReadAt(buffer, size, dataOffset + offset); };
+			return ErrorBoundedCodec::Decode(read, header.Resolution, output->GetPointer(0));
+		}
+		if (header.Storage == Quantization::EStorage::Float)
+			return file.ReadAt(output->GetPointer(0), numValues * (int64_t)sizeof(float), dataOffset);
+		const size_t valueSize = Quantization::GetSize(header.Storage);
+		std::vector<char> encoded(numValues * valueSize);
+		if (!file.ReadAt(encoded.data(), (int64_t)encoded.size(), dataOffset)) return false;
+		Quantization::Decode(header.Storage, encoded.data(), numValues, header.Scale, header.Bias, output->GetPointer(0));
+		return true;
+	}
+
+	// Allocates a float array for the lattice in the header.
+	static vtkSmartPointer<vtkFloatArray> AllocateArray(const AmiraReader::Header& header) {
+		vtkNew<vtkFloatArray> mArray;
+		mArray->SetNumberOfComponents(header.NumComponents);
+		mArray->SetNumberOfTuples((int64_t)header.Resolution.prod());
+		return mArray.Get();
+	}
+
+	// Allocates a field for the header and reads the data section of an open file into it.
+	static vtkSmartPointer<vtkImageData> ReadField(FILE* fp, const AmiraReader::Header& header, const char* fieldName) {
+		vtkNew<vtkFloatArray> mArray;
+		int64_t numPoints = (int64_t)header.Resolution.prod();
+		mArray->SetNumberOfComponents(header.NumComponents);
+		mArray->SetNumberOfTuples(numPoints);
+		vtkSmartPointer<vtkImageData> field = CreateField(header, mArray, fieldName);
+		if (!ReadData(fp, header, mArray)) return nullptr;
+		return field;
+	}
+
+	// Wraps the data section of a mapped file in a field. The field takes over the mapping.
+	static vtkSmartPointer<vtkImageData> MapField(std::unique_ptr<MappedFile> file, const AmiraReader::Header& header, const char* fieldName) {
+		// is the data section complete?
+		int64_t numValues = (int64_t)header.Resolution.prod() * header.NumComponents;
+		if (header.DataOffset + numValues * (int64_t)Quantization::GetSize(header.Storage) > file->GetSize()) return nullptr;
+
+		// compressed fields are decoded from the mapped pages
+		if (header.Storage == Quantization::EStorage::ErrorBounded) {
+			if (header.NumComponents != 1) return nullptr;
+			vtkSmartPointer<vtkFloatArray> mArray = AllocateArray(header);
+			if (!ErrorBoundedCodec::Decode(file->GetData() + header.DataOffset, file->GetSize() - header.DataOffset, header.Resolution, mArray->GetPointer(0))) return nullptr;
+			return CreateField(header, mArray, fieldName);
+		}
+
+		// compact storage types are decoded straight from the mapped pages, the mapping is released afterwards.
+		// The same holds for floats that are not aligned, since they cannot be handed to VTK.
+		if (header.Storage != Quantization::EStorage::Float || header.DataOffset % sizeof(float) != 0) {
+			vtkSmartPointer<vtkFloatArray> mArray = AllocateArray(header);
+			Quantization::Decode(header.Storage, file->GetData() + header.DataOffset, numValues, header.Scale, header.Bias, mArray->GetPointer(0));
+			return CreateField(header, mArray, fieldName);
+		}
+
+		// let the array point into the mapping
+		float* data = (float*)(file->GetData() + header.DataOffset);
+		{
+			std::lock_guard<std::mutex> lock(sMappingsMutex);
+			sMappings[data] = std::move(file);
+		}
+		vtkNew<vtkFloatArray> mArray;
+		mArray->SetNumberOfComponents(header.NumComponents);
+		mArray->SetArray(data, numValues, 0, vtkFloatArray::VTK_DATA_ARRAY_USER_DEFINED);
+		mArray->SetArrayFreeFunction(ReleaseMapping);
+		return CreateField(header, mArray, fieldName);
+	}
+
+	vtkSmartPointer<vtkImageData> AmiraReader::ReadField(const char* path, const char* fieldName)
+	{
+		FILE* fp = fopen(path, "rb");
+		if (!fp) return nullptr;
 
-		// read the data
-		if (!ReadField(path, mArray)) return nullptr;
+		// read the header and continue with the open file
+		char buffer[2048];
+		ReadHeaderBuffer(fp, buffer);
+		Header header;
+		vtkSmartPointer<vtkImageData> field;
+		if (ParseHeader(buffer, header))
+			field = vispro::ReadField(fp, header, fieldName);
+		fclose(fp);
 		return field;
 	}
 
+	vtkSmartPointer<vtkImageData> AmiraReader::ReadField(const char* path, const Header& header, const char* fieldName)
+	{
+		FILE* fp = fopen(path, "rb");
+		if (!fp) return nullptr;
+		vtkSmartPointer<vtkImageData> field = vispro::ReadField(fp, header, fieldName);
+		fclose(fp);
+		return field;
+	}
+
+	vtkSmartPointer<vtkImageData> AmiraReader::ReadField(const RandomAccessFile& file, int64_t offset, const Header& header, const char* fieldName)
+	{
+		vtkSmartPointer<vtkFloatArray> array = AllocateArray(header);
+		if (!ReadData(file, offset, header, array)) return nullptr;
+		return CreateField(header, array, fieldName);
+	}
+
+	bool AmiraReader::ReadField(const RandomAccessFile& file, int64_t offset, const Header& header, vtkFloatArray* output)
+	{
+		return ReadData(file, offset, header, output);
+	}
+
+	Eigen::AlignedBox3i AmiraReader::GetIndexRegion(const Header& header, const Eigen::AlignedBox3d& box)
+	{
+		Eigen::AlignedBox3i region;
+		if (box.isEmpty() || !header.Bounds.intersects(box)) return region;	// empty
+		Eigen::Vector3d relativeMin = (box.min() - header.Bounds.min()).cwiseQuotient(header.Spacing);
+		Eigen::Vector3d relativeMax = (box.max() - header.Bounds.min()).cwiseQuotient(header.Spacing);
+		for (int i = 0; i < 3; ++i) {
+			region.min()[i] = std::max(0, (int)std::floor(relativeMin[i]));
+			region.max()[i] = std::min(header.Resolution[i] - 1, (int)std::ceil(relativeMax[i]));
+		}
+		return region;
+	}
+
+	AmiraReader::Header AmiraReader::GetRegionHeader(const Header& header, const Eigen::AlignedBox3i& region)
+	{
+		Header regionHeader = header;
+		regionHeader.Resolution = region.sizes() + Eigen::Vector3i(1, 1, 1);
+		Eigen::Vector3d min = header.Bounds.min() + region.min().cast<double>().cwiseProduct(header.Spacing);
+		Eigen::Vector3d max = header.Bounds.min() + region.max().cast<double>().cwiseProduct(header.Spacing);
+		regionHeader.Bounds = Eigen::AlignedBox3d(min, max);
+		return regionHeader;
+	}
+
+	vtkSmartPointer<vtkImageData> AmiraReader::ReadFieldRegion(const char* path, const Header& header, const Eigen::AlignedBox3i& region, const char* fieldName)
+	{
+		if (region.isEmpty() || (region.min().array() < 0).any() || (region.max().array() >= header.Resolution.array()).any()) return nullptr;
+		RandomAccessFile file;
+		if (!file.Open(path)) return nullptr;
+		Header regionHeader = GetRegionHeader(header, region);
+		vtkSmartPointer<vtkFloatArray> array = AllocateArray(regionHeader);
+		if (!ReadFieldRegion(file, 0, header, region, array)) return nullptr;
+		return CreateField(regionHeader, array, fieldName);
+	}
+
+	vtkSmartPointer<vtkImageData> AmiraReader::ReadFieldRegion(const char* path, const Header& header, const Eigen::AlignedBox3d& box, const char* fieldName)
+	{
+		return ReadFieldRegion(path, header, GetIndexRegion(header, box), fieldName);
+	}
+
+	bool AmiraReader::ReadFieldRegion(const RandomAccessFile& file, int64_t offset, const Header& header, const Eigen::AlignedBox3i& region, vtkFloatArray* output)
+	{
+		const Eigen::Vector3i size = region.sizes() + Eigen::Vector3i(1, 1, 1);
+		const int64_t valueSize = (int64_t)Quantization::GetSize(header.Storage) * header.NumComponents;
+		const int64_t rowSize = size.x() * valueSize;
+		const int64_t numRows = (int64_t)size.y() * size.z();
+		const int64_t numValues = numRows * size.x() * header.NumComponents;
+		if (output->GetNumberOfValues() != numValues) return false;
+
+		// compressed fields are decoded slice by slice, only the blocks of the requested slices are read
+		if (header.Storage == Quantization::EStorage::ErrorBounded) {
+			if (header.NumComponents != 1) return false;
+			const int64_t sliceSize = (int64_t)header.Resolution.x() * header.Resolution.y();
+			std::vector<float> slab(sliceSize * size.z());
+			auto read = [&file, offset, &header](void* buffer, int64_t count, int64_t streamOffset) { return file.ReadAt(buffer, count, offset + header.DataOffset + streamOffset); };
+			if (!ErrorBoundedCodec::Decode(read, header.Resolution, region.min().z(), size.z(), slab.data())) return false;
+			float* target = output->GetPointer(0);
+			for (int64_t iRow = 0; iRow < numRows; ++iRow) {
+				const int64_t y = region.min().y() + iRow % size.y();
+				const int64_t z = iRow / size.y();
+				memcpy(target + iRow * size.x(), slab.data() + z * sliceSize + y * header.Resolution.x() + region.min().x(), size.x() * sizeof(float));
+			}
+			return true;
+		}
+
+		// floats go straight into the output, compact types are decoded afterwards
+		std::vector<char> encoded;
+		char* target = (char*)output->GetPointer(0);
+		if (header.Storage != Quantization::EStorage::Float) {
+			encoded.resize(numValues * Quantization::GetSize(header.Storage));
+			target = encoded.data();
+		}
+
+		// The rows of the box are strided in the file. Rows whose gap is small are gathered by one vectored read, which
+		// skips the gap. Larger gaps end the read, since reading them would cost more than another call.
+		const int64_t maxGap = (int64_t)64 << 10;
+		std::vector<RandomAccessFile::Segment> segments;
+		int64_t readOffset = 0, readEnd = 0;
+		for (int64_t iRow = 0; iRow < numRows; ++iRow) {
+			const int64_t y = region.min().y() + iRow % size.y();
+			const int64_t z = region.min().z() + iRow / size.y();
+			const int64_t rowOffset = offset + header.DataOffset + ((z * header.Resolution.y() + y) * header.Resolution.x() + region.min().x()) * valueSize;
+			if (!segments.empty() && rowOffset - readEnd > maxGap) {
+				if (!file.ReadAt(segments.data(), (int)segments.size(), readOffset)) return false;
+				segments.clear();
+			}
+			if (segments.empty()) readOffset = rowOffset;
+			else if (rowOffset > readEnd) segments.push_back(RandomAccessFile::Segment{ nullptr, rowOffset - readEnd });
+			segments.push_back(RandomAccessFile::Segment{ target + iRow * rowSize, rowSize });
+			readEnd = rowOffset + rowSize;
+		}
+		if (!segments.empty() && !file.ReadAt(segments.data(), (int)segments.size(), readOffset)) return false;
+
+		if (header.Storage != Quantization::EStorage::Float)
+			Quantization::Decode(header.Storage, encoded.data(), numValues, header.Scale, header.Bias, output->GetPointer(0));
+		return true;
+	}
+
+	vtkSmartPointer<vtkImageData> AmiraReader::AllocateField(const Header& header, const char* fieldName)
+	{
+		vtkSmartPointer<vtkFloatArray> array = AllocateArray(header);
+		return CreateField(header, array, fieldName);
+	}
+
+	bool AmiraReader::PlanReadRegion(const RandomAccessFile& file, int64_t offset, int64_t size, const Header& header, const Eigen::AlignedBox3i& region, vtkFloatArray* output,
+		std::vector<BatchReader::Request>& requests, BatchReader::FinishFunction& finish)
+	{
+		if (region.isEmpty() || (region.min().array() < 0).any() || (region.max().array() >= header.Resolution.array()).any()) return false;
+		const Eigen::Vector3i regionSize = region.sizes() + Eigen::Vector3i(1, 1, 1);
+		const int64_t numRows = (int64_t)regionSize.y() * regionSize.z();
+		const int64_t numValues = numRows * regionSize.x() * header.NumComponents;
+		if (output->GetNumberOfValues() != numValues) return false;
+
+		// The block sizes of compressed fields are only known from the stream itself, so the stream is read at once. Like
+		// ReadFieldRegion, only the blocks of the requested slices are decoded afterwards.
+		if (header.Storage == Quantization::EStorage::ErrorBounded) {
+			if (header.NumComponents != 1 || size <= header.DataOffset) return false;
+			auto stream = std::make_shared<std::vector<char>>((size_t)(size - header.DataOffset));
+			requests.push_back(BatchReader::Request{ &file, stream->data(), (int64_t)stream->size(), offset + header.DataOffset });
+			finish = [stream, header, region, regionSize, numRows, output]() {
+				if (regionSize == header.Resolution)
+					return ErrorBoundedCodec::Decode(stream->data(), (int64_t)stream->size(), header.Resolution, output->GetPointer(0));
+				const int64_t sliceSize = (int64_t)header.Resolution.x() * header.Resolution.y();
+				std::vector<float> slab(sliceSize * regionSize.z());
+				auto read = [&stream](void* buffer, int64_t count, int64_t streamOffset) {
+					if (streamOffset < 0 || count < 0 || streamOffset + count > (int64_t)stream->size()) return false;
+					memcpy(buffer, stream->data() + streamOffset, count);
+					return true;
+				};
+				if (!ErrorBoundedCodec::Decode(read, header.Resolution, region.min().z(), regionSize.z(), slab.data())) return false;
+				float* target = output->GetPointer(0);
+				for (int64_t iRow = 0; iRow < numRows; ++iRow) {
+					const int64_t y = region.min().y() + iRow % regionSize.y();
+					const int64_t z = iRow / regionSize.y();
+					memcpy(target + iRow * regionSize.x(), slab.data() + z * sliceSize + y * header.Resolution.x() + region.min().x(), regionSize.x() * sizeof(float));
+				}
+				return true;
+			};
+			return true;
+		}
+
+		// floats go straight into the output, compact types are decoded once they arrived
+		std::shared_ptr<std::vector<char>> encoded;
+		char* target = (char*)output->GetPointer(0);
+		if (header.Storage != Quantization::EStorage::Float) {
+			encoded = std::make_shared<std::vector<char>>((size_t)numValues * Quantization::GetSize(header.Storage));
+			target = encoded->data();
+			finish = [encoded, header, numValues, output]() {
+				Quantization::Decode(header.Storage, encoded->data(), numValues, header.Scale, header.Bias, output->GetPointer(0));
+				return true;
+			};
+		}
+		else finish = nullptr;
+
+		// rows that are adjacent in the file are merged into one read, which makes the full lattice a single read
+		const int64_t valueSize = (int64_t)Quantization::GetSize(header.Storage) * header.NumComponents;
+		const int64_t rowSize = regionSize.x() * valueSize;
+		const size_t firstRequest = requests.size();
+		for (int64_t iRow = 0; iRow < numRows; ++iRow) {
+			const int64_t y = region.min().y() + iRow % regionSize.y();
+			const int64_t z = region.min().z() + iRow / regionSize.y();
+			const int64_t rowOffset = offset + header.DataOffset + ((z * header.Resolution.y() + y) * header.Resolution.x() + region.min().x()) * valueSize;
+			if (requests.size() > firstRequest && requests.back().Offset + requests.back().Size == rowOffset)
+				requests.back().Size += rowSize;
+			else requests.push_back(BatchReader::Request{ &file, target + iRow * rowSize, rowSize, rowOffset });
+		}
+		return true;
+	}
+
+	vtkSmartPointer<vtkImageData> AmiraReader::ReadFieldMapped(std::unique_ptr<MappedFile> file, const Header& header, const char* fieldName)
+	{
+		return MapField(std::move(file), header, fieldName);
+	}
+
+	vtkSmartPointer<vtkImageData> AmiraReader::ReadFieldMapped(const char* path, const char* fieldName)
+	{
+		std::unique_ptr<MappedFile> file(new MappedFile());
+		if (!file->Open(path)) return nullptr;
+
+		// parse the header straight from the mapped pages
+		char buffer[2048];
+		size_t headerSize = (size_t)std::min(file->GetSize(), (int64_t)2047);
+		memcpy(buffer, file->GetData(), headerSize);
+		buffer[headerSize] = '\0';
+		Header header;
+		if (!ParseHeader(buffer, header)) return nullptr;
+
+		// floats that are not aligned cannot be handed to VTK, so we fall back to a copy
+		if (header.Storage == Quantization::EStorage::Float && header.DataOffset % sizeof(float) != 0) return ReadField(path, header, fieldName);
+		return MapField(std::move(file), header, fieldName);
+	}
+
+	vtkSmartPointer<vtkImageData> AmiraReader::ReadFieldMapped(const char* path, const Header& header, const char* fieldName)
+	{
+		if (header.Storage == Quantization::EStorage::Float && header.DataOffset % sizeof(float) != 0) return ReadField(path, header, fieldName);
+		std::unique_ptr<MappedFile> file(new MappedFile());
+		if (!file->Open(path)) return nullptr;
+		return MapField(std::move(file), header, fieldName);
+	}
+
 	bool AmiraReader::ReadHeader(const char* path, Eigen::AlignedBox3d& bounds, Eigen::Vector3i& resolution, Eigen::Vector3d& spacing, int& numComponents)
+	{
+		Header header;
+		if (!ReadHeader(path, header)) return false;
+		bounds = header.Bounds;
+		resolution = header.Resolution;
+		spacing = header.Spacing;
+		numComponents = header.NumComponents;
+		return true;
+	}
+
+	bool AmiraReader::ReadHeader(const char* path, Header& header)
 	{
 		// get the path parameter
 		FILE* fp = fopen(path, "rb");
 		if (!fp) return false;
 
-		// We read the first 2k bytes into memory to parse the header.
-		// The fixed buffer size looks a bit like a hack, and it is one, but it gets the job done.
 		char buffer[2048];
-		fread(buffer, sizeof(char), 2047, fp);
-		buffer[2047] = '\0'; //The following string routines prefer null-terminated strings
+		ReadHeaderBuffer(fp, buffer);
+		fclose(fp);
+		return ParseHeader(buffer, header);
+	}
 
-		if (!strstr(buffer, "# AmiraMesh BINARY-LITTLE-ENDIAN 2.1")) {
-			fclose(fp);
-			return false;
+	bool AmiraReader::ReadField(const char* path, vtkFloatArray* output)
+	{
+		// get the path parameter
+		FILE* fp = fopen(path, "rb");
+		if (!fp) return false;
+
+		char buffer[2048];
+		ReadHeaderBuffer(fp, buffer);
+		Header header;
+		bool success = ParseHeader(buffer, header) && ReadData(fp, header, output);
+		fclose(fp);
+		return success;
+	}
+
+	bool AmiraReader::ReadField(const char* path, const Header& header, vtkFloatArray* output)
+	{
+		FILE* fp = fopen(path, "rb");
+		if (!fp) return false;
+		bool success = ReadData(fp, header, output);
+		fclose(fp);
+		return success;
+	}
+
+	const char* AmiraReader::GetTypeName(Quantization::EStorage storage)
+	{
+		switch (storage) {
+		case Quantization::EStorage::Half: return "half";
+		case Quantization::EStorage::UNorm16: return "ushort";
+		case Quantization::EStorage::UNorm8: return "byte";
+		default: return "float";
 		}
+	}
+
+	bool AmiraReader::ParseHeader(const char* buffer, Header& header)
+	{
+		if (!strstr(buffer, "# AmiraMesh BINARY-LITTLE-ENDIAN 2.1"))
+			return false;
 
 		// Find the Lattice definition, i.e., the dimensions of the uniform grid
 		int xDim(0), yDim(0), zDim(0);
 		if (sscanf(FindAndJump(buffer, "define Lattice"), "%d %d %d", &xDim, &yDim, &zDim) == 3)
-			resolution = Eigen::Vector3i(xDim, yDim, zDim);
+			header.Resolution = Eigen::Vector3i(xDim, yDim, zDim);
 
 		//Is it a uniform grid? We need this only for the sanity check below.
 		const bool bIsUniform = (strstr(buffer, "CoordType \"uniform\"") != NULL);
@@ -72,74 +457,66 @@ namespace vispro
 		float xmin(1.0f), ymin(1.0f), zmin(1.0f);
 		float xmax(-1.0f), ymax(-1.0f), zmax(-1.0f);
 		if (sscanf(FindAndJump(buffer, "BoundingBox"), "%g %g %g %g %g %g", &xmin, &xmax, &ymin, &ymax, &zmin, &zmax) == 6)
-			bounds = Eigen::AlignedBox3d(Eigen::Vector3d(xmin, ymin, zmin), Eigen::Vector3d(xmax, ymax, zmax));
+			header.Bounds = Eigen::AlignedBox3d(Eigen::Vector3d(xmin, ymin, zmin), Eigen::Vector3d(xmax, ymax, zmax));
 
-		//Type of the field: scalar, vector
-		numComponents = 0;
-		if (strstr(buffer, "Lattice { float Data }"))
-		{
-			// Scalar field
-			numComponents = 1;
-		}
-		else
+		//Type of the field: "Lattice { float Data }" is a scalar field, "Lattice { float[3] Data }" a vector field
+		header.NumComponents = 0;
+		char typeName[16];
+		const char* type = FindAndJump(buffer, "Lattice { ");
+		if (type == buffer || sscanf(type, "%15[a-z]", typeName) != 1)
+			return false;
+		const char* afterType = type + strlen(typeName);
+		if (*afterType == '[')
 		{
 			// A field with more than one component, i.e., a vector field
-			if (sscanf(FindAndJump(buffer, "Lattice { float["), "%d", &numComponents) != 1)
-			{
-				fclose(fp);
+			if (sscanf(afterType + 1, "%d", &header.NumComponents) != 1)
 				return false;
+		}
+		else header.NumComponents = 1;	// Scalar field
+
+		// Storage type of the values, normalized integers come with a scale and a bias
+		bool bKnownType = false;
+		const Quantization::EStorage storages[] = { Quantization::EStorage::Float, Quantization::EStorage::Half, Quantization::EStorage::UNorm16, Quantization::EStorage::UNorm8 };
+		for (Quantization::EStorage storage : storages) {
+			if (strcmp(typeName, GetTypeName(storage)) == 0) {
+				header.Storage = storage;
+				bKnownType = true;
 			}
 		}
+		if (!bKnownType)
+			return false;
+		header.Scale = 1.0f;
+		header.Bias = 0.0f;
+		if (strstr(buffer, "DataScale"))
+			sscanf(FindAndJump(buffer, "DataScale"), "%g", &header.Scale);
+		if (strstr(buffer, "DataBias"))
+			sscanf(FindAndJump(buffer, "DataBias"), "%g", &header.Bias);
+
+		// Compressed data sections are marked in the lattice definition, e.g., "Lattice { float Data } @1(VpErrorBounded,1234)"
+		if (header.Storage == Quantization::EStorage::Float && strstr(buffer, "@1(VpErrorBounded")) {
+			header.Storage = Quantization::EStorage::ErrorBounded;
+			header.Scale = 0.0f;
+			if (strstr(buffer, "ErrorBound "))
+				sscanf(FindAndJump(buffer, "ErrorBound "), "%g", &header.Scale);
+		}
 
 		// Sanity check
-		if (xDim <= 0 || yDim <= 0 || zDim <= 0 || xmin > xmax || ymin > ymax || zmin > zmax || !bIsUniform || numComponents <= 0) {
-			fclose(fp);
+		if (xDim <= 0 || yDim <= 0 || zDim <= 0 || xmin > xmax || ymin > ymax || zmin > zmax || !bIsUniform || header.NumComponents <= 0)
 			return false;
-		}
 
 		// compute spacing
-		spacing = Eigen::Vector3d(
-			(bounds.max()[0] - bounds.min()[0]) / (resolution[0] - 1.),
-			(bounds.max()[1] - bounds.min()[1]) / (resolution[1] - 1.),
-			(bounds.max()[2] - bounds.min()[2]) / (resolution[2] - 1.));
-		fclose(fp);
-		return true;
-	}
-
-	bool AmiraReader::ReadField(const char* path, vtkFloatArray* output)
-	{
-		// get the path parameter
-		FILE* fp = fopen(path, "rb");
-		if (!fp) return false;
+		header.Spacing = Eigen::Vector3d(
+			(header.Bounds.max()[0] - header.Bounds.min()[0]) / (header.Resolution[0] - 1.),
+			(header.Bounds.max()[1] - header.Bounds.min()[1]) / (header.Resolution[1] - 1.),
+			(header.Bounds.max()[2] - header.Bounds.min()[2]) / (header.Resolution[2] - 1.));
 
-		// We read the first 2k bytes into memory to parse the header.
-		// The fixed buffer size looks a bit like a hack, and it is one, but it gets the job done.
-		char buffer[2048];
-		fread(buffer, sizeof(char), 2047, fp);
-		buffer[2047] = '\0'; //The following string routines prefer null-terminated strings
-
-		// Find the beginning of the data section
-		const long idxStartData = (long)(strstr(buffer, "# Data section follows") - buffer);
-		if (idxStartData > 0)
-		{
-			// Set the file pointer to the beginning of "# Data section follows"
-			fseek(fp, idxStartData, SEEK_SET);
-			// Consume this line, which is "# Data section follows"
-			fgets(buffer, 2047, fp);
-			// Consume the next line, which is "@1"
-			fgets(buffer, 2047, fp);
-
-			// read the data
-			const size_t numValues = output->GetNumberOfValues();
-			const size_t actRead = fread((void*)output->GetPointer(0), sizeof(float), numValues, fp);
-			if (numValues != actRead) {
-				fclose(fp);
-				return false;
-			}
-			fclose(fp);
-			return true;
-		}
-		fclose(fp);
-		return false;
+		// Find the beginning of the data section: skip the line "# Data section follows" and the next one, which is "@1"
+		const char* dataSection = strstr(buffer, "# Data section follows");
+		if (!dataSection) return false;
+		const char* lineEnd = strchr(dataSection, '\n');
+		if (lineEnd) lineEnd = strchr(lineEnd + 1, '\n');
+		if (!lineEnd) return false;
+		header.DataOffset = (int64_t)(lineEnd + 1 - buffer);
+		return true;
 	}
 }
\ No newline at end of file
@@ -1,24 +1,88 @@
 #pragma once
 
+#include <memory>
 #include <vtkSmartPointer.h>
 #include <Eigen/Eigen>
+#include "Quantization.hpp"
+#include "BatchReader.hpp"
 
 class vtkImageData;
 class vtkFloatArray;
 
 namespace vispro
 {
+	class MappedFile;
+	class RandomAccessFile;
+
 	// Helper class for writing vtkImageData to the Amira format (*.am)
 	class AmiraReader
 	{
 	public:
+		// Everything that is known about a field after parsing the header of an amira file.
+		struct Header {
+			Eigen::AlignedBox3d Bounds;		// bounding box of the domain
+			Eigen::Vector3i Resolution;		// number of grid points per dimension
+			Eigen::Vector3d Spacing;		// distance between adjacent grid points
+			int NumComponents;				// number of values per grid point
+			Quantization::EStorage Storage;	// storage type of the values in the data section
+			float Scale;					// scale of normalized integer values
+			float Bias;						// bias of normalized integer values
+			int64_t DataOffset;				// byte offset of the first value in the data section
+		};
+
+		// Gets the name of a storage type in the lattice definition of the header, e.g., "float" or "ushort".
+		static const char* GetTypeName(Quantization::EStorage storage);
+
 		// Reads a field into a vtkImageData.
 		static vtkSmartPointer<vtkImageData> ReadField(const char* path, const char* fieldName);
+		// Reads a field with a known header into a vtkImageData. The header is not parsed again.
+		static vtkSmartPointer<vtkImageData> ReadField(const char* path, const Header& header, const char* fieldName);
+		// Maps a field into memory and wraps the data section in a vtkImageData without copying it. Pages are read on first access and the mapping is released together with the array.
+		// This requires floats whose data section starts at a multiple of 4 bytes, which AmiraWriter ensures. Other fields are read or decoded into a copy.
+		static vtkSmartPointer<vtkImageData> ReadFieldMapped(const char* path, const char* fieldName);
+		// Maps a field with a known header into memory. The header is not parsed again.
+		static vtkSmartPointer<vtkImageData> ReadFieldMapped(const char* path, const Header& header, const char* fieldName);
 
 		// Reads the bounding box and the resolution from an amira file.
 		static bool ReadHeader(const char* path, Eigen::AlignedBox3d& bounds, Eigen::Vector3i& resolution, Eigen::Vector3d& spacing, int& numComponents);
+		// Reads the full header from an amira file, including the location of the data section.
+		static bool ReadHeader(const char* path, Header& header);
 
 		// Reads a field into a pre-allocated vtkFloatArray. Note that it needs to have the right size allocated!
+		// Fields that are stored as half floats or normalized integers are decoded to floats.
 		static bool ReadField(const char* path, vtkFloatArray* output);
+		// Reads a field with a known header into a pre-allocated vtkFloatArray. The header is not parsed again.
+		static bool ReadField(const char* path, const Header& header, vtkFloatArray* output);
+
+		// Reads a field that is embedded in a larger file, e.g., a time step of a TimeSeriesContainer. The offset is the start of the embedded amira file.
+		static vtkSmartPointer<vtkImageData> ReadField(const RandomAccessFile& file, int64_t offset, const Header& header, const char* fieldName);
+		// Reads an embedded field into a pre-allocated vtkFloatArray.
+		static bool ReadField(const RandomAccessFile& file, int64_t offset, const Header& header, vtkFloatArray* output);
+		// Wraps an embedded field that was mapped by the caller. The mapping has to start at the embedded amira file and is released together with the array.
+		static vtkSmartPointer<vtkImageData> ReadFieldMapped(std::unique_ptr<MappedFile> file, const Header& header, const char* fieldName);
+
+		// Gets the grid points that cover a box in world space, i.e., the smallest index box that contains it, clamped to the lattice.
+		// The result is empty if the box does not overlap the domain.
+		static Eigen::AlignedBox3i GetIndexRegion(const Header& header, const Eigen::AlignedBox3d& box);
+		// Gets the header of the sub-lattice of an index box. The bounds start at the first grid point of the box.
+		static Header GetRegionHeader(const Header& header, const Eigen::AlignedBox3i& region);
+		// Reads the grid points in an index box (inclusive) into a vtkImageData whose origin is the first grid point of the box.
+		// Only the rows of the box are read, with few vectored reads. Returns nullptr if the box is empty or outside the lattice.
+		static vtkSmartPointer<vtkImageData> ReadFieldRegion(const char* path, const Header& header, const Eigen::AlignedBox3i& region, const char* fieldName);
+		// Reads the grid points that cover a box in world space (see GetIndexRegion).
+		static vtkSmartPointer<vtkImageData> ReadFieldRegion(const char* path, const Header& header, const Eigen::AlignedBox3d& box, const char* fieldName);
+		// Reads the grid points in an index box of an embedded field into a pre-allocated vtkFloatArray with the size of the box.
+		static bool ReadFieldRegion(const RandomAccessFile& file, int64_t offset, const Header& header, const Eigen::AlignedBox3i& region, vtkFloatArray* output);
+
+		// Allocates a vtkImageData with the lattice of a header and an uninitialized float array, e.g., as target of a batched read.
+		static vtkSmartPointer<vtkImageData> AllocateField(const Header& header, const char* fieldName);
+		// Plans the reads of the grid points in an index box of an embedded field into a pre-allocated vtkFloatArray with the size of the box.
+		// The size is the size of the embedded amira file. The reads are appended to the requests, and the finish function completes the array
+		// once they arrived, e.g., by decoding compact storage types. Compressed fields are read as a whole, but only the slices of the box are decoded. Returns false if the array does not fit.
+		static bool PlanReadRegion(const RandomAccessFile& file, int64_t offset, int64_t size, const Header& header, const Eigen::AlignedBox3i& region, vtkFloatArray* output,
+			std::vector<BatchReader::Request>& requests, BatchReader::FinishFunction& finish);
+
+		// Parses the header from the first bytes of an amira file. The buffer has to be null-terminated.
+		static bool ParseHeader(const char* buffer, Header& header);
 	};
 }
\ No newline at end of file
@@ -1,13 +1,63 @@
 #include "AmiraWriter.hpp"
+#include "AmiraReader.hpp"
+#include "CpuFeatures.hpp"
+#include "ErrorBoundedCodec.hpp"
+#include "RandomAccessFile.hpp"
+#include <algorithm>
 #include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <vector>
+#ifdef VISPRO_X86
+#include <immintrin.h>
+#endif
 #include <vtkImageData.h>
 #include <vtkPointData.h>
 #include <vtkFloatArray.h>
 
 namespace vispro
 {
-	void AmiraWriter::WriteScalarField(const char* path, const char* fieldName, vtkImageData* imageData)
-	{
+	// Number of grid points that are interleaved at once. The block and the three input ranges stay in the L2 cache.
+	static const int64_t InterleaveBlockSize = 16384;
+
+	// Interleaves three component arrays into (u, v, w) tuples.
+	static void Interleave(const float* u, const float* v, const float* w, int64_t count, float* output) {
+		int64_t i = 0;
+#ifdef VISPRO_X86
+		// four tuples at a time: the 12 floats are assembled from the three inputs with shuffles
+		for (; i + 4 <= count; i += 4) {
+			__m128 u4 = _mm_loadu_ps(u + i);
+			__m128 v4 = _mm_loadu_ps(v + i);
+			__m128 w4 = _mm_loadu_ps(w + i);
+			__m128 uvLo = _mm_unpacklo_ps(u4, v4);									// u0 v0 u1 v1
+			__m128 uvHi = _mm_unpackhi_ps(u4, v4);									// u2 v2 u3 v3
+			__m128 w0u1 = _mm_shuffle_ps(w4, uvLo, _MM_SHUFFLE(2, 2, 0, 0));		// w0 w0 u1 u1
+			__m128 v1w1 = _mm_shuffle_ps(uvLo, w4, _MM_SHUFFLE(1, 1, 3, 3));		// v1 v1 w1 w1
+			__m128 w2u3 = _mm_shuffle_ps(w4, uvHi, _MM_SHUFFLE(3, 2, 2, 2));		// w2 w2 u3 v3
+			__m128 v3w3 = _mm_shuffle_ps(uvHi, w4, _MM_SHUFFLE(3, 3, 3, 3));		// v3 v3 w3 w3
+			_mm_storeu_ps(output + 3 * i + 0, _mm_shuffle_ps(uvLo, w0u1, _MM_SHUFFLE(2, 0, 1, 0)));	// u0 v0 w0 u1
+			_mm_storeu_ps(output + 3 * i + 4, _mm_shuffle_ps(v1w1, uvHi, _MM_SHUFFLE(1, 0, 2, 0)));	// v1 w1 u2 v2
+			_mm_storeu_ps(output + 3 * i + 8, _mm_shuffle_ps(w2u3, v3w3, _MM_SHUFFLE(2, 0, 2, 0)));	// w2 u3 v3 w3
+		}
+#endif
+		for (; i < count; ++i) {
+			output[3 * i + 0] = u[i];
+			output[3 * i + 1] = v[i];
+			output[3 * i + 2] = w[i];
+		}
+	}
+
+	// Writes a header, whose text ends with the lattice definition, followed by the line that starts the data section. The header is
+	// padded with blank lines, so that the data section starts at a multiple of the size of a float. Otherwise the floats could not
+	// be mapped into memory and used in place (see AmiraReader::ReadFieldMapped).
+	static void WriteHeader(std::ostream& outStream, const std::string& header) {
+		static const std::string dataSection = "# Data section follows\n@1\n";
+		const size_t padding = (sizeof(float) - (header.size() + dataSection.size()) % sizeof(float)) % sizeof(float);
+		outStream << header << std::string(padding, '\n') << dataSection;
+	}
+
+	// Writes the header of a vector field.
+	static void WriteVectorHeader(std::ostream& outStream, vtkImageData* imageData) {
 		int* resolution = imageData->GetDimensions();
 		double* spacing = imageData->GetSpacing();
 		double* minCorner = imageData->GetOrigin();
@@ -16,34 +66,27 @@ namespace vispro
 			minCorner[1] + spacing[1] * (resolution[1] - 1),
 			minCorner[2] + spacing[2] * (resolution[2] - 1)
 		};
+		std::ostringstream header;
+		header << "# AmiraMesh BINARY-LITTLE-ENDIAN 2.1\n\n\n";
+		header << "define Lattice " << resolution[0] << " " << resolution[1] << " " << resolution[2] << "\n\n";
+		header << "Parameters {\n";
+		header << "Content \"" << resolution[0] << "x" << resolution[1] << "x" << resolution[2] << " float[3], uniform coordinates\",\n";
+		header << "\tBoundingBox " << minCorner[0] << " " << maxCorner[0] << " " << minCorner[1] << " " << maxCorner[1] << " " << minCorner[2] << " " << maxCorner[2] << ",\n";
+		header << "\tCoordType \"uniform\"\n";
+		header << "}\n\n";
+		header << "Lattice { float[3] Data } @1\n\n";
+		WriteHeader(outStream, header.str());
+	}
 
-		// Write header
-		{
-			std::ofstream outStream(path);
-			outStream << "# AmiraMesh BINARY-LITTLE-ENDIAN 2.1\n\n\n";
-			outStream << "define Lattice " << resolution[0] << " " << resolution[1] << " " << resolution[2] << "\n\n";
-			outStream << "Parameters {\n";
-			outStream << "Content \"" << resolution[0] << "x" << resolution[1] << "x" << resolution[2] << " float[3], uniform coordinates\",\n";
-			outStream << "\tBoundingBox " << minCorner[0] << " " << maxCorner[0] << " " << minCorner[1] << " " << maxCorner[1] << " " << minCorner[2] << " " << maxCorner[2] << ",\n";
-			outStream << "\tCoordType \"uniform\"\n";
-			outStream << "}\n\n";
-			outStream << "Lattice { float Data } @1\n\n";
-			outStream << "# Data section follows\n";
-			outStream << "@1\n";
-			outStream.close();
-		}
-
-		// Write data
-		{
-			std::ofstream outStream(path, std::ios::out | std::ios::app | std::ios::binary);
-			vtkFloatArray* floatArray = dynamic_cast<vtkFloatArray*>(imageData->GetPointData()->GetArray(fieldName));
-			outStream.write((char*)floatArray->GetPointer(0), sizeof(float) * resolution[0] * resolution[1] * resolution[2]);
-			outStream.close();
-		}
+	void AmiraWriter::WriteScalarField(const char* path, const char* fieldName, vtkImageData* imageData, Quantization::EStorage storage, double errorBound)
+	{
+		std::ofstream outStream(path, std::ios::out | std::ios::binary);
+		WriteScalarField(outStream, fieldName, imageData, storage, errorBound);
 	}
 
-	void AmiraWriter::WriteVectorField(const char* path, const char* fieldUName, const char* fieldVName, const char* fieldWName, vtkImageData* imageData)
+	void AmiraWriter::WriteScalarField(std::ostream& outStream, const char* fieldName, vtkImageData* imageData, Quantization::EStorage storage, double errorBound)
 	{
+		vtkFloatArray* floatArray = dynamic_cast<vtkFloatArray*>(imageData->GetPointData()->GetArray(fieldName));
 		int* resolution = imageData->GetDimensions();
 		double* spacing = imageData->GetSpacing();
 		double* minCorner = imageData->GetOrigin();
@@ -52,40 +95,129 @@ namespace vispro
 			minCorner[1] + spacing[1] * (resolution[1] - 1),
 			minCorner[2] + spacing[2] * (resolution[2] - 1)
 		};
+		// arrays with several components are written interleaved, e.g., the levels of a pyramid of the velocity
+		const int numComponents = floatArray->GetNumberOfComponents();
+		const size_t numValues = (size_t)resolution[0] * resolution[1] * resolution[2] * numComponents;
+
+		// Compressed fields are encoded up front, since the size of the data section goes into the header
+		if (storage == Quantization::EStorage::ErrorBounded && (!(errorBound > 0) || numComponents != 1)) storage = Quantization::EStorage::Float;
+		const std::string typeName = std::string(AmiraReader::GetTypeName(storage)) + (numComponents > 1 ? "[" + std::to_string(numComponents) + "]" : "");
+		std::vector<char> compressed;
+		if (storage == Quantization::EStorage::ErrorBounded)
+			ErrorBoundedCodec::Encode(floatArray->GetPointer(0), Eigen::Vector3i(resolution), errorBound, compressed);
+
+		// Normalized integers span the value range of the field
+		float scale = 1.0f, bias = 0.0f;
+		const bool bNormalized = storage == Quantization::EStorage::UNorm16 || storage == Quantization::EStorage::UNorm8;
+		if (bNormalized) {
+			const float* values = floatArray->GetPointer(0);
+			float minValue = std::numeric_limits<float>::max(), maxValue = std::numeric_limits<float>::lowest();
+#ifndef _DEBUG
+#pragma omp parallel for reduction(min:minValue) reduction(max:maxValue)
+#endif
+			for (int64_t i = 0; i < (int64_t)numValues; ++i) {
+				minValue = std::min(minValue, values[i]);
+				maxValue = std::max(maxValue, values[i]);
+			}
+			const float maxCode = storage == Quantization::EStorage::UNorm16 ? 65535.0f : 255.0f;
+			bias = minValue;
+			scale = (maxValue - minValue) / maxCode;
+		}
 
 		// Write header
 		{
-			std::ofstream outStream(path);
-			outStream << "# AmiraMesh BINARY-LITTLE-ENDIAN 2.1\n\n\n";
-			outStream << "define Lattice " << resolution[0] << " " << resolution[1] << " " << resolution[2] << "\n\n";
-			outStream << "Parameters {\n";
-			outStream << "Content \"" << resolution[0] << "x" << resolution[1] << "x" << resolution[2] << " float[3], uniform coordinates\",\n";
-			outStream << "\tBoundingBox " << minCorner[0] << " " << maxCorner[0] << " " << minCorner[1] << " " << maxCorner[1] << " " << minCorner[2] << " " << maxCorner[2] << ",\n";
-			outStream << "\tCoordType \"uniform\"\n";
-			outStream << "}\n\n";
-			outStream << "Lattice { float[3] Data } @1\n\n";
-			outStream << "# Data section follows\n";
-			outStream << "@1\n";
-			outStream.close();
+			std::ostringstream header;
+			header << "# AmiraMesh BINARY-LITTLE-ENDIAN 2.1\n\n\n";
+			header << "define Lattice " << resolution[0] << " " << resolution[1] << " " << resolution[2] << "\n\n";
+			header << "Parameters {\n";
+			header << "Content \"" << resolution[0] << "x" << resolution[1] << "x" << resolution[2] << " " << typeName << ", uniform coordinates\",\n";
+			if (bNormalized) {
+				// values are reconstructed as DataBias + DataScale * value
+				header << std::setprecision(9);
+				header << "\tDataScale " << scale << ",\n";
+				header << "\tDataBias " << bias << ",\n";
+				header << std::setprecision(6);
+			}
+			if (storage == Quantization::EStorage::ErrorBounded) {
+				header << std::setprecision(9);
+				header << "\tErrorBound " << errorBound << ",\n";
+				header << std::setprecision(6);
+			}
+			header << "\tBoundingBox " << minCorner[0] << " " << maxCorner[0] << " " << minCorner[1] << " " << maxCorner[1] << " " << minCorner[2] << " " << maxCorner[2] << ",\n";
+			header << "\tCoordType \"uniform\"\n";
+			header << "}\n\n";
+			header << "Lattice { " << typeName << " Data } @1";
+			if (storage == Quantization::EStorage::ErrorBounded)
+				header << "(VpErrorBounded," << compressed.size() << ")";
+			header << "\n\n";
+			WriteHeader(outStream, header.str());
 		}
 
 		// Write data
 		{
-			std::ofstream outStream(path, std::ios::out | std::ios::app | std::ios::binary);
-			vtkFloatArray* floatUArray = dynamic_cast<vtkFloatArray*>(imageData->GetPointData()->GetArray(fieldUName));
-			vtkFloatArray* floatVArray = dynamic_cast<vtkFloatArray*>(imageData->GetPointData()->GetArray(fieldVName));
-			vtkFloatArray* floatWArray = dynamic_cast<vtkFloatArray*>(imageData->GetPointData()->GetArray(fieldWName));
-			std::vector<float> interleaved(resolution[0] * resolution[1] * resolution[2] * 3);
+			if (storage == Quantization::EStorage::Float)
+				outStream.write((char*)floatArray->GetPointer(0), sizeof(float) * numValues);
+			else if (storage == Quantization::EStorage::ErrorBounded)
+				outStream.write(compressed.data(), compressed.size());
+			else {
+				std::vector<char> encoded(numValues * Quantization::GetSize(storage));
+				Quantization::Encode(storage, floatArray->GetPointer(0), numValues, scale, bias, encoded.data());
+				outStream.write(encoded.data(), encoded.size());
+			}
+		}
+	}
+
+	void AmiraWriter::WriteVectorField(const char* path, const char* fieldUName, const char* fieldVName, const char* fieldWName, vtkImageData* imageData)
+	{
+		RandomAccessFile file;
+		if (!file.Open(path, RandomAccessFile::EMode::Create)) return;
+
+		// Write header
+		std::ostringstream headerStream;
+		WriteVectorHeader(headerStream, imageData);
+		const std::string header = headerStream.str();
+		if (!file.WriteAt(header.data(), (int64_t)header.size(), 0)) return;
+
+		// Write data: each thread interleaves blocks into its own buffer and writes them to their final position
+		const float* u = dynamic_cast<vtkFloatArray*>(imageData->GetPointData()->GetArray(fieldUName))->GetPointer(0);
+		const float* v = dynamic_cast<vtkFloatArray*>(imageData->GetPointData()->GetArray(fieldVName))->GetPointer(0);
+		const float* w = dynamic_cast<vtkFloatArray*>(imageData->GetPointData()->GetArray(fieldWName))->GetPointer(0);
+		const int* resolution = imageData->GetDimensions();
+		const int64_t numPoints = (int64_t)resolution[0] * resolution[1] * resolution[2];
+		const int64_t numBlocks = (numPoints + InterleaveBlockSize - 1) / InterleaveBlockSize;
 #ifndef _DEBUG
 #pragma omp parallel
 #endif
-			for (size_t i = 0; i < interleaved.size() / 3; ++i) {
-				interleaved[i * 3 + 0] = floatUArray->GetValue(i);
-				interleaved[i * 3 + 1] = floatVArray->GetValue(i);
-				interleaved[i * 3 + 2] = floatWArray->GetValue(i);
+		{
+			std::vector<float> block(InterleaveBlockSize * 3);
+#ifndef _DEBUG
+#pragma omp for schedule(dynamic)
+#endif
+			for (int64_t iBlock = 0; iBlock < numBlocks; ++iBlock) {
+				const int64_t first = iBlock * InterleaveBlockSize;
+				const int64_t count = std::min(InterleaveBlockSize, numPoints - first);
+				Interleave(u + first, v + first, w + first, count, block.data());
+				file.WriteAt(block.data(), count * 3 * (int64_t)sizeof(float), (int64_t)header.size() + first * 3 * (int64_t)sizeof(float));
 			}
-			outStream.write((char*)interleaved.data(), sizeof(float) * interleaved.size());
-			outStream.close();
+		}
+	}
+
+	void AmiraWriter::WriteVectorField(std::ostream& outStream, const char* fieldUName, const char* fieldVName, const char* fieldWName, vtkImageData* imageData)
+	{
+		// Write header
+		WriteVectorHeader(outStream, imageData);
+
+		// Write data: a stream is sequential, so the blocks are interleaved one after the other
+		const float* u = dynamic_cast<vtkFloatArray*>(imageData->GetPointData()->GetArray(fieldUName))->GetPointer(0);
+		const float* v = dynamic_cast<vtkFloatArray*>(imageData->GetPointData()->GetArray(fieldVName))->GetPointer(0);
+		const float* w = dynamic_cast<vtkFloatArray*>(imageData->GetPointData()->GetArray(fieldWName))->GetPointer(0);
+		const int* resolution = imageData->GetDimensions();
+		const int64_t numPoints = (int64_t)resolution[0] * resolution[1] * resolution[2];
+		std::vector<float> block(InterleaveBlockSize * 3);
+		for (int64_t first = 0; first < numPoints; first += InterleaveBlockSize) {
+			const int64_t count = std::min(InterleaveBlockSize, numPoints - first);
+			Interleave(u + first, v + first, w + first, count, block.data());
+			outStream.write((char*)block.data(), count * 3 * sizeof(float));
 		}
 	}
 }
\ No newline at end of file
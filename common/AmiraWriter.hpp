@@ -1,5 +1,8 @@
 #pragma once
 
+#include <ostream>
+#include "Quantization.hpp"
+
 class vtkImageData;
 
 namespace vispro
@@ -8,10 +11,16 @@ namespace vispro
 	class AmiraWriter
 	{
 	public:
-		// Writes a scalar field in vtkImageData to file.
-		static void WriteScalarField(const char* path, const char* fieldName, vtkImageData* imageData);
+		// Writes a scalar field in vtkImageData to file. Fields that are only visualized can be stored as half floats or normalized integers,
+		// or compressed such that each value differs by at most the absolute error bound (ErrorBounded). A non-positive error bound stores full floats instead.
+		// An array with several components is written as interleaved vector field, which cannot be compressed.
+		static void WriteScalarField(const char* path, const char* fieldName, vtkImageData* imageData, Quantization::EStorage storage = Quantization::EStorage::Float, double errorBound = 0);
+		// Writes a scalar field to a binary stream, e.g., to embed it in a TimeSeriesContainer.
+		static void WriteScalarField(std::ostream& outStream, const char* fieldName, vtkImageData* imageData, Quantization::EStorage storage = Quantization::EStorage::Float, double errorBound = 0);
 
 		// Writes a vector field in vtkImageData to file.
 		static void WriteVectorField(const char* path, const char* fieldUName, const char* fieldVName, const char* fieldWName, vtkImageData* imageData);
+		// Writes a vector field to a binary stream.
+		static void WriteVectorField(std::ostream& outStream, const char* fieldUName, const char* fieldVName, const char* fieldWName, vtkImageData* imageData);
 	};
 }
\ No newline at end of file
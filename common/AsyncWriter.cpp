@@ -0,0 +1,143 @@
+#include "AsyncWriter.hpp"
+#include "AmiraWriter.hpp"
+#include <algorithm>
+#include <vtkImageData.h>
+#include <vtkPointData.h>
+#include <vtkFloatArray.h>
+
+namespace vispro
+{
+	// Checks whether a pooled field has the requested lattice and arrays.
+	static bool Matches(vtkImageData* field, const int* dimensions, const double* origin, const double* spacing, const std::vector<std::string>& arrayNames) {
+		const int* fieldDimensions = field->GetDimensions();
+		const double* fieldOrigin = field->GetOrigin();
+		const double* fieldSpacing = field->GetSpacing();
+		for (int i = 0; i < 3; ++i)
+			if (fieldDimensions[i] != dimensions[i] || fieldOrigin[i] != origin[i] || fieldSpacing[i] != spacing[i]) return false;
+		if (field->GetPointData()->GetNumberOfArrays() != (int)arrayNames.size()) return false;
+		for (const std::string& name : arrayNames)
+			if (!field->GetPointData()->GetArray(name.c_str())) return false;
+		return true;
+	}
+
+	// Writes the field of a job, or one of its pyramid levels, to a path.
+	static void WriteField(const std::string& path, const std::vector<std::string>& arrayNames, vtkImageData* field, Quantization::EStorage storage, double errorBound) {
+		if (arrayNames.size() == 3)
+			AmiraWriter::WriteVectorField(path.c_str(), arrayNames[0].c_str(), arrayNames[1].c_str(), arrayNames[2].c_str(), field);
+		else AmiraWriter::WriteScalarField(path.c_str(), arrayNames[0].c_str(), field, storage, errorBound);
+	}
+
+	AsyncWriter::AsyncWriter(int queueLength) : mQueueLength(std::max(queueLength, 1)), mNumLevels(1), mFilter(Pyramid::EFilter::Box), mBusy(false), mStop(false)
+	{
+		mThread = std::thread(&AsyncWriter::Run, this);
+	}
+
+	AsyncWriter::~AsyncWriter()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			mStop = true;
+		}
+		mChanged.notify_all();
+		mThread.join();
+	}
+
+	vtkSmartPointer<vtkImageData> AsyncWriter::AcquireField(const int* dimensions, const double* origin, const double* spacing, const std::vector<std::string>& arrayNames)
+	{
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			for (size_t i = 0; i < mPool.size(); ++i) {
+				if (!Matches(mPool[i], dimensions, origin, spacing, arrayNames)) continue;
+				vtkSmartPointer<vtkImageData> field = mPool[i];
+				mPool.erase(mPool.begin() + i);
+				return field;
+			}
+		}
+		return AllocateField(dimensions, origin, spacing, arrayNames);
+	}
+
+	vtkSmartPointer<vtkImageData> AsyncWriter::AllocateField(const int* dimensions, const double* origin, const double* spacing, const std::vector<std::string>& arrayNames)
+	{
+		vtkNew<vtkImageData> field;
+		field->SetDimensions(dimensions);
+		field->SetOrigin(origin);
+		field->SetSpacing(spacing);
+		int64_t numPoints = (int64_t)dimensions[0] * dimensions[1] * dimensions[2];
+		for (const std::string& name : arrayNames) {
+			vtkNew<vtkFloatArray> mArray;
+			mArray->SetNumberOfComponents(1);
+			mArray->SetNumberOfTuples(numPoints);
+			mArray->SetName(name.c_str());
+			field->GetPointData()->AddArray(mArray);
+		}
+		if (!arrayNames.empty())
+			field->GetPointData()->SetActiveScalars(arrayNames[0].c_str());
+		return field.Get();
+	}
+
+	void AsyncWriter::WriteScalarField(const char* path, const char* fieldName, vtkSmartPointer<vtkImageData> imageData, Quantization::EStorage storage, double errorBound)
+	{
+		Enqueue(Job{ path, { fieldName }, imageData, storage, errorBound, mNumLevels, mFilter });
+	}
+
+	void AsyncWriter::WriteVectorField(const char* path, const char* fieldUName, const char* fieldVName, const char* fieldWName, vtkSmartPointer<vtkImageData> imageData)
+	{
+		Enqueue(Job{ path, { fieldUName, fieldVName, fieldWName }, imageData, Quantization::EStorage::Float, 0, mNumLevels, mFilter });
+	}
+
+	void AsyncWriter::Flush()
+	{
+		std::unique_lock<std::mutex> lock(mMutex);
+		mChanged.wait(lock, [this] { return mQueue.empty() && !mBusy; });
+	}
+
+	void AsyncWriter::SetPyramid(int numLevels, Pyramid::EFilter filter)
+	{
+		mNumLevels = std::max(numLevels, 1);
+		mFilter = filter;
+	}
+
+	void AsyncWriter::Enqueue(Job&& job)
+	{
+		{
+			std::unique_lock<std::mutex> lock(mMutex);
+			mChanged.wait(lock, [this] { return mQueue.size() < mQueueLength; });
+			mQueue.push_back(std::move(job));
+		}
+		mChanged.notify_all();
+	}
+
+	void AsyncWriter::Run()
+	{
+		while (true) {
+			Job job;
+			{
+				std::unique_lock<std::mutex> lock(mMutex);
+				mChanged.wait(lock, [this] { return !mQueue.empty() || mStop; });
+				if (mQueue.empty()) return;
+				job = std::move(mQueue.front());
+				mQueue.pop_front();
+				mBusy = true;
+			}
+			// a slot in the queue became available
+			mChanged.notify_all();
+
+			WriteField(job.Path, job.ArrayNames, job.Field, job.Storage, job.ErrorBound);
+			// the coarse levels are reduced from the field, which is still owned by the writer
+			if (job.NumLevels > 1) {
+				std::vector<vtkSmartPointer<vtkImageData>> levels = Pyramid::Build(job.Field, job.Filter, job.NumLevels);
+				for (int level = 1; level < job.NumLevels; ++level)
+					WriteField(Pyramid::GetLevelPath(job.Path, level), job.ArrayNames, levels[level - 1], job.Storage, job.ErrorBound);
+			}
+
+			{
+				std::lock_guard<std::mutex> lock(mMutex);
+				// keep at most as many fields as can be in flight
+				if (mPool.size() <= mQueueLength)
+					mPool.push_back(job.Field);
+				mBusy = false;
+			}
+			mChanged.notify_all();
+		}
+	}
+}
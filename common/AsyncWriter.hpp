@@ -0,0 +1,85 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <vtkSmartPointer.h>
+#include "Quantization.hpp"
+#include "Pyramid.hpp"
+
+class vtkImageData;
+
+namespace vispro
+{
+	// Writes fields to the Amira format (*.am) on a background thread, so that the computation of the next time step
+	// overlaps the write of the previous one. Submitted fields are owned by the writer until they are flushed and then go
+	// back to a pool, from which the next output field is taken. The queue is bounded, i.e., a producer that is faster than
+	// the disk blocks instead of piling up fields in memory. Optionally, the coarse levels of a resolution pyramid are written next to each field.
+	class AsyncWriter
+	{
+	public:
+		// Constructor. Receives the number of fields that may wait in the queue. The default of one gives double buffering:
+		// one field is computed while the previous one is written.
+		AsyncWriter(int queueLength = 1);
+		// Destructor. Writes the remaining fields and stops the background thread.
+		~AsyncWriter();
+
+		// Gets an output field with one float array per name from the pool, or allocates one if no pooled field matches.
+		vtkSmartPointer<vtkImageData> AcquireField(const int* dimensions, const double* origin, const double* spacing, const std::vector<std::string>& arrayNames);
+		// Allocates a field with one float array per name. The first array becomes the active scalars.
+		static vtkSmartPointer<vtkImageData> AllocateField(const int* dimensions, const double* origin, const double* spacing, const std::vector<std::string>& arrayNames);
+
+		// Queues a scalar field for writing (see AmiraWriter::WriteScalarField). The caller must not modify the field afterwards.
+		void WriteScalarField(const char* path, const char* fieldName, vtkSmartPointer<vtkImageData> imageData, Quantization::EStorage storage = Quantization::EStorage::Float, double errorBound = 0);
+		// Queues a vector field for writing (see AmiraWriter::WriteVectorField). The caller must not modify the field afterwards.
+		void WriteVectorField(const char* path, const char* fieldUName, const char* fieldVName, const char* fieldWName, vtkSmartPointer<vtkImageData> imageData);
+		// Blocks until all queued fields are written.
+		void Flush();
+		// Sets the number of pyramid levels that are written next to each subsequently queued field (see Pyramid). One writes only the field (default).
+		void SetPyramid(int numLevels, Pyramid::EFilter filter = Pyramid::EFilter::Box);
+
+	private:
+		// Delete the copy-constructor.
+		AsyncWriter(const AsyncWriter& other) = delete;
+
+		// A field waiting to be written.
+		struct Job {
+			std::string Path;						// output path
+			std::vector<std::string> ArrayNames;	// one name for scalar fields, three for vector fields
+			vtkSmartPointer<vtkImageData> Field;	// the field to write
+			Quantization::EStorage Storage;			// storage type of scalar fields
+			double ErrorBound;						// absolute error bound of compressed scalar fields
+			int NumLevels;							// number of pyramid levels, including the field itself
+			Pyramid::EFilter Filter;				// filter of the pyramid reduction
+		};
+
+		// Adds a job to the queue. Blocks while the queue is full.
+		void Enqueue(Job&& job);
+		// Main loop of the background thread.
+		void Run();
+
+		// Maximum number of queued jobs.
+		size_t mQueueLength;
+		// Number of pyramid levels of new jobs.
+		int mNumLevels;
+		// Filter of the pyramid reduction of new jobs.
+		Pyramid::EFilter mFilter;
+		// Queued jobs in submission order.
+		std::deque<Job> mQueue;
+		// Fields that were written and can be reused.
+		std::vector<vtkSmartPointer<vtkImageData>> mPool;
+		// Flag that is set while the background thread writes a field.
+		bool mBusy;
+		// Flag that tells the background thread to exit once the queue is empty.
+		bool mStop;
+		// Guards the queue, the pool and the flags.
+		std::mutex mMutex;
+		// Signaled when a job was added or removed, or when the writer stops.
+		std::condition_variable mChanged;
+		// The background thread.
+		std::thread mThread;
+	};
+}
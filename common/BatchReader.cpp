@@ -0,0 +1,345 @@
+#include "BatchReader.hpp"
+#include "RandomAccessFile.hpp"
+#include <algorithm>
+#include <chrono>
+#ifdef __linux__
+#include <cerrno>
+#include <cstring>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+namespace vispro
+{
+	// Number of threads of the fallback pool at most. More threads than this rarely raise the throughput of a single device.
+	static const int MaxPoolThreads = 16;
+
+#ifdef __linux__
+	// There is no wrapper in the C library, so the ring is set up with the raw system calls (no dependency on liburing).
+	static int IoUringSetup(unsigned entries, io_uring_params* params) {
+		return (int)syscall(__NR_io_uring_setup, entries, params);
+	}
+	static int IoUringEnter(int fd, unsigned toSubmit, unsigned minComplete, unsigned flags) {
+		return (int)syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, nullptr, 0);
+	}
+
+	struct BatchReader::Ring {
+		// A read in flight. The index of the slot is the user data of its submission and completion.
+		struct Slot {
+			Part Read;		// the part that is read
+			iovec Vector;	// destination of the read, which has to stay valid until it completed
+		};
+
+		int Fd = -1;					// file descriptor of the ring
+		void* SqMemory = nullptr;		// mapping of the submission queue
+		size_t SqMemorySize = 0;
+		void* CqMemory = nullptr;		// mapping of the completion queue, which is the same as the submission queue on newer kernels
+		size_t CqMemorySize = 0;
+		io_uring_sqe* Sqes = nullptr;	// mapping of the submission entries
+		size_t SqesSize = 0;
+		unsigned* SqTail = nullptr;
+		unsigned* SqMask = nullptr;
+		unsigned* SqArray = nullptr;
+		unsigned* CqHead = nullptr;
+		unsigned* CqTail = nullptr;
+		unsigned* CqMask = nullptr;
+		io_uring_cqe* Cqes = nullptr;
+		std::vector<Slot> Slots;		// one slot per read in flight
+		std::vector<int> FreeSlots;		// indices of unused slots
+	};
+#endif
+
+	BatchReader::BatchReader(int queueDepth) : mQueueDepth(std::max(queueDepth, 1)), mNextTicket(0), mStop(false)
+	{
+#ifdef __linux__
+		mRing = nullptr;
+		mRingFailed = false;
+		if (SetupRing()) {
+			mThreads.emplace_back(&BatchReader::RunRing, this);
+			return;
+		}
+#endif
+		const int numThreads = std::min(mQueueDepth, MaxPoolThreads);
+		for (int i = 0; i < numThreads; ++i)
+			mThreads.emplace_back(&BatchReader::RunPool, this);
+	}
+
+	BatchReader::~BatchReader()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			mStop = true;
+		}
+		mChanged.notify_all();
+		for (std::thread& thread : mThreads)
+			thread.join();
+		// the completion thread is the only one that starts fallback threads, so they are joined after it
+		for (std::thread& thread : mFallbackThreads)
+			thread.join();
+#ifdef __linux__
+		DestroyRing();
+#endif
+	}
+
+	BatchReader::Ticket BatchReader::Submit(const std::vector<Request>& requests, FinishFunction finish)
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		const Ticket ticket = mNextTicket++;
+		Batch& batch = mBatches[ticket];
+		batch.NumPending = 0;
+		batch.Failed = false;
+		batch.Finish = std::move(finish);
+		for (const Request& request : requests) {
+			for (int64_t offset = 0; offset < request.Size; offset += PartSize) {
+				mPending.push_back(Part{ ticket, request.File, (char*)request.Buffer + offset, std::min(PartSize, request.Size - offset), request.Offset + offset });
+				++batch.NumPending;
+			}
+		}
+#ifdef __linux__
+		if (mRing && !mRingFailed) {
+			SubmitPending();
+			return ticket;
+		}
+#endif
+		mChanged.notify_all();
+		return ticket;
+	}
+
+	bool BatchReader::Wait(Ticket ticket)
+	{
+		Batch batch;
+		{
+			std::unique_lock<std::mutex> lock(mMutex);
+			auto it = mBatches.find(ticket);
+			if (it == mBatches.end()) return false;
+			mCompleted.wait(lock, [&it] { return it->second.NumPending == 0; });
+			batch = std::move(it->second);
+			mBatches.erase(it);
+		}
+		// the batch is finished outside of the lock, so that decoding does not delay other batches
+		if (batch.Failed) return false;
+		return !batch.Finish || batch.Finish();
+	}
+
+	bool BatchReader::IsReady(Ticket ticket) const
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		auto it = mBatches.find(ticket);
+		return it == mBatches.end() || it->second.NumPending == 0;
+	}
+
+	bool BatchReader::UsesIoUring() const
+	{
+#ifdef __linux__
+		std::lock_guard<std::mutex> lock(mMutex);
+		return mRing != nullptr && !mRingFailed;
+#else
+		return false;
+#endif
+	}
+
+	void BatchReader::Complete(const Part& part, bool success)
+	{
+		Batch& batch = mBatches[part.Batch];
+		if (!success) batch.Failed = true;
+		if (--batch.NumPending == 0)
+			mCompleted.notify_all();
+	}
+
+	void BatchReader::RunPool()
+	{
+		std::unique_lock<std::mutex> lock(mMutex);
+		for (;;) {
+			mChanged.wait(lock, [this] { return mStop || !mPending.empty(); });
+			if (mPending.empty()) return;	// stopped and nothing left
+			Part part = mPending.front();
+			mPending.pop_front();
+			lock.unlock();
+			const bool success = part.File->ReadAt(part.Buffer, part.Size, part.Offset);
+			lock.lock();
+			Complete(part, success);
+		}
+	}
+
+#ifdef __linux__
+	bool BatchReader::SetupRing()
+	{
+		io_uring_params params = {};
+		const int fd = IoUringSetup((unsigned)mQueueDepth, &params);
+		if (fd < 0) return false;	// e.g., an old kernel or a sandbox that blocks io_uring
+
+		Ring* ring = new Ring();
+		ring->Fd = fd;
+		ring->SqMemorySize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+		ring->CqMemorySize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+		const bool singleMapping = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+		if (singleMapping)
+			ring->SqMemorySize = ring->CqMemorySize = std::max(ring->SqMemorySize, ring->CqMemorySize);
+		ring->SqMemory = mmap(nullptr, ring->SqMemorySize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+		if (ring->SqMemory != MAP_FAILED)
+			ring->CqMemory = singleMapping ? ring->SqMemory : mmap(nullptr, ring->CqMemorySize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+		ring->SqesSize = params.sq_entries * sizeof(io_uring_sqe);
+		if (ring->SqMemory != MAP_FAILED && ring->CqMemory != MAP_FAILED)
+			ring->Sqes = (io_uring_sqe*)mmap(nullptr, ring->SqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+		mRing = ring;
+		if (ring->SqMemory == MAP_FAILED || ring->CqMemory == MAP_FAILED || ring->Sqes == nullptr || ring->Sqes == MAP_FAILED) {
+			DestroyRing();
+			return false;
+		}
+
+		char* sq = (char*)ring->SqMemory;
+		char* cq = (char*)ring->CqMemory;
+		ring->SqTail = (unsigned*)(sq + params.sq_off.tail);
+		ring->SqMask = (unsigned*)(sq + params.sq_off.ring_mask);
+		ring->SqArray = (unsigned*)(sq + params.sq_off.array);
+		ring->CqHead = (unsigned*)(cq + params.cq_off.head);
+		ring->CqTail = (unsigned*)(cq + params.cq_off.tail);
+		ring->CqMask = (unsigned*)(cq + params.cq_off.ring_mask);
+		ring->Cqes = (io_uring_cqe*)(cq + params.cq_off.cqes);
+
+		// the kernel rounds the number of entries up to a power of two, but we keep at most the requested number of reads in flight
+		ring->Slots.resize(mQueueDepth);
+		for (int i = mQueueDepth - 1; i >= 0; --i)
+			ring->FreeSlots.push_back(i);
+		return true;
+	}
+
+	void BatchReader::DestroyRing()
+	{
+		Ring* ring = mRing;
+		if (!ring) return;
+		if (ring->Sqes && ring->Sqes != MAP_FAILED) munmap(ring->Sqes, ring->SqesSize);
+		if (ring->CqMemory && ring->CqMemory != MAP_FAILED && ring->CqMemory != ring->SqMemory) munmap(ring->CqMemory, ring->CqMemorySize);
+		if (ring->SqMemory && ring->SqMemory != MAP_FAILED) munmap(ring->SqMemory, ring->SqMemorySize);
+		close(ring->Fd);
+		delete ring;
+		mRing = nullptr;
+	}
+
+	void BatchReader::SubmitPending()
+	{
+		Ring& ring = *mRing;
+		unsigned numSubmitted = 0;
+		unsigned tail = *ring.SqTail;	// only we write the tail
+		while (!mPending.empty() && !ring.FreeSlots.empty()) {
+			const int iSlot = ring.FreeSlots.back();
+			ring.FreeSlots.pop_back();
+			Ring::Slot& slot = ring.Slots[iSlot];
+			slot.Read = mPending.front();
+			mPending.pop_front();
+			slot.Vector.iov_base = slot.Read.Buffer;
+			slot.Vector.iov_len = (size_t)slot.Read.Size;
+
+			// vectored reads are supported since the first kernel with io_uring, plain reads only since 5.6
+			const unsigned index = tail & *ring.SqMask;
+			io_uring_sqe& sqe = ring.Sqes[index];
+			memset(&sqe, 0, sizeof(sqe));
+			sqe.opcode = IORING_OP_READV;
+			sqe.fd = slot.Read.File->GetDescriptor();
+			sqe.addr = (uint64_t)(uintptr_t)&slot.Vector;
+			sqe.len = 1;
+			sqe.off = (uint64_t)slot.Read.Offset;
+			sqe.user_data = (uint64_t)iSlot;
+			ring.SqArray[index] = index;
+			++tail;
+			++numSubmitted;
+		}
+		if (numSubmitted == 0) return;
+		__atomic_store_n(ring.SqTail, tail, __ATOMIC_RELEASE);
+
+		// the kernel may consume fewer entries than were published, so enter again for the rest
+		if (mRingFailed) return;
+		int error = 0;
+		while (numSubmitted > 0) {
+			const int result = IoUringEnter(ring.Fd, numSubmitted, 0, 0);
+			if (result < 0 && (errno == EINTR || errno == EAGAIN)) continue;
+			if (result <= 0) {
+				error = result < 0 ? errno : EBUSY;
+				break;
+			}
+			numSubmitted -= (unsigned)result;
+		}
+
+		// Take back the entries that the kernel did not consume, which are the last ones that were published. The kernel never saw them, so
+		// their slots are free. If the completion queue is full (EBUSY), the parts are submitted again once the completion thread reaped reads
+		// in flight. Otherwise, the ring is given up and the fallback pool reads them.
+		if (numSubmitted > 0) {
+			tail -= numSubmitted;
+			__atomic_store_n(ring.SqTail, tail, __ATOMIC_RELEASE);
+			std::vector<Part> parts;
+			for (unsigned i = 0; i < numSubmitted; ++i) {
+				const int iSlot = (int)ring.Sqes[(tail + i) & *ring.SqMask].user_data;
+				parts.push_back(ring.Slots[iSlot].Read);
+				ring.FreeSlots.push_back(iSlot);
+			}
+			for (auto it = parts.rbegin(); it != parts.rend(); ++it)
+				mPending.push_front(*it);
+			if (error != EBUSY || (int)ring.FreeSlots.size() == mQueueDepth) FailRing();
+		}
+		// the completion thread might sleep without reads in flight
+		mChanged.notify_all();
+	}
+
+	void BatchReader::FailRing()
+	{
+		if (mRingFailed) return;
+		mRingFailed = true;
+		const int numThreads = std::min(mQueueDepth, MaxPoolThreads);
+		for (int i = 0; i < numThreads; ++i)
+			mFallbackThreads.emplace_back(&BatchReader::RunPool, this);
+		mChanged.notify_all();
+	}
+
+	void BatchReader::RunRing()
+	{
+		Ring& ring = *mRing;
+		std::unique_lock<std::mutex> lock(mMutex);
+		for (;;) {
+			mChanged.wait(lock, [this, &ring] { return mStop || (int)ring.FreeSlots.size() < mQueueDepth; });
+			if ((int)ring.FreeSlots.size() == mQueueDepth) return;	// stopped and nothing in flight
+
+			// Block until at least one read completed. New batches do not need this thread to be submitted, since Submit
+			// enters the ring itself. The lock is not held, so that Submit can proceed while we sleep. Once the ring failed,
+			// the kernel may still complete the reads in flight, whose buffers must not be released before, so the completion
+			// queue is polled until they all arrived.
+			const bool failed = mRingFailed;
+			lock.unlock();
+			int result = 0, error = 0;
+			if (failed) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			else {
+				result = IoUringEnter(ring.Fd, 0, 1, IORING_ENTER_GETEVENTS);
+				error = result < 0 ? errno : 0;
+			}
+			lock.lock();
+			if (result < 0 && error != EINTR && error != EAGAIN && error != EBUSY)
+				FailRing();
+
+			// collect the completions
+			unsigned head = *ring.CqHead;
+			const unsigned tail = __atomic_load_n(ring.CqTail, __ATOMIC_ACQUIRE);
+			for (; head != tail; ++head) {
+				const io_uring_cqe& cqe = ring.Cqes[head & *ring.CqMask];
+				const int iSlot = (int)cqe.user_data;
+				Part part = ring.Slots[iSlot].Read;
+				ring.FreeSlots.push_back(iSlot);
+				if (cqe.res == -EINTR || cqe.res == -EAGAIN)
+					mPending.push_front(part);		// retry
+				else if (cqe.res > 0 && cqe.res < part.Size) {
+					// a short read continues behind the last transferred byte
+					part.Buffer += cqe.res;
+					part.Offset += cqe.res;
+					part.Size -= cqe.res;
+					mPending.push_front(part);
+				}
+				else Complete(part, cqe.res == part.Size);
+			}
+			__atomic_store_n(ring.CqHead, head, __ATOMIC_RELEASE);
+			if (mRingFailed) mChanged.notify_all();	// the retries go to the fallback pool
+			else SubmitPending();
+		}
+	}
+#endif
+}
\ No newline at end of file
@@ -0,0 +1,123 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace vispro
+{
+	class RandomAccessFile;
+
+	// Reads batches of byte ranges, e.g., the fields of several upcoming time steps, with many reads in flight at once. On Linux,
+	// the reads are submitted to an io_uring and a background thread collects the completions. Elsewhere, or if the kernel refuses
+	// to set up a ring, a pool of threads issues positional reads instead. If the ring fails later, the pool takes over the parts that
+	// were not submitted yet and the reads in flight are still collected from the ring. Large reads are split into parts, so that even a single
+	// field keeps the device busy. The caller provides the buffers and waits for a batch before it touches them.
+	class BatchReader
+	{
+	public:
+		// A read of consecutive bytes of a file into a buffer.
+		struct Request {
+			const RandomAccessFile* File;	// file to read from, has to stay open until the batch completed
+			void* Buffer;					// destination of the bytes
+			int64_t Size;					// number of bytes
+			int64_t Offset;					// byte offset in the file
+		};
+
+		// Identifies a submitted batch.
+		using Ticket = int64_t;
+		// Function that completes a batch once all bytes arrived, e.g., by decoding compact storage types. Returns false on failure.
+		using FinishFunction = std::function<bool()>;
+
+		// Default number of reads in flight.
+		static constexpr int DefaultQueueDepth = 32;
+		// Size in bytes of the parts that large reads are split into.
+		static constexpr int64_t PartSize = (int64_t)4 << 20;
+
+		// Constructor. Receives the number of reads that are in flight at most, which is also the number of threads of the fallback.
+		BatchReader(int queueDepth = DefaultQueueDepth);
+		// Destructor. Completes the outstanding reads and stops the background threads.
+		~BatchReader();
+
+		// Submits a batch of reads. The files and buffers have to stay valid until the batch was waited for. The finish function is called by Wait.
+		Ticket Submit(const std::vector<Request>& requests, FinishFunction finish = nullptr);
+		// Blocks until all reads of a batch arrived and calls its finish function. Returns false if a read or the finish function failed.
+		// Every ticket has to be waited for exactly once.
+		bool Wait(Ticket ticket);
+		// Checks whether all reads of a batch arrived, i.e., whether Wait would return without blocking on the device.
+		bool IsReady(Ticket ticket) const;
+		// Checks whether the reads are submitted to an io_uring, rather than issued by the thread pool.
+		bool UsesIoUring() const;
+
+	private:
+		// Delete the copy-constructor.
+		BatchReader(const BatchReader& other) = delete;
+
+		// A read of at most PartSize bytes that belongs to a batch.
+		struct Part {
+			Ticket Batch;					// batch the part belongs to
+			const RandomAccessFile* File;	// file to read from
+			char* Buffer;					// destination of the bytes
+			int64_t Size;					// number of bytes that are still missing
+			int64_t Offset;					// byte offset of the first missing byte
+		};
+		// State of a submitted batch.
+		struct Batch {
+			int64_t NumPending;				// number of parts that have not arrived yet
+			bool Failed;					// flag that is set if a part could not be read
+			FinishFunction Finish;			// function that is called by Wait
+		};
+
+		// Marks a part as arrived. Has to be called with the lock held.
+		void Complete(const Part& part, bool success);
+		// Main loop of a thread of the fallback pool.
+		void RunPool();
+
+		// Maximum number of reads in flight.
+		int mQueueDepth;
+		// Parts that were not submitted yet, in submission order.
+		std::deque<Part> mPending;
+		// Batches that were not waited for yet.
+		std::map<Ticket, Batch> mBatches;
+		// Ticket of the next batch.
+		Ticket mNextTicket;
+		// Flag that tells the background threads to exit once all parts arrived.
+		bool mStop;
+		// Guards the parts, the batches and the ring.
+		mutable std::mutex mMutex;
+		// Signaled when parts were added or the reader stops.
+		std::condition_variable mChanged;
+		// Signaled when a batch completed.
+		std::condition_variable mCompleted;
+		// The background threads, i.e., the completion thread of the ring or the fallback pool.
+		std::vector<std::thread> mThreads;
+		// Threads of the fallback pool that were started after the ring failed.
+		std::vector<std::thread> mFallbackThreads;
+
+#ifdef __linux__
+		// Maps the submission and completion queues of an io_uring. Returns false if io_uring is not available.
+		bool SetupRing();
+		// Releases the ring.
+		void DestroyRing();
+		// Moves pending parts into free slots of the submission queue and submits them. Entries that the kernel refuses are taken back and
+		// stay pending, either until the completion queue has room again or for the fallback pool if the ring failed. Has to be called with the lock held.
+		void SubmitPending();
+		// Stops submitting to the ring and starts the fallback pool, which reads the pending and all later parts. The reads in flight keep their
+		// slots until their completions are collected. Has to be called with the lock held.
+		void FailRing();
+		// Main loop of the completion thread of the ring.
+		void RunRing();
+
+		// Memory-mapped state of the io_uring.
+		struct Ring;
+		Ring* mRing;
+		// Flag that is set once entering the ring failed, after which no parts are submitted to it.
+		bool mRingFailed;
+#endif
+	};
+}
\ No newline at end of file
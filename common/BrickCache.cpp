@@ -0,0 +1,95 @@
+#include "BrickCache.hpp"
+
+namespace vispro
+{
+	BrickCache::BrickCache(size_t budgetBytes) : mBudget(budgetBytes), mCachedBytes(0), mNumDecoded(0) {}
+
+	bool BrickCache::Open(const char* path)
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mLru.clear();
+		mBricks.clear();
+		mCachedBytes = 0;
+		mNumDecoded = 0;
+		return mReader.Open(path);
+	}
+
+	const BrickedReader::Header& BrickCache::GetHeader() const { return mReader.GetHeader(); }
+
+	BrickCache::BrickPtr BrickCache::GetBrick(int bx, int by, int bz)
+	{
+		const int index = mReader.GetBrickIndex(bx, by, bz);
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			auto it = mBricks.find(index);
+			if (it != mBricks.end()) {
+				// move to the front of the LRU list
+				mLru.splice(mLru.begin(), mLru, it->second.second);
+				return it->second.first;
+			}
+		}
+
+		// decode outside of the lock, so that other threads can keep sampling cached bricks
+		std::shared_ptr<std::vector<float>> brick = std::make_shared<std::vector<float>>();
+		if (!mReader.DecodeBrick(bx, by, bz, *brick)) return nullptr;
+
+		std::lock_guard<std::mutex> lock(mMutex);
+		auto it = mBricks.find(index);
+		if (it != mBricks.end()) return it->second.first;	// another thread was faster
+		mLru.push_front(index);
+		mBricks[index] = std::make_pair(brick, mLru.begin());
+		mCachedBytes += brick->size() * sizeof(float);
+		mNumDecoded++;
+
+		// evict the least recently used bricks, but always keep the one we just decoded
+		while (mCachedBytes > mBudget && mLru.size() > 1) {
+			auto victim = mBricks.find(mLru.back());
+			mCachedBytes -= victim->second.first->size() * sizeof(float);
+			mBricks.erase(victim);
+			mLru.pop_back();
+		}
+		return brick;
+	}
+
+	bool BrickCache::GatherCorners(const Eigen::Vector3i& sample0, const Eigen::Vector3i& sample1, float* corners)
+	{
+		const BrickedReader::Header& header = mReader.GetHeader();
+		const int brickSize = header.BrickSize;
+		const int numComponents = header.NumComponents;
+		// most cells lie inside a single brick, so we remember the last one
+		int lastIndex = -1;
+		BrickPtr brick;
+		Eigen::Vector3i extent;
+		for (int corner = 0; corner < 8; ++corner) {
+			Eigen::Vector3i sample(
+				(corner & 1) ? sample1.x() : sample0.x(),
+				(corner & 2) ? sample1.y() : sample0.y(),
+				(corner & 4) ? sample1.z() : sample0.z());
+			Eigen::Vector3i b = sample / brickSize;
+			int index = mReader.GetBrickIndex(b.x(), b.y(), b.z());
+			if (index != lastIndex) {
+				brick = GetBrick(b.x(), b.y(), b.z());
+				if (!brick) return false;
+				extent = mReader.GetBrickExtent(b.x(), b.y(), b.z());
+				lastIndex = index;
+			}
+			Eigen::Vector3i local = sample - b * brickSize;
+			const float* value = brick->data() + (((size_t)local.z() * extent.y() + local.y()) * extent.x() + local.x()) * numComponents;
+			for (int c = 0; c < numComponents; ++c)
+				corners[corner * numComponents + c] = value[c];
+		}
+		return true;
+	}
+
+	size_t BrickCache::GetCachedBytes() const
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		return mCachedBytes;
+	}
+
+	size_t BrickCache::GetNumDecodedBricks() const
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		return mNumDecoded;
+	}
+}
\ No newline at end of file
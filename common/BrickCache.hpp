@@ -0,0 +1,58 @@
+#pragma once
+
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include "BrickedReader.hpp"
+
+namespace vispro
+{
+	// Least-recently-used cache of decompressed bricks on top of a BrickedReader. Bricks are decoded on first access,
+	// so sampling a field only pays for the regions that are actually visited.
+	class BrickCache
+	{
+	public:
+		// Decompressed values of a brick in x-fastest order with interleaved components.
+		typedef std::shared_ptr<const std::vector<float>> BrickPtr;
+
+		// Constructor. Receives the maximum number of bytes of decompressed bricks that are kept in memory.
+		BrickCache(size_t budgetBytes = (size_t)256 << 20);
+
+		// Opens a bricked file. All cached bricks are dropped.
+		bool Open(const char* path);
+		// Gets the header of the opened file.
+		const BrickedReader::Header& GetHeader() const;
+
+		// Gets a brick, which is decoded if it is not in the cache. Returns nullptr if the brick could not be decoded.
+		BrickPtr GetBrick(int bx, int by, int bz);
+		// Copies the values at the eight corners of a grid cell into "corners" (8 * NumComponents floats).
+		// The corners are ordered x-fastest, i.e., (x0,y0,z0), (x1,y0,z0), (x0,y1,z0), ..., (x1,y1,z1).
+		bool GatherCorners(const Eigen::Vector3i& sample0, const Eigen::Vector3i& sample1, float* corners);
+
+		// Gets the number of bytes of the decompressed bricks that are currently cached.
+		size_t GetCachedBytes() const;
+		// Gets the number of bricks that were decoded since the file was opened.
+		size_t GetNumDecodedBricks() const;
+
+	private:
+		// Delete the copy-constructor.
+		BrickCache(const BrickCache& other) = delete;
+
+		// Reader of the bricked file.
+		BrickedReader mReader;
+		// Maximum number of bytes to keep in memory.
+		size_t mBudget;
+		// Number of bytes currently in memory.
+		size_t mCachedBytes;
+		// Number of decoded bricks.
+		size_t mNumDecoded;
+		// Brick indices ordered from most to least recently used.
+		std::list<int> mLru;
+		// Cached bricks together with their position in the LRU list.
+		std::unordered_map<int, std::pair<BrickPtr, std::list<int>::iterator>> mBricks;
+		// Guards the cache, which may be accessed by several threads.
+		mutable std::mutex mMutex;
+	};
+}
\ No newline at end of file
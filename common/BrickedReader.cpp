@@ -0,0 +1,113 @@
+#include "BrickedReader.hpp"
+#include "BrickedWriter.hpp"
+#include <cstring>
+#include <vtkSmartPointer.h>
+#include <vtkLZ4DataCompressor.h>
+#include <vtkZLibDataCompressor.h>
+
+namespace vispro
+{
+	// Reads a value from the mapped memory and advances the pointer.
+	template <typename T> static T ReadValue(const char*& ptr) {
+		T value;
+		memcpy(&value, ptr, sizeof(T));
+		ptr += sizeof(T);
+		return value;
+	}
+
+	BrickedReader::BrickedReader() : mHeader() {}
+
+	bool BrickedReader::Open(const char* path)
+	{
+		mIndex.clear();
+		if (!mFile.Open(path)) return false;
+
+		// the fixed part of the header
+		const int64_t fixedHeaderSize = 4 + 7 * sizeof(int32_t) + 6 * sizeof(double);
+		if (mFile.GetSize() < fixedHeaderSize || memcmp(mFile.GetData(), Magic, 4) != 0) return false;
+		const char* ptr = mFile.GetData() + 4;
+		if (ReadValue<int32_t>(ptr) != Version) return false;
+		for (int i = 0; i < 3; ++i) mHeader.Resolution[i] = ReadValue<int32_t>(ptr);
+		mHeader.NumComponents = ReadValue<int32_t>(ptr);
+		mHeader.BrickSize = ReadValue<int32_t>(ptr);
+		mHeader.Codec = ReadValue<int32_t>(ptr);
+		Eigen::Vector3d min, max;
+		for (int i = 0; i < 3; ++i) min[i] = ReadValue<double>(ptr);
+		for (int i = 0; i < 3; ++i) max[i] = ReadValue<double>(ptr);
+		mHeader.Bounds = Eigen::AlignedBox3d(min, max);
+
+		// Sanity check
+		if (mHeader.Resolution.minCoeff() <= 0 || mHeader.NumComponents <= 0 || mHeader.BrickSize <= 0) return false;
+		mHeader.Spacing = (max - min).cwiseQuotient((mHeader.Resolution - Eigen::Vector3i(1, 1, 1)).cast<double>());
+		for (int i = 0; i < 3; ++i)
+			mHeader.NumBricks[i] = (mHeader.Resolution[i] + mHeader.BrickSize - 1) / mHeader.BrickSize;
+
+		// the brick index
+		const int64_t totalBricks = (int64_t)mHeader.NumBricks.prod();
+		if (mFile.GetSize() < fixedHeaderSize + totalBricks * 2 * (int64_t)sizeof(uint64_t)) return false;
+		mIndex.resize(totalBricks);
+		for (int64_t iBrick = 0; iBrick < totalBricks; ++iBrick) {
+			mIndex[iBrick].first = ReadValue<uint64_t>(ptr);
+			mIndex[iBrick].second = ReadValue<uint64_t>(ptr);
+			if (mIndex[iBrick].first + mIndex[iBrick].second > (uint64_t)mFile.GetSize()) return false;
+		}
+		return true;
+	}
+
+	const BrickedReader::Header& BrickedReader::GetHeader() const { return mHeader; }
+
+	int BrickedReader::GetBrickIndex(int bx, int by, int bz) const
+	{
+		return (bz * mHeader.NumBricks[1] + by) * mHeader.NumBricks[0] + bx;
+	}
+
+	Eigen::Vector3i BrickedReader::GetBrickExtent(int bx, int by, int bz) const
+	{
+		const int brickSize = mHeader.BrickSize;
+		return Eigen::Vector3i(
+			std::min(brickSize, mHeader.Resolution[0] - bx * brickSize),
+			std::min(brickSize, mHeader.Resolution[1] - by * brickSize),
+			std::min(brickSize, mHeader.Resolution[2] - bz * brickSize));
+	}
+
+	bool BrickedReader::DecodeBrick(int bx, int by, int bz, std::vector<float>& output) const
+	{
+		const std::pair<uint64_t, uint64_t>& entry = mIndex[GetBrickIndex(bx, by, bz)];
+		const unsigned char* compressed = (const unsigned char*)mFile.GetData() + entry.first;
+		const size_t numValues = (size_t)GetBrickExtent(bx, by, bz).prod() * mHeader.NumComponents;
+		const size_t numBytes = numValues * sizeof(float);
+
+		// decompress the byte planes
+		std::vector<unsigned char> shuffled;
+		const unsigned char* planes = compressed;
+		switch ((BrickedWriter::ECodec)mHeader.Codec) {
+		case BrickedWriter::ECodec::None:
+			if (entry.second != numBytes) return false;
+			break;
+		case BrickedWriter::ECodec::LZ4: {
+			vtkNew<vtkLZ4DataCompressor> compressor;
+			shuffled.resize(numBytes);
+			if (compressor->Uncompress(compressed, entry.second, shuffled.data(), numBytes) != numBytes) return false;
+			planes = shuffled.data();
+			break;
+		}
+		case BrickedWriter::ECodec::ZLib: {
+			vtkNew<vtkZLibDataCompressor> compressor;
+			shuffled.resize(numBytes);
+			if (compressor->Uncompress(compressed, entry.second, shuffled.data(), numBytes) != numBytes) return false;
+			planes = shuffled.data();
+			break;
+		}
+		default:
+			return false;
+		}
+
+		// interleave the byte planes again
+		output.resize(numValues);
+		unsigned char* bytes = (unsigned char*)output.data();
+		for (size_t i = 0; i < numValues; ++i)
+			for (size_t b = 0; b < sizeof(float); ++b)
+				bytes[i * sizeof(float) + b] = planes[b * numValues + i];
+		return true;
+	}
+}
\ No newline at end of file
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <vector>
+#include <Eigen/Eigen>
+#include "MappedFile.hpp"
+
+namespace vispro
+{
+	// Reads fields in the bricked format (*.amb) that is written by BrickedWriter. The file is mapped into memory, so
+	// only the compressed bricks that are decoded are read from disk.
+	class BrickedReader
+	{
+	public:
+		// Header of a bricked file.
+		struct Header {
+			Eigen::AlignedBox3d Bounds;		// bounding box of the domain
+			Eigen::Vector3i Resolution;		// number of grid points per dimension
+			Eigen::Vector3d Spacing;		// distance between adjacent grid points
+			int NumComponents;				// number of floats per grid point
+			int BrickSize;					// number of grid points per brick and dimension
+			Eigen::Vector3i NumBricks;		// number of bricks per dimension
+			int Codec;						// codec of the bricks, see BrickedWriter::ECodec
+		};
+
+		// Identifier and version of the file format, shared with the BrickedWriter.
+		static constexpr char Magic[4] = { 'V', 'P', 'B', 'R' };
+		static constexpr int32_t Version = 1;
+
+		// Constructor.
+		BrickedReader();
+
+		// Opens a bricked file and reads its header and brick index.
+		bool Open(const char* path);
+		// Gets the header of the opened file.
+		const Header& GetHeader() const;
+
+		// Gets the linear index of a brick.
+		int GetBrickIndex(int bx, int by, int bz) const;
+		// Gets the number of grid points of a brick per dimension. Bricks at the upper boundary may be smaller.
+		Eigen::Vector3i GetBrickExtent(int bx, int by, int bz) const;
+		// Decompresses a brick. The output contains the values of the brick in x-fastest order with interleaved components.
+		bool DecodeBrick(int bx, int by, int bz, std::vector<float>& output) const;
+
+	private:
+		// Delete the copy-constructor.
+		BrickedReader(const BrickedReader& other) = delete;
+
+		// Mapping of the file.
+		MappedFile mFile;
+		// Header of the file.
+		Header mHeader;
+		// Byte offset and compressed size of each brick.
+		std::vector<std::pair<uint64_t, uint64_t>> mIndex;
+	};
+}
\ No newline at end of file
@@ -0,0 +1,114 @@
+#include "BrickedWriter.hpp"
+#include "BrickedReader.hpp"
+#include <cstdio>
+#include <vector>
+#include <vtkSmartPointer.h>
+#include <vtkImageData.h>
+#include <vtkPointData.h>
+#include <vtkFloatArray.h>
+#include <vtkLZ4DataCompressor.h>
+#include <vtkZLibDataCompressor.h>
+
+namespace vispro
+{
+	template <typename T> static void WriteValue(FILE* fp, const T& value) { fwrite(&value, sizeof(T), 1, fp); }
+
+	// Creates the compressor for a codec, or nullptr if the bricks are stored uncompressed.
+	static vtkSmartPointer<vtkDataCompressor> CreateCompressor(BrickedWriter::ECodec codec) {
+		switch (codec) {
+		case BrickedWriter::ECodec::LZ4: return vtkSmartPointer<vtkLZ4DataCompressor>::New();
+		case BrickedWriter::ECodec::ZLib: return vtkSmartPointer<vtkZLibDataCompressor>::New();
+		default: return nullptr;
+		}
+	}
+
+	bool BrickedWriter::WriteField(const char* path, const char* fieldName, vtkImageData* imageData, int brickSize, ECodec codec)
+	{
+		vtkFloatArray* floatArray = dynamic_cast<vtkFloatArray*>(imageData->GetPointData()->GetArray(fieldName));
+		if (!floatArray || brickSize <= 0) return false;
+		int* resolution = imageData->GetDimensions();
+		double* spacing = imageData->GetSpacing();
+		double* minCorner = imageData->GetOrigin();
+		const int numComponents = floatArray->GetNumberOfComponents();
+		const int numBricks[3] = {
+			(resolution[0] + brickSize - 1) / brickSize,
+			(resolution[1] + brickSize - 1) / brickSize,
+			(resolution[2] + brickSize - 1) / brickSize
+		};
+		const int64_t totalBricks = (int64_t)numBricks[0] * numBricks[1] * numBricks[2];
+
+		// compress all bricks in parallel
+		std::vector<std::vector<unsigned char>> compressed(totalBricks);
+		const float* values = floatArray->GetPointer(0);
+#ifndef _DEBUG
+#pragma omp parallel
+#endif
+		{
+			vtkSmartPointer<vtkDataCompressor> compressor = CreateCompressor(codec);
+			std::vector<float> brick;
+			std::vector<unsigned char> shuffled;
+#ifndef _DEBUG
+#pragma omp for schedule(dynamic)
+#endif
+			for (int64_t iBrick = 0; iBrick < totalBricks; ++iBrick) {
+				int bx = (int)(iBrick % numBricks[0]);
+				int by = (int)((iBrick / numBricks[0]) % numBricks[1]);
+				int bz = (int)(iBrick / ((int64_t)numBricks[0] * numBricks[1]));
+				int ex = std::min(brickSize, resolution[0] - bx * brickSize);
+				int ey = std::min(brickSize, resolution[1] - by * brickSize);
+				int ez = std::min(brickSize, resolution[2] - bz * brickSize);
+
+				// gather the brick into a contiguous block
+				brick.resize((size_t)ex * ey * ez * numComponents);
+				for (int iz = 0; iz < ez; ++iz)
+					for (int iy = 0; iy < ey; ++iy) {
+						int64_t src = (((int64_t)bz * brickSize + iz) * resolution[1] + by * brickSize + iy) * resolution[0] + bx * brickSize;
+						memcpy(&brick[((size_t)iz * ey + iy) * ex * numComponents], values + src * numComponents, sizeof(float) * ex * numComponents);
+					}
+
+				// group the bytes by significance: exponents and high mantissa bytes compress much better when they are adjacent
+				const size_t numValues = brick.size();
+				const unsigned char* bytes = (const unsigned char*)brick.data();
+				shuffled.resize(numValues * sizeof(float));
+				for (size_t i = 0; i < numValues; ++i)
+					for (size_t b = 0; b < sizeof(float); ++b)
+						shuffled[b * numValues + i] = bytes[i * sizeof(float) + b];
+
+				std::vector<unsigned char>& output = compressed[iBrick];
+				if (compressor) {
+					output.resize(compressor->GetMaximumCompressionSpace(shuffled.size()));
+					output.resize(compressor->Compress(shuffled.data(), shuffled.size(), output.data(), output.size()));
+				}
+				else output = shuffled;
+			}
+		}
+
+		FILE* fp = fopen(path, "wb");
+		if (!fp) return false;
+
+		// Write header
+		fwrite(BrickedReader::Magic, sizeof(char), 4, fp);
+		WriteValue(fp, BrickedReader::Version);
+		for (int i = 0; i < 3; ++i) WriteValue(fp, (int32_t)resolution[i]);
+		WriteValue(fp, (int32_t)numComponents);
+		WriteValue(fp, (int32_t)brickSize);
+		WriteValue(fp, (int32_t)codec);
+		for (int i = 0; i < 3; ++i) WriteValue(fp, minCorner[i]);
+		for (int i = 0; i < 3; ++i) WriteValue(fp, minCorner[i] + spacing[i] * (resolution[i] - 1));
+
+		// Write brick index, the payload starts right after it
+		uint64_t offset = (uint64_t)ftell(fp) + totalBricks * 2 * sizeof(uint64_t);
+		for (int64_t iBrick = 0; iBrick < totalBricks; ++iBrick) {
+			WriteValue(fp, offset);
+			WriteValue(fp, (uint64_t)compressed[iBrick].size());
+			offset += compressed[iBrick].size();
+		}
+
+		// Write bricks
+		for (int64_t iBrick = 0; iBrick < totalBricks; ++iBrick)
+			fwrite(compressed[iBrick].data(), sizeof(unsigned char), compressed[iBrick].size(), fp);
+		bool success = ferror(fp) == 0;
+		fclose(fp);
+		return success;
+	}
+}
\ No newline at end of file
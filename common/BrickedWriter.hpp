@@ -0,0 +1,23 @@
+#pragma once
+
+class vtkImageData;
+
+namespace vispro
+{
+	// Helper class for writing vtkImageData to the bricked format (*.amb).
+	// The lattice is split into cubic bricks that are compressed individually, followed by an index of the brick offsets,
+	// which allows to decompress only the bricks that are actually touched (see BrickedReader and BrickCache).
+	class BrickedWriter
+	{
+	public:
+		// Codecs for compressing the individual bricks.
+		enum class ECodec {
+			None,	// uncompressed
+			LZ4,	// fast decompression, moderate ratio
+			ZLib	// slower decompression, better ratio
+		};
+
+		// Writes the field with the given name in the vtkImageData to file. Scalar and vector fields are supported.
+		static bool WriteField(const char* path, const char* fieldName, vtkImageData* imageData, int brickSize = 32, ECodec codec = ECodec::LZ4);
+	};
+}
\ No newline at end of file
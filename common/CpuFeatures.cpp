@@ -0,0 +1,69 @@
+#include "CpuFeatures.hpp"
+#ifdef VISPRO_X86
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+namespace vispro
+{
+#ifdef VISPRO_X86
+	// Executes the cpuid instruction for a leaf and sub-leaf.
+	static void CpuId(unsigned int leaf, unsigned int subLeaf, unsigned int regs[4]) {
+#ifdef _MSC_VER
+		int info[4];
+		__cpuidex(info, (int)leaf, (int)subLeaf);
+		for (int i = 0; i < 4; ++i) regs[i] = (unsigned int)info[i];
+#else
+		__cpuid_count(leaf, subLeaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+	}
+
+	// Reads the extended control register 0, which tells which register states are saved by the operating system.
+	static unsigned long long ReadXCR0() {
+#ifdef _MSC_VER
+		return _xgetbv(0);
+#else
+		unsigned int eax, edx;
+		__asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+		return ((unsigned long long)edx << 32) | eax;
+#endif
+	}
+
+	// Bit masks of the supported instruction sets.
+	enum EFeature { AVX2 = 1, AVX512F = 2 };
+
+	static int DetectFeatures() {
+		unsigned int regs[4];
+		CpuId(0, 0, regs);
+		if (regs[0] < 7) return 0;
+		CpuId(1, 0, regs);
+		const bool fma = (regs[2] >> 12) & 1;
+		const bool osxsave = (regs[2] >> 27) & 1;
+		const bool avx = (regs[2] >> 28) & 1;
+		const bool f16c = (regs[2] >> 29) & 1;
+		if (!osxsave || !avx) return 0;
+		// the operating system has to save the ymm (and zmm) registers on context switches
+		const unsigned long long xcr0 = ReadXCR0();
+		if ((xcr0 & 0x6) != 0x6) return 0;
+		CpuId(7, 0, regs);
+		int features = 0;
+		if (((regs[1] >> 5) & 1) && fma && f16c) features |= AVX2;
+		if (((regs[1] >> 16) & 1) && (xcr0 & 0xE0) == 0xE0) features |= AVX512F;
+		return features;
+	}
+
+	static int GetFeatures() {
+		static const int features = DetectFeatures();
+		return features;
+	}
+
+	bool CpuFeatures::HasAVX2() { return (GetFeatures() & AVX2) != 0; }
+	bool CpuFeatures::HasAVX512F() { return (GetFeatures() & AVX512F) != 0; }
+#else
+	bool CpuFeatures::HasAVX2() { return false; }
+	bool CpuFeatures::HasAVX512F() { return false; }
+#endif
+}
\ No newline at end of file
@@ -0,0 +1,25 @@
+#pragma once
+
+// Instruction set specific code is compiled with target attributes and selected at runtime, so the binaries do not depend on the build machine.
+#if defined(__x86_64__) || defined(_M_X64)
+#define VISPRO_X86 1
+#endif
+
+#if defined(VISPRO_X86) && (defined(__GNUC__) || defined(__clang__))
+#define VISPRO_TARGET(isa) __attribute__((target(isa)))
+#else
+#define VISPRO_TARGET(isa)
+#endif
+
+namespace vispro
+{
+	// Runtime detection of the SIMD instruction sets that are supported by the CPU and the operating system.
+	class CpuFeatures
+	{
+	public:
+		// AVX2 together with FMA and F16C, i.e., Haswell or newer.
+		static bool HasAVX2();
+		// AVX-512 foundation instructions.
+		static bool HasAVX512F();
+	};
+}
\ No newline at end of file
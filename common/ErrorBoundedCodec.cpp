@@ -0,0 +1,257 @@
+#include "ErrorBoundedCodec.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <thread>
+#include <vtkSmartPointer.h>
+#include <vtkZLibDataCompressor.h>
+
+namespace vispro
+{
+	// Number of values that a block should hold. Blocks consist of whole z-slices.
+	static const int64_t BlockValues = (int64_t)1 << 19;
+	// Number of compressed bytes that are read at once when streaming.
+	static const int64_t StreamChunkSize = (int64_t)16 << 20;
+	// Codes in the residual stream. All smaller codes are zigzag-encoded residuals.
+	static const uint8_t Code16 = 253;		// followed by a 16-bit zigzag-encoded residual
+	static const uint8_t Code64 = 254;		// followed by a 64-bit zigzag-encoded residual
+	static const uint8_t CodeRaw = 255;		// followed by a verbatim float
+	// Largest magnitude of a quantization code, which keeps the predictions far from overflowing.
+	static const double MaxCode = 1e15;
+
+	// Maps signed residuals to unsigned integers, such that small magnitudes give small numbers.
+	static inline uint64_t ZigZag(int64_t value) { return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63); }
+	static inline int64_t UnZigZag(uint64_t value) { return (int64_t)(value >> 1) ^ -(int64_t)(value & 1); }
+
+	// Reconstructs a value from its quantization code. The encoder uses the same function to verify the error bound.
+	static inline float Reconstruct(int64_t code, double step) { return (float)((double)code * step); }
+
+	// Predicts the code of a grid point from its seven lower neighbors in the block (Lorenzo predictor). Missing neighbors are zero.
+	static inline int64_t Predict(const int64_t* codes, int64_t i, int x, int y, int z, int64_t nx, int64_t sliceSize) {
+		const int64_t c100 = x > 0 ? codes[i - 1] : 0;
+		const int64_t c010 = y > 0 ? codes[i - nx] : 0;
+		const int64_t c001 = z > 0 ? codes[i - sliceSize] : 0;
+		const int64_t c110 = x > 0 && y > 0 ? codes[i - nx - 1] : 0;
+		const int64_t c101 = x > 0 && z > 0 ? codes[i - sliceSize - 1] : 0;
+		const int64_t c011 = y > 0 && z > 0 ? codes[i - sliceSize - nx] : 0;
+		const int64_t c111 = x > 0 && y > 0 && z > 0 ? codes[i - sliceSize - nx - 1] : 0;
+		return c100 + c010 + c001 - c110 - c101 - c011 + c111;
+	}
+
+	// Quantizes and predicts the values of a block and writes the residual stream.
+	static void EncodeBlock(const float* input, int nx, int ny, int nz, double errorBound, std::vector<int64_t>& codes, std::vector<uint8_t>& encoded) {
+		const int64_t sliceSize = (int64_t)nx * ny;
+		const double step = 2 * errorBound;
+		codes.resize(sliceSize * nz);
+		encoded.clear();
+		int64_t i = 0;
+		for (int z = 0; z < nz; ++z)
+			for (int y = 0; y < ny; ++y)
+				for (int x = 0; x < nx; ++x, ++i) {
+					const float value = input[i];
+					const double quantized = std::nearbyint(value / step);
+					bool raw = !(std::abs(quantized) <= MaxCode);	// also catches NaN
+					const int64_t code = raw ? 0 : (int64_t)quantized;
+					if (!raw) raw = !(std::abs((double)Reconstruct(code, step) - value) <= errorBound);
+					if (raw) {
+						// raw values do not take part in the prediction
+						codes[i] = 0;
+						encoded.push_back(CodeRaw);
+						encoded.insert(encoded.end(), (const uint8_t*)&value, (const uint8_t*)&value + sizeof(float));
+						continue;
+					}
+					codes[i] = code;
+					const uint64_t residual = ZigZag(code - Predict(codes.data(), i, x, y, z, nx, sliceSize));
+					if (residual < Code16)
+						encoded.push_back((uint8_t)residual);
+					else if (residual <= 0xFFFF) {
+						const uint16_t residual16 = (uint16_t)residual;
+						encoded.push_back(Code16);
+						encoded.insert(encoded.end(), (const uint8_t*)&residual16, (const uint8_t*)&residual16 + sizeof(uint16_t));
+					}
+					else {
+						encoded.push_back(Code64);
+						encoded.insert(encoded.end(), (const uint8_t*)&residual, (const uint8_t*)&residual + sizeof(uint64_t));
+					}
+				}
+	}
+
+	// Reconstructs the values of a block from its residual stream. Returns false if the stream does not match the block.
+	static bool DecodeBlock(const uint8_t* encoded, int64_t encodedSize, int nx, int ny, int nz, double errorBound, std::vector<int64_t>& codes, float* output) {
+		const int64_t sliceSize = (int64_t)nx * ny;
+		const double step = 2 * errorBound;
+		codes.resize(sliceSize * nz);
+		const uint8_t* source = encoded;
+		const uint8_t* end = encoded + encodedSize;
+		int64_t i = 0;
+		for (int z = 0; z < nz; ++z)
+			for (int y = 0; y < ny; ++y)
+				for (int x = 0; x < nx; ++x, ++i) {
+					if (source >= end) return false;
+					const uint8_t symbol = *source++;
+					uint64_t residual = symbol;
+					if (symbol == CodeRaw) {
+						if (end - source < (int64_t)sizeof(float)) return false;
+						memcpy(&output[i], source, sizeof(float));
+						source += sizeof(float);
+						codes[i] = 0;
+						continue;
+					}
+					if (symbol == Code16) {
+						uint16_t residual16;
+						if (end - source < (int64_t)sizeof(uint16_t)) return false;
+						memcpy(&residual16, source, sizeof(uint16_t));
+						source += sizeof(uint16_t);
+						residual = residual16;
+					}
+					else if (symbol == Code64) {
+						if (end - source < (int64_t)sizeof(uint64_t)) return false;
+						memcpy(&residual, source, sizeof(uint64_t));
+						source += sizeof(uint64_t);
+					}
+					const int64_t code = Predict(codes.data(), i, x, y, z, nx, sliceSize) + UnZigZag(residual);
+					codes[i] = code;
+					output[i] = Reconstruct(code, step);
+				}
+		return source == end;
+	}
+
+	void ErrorBoundedCodec::Encode(const float* input, const Eigen::Vector3i& resolution, double errorBound, std::vector<char>& output)
+	{
+		const int64_t sliceSize = (int64_t)resolution.x() * resolution.y();
+		const int slicesPerBlock = (int)std::max((int64_t)1, BlockValues / sliceSize);
+		const int numBlocks = (resolution.z() + slicesPerBlock - 1) / slicesPerBlock;
+
+		// code the blocks independently
+		std::vector<std::vector<uint8_t>> blocks(numBlocks);
+		std::vector<BlockRecord> records(numBlocks);
+#ifndef _DEBUG
+#pragma omp parallel
+#endif
+		{
+			vtkSmartPointer<vtkZLibDataCompressor> compressor = vtkSmartPointer<vtkZLibDataCompressor>::New();
+			std::vector<int64_t> codes;
+			std::vector<uint8_t> encoded;
+#ifndef _DEBUG
+#pragma omp for schedule(dynamic)
+#endif
+			for (int iBlock = 0; iBlock < numBlocks; ++iBlock) {
+				const int firstSlice = iBlock * slicesPerBlock;
+				const int numSlices = std::min(slicesPerBlock, resolution.z() - firstSlice);
+				EncodeBlock(input + firstSlice * sliceSize, resolution.x(), resolution.y(), numSlices, errorBound, codes, encoded);
+
+				// blocks that zlib cannot shrink are stored as they are, which is marked by equal sizes
+				std::vector<uint8_t>& block = blocks[iBlock];
+				block.resize(compressor->GetMaximumCompressionSpace(encoded.size()));
+				size_t compressedSize = compressor->Compress(encoded.data(), encoded.size(), block.data(), block.size());
+				if (compressedSize == 0 || compressedSize >= encoded.size()) {
+					block = encoded;
+					compressedSize = encoded.size();
+				}
+				block.resize(compressedSize);
+				records[iBlock] = BlockRecord{ (int64_t)compressedSize, (int64_t)encoded.size() };
+			}
+		}
+
+		// header, block table and blocks
+		const StreamHeader header = { { 'V', 'P', 'E', 'B' }, numBlocks, slicesPerBlock, 0, errorBound };
+		output.assign((const char*)&header, (const char*)&header + sizeof(StreamHeader));
+		output.insert(output.end(), (const char*)records.data(), (const char*)(records.data() + numBlocks));
+		for (const std::vector<uint8_t>& block : blocks)
+			output.insert(output.end(), block.begin(), block.end());
+	}
+
+	bool ErrorBoundedCodec::Decode(const ReadFunction& read, const Eigen::Vector3i& resolution, float* output, int numThreads)
+	{
+		return Decode(read, resolution, 0, resolution.z(), output, numThreads);
+	}
+
+	bool ErrorBoundedCodec::Decode(const ReadFunction& read, const Eigen::Vector3i& resolution, int firstSlice, int numSlices, float* output, int numThreads)
+	{
+		// read the header and the block table
+		StreamHeader header;
+		if (!read(&header, sizeof(StreamHeader), 0) || memcmp(header.Magic, "VPEB", 4) != 0) return false;
+		if (header.NumBlocks <= 0 || header.SlicesPerBlock <= 0 || (int64_t)header.NumBlocks * header.SlicesPerBlock < resolution.z()) return false;
+		std::vector<BlockRecord> records(header.NumBlocks);
+		if (!read(records.data(), (int64_t)(records.size() * sizeof(BlockRecord)), sizeof(StreamHeader))) return false;
+		std::vector<int64_t> offsets(header.NumBlocks + 1);
+		offsets[0] = sizeof(StreamHeader) + records.size() * sizeof(BlockRecord);
+		for (int iBlock = 0; iBlock < header.NumBlocks; ++iBlock)
+			offsets[iBlock + 1] = offsets[iBlock] + records[iBlock].CompressedSize;
+
+		// blocks that overlap the requested slices
+		const int64_t sliceSize = (int64_t)resolution.x() * resolution.y();
+		const int slicesPerBlock = header.SlicesPerBlock;
+		const int endSlice = firstSlice + numSlices;
+		const int firstBlock = firstSlice / slicesPerBlock;
+		const int endBlock = std::min(header.NumBlocks, (endSlice + slicesPerBlock - 1) / slicesPerBlock);
+		if (numThreads <= 0) numThreads = std::max(1, (int)std::thread::hardware_concurrency());
+
+		// read chunks of consecutive blocks and decode the blocks of a chunk in parallel
+		std::vector<uint8_t> chunk;
+		for (int iBlock = firstBlock; iBlock < endBlock;) {
+			int endChunk = iBlock + 1;
+			while (endChunk < endBlock && offsets[endChunk + 1] - offsets[iBlock] <= StreamChunkSize) ++endChunk;
+			chunk.resize(offsets[endChunk] - offsets[iBlock]);
+			if (!read(chunk.data(), (int64_t)chunk.size(), offsets[iBlock])) return false;
+
+			std::atomic<bool> success(true);
+#ifndef _DEBUG
+#pragma omp parallel num_threads(std::min(numThreads, endChunk - iBlock))
+#endif
+			{
+				vtkSmartPointer<vtkZLibDataCompressor> compressor = vtkSmartPointer<vtkZLibDataCompressor>::New();
+				std::vector<uint8_t> encoded;
+				std::vector<int64_t> codes;
+				std::vector<float> slab;
+#ifndef _DEBUG
+#pragma omp for schedule(dynamic)
+#endif
+				for (int jBlock = iBlock; jBlock < endChunk; ++jBlock) {
+					const BlockRecord& record = records[jBlock];
+					const uint8_t* source = chunk.data() + (offsets[jBlock] - offsets[iBlock]);
+					if (record.CompressedSize != record.EncodedSize) {
+						encoded.resize(record.EncodedSize);
+						if (compressor->Uncompress(source, (size_t)record.CompressedSize, encoded.data(), encoded.size()) != encoded.size()) {
+							success = false;
+							continue;
+						}
+						source = encoded.data();
+					}
+
+					// blocks that are only partially requested are decoded into a slab and the requested slices are copied
+					const int blockFirstSlice = jBlock * slicesPerBlock;
+					const int blockNumSlices = std::min(slicesPerBlock, resolution.z() - blockFirstSlice);
+					const int copyFirstSlice = std::max(blockFirstSlice, firstSlice);
+					const int copyEndSlice = std::min(blockFirstSlice + blockNumSlices, endSlice);
+					const bool partial = copyFirstSlice != blockFirstSlice || copyEndSlice != blockFirstSlice + blockNumSlices;
+					float* target = output + (blockFirstSlice - firstSlice) * sliceSize;
+					if (partial) {
+						slab.resize(blockNumSlices * sliceSize);
+						target = slab.data();
+					}
+					if (!DecodeBlock(source, record.EncodedSize, resolution.x(), resolution.y(), blockNumSlices, header.ErrorBound, codes, target)) {
+						success = false;
+						continue;
+					}
+					if (partial)
+						memcpy(output + (copyFirstSlice - firstSlice) * sliceSize, target + (copyFirstSlice - blockFirstSlice) * sliceSize, (copyEndSlice - copyFirstSlice) * sliceSize * sizeof(float));
+				}
+			}
+			if (!success) return false;
+			iBlock = endChunk;
+		}
+		return true;
+	}
+
+	bool ErrorBoundedCodec::Decode(const char* data, int64_t size, const Eigen::Vector3i& resolution, float* output, int numThreads)
+	{
+		auto read = [data, size](void* buffer, int64_t count, int64_t offset) {
+			if (offset < 0 || offset + count > size) return false;
+			memcpy(buffer, data + offset, (size_t)count);
+			return true;
+		};
+		return Decode(read, resolution, output, numThreads);
+	}
+}
\ No newline at end of file
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+#include <Eigen/Eigen>
+
+namespace vispro
+{
+	// Error-bounded lossy compression of scalar fields in the style of SZ. Each value is quantized to the nearest multiple of
+	// twice the error bound, so that the reconstruction differs by at most the error bound. The integer codes are predicted from
+	// their lower neighbors (Lorenzo predictor) and the residuals are entropy-coded with zlib. Values that cannot be quantized,
+	// e.g., NaN or very large magnitudes, are stored verbatim.
+	// The field is split into blocks of consecutive z-slices that are coded independently, which allows to decode in parallel
+	// and to stream the data section block by block. The stream starts with a StreamHeader and a BlockRecord for each block.
+	class ErrorBoundedCodec
+	{
+	public:
+		// Header at the beginning of a compressed stream.
+		struct StreamHeader {
+			char Magic[4];			// "VPEB"
+			int32_t NumBlocks;		// number of blocks
+			int32_t SlicesPerBlock;	// number of z-slices per block, the last block may have fewer
+			int32_t Reserved;		// padding, always 0
+			double ErrorBound;		// maximum absolute error of the reconstruction
+		};
+		// Size of a block in the stream.
+		struct BlockRecord {
+			int64_t CompressedSize;	// number of bytes of the block in the stream
+			int64_t EncodedSize;	// number of bytes of the residuals before entropy coding
+		};
+		// Reads a number of bytes at an offset relative to the start of the stream. Returns false if the bytes are not available.
+		typedef std::function<bool(void* buffer, int64_t size, int64_t offset)> ReadFunction;
+
+		// Compresses a scalar field with the given resolution.
+		static void Encode(const float* input, const Eigen::Vector3i& resolution, double errorBound, std::vector<char>& output);
+		// Decompresses a stream into the full field. Blocks are read in chunks and decoded in parallel. Receives the number of threads, 0 uses all hardware threads.
+		static bool Decode(const ReadFunction& read, const Eigen::Vector3i& resolution, float* output, int numThreads = 0);
+		// Decompresses the z-slices [firstSlice, firstSlice + numSlices) into an output that holds only these slices. Only the blocks that overlap them are read.
+		static bool Decode(const ReadFunction& read, const Eigen::Vector3i& resolution, int firstSlice, int numSlices, float* output, int numThreads = 0);
+		// Decompresses a stream that is entirely in memory.
+		static bool Decode(const char* data, int64_t size, const Eigen::Vector3i& resolution, float* output, int numThreads = 0);
+	};
+}
\ No newline at end of file
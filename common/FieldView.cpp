@@ -0,0 +1,138 @@
+#include "FieldView.hpp"
+#include <vtkImageData.h>
+#include <vtkFloatArray.h>
+#include <vtkPointData.h>
+
+namespace vispro
+{
+	// Spreads the bits of an index, such that two zero bits separate adjacent bits. Shifting the result by the dimension interleaves three indices.
+	static int64_t SpreadBits(int64_t index) {
+		int64_t result = 0;
+		for (int bit = 0; bit < 21; ++bit)
+			result |= ((index >> bit) & 1) << (3 * bit);
+		return result;
+	}
+
+	// Number of tiles of the Morton layout per dimension.
+	static Eigen::Vector3i GetNumMortonTiles(const Eigen::Vector3i& dimensions) {
+		return (dimensions + Eigen::Vector3i::Constant(FieldView::MortonTileSize - 1)) / FieldView::MortonTileSize;
+	}
+
+	FieldView::FieldView() : Data(nullptr), Dimensions(0, 0, 0), NumComponents(0), Layout(ELayout::Linear), StrideY(0), StrideZ(0),
+		Offsets{ nullptr, nullptr, nullptr }, Steps{ nullptr, nullptr, nullptr }, Origin(0, 0, 0), Spacing(1, 1, 1), InvSpacing(1, 1, 1)
+	{}
+
+	FieldView::FieldView(vtkImageData* field, ELayout layout) : FieldView()
+	{
+		vtkFloatArray* array = field ? vtkFloatArray::SafeDownCast(field->GetPointData()->GetAbstractArray(0)) : nullptr;
+		if (!array) return;
+		Dimensions = Eigen::Vector3i(field->GetDimensions());
+		NumComponents = array->GetNumberOfComponents();
+		Layout = layout;
+		Origin = Eigen::Vector3d(field->GetOrigin());
+		Spacing = Eigen::Vector3d(field->GetSpacing());
+		InvSpacing = Spacing.cwiseInverse();
+		StrideY = (int64_t)Dimensions.x() * NumComponents;
+		StrideZ = StrideY * Dimensions.y();
+		if (layout == ELayout::Linear) Data = array->GetPointer(0);
+		else {
+			BuildTables();
+			Convert(array->GetPointer(0));
+		}
+	}
+
+	bool FieldView::IsValid() const { return Data != nullptr; }
+
+	bool FieldView::HasSameLattice(const FieldView& other) const
+	{
+		return Dimensions == other.Dimensions && NumComponents == other.NumComponents && Layout == other.Layout && Origin == other.Origin && Spacing == other.Spacing;
+	}
+
+	int64_t FieldView::GetOffset(int x, int y, int z) const
+	{
+		if (Layout == ELayout::Linear) return z * StrideZ + y * StrideY + (int64_t)x * NumComponents;
+		return Offsets[0][x] + Offsets[1][y] + Offsets[2][z];
+	}
+
+	void FieldView::BuildTables()
+	{
+		mTables = std::make_shared<std::vector<int64_t>>(2 * (size_t)Dimensions.sum());
+		int64_t* table = mTables->data();
+		const Eigen::Vector3i numTiles = GetNumMortonTiles(Dimensions);
+		for (int d = 0; d < 3; ++d) {
+			int64_t* offsets = table;
+			int64_t* steps = table + Dimensions[d];
+			table += 2 * Dimensions[d];
+			for (int64_t i = 0; i < Dimensions[d]; ++i) {
+				if (Layout == ELayout::Morton) {
+					// the tile contributes its stride between the tiles, the local index its interleaved bits
+					int64_t tileStride = (int64_t)MortonTileSize * MortonTileSize * MortonTileSize;
+					for (int e = 0; e < d; ++e)
+						tileStride *= numTiles[e];
+					auto offset = [&](int64_t index) { return ((index / MortonTileSize) * tileStride + (SpreadBits(index % MortonTileSize) << d)) * NumComponents; };
+					offsets[i] = offset(i);
+					steps[i] = offset(i + 1) - offset(i);
+				}
+				else {
+					// strides of a grid point inside a brick and of a brick, the bricks have one more grid point than cells per dimension
+					const int64_t localStride = d == 0 ? 1 : d == 1 ? BrickSize + 1 : (BrickSize + 1) * (BrickSize + 1);
+					int64_t brickStride = (int64_t)(BrickSize + 1) * (BrickSize + 1) * (BrickSize + 1);
+					for (int e = 0; e < d; ++e)
+						brickStride *= (Dimensions[e] - 1) / BrickSize + 1;
+					offsets[i] = ((i / BrickSize) * brickStride + (i % BrickSize) * localStride) * NumComponents;
+					steps[i] = localStride * NumComponents;
+				}
+			}
+			Offsets[d] = offsets;
+			Steps[d] = steps;
+		}
+	}
+
+	void FieldView::Convert(const float* linear)
+	{
+		const Eigen::Vector3i& dims = Dimensions;
+		const int numComponents = NumComponents;
+		if (Layout == ELayout::Morton) {
+			// the tiles are filled completely, the grid points beyond the lattice stay zero
+			const int64_t tileValues = (int64_t)MortonTileSize * MortonTileSize * MortonTileSize * numComponents;
+			mValues = std::make_shared<std::vector<float>>((size_t)(GetNumMortonTiles(dims).cast<int64_t>().prod() * tileValues), 0.f);
+			float* values = mValues->data();
+#ifndef _DEBUG
+#pragma omp parallel for
+#endif
+			for (int z = 0; z < dims.z(); ++z)
+				for (int y = 0; y < dims.y(); ++y)
+					for (int x = 0; x < dims.x(); ++x)
+						std::copy_n(linear + (((int64_t)z * dims.y() + y) * dims.x() + x) * numComponents, numComponents, values + GetOffset(x, y, z));
+		}
+		else {
+			// every brick is filled completely, grid points beyond the lattice repeat the last grid point
+			const Eigen::Vector3i numBricks = (dims - Eigen::Vector3i(1, 1, 1)) / BrickSize + Eigen::Vector3i(1, 1, 1);
+			const int64_t brickValues = (int64_t)(BrickSize + 1) * (BrickSize + 1) * (BrickSize + 1) * numComponents;
+			mValues = std::make_shared<std::vector<float>>((size_t)(numBricks.cast<int64_t>().prod() * brickValues));
+			float* values = mValues->data();
+#ifndef _DEBUG
+#pragma omp parallel for
+#endif
+			for (int bz = 0; bz < numBricks.z(); ++bz) {
+				for (int by = 0; by < numBricks.y(); ++by) {
+					for (int bx = 0; bx < numBricks.x(); ++bx) {
+						float* brick = values + ((int64_t)(bz * numBricks.y() + by) * numBricks.x() + bx) * brickValues;
+						for (int lz = 0; lz <= BrickSize; ++lz) {
+							const int z = std::min(bz * BrickSize + lz, dims.z() - 1);
+							for (int ly = 0; ly <= BrickSize; ++ly) {
+								const int y = std::min(by * BrickSize + ly, dims.y() - 1);
+								for (int lx = 0; lx <= BrickSize; ++lx) {
+									const int x = std::min(bx * BrickSize + lx, dims.x() - 1);
+									std::copy_n(linear + (((int64_t)z * dims.y() + y) * dims.x() + x) * numComponents, numComponents,
+										brick + ((lz * (BrickSize + 1) + ly) * (BrickSize + 1) + lx) * numComponents);
+								}
+							}
+						}
+					}
+				}
+			}
+		}
+		Data = mValues->data();
+	}
+}
\ No newline at end of file
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include <Eigen/Eigen>
+
+class vtkImageData;
+
+namespace vispro
+{
+	// View of the values of a float field on a uniform grid. It is built once per field, so that sampling reads the values
+	// through a raw pointer instead of looking up the array, the lattice and the tuples of the vtkImageData for every sample.
+	// The components of a grid point are always consecutive. The order of the grid points is given by the layout: the linear
+	// layout views the array of the field without copying it, the other layouts hold a reordered copy of the values.
+	// In the other layouts, the offset of a grid point is the sum of one table entry per dimension.
+	struct FieldView {
+		// Order of the grid points in memory.
+		enum class ELayout {
+			Linear,		// x fastest, as in the vtkImageData
+			Morton,		// Z-order curve inside tiles of MortonTileSize^3 grid points, i.e., the bits of the local indices are interleaved, with x fastest between
+						// the tiles. Lattices are padded to whole tiles, which costs less than MortonTileSize - 1 grid points per dimension, e.g., nothing for 640x240x80.
+			Bricked,	// bricks of BrickSize^3 cells with x fastest inside and between bricks. A halo of one grid point on the upper
+						// faces of each brick repeats the neighbors, so that all corners of a cell are in the same brick.
+		};
+
+		// Number of cells per dimension of a brick of the bricked layout.
+		static constexpr int BrickSize = 8;
+		// Number of grid points per dimension of a tile of the Morton layout, which is a power of two.
+		static constexpr int MortonTileSize = 16;
+
+		// Constructor. Creates an empty view.
+		FieldView();
+		// Constructor. Views the first point data array of a field, which has to be a vtkFloatArray. The view is empty otherwise.
+		// Layouts other than the linear one reorder the values into a copy. The linear layout is invalidated when the array is
+		// resized or the lattice of the field changes.
+		explicit FieldView(vtkImageData* field, ELayout layout = ELayout::Linear);
+
+		// Checks whether the view points to values.
+		bool IsValid() const;
+		// Checks whether another view has the same lattice, number of components and layout, i.e., whether a grid point is at the same offset in both.
+		bool HasSameLattice(const FieldView& other) const;
+		// Gets the offset of the first component of a grid point.
+		int64_t GetOffset(int x, int y, int z) const;
+
+		const float* Data;				// values in the layout
+		Eigen::Vector3i Dimensions;		// number of grid points per dimension
+		int NumComponents;				// number of values per grid point
+		ELayout Layout;					// order of the grid points
+		int64_t StrideY;				// offset between adjacent rows of the linear layout
+		int64_t StrideZ;				// offset between adjacent slices of the linear layout
+		const int64_t* Offsets[3];		// per dimension, offset contributed by the index of a grid point. Null for the linear layout.
+		const int64_t* Steps[3];		// per dimension, offset from a grid point to its upper neighbor in the same cell. Null for the linear layout.
+		Eigen::Vector3d Origin;			// location of the first grid point
+		Eigen::Vector3d Spacing;		// distance between adjacent grid points
+		Eigen::Vector3d InvSpacing;		// reciprocal of the spacing, which turns the divisions of a sample into multiplications
+
+	private:
+		// Fills the offset and step tables of a layout other than the linear one.
+		void BuildTables();
+		// Reorders the values of a linear array into the layout.
+		void Convert(const float* linear);
+
+		// Storage of the offset and step tables, which is shared between copies of the view.
+		std::shared_ptr<std::vector<int64_t>> mTables;
+		// Storage of the reordered values, which is shared between copies of the view. Empty for the linear layout.
+		std::shared_ptr<std::vector<float>> mValues;
+	};
+}
\ No newline at end of file
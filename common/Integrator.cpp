@@ -0,0 +1,34 @@
+#include "Integrator.hpp"
+
+namespace vispro
+{
+	const char* Integrator::GetName(EMethod method) {
+		switch (method) {
+		case EMethod::Euler: return "Euler";
+		case EMethod::RK2: return "RK2";
+		case EMethod::RK4: return "RK4";
+		case EMethod::DormandPrince: return "DormandPrince";
+		}
+		return "";
+	}
+
+	int Integrator::GetNumStages(EMethod method) {
+		switch (method) {
+		case EMethod::Euler: return Euler::NumStages;
+		case EMethod::RK2: return RK2::NumStages;
+		case EMethod::RK4: return RK4::NumStages;
+		case EMethod::DormandPrince: return DormandPrince::NumStages - 1;	// the last stage is the first of the next step
+		}
+		return 0;
+	}
+
+	double Integrator::GetReach(EMethod method) {
+		switch (method) {
+		case EMethod::Euler: return GetReach<Euler>();
+		case EMethod::RK2: return GetReach<RK2>();
+		case EMethod::RK4: return GetReach<RK4>();
+		case EMethod::DormandPrince: return GetReach<DormandPrince>();
+		}
+		return 1;
+	}
+}
\ No newline at end of file
@@ -0,0 +1,170 @@
+#pragma once
+
+#include <Eigen/Eigen>
+
+namespace vispro
+{
+	// Explicit Runge-Kutta integrators for the advection of particles. Each integrator is a policy with its Butcher tableau,
+	// which the tracers are instantiated with, so that the stages are unrolled at compile time. At runtime, the tracers pick
+	// the instantiation from a table with one entry per method, in the order of EMethod.
+	class Integrator
+	{
+	public:
+		// Integration methods.
+		enum class EMethod {
+			Euler,	// explicit Euler, first order, one sample per step
+			RK2,	// explicit midpoint rule, second order, two samples per step
+			RK4,	// classical Runge-Kutta, fourth order, four samples per step
+			DormandPrince,	// Dormand-Prince 5(4), fifth order with an embedded fourth-order error estimate, six samples per step
+		};
+		// Number of integration methods.
+		static const int NumMethods = 4;
+
+		// Explicit Euler.
+		struct Euler {
+			static constexpr int NumStages = 1;
+			static constexpr double A[1][1] = { { 0 } };	// weights of the previous stages in the location of a stage
+			static constexpr double B[1] = { 1 };			// weights of the stages in the step
+			static constexpr double C[1] = { 0 };			// relative times of the stages
+		};
+		// Explicit midpoint rule.
+		struct RK2 {
+			static constexpr int NumStages = 2;
+			static constexpr double A[2][2] = { { 0, 0 }, { 0.5, 0 } };
+			static constexpr double B[2] = { 0, 1 };
+			static constexpr double C[2] = { 0, 0.5 };
+		};
+		// Classical fourth-order Runge-Kutta.
+		struct RK4 {
+			static constexpr int NumStages = 4;
+			static constexpr double A[4][4] = { { 0, 0, 0, 0 }, { 0.5, 0, 0, 0 }, { 0, 0.5, 0, 0 }, { 0, 0, 1, 0 } };
+			static constexpr double B[4] = { 1 / 6., 1 / 3., 1 / 3., 1 / 6. };
+			static constexpr double C[4] = { 0, 0.5, 0.5, 1 };
+		};
+		// Dormand-Prince 5(4). The last stage is sampled at the end of the step (first same as last), so that it is the first stage
+		// of the next step. It only enters the error estimate, fixed steps skip it.
+		struct DormandPrince {
+			static constexpr int NumStages = 7;
+			static constexpr int EmbeddedOrder = 4;	// order of the solution that the error is estimated with
+			static constexpr double A[7][7] = {
+				{ 0, 0, 0, 0, 0, 0, 0 },
+				{ 1 / 5., 0, 0, 0, 0, 0, 0 },
+				{ 3 / 40., 9 / 40., 0, 0, 0, 0, 0 },
+				{ 44 / 45., -56 / 15., 32 / 9., 0, 0, 0, 0 },
+				{ 19372 / 6561., -25360 / 2187., 64448 / 6561., -212 / 729., 0, 0, 0 },
+				{ 9017 / 3168., -355 / 33., 46732 / 5247., 49 / 176., -5103 / 18656., 0, 0 },
+				{ 35 / 384., 0, 500 / 1113., 125 / 192., -2187 / 6784., 11 / 84., 0 } };
+			static constexpr double B[7] = { 35 / 384., 0, 500 / 1113., 125 / 192., -2187 / 6784., 11 / 84., 0 };
+			static constexpr double C[7] = { 0, 1 / 5., 3 / 10., 4 / 5., 8 / 9., 1, 1 };
+			static constexpr double E[7] = { 71 / 57600., 0, -71 / 16695., 71 / 1920., -17253 / 339200., 22 / 525., -1 / 40. };	// difference of the weights of the two solutions
+		};
+
+		// Parameters of the step size control of embedded methods.
+		struct StepControl {
+			double Tolerance;	// largest distance between the two solutions of a step that is accepted, in world space
+			double MinStepSize;	// smallest magnitude of the step size, steps of this size are accepted regardless of their error
+			double MaxStepSize;	// largest magnitude of the step size
+		};
+
+		// Gets the name of an integration method.
+		static const char* GetName(EMethod method);
+		// Gets the number of samples per step of an integration method.
+		static int GetNumStages(EMethod method);
+		// Gets the reach of an integration method (see GetReach<Method>).
+		static double GetReach(EMethod method);
+
+		// Location of a stage of a step, given the velocities of the previous stages.
+		template <class Method>
+		static Eigen::Vector3d GetStage(const Eigen::Vector3d& position, double stepSize, const Eigen::Vector3d* k, int stage);
+		// Advances a location by one step of the method. The sampler is called as sample(location, relativeTime, velocity), with
+		// the time relative to the start of the step, and returns false if the location is outside of the domain. The step is
+		// abandoned then and false is returned, the location is unchanged in that case.
+		template <class Method, class Sampler>
+		static bool Step(Eigen::Vector3d& position, double stepSize, Sampler&& sample);
+
+		// Gets the distance from the start of a step to its samples and its end at most, in units of the step size times the largest speed. This is
+		// the largest sum of the magnitudes of the weights of a row of A or of B, which exceeds one for methods with negative weights, e.g., about 24.7 for Dormand-Prince.
+		template <class Method>
+		static constexpr double GetReach();
+		// Checks whether a stage enters the step or a later stage. Stages that do not are skipped by fixed steps.
+		template <class Method>
+		static constexpr bool IsStageUsed(int stage);
+		// Samples the stages of a step of an embedded method after the first one, whose velocity is given in k[0]. The sampler is called
+		// as in Step and false is returned if a stage is outside of the domain. Otherwise, the end of the step is the location of the last
+		// stage and k[NumStages - 1] is the velocity there, i.e., the first stage of the next step.
+		template <class Method, class Sampler>
+		static bool SampleStages(const Eigen::Vector3d& position, double stepSize, Eigen::Vector3d* k, Sampler&& sample);
+		// Estimates the error of a step of an embedded method from the velocities of its stages.
+		template <class Method>
+		static double GetError(double stepSize, const Eigen::Vector3d* k);
+		// Adapts the step size to the error of a step of an embedded method and returns whether the step is accepted. The step size
+		// is replaced by the magnitude of the next one, i.e., of the step that retries a rejected step or follows an accepted one.
+		template <class Method>
+		static bool AdaptStepSize(const StepControl& control, double error, double& stepSize);
+	};
+
+	template <class Method>
+	Eigen::Vector3d Integrator::GetStage(const Eigen::Vector3d& position, double stepSize, const Eigen::Vector3d* k, int stage) {
+		Eigen::Vector3d location = position;
+		for (int j = 0; j < stage; ++j)
+			if (Method::A[stage][j] != 0) location += stepSize * Method::A[stage][j] * k[j];
+		return location;
+	}
+
+	template <class Method, class Sampler>
+	bool Integrator::Step(Eigen::Vector3d& position, double stepSize, Sampler&& sample) {
+		Eigen::Vector3d k[Method::NumStages];
+		for (int stage = 0; stage < Method::NumStages; ++stage)
+			if (IsStageUsed<Method>(stage) && !sample(GetStage<Method>(position, stepSize, k, stage), Method::C[stage] * stepSize, k[stage])) return false;
+		for (int stage = 0; stage < Method::NumStages; ++stage)
+			if (Method::B[stage] != 0) position += stepSize * Method::B[stage] * k[stage];
+		return true;
+	}
+
+	template <class Method>
+	constexpr double Integrator::GetReach() {
+		double reach = 0, sum = 0;
+		for (int stage = 0; stage < Method::NumStages; ++stage) {
+			double rowSum = 0;
+			for (int j = 0; j < stage; ++j)
+				rowSum += Method::A[stage][j] < 0 ? -Method::A[stage][j] : Method::A[stage][j];
+			reach = rowSum > reach ? rowSum : reach;
+			sum += Method::B[stage] < 0 ? -Method::B[stage] : Method::B[stage];
+		}
+		return sum > reach ? sum : reach;
+	}
+
+	template <class Method>
+	constexpr bool Integrator::IsStageUsed(int stage) {
+		if (Method::B[stage] != 0) return true;
+		for (int later = stage + 1; later < Method::NumStages; ++later)
+			if (Method::A[later][stage] != 0) return true;
+		return false;
+	}
+
+	template <class Method, class Sampler>
+	bool Integrator::SampleStages(const Eigen::Vector3d& position, double stepSize, Eigen::Vector3d* k, Sampler&& sample) {
+		for (int stage = 1; stage < Method::NumStages; ++stage)
+			if (!sample(GetStage<Method>(position, stepSize, k, stage), Method::C[stage] * stepSize, k[stage])) return false;
+		return true;
+	}
+
+	template <class Method>
+	double Integrator::GetError(double stepSize, const Eigen::Vector3d* k) {
+		Eigen::Vector3d error(0, 0, 0);
+		for (int stage = 0; stage < Method::NumStages; ++stage)
+			if (Method::E[stage] != 0) error += Method::E[stage] * k[stage];
+		return std::abs(stepSize) * error.norm();
+	}
+
+	template <class Method>
+	bool Integrator::AdaptStepSize(const StepControl& control, double error, double& stepSize) {
+		// the usual controller with a safety factor, which grows or shrinks the step by at most a factor of five
+		const double size = std::abs(stepSize);
+		const bool accepted = error <= control.Tolerance || size <= control.MinStepSize;
+		double factor = error > 0 ? 0.9 * std::pow(control.Tolerance / error, 1. / (Method::EmbeddedOrder + 1)) : 5;
+		factor = std::min(accepted ? 5. : 1., std::max(0.2, factor));
+		stepSize = std::min(control.MaxStepSize, std::max(control.MinStepSize, size * factor));
+		return accepted;
+	}
+}
\ No newline at end of file
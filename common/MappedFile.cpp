@@ -0,0 +1,81 @@
+#include "MappedFile.hpp"
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace vispro
+{
+#ifdef _WIN32
+	MappedFile::MappedFile() : mData(nullptr), mSize(0), mMapping(nullptr) {}
+#else
+	MappedFile::MappedFile() : mData(nullptr), mSize(0) {}
+#endif
+
+	MappedFile::~MappedFile() { Close(); }
+
+	bool MappedFile::Open(const char* path) { return Open(path, 0, 0); }
+
+	bool MappedFile::Open(const char* path, int64_t offset, int64_t size)
+	{
+		Close();
+#ifdef _WIN32
+		HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+		if (file == INVALID_HANDLE_VALUE) return false;
+		LARGE_INTEGER fileSize;
+		if (!GetFileSizeEx(file, &fileSize) || offset < 0 || offset >= fileSize.QuadPart || (size != 0 && offset + size > fileSize.QuadPart)) {
+			CloseHandle(file);
+			return false;
+		}
+		if (size == 0) size = fileSize.QuadPart - offset;
+		// the mapping object keeps the file alive, so the file handle can be closed right away
+		mMapping = CreateFileMappingA(file, NULL, PAGE_WRITECOPY, 0, 0, NULL);
+		CloseHandle(file);
+		if (!mMapping) return false;
+		mData = (char*)MapViewOfFile(mMapping, FILE_MAP_COPY, (DWORD)(offset >> 32), (DWORD)(offset & 0xFFFFFFFF), (SIZE_T)size);
+		if (!mData) {
+			CloseHandle(mMapping);
+			mMapping = nullptr;
+			return false;
+		}
+		mSize = size;
+#else
+		int fd = open(path, O_RDONLY);
+		if (fd < 0) return false;
+		struct stat st;
+		if (fstat(fd, &st) != 0 || offset < 0 || offset >= (int64_t)st.st_size || (size != 0 && offset + size > (int64_t)st.st_size)) {
+			close(fd);
+			return false;
+		}
+		if (size == 0) size = (int64_t)st.st_size - offset;
+		// private mapping: writes end up in anonymous copies of the touched pages
+		void* data = mmap(nullptr, (size_t)size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, (off_t)offset);
+		close(fd);
+		if (data == MAP_FAILED) return false;
+		mData = (char*)data;
+		mSize = size;
+#endif
+		return true;
+	}
+
+	void MappedFile::Close()
+	{
+		if (!mData) return;
+#ifdef _WIN32
+		UnmapViewOfFile(mData);
+		CloseHandle(mMapping);
+		mMapping = nullptr;
+#else
+		munmap(mData, (size_t)mSize);
+#endif
+		mData = nullptr;
+		mSize = 0;
+	}
+
+	char* MappedFile::GetData() const { return mData; }
+	int64_t MappedFile::GetSize() const { return mSize; }
+}
\ No newline at end of file
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstdint>
+
+namespace vispro
+{
+	// Maps a file into the address space. Pages are only read from disk when they are first touched.
+	// The mapping is copy-on-write, i.e., writing to the memory does not modify the file.
+	class MappedFile
+	{
+	public:
+		// Constructor.
+		MappedFile();
+		// Destructor. Unmaps the file.
+		~MappedFile();
+
+		// Maps the file at the given path. Returns false if the file could not be mapped.
+		bool Open(const char* path);
+		// Maps a range of the file. The offset has to be a multiple of the allocation granularity, which is 64 KB on
+		// Windows and the page size elsewhere. A size of 0 maps the rest of the file.
+		bool Open(const char* path, int64_t offset, int64_t size);
+		// Unmaps the file.
+		void Close();
+
+		// Gets the pointer to the first mapped byte.
+		char* GetData() const;
+		// Gets the size of the mapped range in bytes.
+		int64_t GetSize() const;
+
+	private:
+		// Delete the copy-constructor.
+		MappedFile(const MappedFile& other) = delete;
+
+		// Pointer to the mapped memory.
+		char* mData;
+		// Size of the mapped memory in bytes.
+		int64_t mSize;
+#ifdef _WIN32
+		// Handle of the file mapping object.
+		void* mMapping;
+#endif
+	};
+}
\ No newline at end of file
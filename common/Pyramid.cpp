@@ -0,0 +1,150 @@
+#include "Pyramid.hpp"
+#include <algorithm>
+#include <cmath>
+#include <vtkImageData.h>
+#include <vtkPointData.h>
+#include <vtkFloatArray.h>
+#include <Eigen/Eigen>
+
+namespace vispro
+{
+	// Largest number of fine grid points that contribute to a coarse grid point along one axis.
+	static const int MaxTaps = 8;
+
+	// Weights of the fine grid points that contribute to each coarse grid point along one axis.
+	struct Taps {
+		std::vector<int> First;			// first contributing fine grid point
+		std::vector<float> Weights;		// MaxTaps normalized weights per coarse grid point, unused taps are zero
+	};
+
+	// Computes the filter taps for the reduction of an axis with a given number of fine and coarse grid points.
+	static Taps GetTaps(int numFine, int numCoarse, Pyramid::EFilter filter) {
+		Taps taps;
+		taps.First.resize(numCoarse);
+		taps.Weights.assign((size_t)numCoarse * MaxTaps, 0.0f);
+		// distance of coarse grid points in units of fine grid points
+		const double ratio = numCoarse > 1 ? (numFine - 1.0) / (numCoarse - 1.0) : 1.0;
+		const double radius = filter == Pyramid::EFilter::Box ? 0.5 * ratio + 0.5 : ratio;
+		const double sigma = 0.5 * ratio;
+		for (int i = 0; i < numCoarse; ++i) {
+			const double center = i * ratio;
+			const int first = std::max(0, (int)std::ceil(center - radius));
+			const int last = std::min(std::min(numFine - 1, (int)std::floor(center + radius)), first + MaxTaps - 1);
+			float* weights = &taps.Weights[(size_t)i * MaxTaps];
+			double sum = 0;
+			for (int j = first; j <= last; ++j) {
+				double weight;
+				if (filter == Pyramid::EFilter::Box)	// overlap of the fine cell around j with the coarse cell around the center
+					weight = std::max(0.0, std::min(j + 0.5, center + 0.5 * ratio) - std::max(j - 0.5, center - 0.5 * ratio));
+				else weight = std::exp(-0.5 * (j - center) * (j - center) / (sigma * sigma));
+				weights[j - first] = (float)weight;
+				sum += weight;
+			}
+			// the weights are renormalized at the boundary, where part of the support is missing
+			for (int j = first; j <= last; ++j)
+				weights[j - first] = sum > 0 ? (float)(weights[j - first] / sum) : (j == first ? 1.0f : 0.0f);
+			taps.First[i] = first;
+		}
+		return taps;
+	}
+
+	// Filters and subsamples one axis of an array with interleaved components. The output has the coarse number of grid points along the axis.
+	static void ReduceAxis(const float* input, const Eigen::Vector3i& inputDims, int axis, const Taps& taps, int numComponents, float* output) {
+		Eigen::Vector3i outputDims = inputDims;
+		outputDims[axis] = (int)taps.First.size();
+		const int64_t strides[3] = { numComponents, (int64_t)numComponents * inputDims.x(), (int64_t)numComponents * inputDims.x() * inputDims.y() };
+		const int64_t axisStride = strides[axis];
+		const int64_t numLines = (int64_t)outputDims.y() * outputDims.z();
+#ifndef _DEBUG
+#pragma omp parallel for schedule(static)
+#endif
+		for (int64_t iLine = 0; iLine < numLines; ++iLine) {
+			const int y = (int)(iLine % outputDims.y());
+			const int z = (int)(iLine / outputDims.y());
+			float* target = output + iLine * outputDims.x() * numComponents;
+			for (int x = 0; x < outputDims.x(); ++x) {
+				int coord[3] = { x, y, z };
+				const int i = coord[axis];
+				coord[axis] = taps.First[i];
+				const float* source = input + coord[0] * strides[0] + coord[1] * strides[1] + coord[2] * strides[2];
+				const float* weights = &taps.Weights[(size_t)i * MaxTaps];
+				for (int c = 0; c < numComponents; ++c) {
+					float sum = 0;
+					for (int t = 0; t < MaxTaps && coord[axis] + t < inputDims[axis]; ++t)
+						sum += weights[t] * source[t * axisStride + c];
+					target[x * numComponents + c] = sum;
+				}
+			}
+		}
+	}
+
+	std::string Pyramid::GetLevelSuffix(int level)
+	{
+		if (level <= 0) return "";
+		return "-" + std::to_string(1 << level) + "x";
+	}
+
+	std::string Pyramid::GetLevelPath(const std::string& path, int level)
+	{
+		const size_t extension = path.find_last_of('.');
+		const size_t separator = path.find_last_of("/\\");
+		if (extension == std::string::npos || (separator != std::string::npos && extension < separator))
+			return path + GetLevelSuffix(level);
+		return path.substr(0, extension) + GetLevelSuffix(level) + path.substr(extension);
+	}
+
+	vtkSmartPointer<vtkImageData> Pyramid::Reduce(vtkImageData* field, EFilter filter)
+	{
+		const Eigen::Vector3i dims(field->GetDimensions());
+		const Eigen::Vector3d spacing(field->GetSpacing());
+		Eigen::Vector3i coarseDims;
+		Eigen::Vector3d coarseSpacing;
+		Taps taps[3];
+		for (int i = 0; i < 3; ++i) {
+			// axes with more than one grid point keep at least two, so that the bounding box is preserved
+			coarseDims[i] = dims[i] > 1 ? std::max(2, (dims[i] + 1) / 2) : 1;
+			coarseSpacing[i] = coarseDims[i] > 1 ? spacing[i] * (dims[i] - 1) / (coarseDims[i] - 1) : spacing[i];
+			taps[i] = GetTaps(dims[i], coarseDims[i], filter);
+		}
+
+		vtkNew<vtkImageData> coarse;
+		coarse->SetDimensions(coarseDims.data());
+		coarse->SetOrigin(field->GetOrigin());
+		coarse->SetSpacing(coarseSpacing.data());
+
+		// filter x, then y, then z, which shrinks the data with every pass
+		std::vector<float> bufferX, bufferY;
+		vtkPointData* pointData = field->GetPointData();
+		for (int iArray = 0; iArray < pointData->GetNumberOfArrays(); ++iArray) {
+			vtkFloatArray* array = dynamic_cast<vtkFloatArray*>(pointData->GetArray(iArray));
+			if (!array) continue;
+			const int numComponents = array->GetNumberOfComponents();
+			vtkNew<vtkFloatArray> coarseArray;
+			coarseArray->SetName(array->GetName());
+			coarseArray->SetNumberOfComponents(numComponents);
+			coarseArray->SetNumberOfTuples((int64_t)coarseDims.prod());
+			bufferX.resize((size_t)coarseDims.x() * dims.y() * dims.z() * numComponents);
+			bufferY.resize((size_t)coarseDims.x() * coarseDims.y() * dims.z() * numComponents);
+			ReduceAxis(array->GetPointer(0), dims, 0, taps[0], numComponents, bufferX.data());
+			ReduceAxis(bufferX.data(), Eigen::Vector3i(coarseDims.x(), dims.y(), dims.z()), 1, taps[1], numComponents, bufferY.data());
+			ReduceAxis(bufferY.data(), Eigen::Vector3i(coarseDims.x(), coarseDims.y(), dims.z()), 2, taps[2], numComponents, coarseArray->GetPointer(0));
+			coarse->GetPointData()->AddArray(coarseArray);
+		}
+		if (pointData->GetScalars() && pointData->GetScalars()->GetName())
+			coarse->GetPointData()->SetActiveScalars(pointData->GetScalars()->GetName());
+		if (pointData->GetVectors() && pointData->GetVectors()->GetName())
+			coarse->GetPointData()->SetActiveVectors(pointData->GetVectors()->GetName());
+		return coarse.Get();
+	}
+
+	std::vector<vtkSmartPointer<vtkImageData>> Pyramid::Build(vtkImageData* field, EFilter filter, int numLevels)
+	{
+		std::vector<vtkSmartPointer<vtkImageData>> levels;
+		vtkImageData* previous = field;
+		for (int level = 1; level < numLevels; ++level) {
+			levels.push_back(Reduce(previous, filter));
+			previous = levels.back();
+		}
+		return levels;
+	}
+}
\ No newline at end of file
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <vtkSmartPointer.h>
+
+class vtkImageData;
+
+namespace vispro
+{
+	// Resolution pyramid of a field for interactive previews. Level 0 is the field itself and each further level halves the
+	// number of grid points along every axis (2x, 4x, 8x). The coarse lattices keep the bounding box of the field, i.e., the
+	// spacing is stretched slightly if the number of grid points is even. The levels are stored next to the field with a
+	// suffix, e.g., "halfcylinder-vorticity-1.20-2x.am".
+	class Pyramid
+	{
+	public:
+		// Filter that is applied before subsampling.
+		enum class EFilter {
+			Box,		// average of the fine grid points that fall into a coarse cell
+			Gaussian	// Gaussian with a standard deviation of half a coarse cell
+		};
+
+		// Number of levels including the full resolution.
+		static constexpr int NumLevels = 4;
+
+		// Gets the suffix of a level in file names, e.g., "-2x". Level 0 has no suffix.
+		static std::string GetLevelSuffix(int level);
+		// Gets the path of a level by inserting the suffix before the extension.
+		static std::string GetLevelPath(const std::string& path, int level);
+
+		// Reduces all float arrays of a field by a factor of two along each axis. The axes are filtered one after the other in parallel.
+		static vtkSmartPointer<vtkImageData> Reduce(vtkImageData* field, EFilter filter);
+		// Computes the levels 1 to numLevels - 1 of a field, each one from the previous one.
+		static std::vector<vtkSmartPointer<vtkImageData>> Build(vtkImageData* field, EFilter filter, int numLevels = NumLevels);
+	};
+}
\ No newline at end of file
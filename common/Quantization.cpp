@@ -0,0 +1,183 @@
+#include "Quantization.hpp"
+#include "CpuFeatures.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#ifdef VISPRO_X86
+#include <immintrin.h>
+#endif
+
+namespace vispro
+{
+	static uint32_t AsUInt(float value) { uint32_t u; memcpy(&u, &value, sizeof(float)); return u; }
+	static float AsFloat(uint32_t value) { float f; memcpy(&f, &value, sizeof(float)); return f; }
+
+	uint16_t Quantization::FloatToHalf(float value)
+	{
+		const uint32_t f32Infinity = 255u << 23;
+		const uint32_t f16Max = (127u + 16u) << 23;
+		const uint32_t denormMagic = ((127u - 15u) + (23u - 10u) + 1u) << 23;
+		uint32_t f = AsUInt(value);
+		const uint32_t sign = f & 0x80000000u;
+		f ^= sign;
+		uint16_t result;
+		if (f >= f16Max) {
+			// too large for a half: infinity, or quiet NaN if the input was NaN
+			result = (f > f32Infinity) ? 0x7E00 : 0x7C00;
+		}
+		else if (f < (113u << 23)) {
+			// the result is subnormal: let the float unit do the rounding by adding a magic number
+			result = (uint16_t)(AsUInt(AsFloat(f) + AsFloat(denormMagic)) - denormMagic);
+		}
+		else {
+			// rebias the exponent and round the mantissa to nearest even
+			const uint32_t mantissaOdd = (f >> 13) & 1;
+			f += ((15u - 127u) << 23) + 0xFFF;
+			f += mantissaOdd;
+			result = (uint16_t)(f >> 13);
+		}
+		return result | (uint16_t)(sign >> 16);
+	}
+
+	float Quantization::HalfToFloat(uint16_t value)
+	{
+		const uint32_t shiftedExponent = 0x7C00u << 13;
+		uint32_t f = ((uint32_t)value & 0x7FFF) << 13;
+		const uint32_t exponent = shiftedExponent & f;
+		f += (127u - 15u) << 23;
+		if (exponent == shiftedExponent) {
+			// infinity or NaN
+			f += (128u - 16u) << 23;
+		}
+		else if (exponent == 0) {
+			// zero or subnormal: renormalize with the float unit
+			f += 1u << 23;
+			f = AsUInt(AsFloat(f) - AsFloat(113u << 23));
+		}
+		return AsFloat(f | (((uint32_t)value & 0x8000) << 16));
+	}
+
+	void Quantization::EncodeHalf(const float* input, size_t count, uint16_t* output)
+	{
+		for (size_t i = 0; i < count; ++i)
+			output[i] = FloatToHalf(input[i]);
+	}
+
+	void Quantization::EncodeUNorm16(const float* input, size_t count, float scale, float bias, uint16_t* output)
+	{
+		const float invScale = scale > 0 ? 1.0f / scale : 0.0f;
+		for (size_t i = 0; i < count; ++i)
+			output[i] = (uint16_t)std::lround(std::min(std::max((input[i] - bias) * invScale, 0.0f), 65535.0f));
+	}
+
+	void Quantization::EncodeUNorm8(const float* input, size_t count, float scale, float bias, uint8_t* output)
+	{
+		const float invScale = scale > 0 ? 1.0f / scale : 0.0f;
+		for (size_t i = 0; i < count; ++i)
+			output[i] = (uint8_t)std::lround(std::min(std::max((input[i] - bias) * invScale, 0.0f), 255.0f));
+	}
+
+	// ----- scalar decoders, also used for the remainder of the vectorized loops -----
+
+	static void DecodeHalfScalar(const uint16_t* input, size_t count, float* output) {
+		for (size_t i = 0; i < count; ++i)
+			output[i] = Quantization::HalfToFloat(input[i]);
+	}
+
+	template <typename T>
+	static void DecodeUNormScalar(const T* input, size_t count, float scale, float bias, float* output) {
+		for (size_t i = 0; i < count; ++i)
+			output[i] = bias + scale * (float)input[i];
+	}
+
+	// ----- AVX2 decoders, eight values per iteration -----
+#ifdef VISPRO_X86
+	VISPRO_TARGET("avx2,f16c")
+	static void DecodeHalfAVX2(const uint16_t* input, size_t count, float* output) {
+		size_t i = 0;
+		for (; i + 8 <= count; i += 8)
+			_mm256_storeu_ps(output + i, _mm256_cvtph_ps(_mm_loadu_si128((const __m128i*)(input + i))));
+		DecodeHalfScalar(input + i, count - i, output + i);
+	}
+
+	VISPRO_TARGET("avx2")
+	static void DecodeUNorm16AVX2(const uint16_t* input, size_t count, float scale, float bias, float* output) {
+		const __m256 vscale = _mm256_set1_ps(scale);
+		const __m256 vbias = _mm256_set1_ps(bias);
+		size_t i = 0;
+		for (; i + 8 <= count; i += 8) {
+			__m256 q = _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)(input + i))));
+			// multiply and add separately, so that the result matches the scalar code
+			_mm256_storeu_ps(output + i, _mm256_add_ps(vbias, _mm256_mul_ps(vscale, q)));
+		}
+		DecodeUNormScalar(input + i, count - i, scale, bias, output + i);
+	}
+
+	VISPRO_TARGET("avx2")
+	static void DecodeUNorm8AVX2(const uint8_t* input, size_t count, float scale, float bias, float* output) {
+		const __m256 vscale = _mm256_set1_ps(scale);
+		const __m256 vbias = _mm256_set1_ps(bias);
+		size_t i = 0;
+		for (; i + 8 <= count; i += 8) {
+			__m256 q = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(input + i))));
+			_mm256_storeu_ps(output + i, _mm256_add_ps(vbias, _mm256_mul_ps(vscale, q)));
+		}
+		DecodeUNormScalar(input + i, count - i, scale, bias, output + i);
+	}
+#endif
+
+	void Quantization::DecodeHalf(const uint16_t* input, size_t count, float* output)
+	{
+#ifdef VISPRO_X86
+		if (CpuFeatures::HasAVX2()) return DecodeHalfAVX2(input, count, output);
+#endif
+		DecodeHalfScalar(input, count, output);
+	}
+
+	void Quantization::DecodeUNorm16(const uint16_t* input, size_t count, float scale, float bias, float* output)
+	{
+#ifdef VISPRO_X86
+		if (CpuFeatures::HasAVX2()) return DecodeUNorm16AVX2(input, count, scale, bias, output);
+#endif
+		DecodeUNormScalar(input, count, scale, bias, output);
+	}
+
+	void Quantization::DecodeUNorm8(const uint8_t* input, size_t count, float scale, float bias, float* output)
+	{
+#ifdef VISPRO_X86
+		if (CpuFeatures::HasAVX2()) return DecodeUNorm8AVX2(input, count, scale, bias, output);
+#endif
+		DecodeUNormScalar(input, count, scale, bias, output);
+	}
+
+	size_t Quantization::GetSize(EStorage storage)
+	{
+		switch (storage) {
+		case EStorage::Half: return sizeof(uint16_t);
+		case EStorage::UNorm16: return sizeof(uint16_t);
+		case EStorage::UNorm8: return sizeof(uint8_t);
+		case EStorage::ErrorBounded: return 0;
+		default: return sizeof(float);
+		}
+	}
+
+	void Quantization::Encode(EStorage storage, const float* input, size_t count, float scale, float bias, void* output)
+	{
+		switch (storage) {
+		case EStorage::Half: EncodeHalf(input, count, (uint16_t*)output); break;
+		case EStorage::UNorm16: EncodeUNorm16(input, count, scale, bias, (uint16_t*)output); break;
+		case EStorage::UNorm8: EncodeUNorm8(input, count, scale, bias, (uint8_t*)output); break;
+		default: memcpy(output, input, count * sizeof(float)); break;
+		}
+	}
+
+	void Quantization::Decode(EStorage storage, const void* input, size_t count, float scale, float bias, float* output)
+	{
+		switch (storage) {
+		case EStorage::Half: DecodeHalf((const uint16_t*)input, count, output); break;
+		case EStorage::UNorm16: DecodeUNorm16((const uint16_t*)input, count, scale, bias, output); break;
+		case EStorage::UNorm8: DecodeUNorm8((const uint8_t*)input, count, scale, bias, output); break;
+		default: memcpy(output, input, count * sizeof(float)); break;
+		}
+	}
+}
\ No newline at end of file
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace vispro
+{
+	// Conversion between floats and the compact storage types of fields that are only used for visualization.
+	// Half floats are IEEE 754 binary16. Normalized integers store (value - bias) / scale rounded to the nearest integer.
+	// The decoders use AVX2/F16C if the CPU supports it and fall back to bit-identical scalar code otherwise.
+	class Quantization
+	{
+	public:
+		// Storage types of field values.
+		enum class EStorage {
+			Float,		// 32-bit float
+			Half,		// 16-bit float
+			UNorm16,	// 16-bit normalized integer with scale and bias
+			UNorm8,		// 8-bit normalized integer with scale and bias
+			ErrorBounded	// 32-bit float compressed with an absolute error bound (see ErrorBoundedCodec), the scale holds the error bound
+		};
+
+		// Gets the number of bytes of a single value, or 0 if the values are compressed and have no fixed size.
+		static size_t GetSize(EStorage storage);
+		// Encodes an array of floats into the given storage type. Scale and bias are ignored for float and half. Compressed storage is not handled here.
+		static void Encode(EStorage storage, const float* input, size_t count, float scale, float bias, void* output);
+		// Decodes an array of values in the given storage type to floats. Scale and bias are ignored for float and half.
+		static void Decode(EStorage storage, const void* input, size_t count, float scale, float bias, float* output);
+
+		// Converts a float to a half float with round-to-nearest-even.
+		static uint16_t FloatToHalf(float value);
+		// Converts a half float to a float.
+		static float HalfToFloat(uint16_t value);
+
+		// Converts an array of floats to half floats.
+		static void EncodeHalf(const float* input, size_t count, uint16_t* output);
+		// Converts an array of half floats to floats.
+		static void DecodeHalf(const uint16_t* input, size_t count, float* output);
+
+		// Quantizes an array of floats to 16-bit normalized integers.
+		static void EncodeUNorm16(const float* input, size_t count, float scale, float bias, uint16_t* output);
+		// Reconstructs floats from 16-bit normalized integers, i.e., bias + scale * input.
+		static void DecodeUNorm16(const uint16_t* input, size_t count, float scale, float bias, float* output);
+
+		// Quantizes an array of floats to 8-bit normalized integers.
+		static void EncodeUNorm8(const float* input, size_t count, float scale, float bias, uint8_t* output);
+		// Reconstructs floats from 8-bit normalized integers, i.e., bias + scale * input.
+		static void DecodeUNorm8(const uint8_t* input, size_t count, float scale, float bias, float* output);
+	};
+}
\ No newline at end of file
@@ -0,0 +1,167 @@
+#include "RandomAccessFile.hpp"
+#include <algorithm>
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <cerrno>
+#include <climits>
+#include <vector>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+namespace vispro
+{
+	// Large requests are split, since a single call transfers at most 2 GB on most systems.
+	static const int64_t MaxRequestSize = (int64_t)1 << 30;
+
+#ifdef _WIN32
+	RandomAccessFile::RandomAccessFile() : mHandle(INVALID_HANDLE_VALUE) {}
+#else
+	RandomAccessFile::RandomAccessFile() : mFd(-1) {}
+#endif
+
+	RandomAccessFile::~RandomAccessFile() { Close(); }
+
+	bool RandomAccessFile::Open(const char* path, EMode mode)
+	{
+		Close();
+#ifdef _WIN32
+		if (mode == EMode::Read)
+			mHandle = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+		else mHandle = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL, mode == EMode::Create ? CREATE_ALWAYS : OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+		return mHandle != INVALID_HANDLE_VALUE;
+#else
+		if (mode == EMode::Read)
+			mFd = open(path, O_RDONLY);
+		else mFd = open(path, O_RDWR | O_CREAT | (mode == EMode::Create ? O_TRUNC : 0), 0644);
+		return mFd >= 0;
+#endif
+	}
+
+	void RandomAccessFile::Close()
+	{
+		if (!IsOpen()) return;
+#ifdef _WIN32
+		CloseHandle(mHandle);
+		mHandle = INVALID_HANDLE_VALUE;
+#else
+		close(mFd);
+		mFd = -1;
+#endif
+	}
+
+#ifdef _WIN32
+	bool RandomAccessFile::IsOpen() const { return mHandle != INVALID_HANDLE_VALUE; }
+#else
+	bool RandomAccessFile::IsOpen() const { return mFd >= 0; }
+	int RandomAccessFile::GetDescriptor() const { return mFd; }
+#endif
+
+	bool RandomAccessFile::ReadAt(void* buffer, int64_t size, int64_t offset) const
+	{
+		char* dst = (char*)buffer;
+		while (size > 0) {
+			const int64_t request = std::min(size, MaxRequestSize);
+#ifdef _WIN32
+			// the offset is passed in the OVERLAPPED structure, the file pointer is not used
+			OVERLAPPED overlapped = {};
+			overlapped.Offset = (DWORD)(offset & 0xFFFFFFFF);
+			overlapped.OffsetHigh = (DWORD)(offset >> 32);
+			DWORD numRead = 0;
+			if (!ReadFile(mHandle, dst, (DWORD)request, &numRead, &overlapped) || numRead == 0) return false;
+			const int64_t done = numRead;
+#else
+			const ssize_t done = pread(mFd, dst, (size_t)request, (off_t)offset);
+			if (done < 0 && errno == EINTR) continue;
+			if (done <= 0) return false;
+#endif
+			dst += done;
+			offset += done;
+			size -= done;
+		}
+		return true;
+	}
+
+	bool RandomAccessFile::ReadAt(const Segment* segments, int numSegments, int64_t offset) const
+	{
+#ifdef _WIN32
+		// there is no vectored read for regular files, so each segment is read on its own
+		for (int i = 0; i < numSegments; ++i) {
+			if (segments[i].Buffer && !ReadAt(segments[i].Buffer, segments[i].Size, offset)) return false;
+			offset += segments[i].Size;
+		}
+		return true;
+#else
+		// skipped bytes are read into a scratch buffer, which all skipped segments share
+		int64_t maxSkipped = 0;
+		for (int i = 0; i < numSegments; ++i)
+			if (!segments[i].Buffer) maxSkipped = std::max(maxSkipped, segments[i].Size);
+		std::vector<char> scratch((size_t)maxSkipped);
+		std::vector<iovec> iov(numSegments);
+		for (int i = 0; i < numSegments; ++i) {
+			iov[i].iov_base = segments[i].Buffer ? segments[i].Buffer : scratch.data();
+			iov[i].iov_len = (size_t)segments[i].Size;
+		}
+
+		// a call may transfer fewer bytes, so we continue behind the last transferred byte
+		size_t first = 0;
+		while (first < iov.size()) {
+			const int count = (int)std::min(iov.size() - first, (size_t)IOV_MAX);
+			const ssize_t done = preadv(mFd, iov.data() + first, count, (off_t)offset);
+			if (done < 0 && errno == EINTR) continue;
+			if (done <= 0) return false;
+			offset += done;
+			size_t remaining = (size_t)done;
+			while (first < iov.size() && remaining >= iov[first].iov_len) {
+				remaining -= iov[first].iov_len;
+				++first;
+			}
+			if (remaining > 0) {
+				iov[first].iov_base = (char*)iov[first].iov_base + remaining;
+				iov[first].iov_len -= remaining;
+			}
+		}
+		return true;
+#endif
+	}
+
+	bool RandomAccessFile::WriteAt(const void* buffer, int64_t size, int64_t offset)
+	{
+		const char* src = (const char*)buffer;
+		while (size > 0) {
+			const int64_t request = std::min(size, MaxRequestSize);
+#ifdef _WIN32
+			OVERLAPPED overlapped = {};
+			overlapped.Offset = (DWORD)(offset & 0xFFFFFFFF);
+			overlapped.OffsetHigh = (DWORD)(offset >> 32);
+			DWORD numWritten = 0;
+			if (!WriteFile(mHandle, src, (DWORD)request, &numWritten, &overlapped) || numWritten == 0) return false;
+			const int64_t done = numWritten;
+#else
+			const ssize_t done = pwrite(mFd, src, (size_t)request, (off_t)offset);
+			if (done < 0 && errno == EINTR) continue;
+			if (done <= 0) return false;
+#endif
+			src += done;
+			offset += done;
+			size -= done;
+		}
+		return true;
+	}
+
+	int64_t RandomAccessFile::GetSize() const
+	{
+#ifdef _WIN32
+		LARGE_INTEGER size;
+		if (!GetFileSizeEx(mHandle, &size)) return 0;
+		return size.QuadPart;
+#else
+		struct stat st;
+		if (fstat(mFd, &st) != 0) return 0;
+		return (int64_t)st.st_size;
+#endif
+	}
+}
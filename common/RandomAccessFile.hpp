@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstdint>
+
+namespace vispro
+{
+	// File with positional reads and writes (pread/pwrite). There is no shared file pointer, so several threads can
+	// read from the same file at the same time.
+	class RandomAccessFile
+	{
+	public:
+		// How a file is opened.
+		enum class EMode {
+			Read,		// read-only, the file has to exist
+			ReadWrite,	// read and write, the file is created if it does not exist
+			Create,		// read and write, an existing file is truncated
+		};
+
+		// Part of a vectored read: a number of consecutive bytes that go to a buffer. The bytes of a segment without buffer are skipped.
+		struct Segment {
+			void* Buffer;
+			int64_t Size;
+		};
+
+		// Constructor.
+		RandomAccessFile();
+		// Destructor. Closes the file.
+		~RandomAccessFile();
+
+		// Opens the file at the given path. Returns false if the file could not be opened.
+		bool Open(const char* path, EMode mode = EMode::Read);
+		// Closes the file.
+		void Close();
+		// Checks whether a file is open.
+		bool IsOpen() const;
+
+		// Reads a number of bytes at the given offset. Returns false if not all bytes could be read.
+		bool ReadAt(void* buffer, int64_t size, int64_t offset) const;
+		// Reads consecutive bytes at the given offset into several buffers with a single call where possible (preadv).
+		// This gathers strided data, e.g., rows of a sub-box, with few system calls. Returns false if not all bytes could be read.
+		bool ReadAt(const Segment* segments, int numSegments, int64_t offset) const;
+		// Writes a number of bytes at the given offset. The file grows if needed. Returns false if not all bytes could be written.
+		bool WriteAt(const void* buffer, int64_t size, int64_t offset);
+		// Gets the current size of the file in bytes.
+		int64_t GetSize() const;
+#ifndef _WIN32
+		// Gets the file descriptor (-1 if no file is open), e.g., to submit asynchronous reads.
+		int GetDescriptor() const;
+#endif
+
+	private:
+		// Delete the copy-constructor.
+		RandomAccessFile(const RandomAccessFile& other) = delete;
+
+#ifdef _WIN32
+		// Handle of the file.
+		void* mHandle;
+#else
+		// File descriptor.
+		int mFd;
+#endif
+	};
+}
@@ -1,51 +1,248 @@
 #include "Sampling.hpp"
-#include <vtkImageData.h>
-#include <vtkFloatArray.h>
-#include <vtkPointData.h>
+#include "BrickCache.hpp"
+#include "CpuFeatures.hpp"
+#include <limits>
+#ifdef VISPRO_X86
+#include <immintrin.h>
+#endif
 
 namespace vispro
 {
 	double Sampling::LinearSample1(const Eigen::Vector3d& position, vtkImageData* field) {
-		Eigen::Vector3d origin(field->GetOrigin());
-		Eigen::Vector3d spacing(field->GetSpacing());
-		Eigen::Vector3i dimensions(field->GetDimensions());
-		Eigen::Vector3d relative = (position - origin).cwiseQuotient(spacing);
+		return LinearSample1(position, FieldView(field));
+	}
+
+	Eigen::Vector3d Sampling::LinearSample3(const Eigen::Vector3d& position, vtkImageData* field) {
+		return LinearSample3(position, FieldView(field));
+	}
+
+	// ----- batched sampling of vector fields -----
+	// The kernels repeat the operations of LinearSample in the same order for several locations at once. Products and sums are
+	// never fused, which keeps every lane bit-identical to the scalar code.
+
+	// Samples one location after the other. The second field is optional, it is blended with the first one in time.
+	static void LinearSample3Scalar(const double* x, const double* y, const double* z, int64_t count, const FieldView& field, const FieldView* field1, const double* times, int64_t timeStride, double* u, double* v, double* w) {
+		for (int64_t i = 0; i < count; ++i) {
+			const Eigen::Vector3d position(x[i], y[i], z[i]);
+			Eigen::Vector3d sample = field1 ? Sampling::LinearSample3(position, field, *field1, times[i * timeStride]) : Sampling::LinearSample3(position, field);
+			u[i] = sample.x();
+			v[i] = sample.y();
+			w[i] = sample.z();
+		}
+	}
+
+#ifdef VISPRO_X86
+	// Four locations per iteration. Only AVX2 is enabled, so the compiler cannot contract the products and sums into FMAs.
+	VISPRO_TARGET("avx2")
+	static void LinearSample3AVX2(const double* x, const double* y, const double* z, int64_t count, const FieldView& field, const FieldView* field1, const double* times, int64_t timeStride, double* u, double* v, double* w) {
+		const __m256d one = _mm256_set1_pd(1.0);
+		const __m256d vinterp = _mm256_set1_pd(*times);
+		const __m256d origin[3] = { _mm256_set1_pd(field.Origin.x()), _mm256_set1_pd(field.Origin.y()), _mm256_set1_pd(field.Origin.z()) };
+		const __m256d invSpacing[3] = { _mm256_set1_pd(field.InvSpacing.x()), _mm256_set1_pd(field.InvSpacing.y()), _mm256_set1_pd(field.InvSpacing.z()) };
+		const __m128i maxIndex[3] = { _mm_set1_epi32(field.Dimensions.x() - 1), _mm_set1_epi32(field.Dimensions.y() - 1), _mm_set1_epi32(field.Dimensions.z() - 1) };
+		// the strides of the linear layout are multiplied with the low 32 bits of the lanes, the caller made sure that they fit
+		const bool linear = field.Layout == FieldView::ELayout::Linear;
+		const __m256i stride[3] = { _mm256_set1_epi64x(3), _mm256_set1_epi64x(field.StrideY), _mm256_set1_epi64x(field.StrideZ) };
+		const double* position[3] = { x, y, z };
+		int64_t i = 0;
+		for (; i + 4 <= count; i += 4) {
+			// cell and local coordinates per dimension
+			__m256d interp[3], interp1[3];
+			__m256i offset0[3], offset1[3];
+			for (int d = 0; d < 3; ++d) {
+				const __m256d relative = _mm256_mul_pd(_mm256_sub_pd(_mm256_loadu_pd(position[d] + i), origin[d]), invSpacing[d]);
+				const __m128i truncated = _mm256_cvttpd_epi32(relative);
+				const __m128i sample0 = _mm_min_epi32(_mm_max_epi32(truncated, _mm_setzero_si128()), maxIndex[d]);
+				const __m128i sample1 = _mm_min_epi32(_mm_max_epi32(_mm_add_epi32(truncated, _mm_set1_epi32(1)), _mm_setzero_si128()), maxIndex[d]);
+				interp[d] = _mm256_sub_pd(relative, _mm256_cvtepi32_pd(sample0));
+				interp1[d] = _mm256_sub_pd(one, interp[d]);
+				if (linear) {
+					offset0[d] = _mm256_mul_epi32(_mm256_cvtepi32_epi64(sample0), stride[d]);
+					offset1[d] = _mm256_mul_epi32(_mm256_cvtepi32_epi64(sample1), stride[d]);
+				}
+				else {
+					// offsets from the tables of the layout, the step is masked out where the upper corner is clamped to the lower one
+					const __m256i clamped = _mm256_cvtepi32_epi64(_mm_cmpeq_epi32(sample0, sample1));
+					offset0[d] = _mm256_i32gather_epi64((const long long*)field.Offsets[d], sample0, 8);
+					offset1[d] = _mm256_add_epi64(offset0[d], _mm256_andnot_si256(clamped, _mm256_i32gather_epi64((const long long*)field.Steps[d], sample0, 8)));
+				}
+			}
+
+			// corners in the order of LinearSample, i.e., x fastest, and their weights
+			__m256i corner[8];
+			__m256d weight[8];
+			for (int c = 0; c < 8; ++c) {
+				const int cx = c & 1, cy = (c >> 1) & 1, cz = c >> 2;
+				corner[c] = _mm256_add_epi64(_mm256_add_epi64(cz ? offset1[2] : offset0[2], cy ? offset1[1] : offset0[1]), cx ? offset1[0] : offset0[0]);
+				weight[c] = _mm256_mul_pd(_mm256_mul_pd(cz ? interp[2] : interp1[2], cy ? interp[1] : interp1[1]), cx ? interp[0] : interp1[0]);
+			}
+			// the corners of the second time step are at the same offsets
+			double* output[3] = { u, v, w };
+			for (int component = 0; component < 3; ++component) {
+				__m256d sum[2];
+				for (int iField = 0; iField < (field1 ? 2 : 1); ++iField) {
+					const float* data = (iField == 0 ? field.Data : field1->Data) + component;
+					sum[iField] = _mm256_mul_pd(weight[0], _mm256_cvtps_pd(_mm256_i64gather_ps(data, corner[0], 4)));
+					for (int c = 1; c < 8; ++c)
+						sum[iField] = _mm256_add_pd(sum[iField], _mm256_mul_pd(weight[c], _mm256_cvtps_pd(_mm256_i64gather_ps(data, corner[c], 4))));
+				}
+				if (field1) sum[0] = _mm256_add_pd(sum[0], _mm256_mul_pd(_mm256_sub_pd(sum[1], sum[0]), timeStride ? _mm256_loadu_pd(times + i) : vinterp));
+				_mm256_storeu_pd(output[component] + i, sum[0]);
+			}
+		}
+		LinearSample3Scalar(x + i, y + i, z + i, count - i, field, field1, times + i * timeStride, timeStride, u + i, v + i, w + i);
+	}
+
+	// Eight locations per iteration. AVX-512 implies FMA, so products and sums use the explicitly rounded instructions, which are never contracted.
+	VISPRO_TARGET("avx512f")
+	static void LinearSample3AVX512(const double* x, const double* y, const double* z, int64_t count, const FieldView& field, const FieldView* field1, const double* times, int64_t timeStride, double* u, double* v, double* w) {
+		const int rounding = _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC;
+		const __m512d one = _mm512_set1_pd(1.0);
+		const __m512d vinterp = _mm512_set1_pd(*times);
+		const __m512d origin[3] = { _mm512_set1_pd(field.Origin.x()), _mm512_set1_pd(field.Origin.y()), _mm512_set1_pd(field.Origin.z()) };
+		const __m512d invSpacing[3] = { _mm512_set1_pd(field.InvSpacing.x()), _mm512_set1_pd(field.InvSpacing.y()), _mm512_set1_pd(field.InvSpacing.z()) };
+		const __m256i maxIndex[3] = { _mm256_set1_epi32(field.Dimensions.x() - 1), _mm256_set1_epi32(field.Dimensions.y() - 1), _mm256_set1_epi32(field.Dimensions.z() - 1) };
+		const bool linear = field.Layout == FieldView::ELayout::Linear;
+		const __m512i stride[3] = { _mm512_set1_epi64(3), _mm512_set1_epi64(field.StrideY), _mm512_set1_epi64(field.StrideZ) };
+		const double* position[3] = { x, y, z };
+		int64_t i = 0;
+		for (; i + 8 <= count; i += 8) {
+			__m512d interp[3], interp1[3];
+			__m512i offset0[3], offset1[3];
+			for (int d = 0; d < 3; ++d) {
+				const __m512d relative = _mm512_mul_round_pd(_mm512_sub_round_pd(_mm512_loadu_pd(position[d] + i), origin[d], rounding), invSpacing[d], rounding);
+				const __m256i truncated = _mm512_cvttpd_epi32(relative);
+				const __m256i sample0 = _mm256_min_epi32(_mm256_max_epi32(truncated, _mm256_setzero_si256()), maxIndex[d]);
+				const __m256i sample1 = _mm256_min_epi32(_mm256_max_epi32(_mm256_add_epi32(truncated, _mm256_set1_epi32(1)), _mm256_setzero_si256()), maxIndex[d]);
+				interp[d] = _mm512_sub_round_pd(relative, _mm512_cvtepi32_pd(sample0), rounding);
+				interp1[d] = _mm512_sub_round_pd(one, interp[d], rounding);
+				if (linear) {
+					offset0[d] = _mm512_mul_epi32(_mm512_cvtepi32_epi64(sample0), stride[d]);
+					offset1[d] = _mm512_mul_epi32(_mm512_cvtepi32_epi64(sample1), stride[d]);
+				}
+				else {
+					const __mmask8 moved = _mm512_cmpneq_epi64_mask(_mm512_cvtepi32_epi64(sample0), _mm512_cvtepi32_epi64(sample1));
+					offset0[d] = _mm512_i32gather_epi64(sample0, (const long long*)field.Offsets[d], 8);
+					offset1[d] = _mm512_mask_add_epi64(offset0[d], moved, offset0[d], _mm512_i32gather_epi64(sample0, (const long long*)field.Steps[d], 8));
+				}
+			}
+
+			__m512i corner[8];
+			__m512d weight[8];
+			for (int c = 0; c < 8; ++c) {
+				const int cx = c & 1, cy = (c >> 1) & 1, cz = c >> 2;
+				corner[c] = _mm512_add_epi64(_mm512_add_epi64(cz ? offset1[2] : offset0[2], cy ? offset1[1] : offset0[1]), cx ? offset1[0] : offset0[0]);
+				weight[c] = _mm512_mul_round_pd(_mm512_mul_round_pd(cz ? interp[2] : interp1[2], cy ? interp[1] : interp1[1], rounding), cx ? interp[0] : interp1[0], rounding);
+			}
+			double* output[3] = { u, v, w };
+			for (int component = 0; component < 3; ++component) {
+				__m512d sum[2];
+				for (int iField = 0; iField < (field1 ? 2 : 1); ++iField) {
+					const float* data = (iField == 0 ? field.Data : field1->Data) + component;
+					sum[iField] = _mm512_mul_round_pd(weight[0], _mm512_cvtps_pd(_mm512_i64gather_ps(corner[0], data, 4)), rounding);
+					for (int c = 1; c < 8; ++c)
+						sum[iField] = _mm512_add_round_pd(sum[iField], _mm512_mul_round_pd(weight[c], _mm512_cvtps_pd(_mm512_i64gather_ps(corner[c], data, 4)), rounding), rounding);
+				}
+				if (field1) sum[0] = _mm512_add_round_pd(sum[0], _mm512_mul_round_pd(_mm512_sub_round_pd(sum[1], sum[0], rounding), timeStride ? _mm512_loadu_pd(times + i) : vinterp, rounding), rounding);
+				_mm512_storeu_pd(output[component] + i, sum[0]);
+			}
+		}
+		LinearSample3Scalar(x + i, y + i, z + i, count - i, field, field1, times + i * timeStride, timeStride, u + i, v + i, w + i);
+	}
+#endif
+
+	// Dispatches to the widest kernel that the CPU supports. The second field is optional. The relative time is either the same for
+	// all locations (stride 0) or given per location (stride 1).
+	static void LinearSample3Batch(const double* x, const double* y, const double* z, int64_t count, const FieldView& field, const FieldView* field1, const double* times, int64_t timeStride, double* u, double* v, double* w) {
+		// fields on different lattices are sampled separately
+		if (field1 && !field1->HasSameLattice(field))
+			return LinearSample3Scalar(x, y, z, count, field, field1, times, timeStride, u, v, w);
+#ifdef VISPRO_X86
+		// the kernels convert the locations to 32-bit indices and multiply them with 32-bit strides in the linear layout
+		const bool fits = field.NumComponents == 3 && (field.Layout != FieldView::ELayout::Linear || field.StrideZ <= std::numeric_limits<int32_t>::max());
+		if (fits && CpuFeatures::HasAVX512F()) return LinearSample3AVX512(x, y, z, count, field, field1, times, timeStride, u, v, w);
+		if (fits && CpuFeatures::HasAVX2()) return LinearSample3AVX2(x, y, z, count, field, field1, times, timeStride, u, v, w);
+#endif
+		LinearSample3Scalar(x, y, z, count, field, field1, times, timeStride, u, v, w);
+	}
+
+	void Sampling::LinearSample3(const double* x, const double* y, const double* z, int64_t count, const FieldView& field, double* u, double* v, double* w) {
+		const double interp = 0;
+		LinearSample3Batch(x, y, z, count, field, nullptr, &interp, 0, u, v, w);
+	}
+
+	void Sampling::LinearSample3(const double* x, const double* y, const double* z, int64_t count, const FieldView& field0, const FieldView& field1, double interp, double* u, double* v, double* w) {
+		LinearSample3Batch(x, y, z, count, field0, &field1, &interp, 0, u, v, w);
+	}
+
+	void Sampling::LinearSample3(const double* x, const double* y, const double* z, int64_t count, const FieldView& field0, const FieldView& field1, const double* interp, double* u, double* v, double* w) {
+		LinearSample3Batch(x, y, z, count, field0, &field1, interp, 1, u, v, w);
+	}
+
+	double Sampling::LinearSampleGradient1(const Eigen::Vector3d& position, const FieldView& field, Eigen::Vector3d& gradient) {
+		Eigen::Matrix<double, 1, 3> jacobian;
+		const double value = LinearSampleJacobian<1>(position, field, jacobian)[0];
+		gradient = jacobian.transpose();
+		return value;
+	}
+
+	Eigen::Vector3d Sampling::LinearSampleJacobian3(const Eigen::Vector3d& position, const FieldView& field, Eigen::Matrix3d& jacobian) {
+		return LinearSampleJacobian<3>(position, field, jacobian);
+	}
+
+	void Sampling::LinearSampleJacobian3(const double* x, const double* y, const double* z, int64_t count, const FieldView& field, double* u, double* v, double* w, Eigen::Matrix3d* jacobian) {
+		for (int64_t i = 0; i < count; ++i) {
+			const Eigen::Vector3d sample = LinearSampleJacobian<3>(Eigen::Vector3d(x[i], y[i], z[i]), field, jacobian[i]);
+			u[i] = sample.x();
+			v[i] = sample.y();
+			w[i] = sample.z();
+		}
+	}
+
+	double Sampling::LinearSample1(const Eigen::Vector3d& position, BrickCache* field) {
+		const BrickedReader::Header& header = field->GetHeader();
+		// the corners are gathered into a buffer for one component, so other fields would overrun it in release builds, too
+		assert(header.NumComponents == 1);
+		if (header.NumComponents != 1) return 0;
+		Eigen::Vector3d relative = (position - header.Bounds.min()).cwiseQuotient(header.Spacing);
 		Eigen::Vector3i sample0 = relative.cast<int>();
 		Eigen::Vector3i sample1 = sample0 + Eigen::Vector3i(1, 1, 1);
-		sample0 = sample0.cwiseMax(Eigen::Vector3i(0, 0, 0)).cwiseMin(dimensions - Eigen::Vector3i(1, 1, 1));
-		sample1 = sample1.cwiseMax(Eigen::Vector3i(0, 0, 0)).cwiseMin(dimensions - Eigen::Vector3i(1, 1, 1));
+		sample0 = sample0.cwiseMax(Eigen::Vector3i(0, 0, 0)).cwiseMin(header.Resolution - Eigen::Vector3i(1, 1, 1));
+		sample1 = sample1.cwiseMax(Eigen::Vector3i(0, 0, 0)).cwiseMin(header.Resolution - Eigen::Vector3i(1, 1, 1));
 		Eigen::Vector3d interp = relative - sample0.cast<double>();
-		vtkFloatArray* vectors = dynamic_cast<vtkFloatArray*>(field->GetPointData()->GetAbstractArray(0));
+		float c[8];
+		if (!field->GatherCorners(sample0, sample1, c)) return 0;
 		return
-			(1 - interp.z()) * (1 - interp.y()) * (1 - interp.x()) * vectors->GetTuple1(((int64_t)sample0.z() * dimensions.y() + sample0.y()) * dimensions.x() + sample0.x())
-			+ (1 - interp.z()) * (1 - interp.y()) * (interp.x()) * vectors->GetTuple1(((int64_t)sample0.z() * dimensions.y() + sample0.y()) * dimensions.x() + sample1.x())
-			+ (1 - interp.z()) * (interp.y()) * (1 - interp.x()) * vectors->GetTuple1(((int64_t)sample0.z() * dimensions.y() + sample1.y()) * dimensions.x() + sample0.x())
-			+ (1 - interp.z()) * (interp.y()) * (interp.x()) * vectors->GetTuple1(((int64_t)sample0.z() * dimensions.y() + sample1.y()) * dimensions.x() + sample1.x())
-			+ (interp.z()) * (1 - interp.y()) * (1 - interp.x()) * vectors->GetTuple1(((int64_t)sample1.z() * dimensions.y() + sample0.y()) * dimensions.x() + sample0.x())
-			+ (interp.z()) * (1 - interp.y()) * (interp.x()) * vectors->GetTuple1(((int64_t)sample1.z() * dimensions.y() + sample0.y()) * dimensions.x() + sample1.x())
-			+ (interp.z()) * (interp.y()) * (1 - interp.x()) * vectors->GetTuple1(((int64_t)sample1.z() * dimensions.y() + sample1.y()) * dimensions.x() + sample0.x())
-			+ (interp.z()) * (interp.y()) * (interp.x()) * vectors->GetTuple1(((int64_t)sample1.z() * dimensions.y() + sample1.y()) * dimensions.x() + sample1.x());
+			(1 - interp.z()) * (1 - interp.y()) * (1 - interp.x()) * c[0]
+			+ (1 - interp.z()) * (1 - interp.y()) * (interp.x()) * c[1]
+			+ (1 - interp.z()) * (interp.y()) * (1 - interp.x()) * c[2]
+			+ (1 - interp.z()) * (interp.y()) * (interp.x()) * c[3]
+			+ (interp.z()) * (1 - interp.y()) * (1 - interp.x()) * c[4]
+			+ (interp.z()) * (1 - interp.y()) * (interp.x()) * c[5]
+			+ (interp.z()) * (interp.y()) * (1 - interp.x()) * c[6]
+			+ (interp.z()) * (interp.y()) * (interp.x()) * c[7];
 	}
 
-	Eigen::Vector3d Sampling::LinearSample3(const Eigen::Vector3d& position, vtkImageData* field) {
-		Eigen::Vector3d origin(field->GetOrigin());
-		Eigen::Vector3d spacing(field->GetSpacing());
-		Eigen::Vector3i dimensions(field->GetDimensions());
-		Eigen::Vector3d relative = (position - origin).cwiseQuotient(spacing);
+	Eigen::Vector3d Sampling::LinearSample3(const Eigen::Vector3d& position, BrickCache* field) {
+		const BrickedReader::Header& header = field->GetHeader();
+		assert(header.NumComponents == 3);
+		if (header.NumComponents != 3) return Eigen::Vector3d(0, 0, 0);
+		Eigen::Vector3d relative = (position - header.Bounds.min()).cwiseQuotient(header.Spacing);
 		Eigen::Vector3i sample0 = relative.cast<int>();
 		Eigen::Vector3i sample1 = sample0 + Eigen::Vector3i(1, 1, 1);
-		sample0 = sample0.cwiseMax(Eigen::Vector3i(0, 0, 0)).cwiseMin(dimensions - Eigen::Vector3i(1, 1, 1));
-		sample1 = sample1.cwiseMax(Eigen::Vector3i(0, 0, 0)).cwiseMin(dimensions - Eigen::Vector3i(1, 1, 1));
+		sample0 = sample0.cwiseMax(Eigen::Vector3i(0, 0, 0)).cwiseMin(header.Resolution - Eigen::Vector3i(1, 1, 1));
+		sample1 = sample1.cwiseMax(Eigen::Vector3i(0, 0, 0)).cwiseMin(header.Resolution - Eigen::Vector3i(1, 1, 1));
 		Eigen::Vector3d interp = relative - sample0.cast<double>();
-		vtkFloatArray* vectors = dynamic_cast<vtkFloatArray*>(field->GetPointData()->GetAbstractArray(0));
+		float c[8 * 3];
+		if (!field->GatherCorners(sample0, sample1, c)) return Eigen::Vector3d(0, 0, 0);
 		return
-			(1 - interp.z()) * (1 - interp.y()) * (1 - interp.x()) * Eigen::Vector3d(vectors->GetTuple3(((int64_t)sample0.z() * dimensions.y() + sample0.y()) * dimensions.x() + sample0.x()))
-			+ (1 - interp.z()) * (1 - interp.y()) * (interp.x()) * Eigen::Vector3d(vectors->GetTuple3(((int64_t)sample0.z() * dimensions.y() + sample0.y()) * dimensions.x() + sample1.x()))
-			+ (1 - interp.z()) * (interp.y()) * (1 - interp.x()) * Eigen::Vector3d(vectors->GetTuple3(((int64_t)sample0.z() * dimensions.y() + sample1.y()) * dimensions.x() + sample0.x()))
-			+ (1 - interp.z()) * (interp.y()) * (interp.x()) * Eigen::Vector3d(vectors->GetTuple3(((int64_t)sample0.z() * dimensions.y() + sample1.y()) * dimensions.x() + sample1.x()))
-			+ (interp.z()) * (1 - interp.y()) * (1 - interp.x()) * Eigen::Vector3d(vectors->GetTuple3(((int64_t)sample1.z() * dimensions.y() + sample0.y()) * dimensions.x() + sample0.x()))
-			+ (interp.z()) * (1 - interp.y()) * (interp.x()) * Eigen::Vector3d(vectors->GetTuple3(((int64_t)sample1.z() * dimensions.y() + sample0.y()) * dimensions.x() + sample1.x()))
-			+ (interp.z()) * (interp.y()) * (1 - interp.x()) * Eigen::Vector3d(vectors->GetTuple3(((int64_t)sample1.z() * dimensions.y() + sample1.y()) * dimensions.x() + sample0.x()))
-			+ (interp.z()) * (interp.y()) * (interp.x()) * Eigen::Vector3d(vectors->GetTuple3(((int64_t)sample1.z() * dimensions.y() + sample1.y()) * dimensions.x() + sample1.x()));
+			(1 - interp.z()) * (1 - interp.y()) * (1 - interp.x()) * Eigen::Vector3d(c[0], c[1], c[2])
+			+ (1 - interp.z()) * (1 - interp.y()) * (interp.x()) * Eigen::Vector3d(c[3], c[4], c[5])
+			+ (1 - interp.z()) * (interp.y()) * (1 - interp.x()) * Eigen::Vector3d(c[6], c[7], c[8])
+			+ (1 - interp.z()) * (interp.y()) * (interp.x()) * Eigen::Vector3d(c[9], c[10], c[11])
+			+ (interp.z()) * (1 - interp.y()) * (1 - interp.x()) * Eigen::Vector3d(c[12], c[13], c[14])
+			+ (interp.z()) * (1 - interp.y()) * (interp.x()) * Eigen::Vector3d(c[15], c[16], c[17])
+			+ (interp.z()) * (interp.y()) * (1 - interp.x()) * Eigen::Vector3d(c[18], c[19], c[20])
+			+ (interp.z()) * (interp.y()) * (interp.x()) * Eigen::Vector3d(c[21], c[22], c[23]);
 	}
 }
\ No newline at end of file
@@ -1,11 +1,15 @@
 #pragma once
 
+#include <cassert>
 #include "Eigen/Eigen"
+#include "FieldView.hpp"
 
 class vtkImageData;
 
 namespace vispro
 {
+	class BrickCache;
+
 	// Helper for the trilinear sampling of scalar fields and vector fields.
 	class Sampling
 	{
@@ -14,5 +18,159 @@ namespace vispro
 		static double LinearSample1(const Eigen::Vector3d& position, vtkImageData* field);
 		// Linearly samples a 3D vector field at a given domain location.
 		static Eigen::Vector3d LinearSample3(const Eigen::Vector3d& position, vtkImageData* field);
+		// Linearly samples a bricked 3D scalar field at a given domain location. Only the touched bricks are decoded. The field has to have
+		// one component, otherwise the sample is 0.
+		static double LinearSample1(const Eigen::Vector3d& position, BrickCache* field);
+		// Linearly samples a bricked 3D vector field at a given domain location. Only the touched bricks are decoded. The field has to have
+		// three components, otherwise the sample is 0.
+		static Eigen::Vector3d LinearSample3(const Eigen::Vector3d& position, BrickCache* field);
+
+		// Linearly samples a field with N components at a given domain location. This is the fast path for inner loops, since the
+		// view is built once per field. The number of components of the view has to be N.
+		template <int N>
+		static Eigen::Matrix<double, N, 1> LinearSample(const Eigen::Vector3d& position, const FieldView& field);
+		// Linearly samples a field with N components in space and time, i.e., between two time steps. The time is relative, i.e., 0 at the
+		// first and 1 at the second time step. If both fields have the same lattice, the cell and the weights are computed once and the
+		// 16 corners are fetched in one pass. The result is identical to blending two spatial samples.
+		template <int N>
+		static Eigen::Matrix<double, N, 1> LinearSample(const Eigen::Vector3d& position, const FieldView& field0, const FieldView& field1, double interp);
+		// Linearly samples a 3D scalar field at a given domain location.
+		static double LinearSample1(const Eigen::Vector3d& position, const FieldView& field) { return LinearSample<1>(position, field)[0]; }
+		// Linearly samples a 3D vector field at a given domain location.
+		static Eigen::Vector3d LinearSample3(const Eigen::Vector3d& position, const FieldView& field) { return LinearSample<3>(position, field); }
+		// Linearly samples a 3D vector field in space and time (see LinearSample).
+		static Eigen::Vector3d LinearSample3(const Eigen::Vector3d& position, const FieldView& field0, const FieldView& field1, double interp) { return LinearSample<3>(position, field0, field1, interp); }
+		// Linearly samples a 3D vector field at a batch of locations, whose coordinates are given as separate arrays (x, y, z), and
+		// writes the components of the samples to separate arrays (u, v, w). Several locations are sampled at once with gathers if
+		// the CPU supports AVX-512 or AVX2. The results are bit-identical to LinearSample3 for each location.
+		static void LinearSample3(const double* x, const double* y, const double* z, int64_t count, const FieldView& field, double* u, double* v, double* w);
+		// Linearly samples a 3D vector field in space and time at a batch of locations (see LinearSample). The results are bit-identical to LinearSample3 for each location.
+		static void LinearSample3(const double* x, const double* y, const double* z, int64_t count, const FieldView& field0, const FieldView& field1, double interp, double* u, double* v, double* w);
+		// Linearly samples a 3D vector field in space and time at a batch of locations with a relative time per location, e.g., for particles that are at different times.
+		static void LinearSample3(const double* x, const double* y, const double* z, int64_t count, const FieldView& field0, const FieldView& field1, const double* interp, double* u, double* v, double* w);
+
+		// Linearly samples a field with N components and computes the spatial derivatives of the trilinear interpolant from the same
+		// eight corners. Column d of the Jacobian is the derivative along dimension d. Locations outside of the lattice are clamped
+		// to it. Unlike in LinearSample, a location on an upper face of the lattice belongs to the last cell, so that the derivative
+		// across the face is that of the last cell. Inside of the lattice, the value is identical to LinearSample.
+		template <int N>
+		static Eigen::Matrix<double, N, 1> LinearSampleJacobian(const Eigen::Vector3d& position, const FieldView& field, Eigen::Matrix<double, N, 3>& jacobian);
+		// Linearly samples a 3D scalar field and its gradient at a given domain location (see LinearSampleJacobian).
+		static double LinearSampleGradient1(const Eigen::Vector3d& position, const FieldView& field, Eigen::Vector3d& gradient);
+		// Linearly samples a 3D vector field and its Jacobian at a given domain location (see LinearSampleJacobian).
+		static Eigen::Vector3d LinearSampleJacobian3(const Eigen::Vector3d& position, const FieldView& field, Eigen::Matrix3d& jacobian);
+		// Linearly samples a 3D vector field and its Jacobian at a batch of locations, whose coordinates are given as separate arrays
+		// (x, y, z). The components of the samples are written to separate arrays (u, v, w) and the Jacobians to an array of matrices.
+		static void LinearSampleJacobian3(const double* x, const double* y, const double* z, int64_t count, const FieldView& field, double* u, double* v, double* w, Eigen::Matrix3d* jacobian);
+
+	private:
+		// Corners of the cell that contains a location and their trilinear weights, in the order x fastest.
+		struct Cell {
+			int64_t Offset[8];	// offsets of the first component of the corners
+			double Weight[8];	// weights of the corners
+			double Local[3];	// local coordinates of the location in the cell
+		};
+		// Finds the cell of a location in a field. Locations outside of the lattice are clamped to it.
+		static Cell FindCell(const Eigen::Vector3d& position, const FieldView& field);
+		// Finds the cell of a location in a field, which is clamped to the lattice first. The upper faces belong to the last cells.
+		static Cell FindClampedCell(const Eigen::Vector3d& position, const FieldView& field);
+		// Computes the offsets and weights of the corners of a cell, given the lower and upper corner and the local coordinates.
+		static Cell MakeCell(const Eigen::Vector3i& sample0, const Eigen::Vector3i& sample1, const Eigen::Vector3d& interp, const FieldView& field);
+		// Sums the weighted corners of a cell.
+		template <int N>
+		static Eigen::Matrix<double, N, 1> Interpolate(const Cell& cell, const float* data);
 	};
+
+	inline Sampling::Cell Sampling::FindCell(const Eigen::Vector3d& position, const FieldView& field) {
+		Eigen::Vector3d relative = (position - field.Origin).cwiseProduct(field.InvSpacing);
+		Eigen::Vector3i sample0 = relative.cast<int>();
+		Eigen::Vector3i sample1 = sample0 + Eigen::Vector3i(1, 1, 1);
+		sample0 = sample0.cwiseMax(Eigen::Vector3i(0, 0, 0)).cwiseMin(field.Dimensions - Eigen::Vector3i(1, 1, 1));
+		sample1 = sample1.cwiseMax(Eigen::Vector3i(0, 0, 0)).cwiseMin(field.Dimensions - Eigen::Vector3i(1, 1, 1));
+		Eigen::Vector3d interp = relative - sample0.cast<double>();
+		return MakeCell(sample0, sample1, interp, field);
+	}
+
+	inline Sampling::Cell Sampling::FindClampedCell(const Eigen::Vector3d& position, const FieldView& field) {
+		const Eigen::Vector3i maxIndex = field.Dimensions - Eigen::Vector3i(1, 1, 1);
+		Eigen::Vector3d relative = (position - field.Origin).cwiseProduct(field.InvSpacing).cwiseMax(Eigen::Vector3d(0, 0, 0)).cwiseMin(maxIndex.cast<double>());
+		// a lattice with a single grid point in a dimension has a degenerate cell in it
+		Eigen::Vector3i sample0 = relative.cast<int>().cwiseMin((maxIndex - Eigen::Vector3i(1, 1, 1)).cwiseMax(Eigen::Vector3i(0, 0, 0)));
+		Eigen::Vector3i sample1 = (sample0 + Eigen::Vector3i(1, 1, 1)).cwiseMin(maxIndex);
+		Eigen::Vector3d interp = relative - sample0.cast<double>();
+		return MakeCell(sample0, sample1, interp, field);
+	}
+
+	inline Sampling::Cell Sampling::MakeCell(const Eigen::Vector3i& sample0, const Eigen::Vector3i& sample1, const Eigen::Vector3d& interp, const FieldView& field) {
+		int64_t offset[3][2];
+		if (field.Layout == FieldView::ELayout::Linear) {
+			const int64_t stride[3] = { field.NumComponents, field.StrideY, field.StrideZ };
+			for (int d = 0; d < 3; ++d) {
+				offset[d][0] = sample0[d] * stride[d];
+				offset[d][1] = sample1[d] * stride[d];
+			}
+		}
+		else {
+			// the upper corner is reached with the step of the lower one, which stays inside its brick in the bricked layout. Clamped corners coincide.
+			for (int d = 0; d < 3; ++d) {
+				offset[d][0] = field.Offsets[d][sample0[d]];
+				offset[d][1] = offset[d][0] + (sample1[d] - sample0[d]) * field.Steps[d][sample0[d]];
+			}
+		}
+		const double wx[2] = { 1 - interp.x(), interp.x() };
+		const double wy[2] = { 1 - interp.y(), interp.y() };
+		const double wz[2] = { 1 - interp.z(), interp.z() };
+		Cell cell;
+		for (int c = 0; c < 8; ++c) {
+			const int cx = c & 1, cy = (c >> 1) & 1, cz = c >> 2;
+			cell.Offset[c] = offset[2][cz] + offset[1][cy] + offset[0][cx];
+			cell.Weight[c] = wz[cz] * wy[cy] * wx[cx];
+		}
+		for (int d = 0; d < 3; ++d)
+			cell.Local[d] = interp[d];
+		return cell;
+	}
+
+	template <int N>
+	Eigen::Matrix<double, N, 1> Sampling::Interpolate(const Cell& cell, const float* data) {
+		Eigen::Matrix<double, N, 1> sum = cell.Weight[0] * Eigen::Map<const Eigen::Matrix<float, N, 1>>(data + cell.Offset[0]).template cast<double>();
+		for (int c = 1; c < 8; ++c)
+			sum += cell.Weight[c] * Eigen::Map<const Eigen::Matrix<float, N, 1>>(data + cell.Offset[c]).template cast<double>();
+		return sum;
+	}
+
+	template <int N>
+	Eigen::Matrix<double, N, 1> Sampling::LinearSample(const Eigen::Vector3d& position, const FieldView& field) {
+		assert(field.NumComponents == N);
+		return Interpolate<N>(FindCell(position, field), field.Data);
+	}
+
+	template <int N>
+	Eigen::Matrix<double, N, 1> Sampling::LinearSample(const Eigen::Vector3d& position, const FieldView& field0, const FieldView& field1, double interp) {
+		assert(field0.NumComponents == N && field1.NumComponents == N);
+		Eigen::Matrix<double, N, 1> value0, value1;
+		const Cell cell = FindCell(position, field0);
+		value0 = Interpolate<N>(cell, field0.Data);
+		value1 = field1.HasSameLattice(field0) ? Interpolate<N>(cell, field1.Data) : LinearSample<N>(position, field1);
+		return value0 + (value1 - value0) * interp;
+	}
+
+	template <int N>
+	Eigen::Matrix<double, N, 1> Sampling::LinearSampleJacobian(const Eigen::Vector3d& position, const FieldView& field, Eigen::Matrix<double, N, 3>& jacobian) {
+		assert(field.NumComponents == N);
+		const Cell cell = FindClampedCell(position, field);
+		// the derivative of a weight along a dimension replaces the linear factor of that dimension by -1 or 1
+		const double* t = cell.Local;
+		const double w[3][2] = { { 1 - t[0], t[0] }, { 1 - t[1], t[1] }, { 1 - t[2], t[2] } };
+		jacobian.setZero();
+		for (int c = 0; c < 8; ++c) {
+			const int cx = c & 1, cy = (c >> 1) & 1, cz = c >> 2;
+			const Eigen::Matrix<double, N, 1> corner = Eigen::Map<const Eigen::Matrix<float, N, 1>>(field.Data + cell.Offset[c]).template cast<double>();
+			jacobian.col(0) += (cx ? 1. : -1.) * (w[1][cy] * w[2][cz]) * corner;
+			jacobian.col(1) += (cy ? 1. : -1.) * (w[0][cx] * w[2][cz]) * corner;
+			jacobian.col(2) += (cz ? 1. : -1.) * (w[0][cx] * w[1][cy]) * corner;
+		}
+		jacobian = jacobian * field.InvSpacing.asDiagonal();
+		return Interpolate<N>(cell, field.Data);
+	}
 }
\ No newline at end of file
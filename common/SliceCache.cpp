@@ -0,0 +1,108 @@
+#include "SliceCache.hpp"
+#include <vtkImageData.h>
+#include <vtkPointData.h>
+#include <vtkDataArray.h>
+
+namespace vispro
+{
+	// Number of bytes of the values of a field.
+	static size_t GetNumBytes(vtkImageData* data) {
+		size_t numBytes = 0;
+		vtkPointData* pointData = data->GetPointData();
+		for (int i = 0; i < pointData->GetNumberOfArrays(); ++i)
+			numBytes += (size_t)pointData->GetArray(i)->GetNumberOfValues() * sizeof(float);
+		return numBytes;
+	}
+
+	SliceCache::SliceCache() : mBudget(0), mCachedBytes(0), mNumHits(0), mNumMisses(0) {}
+
+	SliceCache& SliceCache::GetInstance()
+	{
+		static SliceCache instance;
+		return instance;
+	}
+
+	void SliceCache::SetBudget(size_t budgetBytes)
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mBudget = budgetBytes;
+		Evict();
+	}
+
+	size_t SliceCache::GetBudget() const
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		return mBudget;
+	}
+
+	bool SliceCache::IsEnabled() const { return GetBudget() > 0; }
+
+	bool SliceCache::Contains(const std::string& basePath, const std::string& field, int timeStep) const
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		return mSlices.find(Key(basePath, field, timeStep)) != mSlices.end();
+	}
+
+	vtkSmartPointer<vtkImageData> SliceCache::Find(const std::string& basePath, const std::string& field, int timeStep)
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		auto it = mSlices.find(Key(basePath, field, timeStep));
+		if (it == mSlices.end()) {
+			mNumMisses++;
+			return nullptr;
+		}
+		// move to the front of the LRU list
+		mLru.splice(mLru.begin(), mLru, std::get<2>(it->second));
+		mNumHits++;
+		return std::get<0>(it->second);
+	}
+
+	void SliceCache::Insert(const std::string& basePath, const std::string& field, int timeStep, vtkSmartPointer<vtkImageData> data)
+	{
+		const size_t numBytes = GetNumBytes(data);
+		std::lock_guard<std::mutex> lock(mMutex);
+		if (numBytes > mBudget) return;
+		const Key key(basePath, field, timeStep);
+		if (mSlices.find(key) != mSlices.end()) return;	// another reader was faster
+		mLru.push_front(key);
+		mSlices[key] = std::make_tuple(data, numBytes, mLru.begin());
+		mCachedBytes += numBytes;
+		Evict();
+	}
+
+	void SliceCache::Clear()
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mLru.clear();
+		mSlices.clear();
+		mCachedBytes = 0;
+	}
+
+	size_t SliceCache::GetCachedBytes() const
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		return mCachedBytes;
+	}
+
+	size_t SliceCache::GetNumHits() const
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		return mNumHits;
+	}
+
+	size_t SliceCache::GetNumMisses() const
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		return mNumMisses;
+	}
+
+	void SliceCache::Evict()
+	{
+		while (mCachedBytes > mBudget && !mLru.empty()) {
+			auto victim = mSlices.find(mLru.back());
+			mCachedBytes -= std::get<1>(victim->second);
+			mSlices.erase(victim);
+			mLru.pop_back();
+		}
+	}
+}
\ No newline at end of file
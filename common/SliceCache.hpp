@@ -0,0 +1,74 @@
+#pragma once
+
+#include <list>
+#include <map>
+#include <mutex>
+#include <string>
+#include <tuple>
+#include <vtkSmartPointer.h>
+
+class vtkImageData;
+
+namespace vispro
+{
+	// Process-wide least-recently-used cache of decoded fields, keyed by the base path of the data set, the field and the time step.
+	// All readers in the process share it, so that repeated or overlapping passes over a time series, e.g., the FTLE of consecutive
+	// start times, read each time step from disk once as long as it fits into the budget. The cached fields are shared with the
+	// readers and must not be modified. A field that is evicted stays alive until its last reader releases it.
+	class SliceCache
+	{
+	public:
+		// Gets the cache of the process. The cache is disabled until a budget is set.
+		static SliceCache& GetInstance();
+
+		// Sets the maximum number of bytes of the cached fields and evicts fields that exceed it. A budget of zero disables the cache (default).
+		void SetBudget(size_t budgetBytes);
+		// Gets the maximum number of bytes of the cached fields.
+		size_t GetBudget() const;
+		// Checks whether the cache has a budget.
+		bool IsEnabled() const;
+
+		// Checks whether a field is cached, without marking it as recently used.
+		bool Contains(const std::string& basePath, const std::string& field, int timeStep) const;
+		// Gets a cached field and marks it as recently used. Returns nullptr if the field is not cached.
+		vtkSmartPointer<vtkImageData> Find(const std::string& basePath, const std::string& field, int timeStep);
+		// Adds a field to the cache, which evicts the least recently used fields that exceed the budget. Fields that are larger than the budget are not added.
+		void Insert(const std::string& basePath, const std::string& field, int timeStep, vtkSmartPointer<vtkImageData> data);
+		// Removes all fields.
+		void Clear();
+
+		// Gets the number of bytes of the cached fields.
+		size_t GetCachedBytes() const;
+		// Gets the number of lookups that found their field.
+		size_t GetNumHits() const;
+		// Gets the number of lookups that did not find their field.
+		size_t GetNumMisses() const;
+
+	private:
+		// Base path, field and time step of a cached field.
+		typedef std::tuple<std::string, std::string, int> Key;
+
+		// Constructor.
+		SliceCache();
+		// Delete the copy-constructor.
+		SliceCache(const SliceCache& other) = delete;
+
+		// Evicts the least recently used fields until the cached fields fit into the budget. Assumes that the mutex is locked.
+		void Evict();
+
+		// Maximum number of bytes to keep in memory.
+		size_t mBudget;
+		// Number of bytes currently in memory.
+		size_t mCachedBytes;
+		// Number of lookups that found their field.
+		size_t mNumHits;
+		// Number of lookups that did not find their field.
+		size_t mNumMisses;
+		// Keys ordered from most to least recently used.
+		std::list<Key> mLru;
+		// Cached fields together with their size in bytes and their position in the LRU list.
+		std::map<Key, std::tuple<vtkSmartPointer<vtkImageData>, size_t, std::list<Key>::iterator>> mSlices;
+		// Guards the cache, which may be accessed by several threads.
+		mutable std::mutex mMutex;
+	};
+}
\ No newline at end of file
@@ -0,0 +1,246 @@
+#include "TimeSeriesContainer.hpp"
+#include "AmiraWriter.hpp"
+#include "MappedFile.hpp"
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <sstream>
+#include <vtkImageData.h>
+#include <vtkFloatArray.h>
+
+namespace vispro
+{
+	// Identifier and version of the container format.
+	static const char ContainerMagic[4] = { 'V', 'P', 'T', 'S' };
+	static const int32_t ContainerVersion = 1;
+
+	// Header at the beginning of the file.
+	struct FileHeader {
+		char Magic[4];
+		int32_t Version;
+		int32_t Capacity;		// number of entries in the offset table
+		int32_t NumSteps;		// one past the last stored time step
+		int64_t EndOffset;		// aligned end of the last time step
+	};
+
+	// Entry of the offset table, which directly follows the file header.
+	struct StepRecord {
+		int64_t Offset;			// 0 if the time step is missing
+		int64_t Size;
+		int64_t DataOffset;
+		double Min[3];
+		double Max[3];
+		int32_t Resolution[3];
+		int32_t NumComponents;
+		int32_t Storage;
+		float Scale;
+		float Bias;
+		int32_t Reserved;
+	};
+	static_assert(sizeof(FileHeader) == 24 && sizeof(StepRecord) == 104, "The container layout must not depend on the compiler.");
+
+	// Rounds an offset up to the alignment of the time steps.
+	static int64_t AlignUp(int64_t offset) { return (offset + TimeSeriesContainer::Alignment - 1) / TimeSeriesContainer::Alignment * TimeSeriesContainer::Alignment; }
+
+	TimeSeriesContainer::TimeSeriesContainer() : mWritable(false), mNumSteps(0), mEndOffset(0) {}
+
+	bool TimeSeriesContainer::Open(const char* path)
+	{
+		Close();
+		if (!mFile.Open(path, RandomAccessFile::EMode::Read)) return false;
+		mPath = path;
+		if (!ReadTable()) {
+			Close();
+			return false;
+		}
+		return true;
+	}
+
+	bool TimeSeriesContainer::OpenForAppend(const char* path, int capacity)
+	{
+		Close();
+		if (capacity <= 0 || !mFile.Open(path, RandomAccessFile::EMode::ReadWrite)) return false;
+		mPath = path;
+		mWritable = true;
+		if (mFile.GetSize() != 0) {
+			if (!ReadTable()) {
+				Close();
+				return false;
+			}
+			return true;
+		}
+
+		// new container: the first time step starts behind the (empty) offset table
+		mSteps.assign(capacity, Step{ 0, 0, AmiraReader::Header() });
+		mEndOffset = AlignUp(sizeof(FileHeader) + capacity * (int64_t)sizeof(StepRecord));
+		std::vector<StepRecord> records(capacity);
+		memset(records.data(), 0, records.size() * sizeof(StepRecord));
+		if (!mFile.WriteAt(records.data(), (int64_t)(records.size() * sizeof(StepRecord)), sizeof(FileHeader)) || !WriteTable(-1)) {
+			Close();
+			return false;
+		}
+		return true;
+	}
+
+	void TimeSeriesContainer::Close()
+	{
+		mFile.Close();
+		mPath.clear();
+		mWritable = false;
+		mNumSteps = 0;
+		mEndOffset = 0;
+		mSteps.clear();
+	}
+
+	int TimeSeriesContainer::GetNumSteps() const { return mNumSteps; }
+	int TimeSeriesContainer::GetCapacity() const { return (int)mSteps.size(); }
+
+	const TimeSeriesContainer::Step* TimeSeriesContainer::Find(int timeStep) const
+	{
+		if (timeStep < 0 || timeStep >= (int)mSteps.size() || mSteps[timeStep].Offset == 0) return nullptr;
+		return &mSteps[timeStep];
+	}
+
+	const RandomAccessFile& TimeSeriesContainer::GetFile() const { return mFile; }
+
+	vtkSmartPointer<vtkImageData> TimeSeriesContainer::ReadStep(int timeStep, const char* fieldName) const
+	{
+		const Step* step = Find(timeStep);
+		if (!step) return nullptr;
+		return AmiraReader::ReadField(mFile, step->Offset, step->Header, fieldName);
+	}
+
+	bool TimeSeriesContainer::ReadStep(int timeStep, vtkFloatArray* output) const
+	{
+		const Step* step = Find(timeStep);
+		if (!step) return false;
+		return AmiraReader::ReadField(mFile, step->Offset, step->Header, output);
+	}
+
+	bool TimeSeriesContainer::ReadStepRegion(int timeStep, const Eigen::AlignedBox3i& region, vtkFloatArray* output) const
+	{
+		const Step* step = Find(timeStep);
+		if (!step) return false;
+		return AmiraReader::ReadFieldRegion(mFile, step->Offset, step->Header, region, output);
+	}
+
+	vtkSmartPointer<vtkImageData> TimeSeriesContainer::ReadStepMapped(int timeStep, const char* fieldName) const
+	{
+		const Step* step = Find(timeStep);
+		if (!step) return nullptr;
+		// the time steps are aligned, so each one can be mapped on its own
+		std::unique_ptr<MappedFile> file(new MappedFile());
+		if (!file->Open(mPath.c_str(), step->Offset, step->Size)) return nullptr;
+		return AmiraReader::ReadFieldMapped(std::move(file), step->Header, fieldName);
+	}
+
+	bool TimeSeriesContainer::AppendStep(int timeStep, const char* data, int64_t size)
+	{
+		if (!mWritable || timeStep < 0 || timeStep >= (int)mSteps.size()) return false;
+
+		// parse the header of the embedded file and check that the data section is complete
+		char buffer[2048];
+		const size_t headerSize = (size_t)std::min(size, (int64_t)2047);
+		memcpy(buffer, data, headerSize);
+		buffer[headerSize] = '\0';
+		AmiraReader::Header header;
+		if (!AmiraReader::ParseHeader(buffer, header)) return false;
+		const int64_t numValues = (int64_t)header.Resolution.prod() * header.NumComponents;
+		if (header.DataOffset + numValues * (int64_t)Quantization::GetSize(header.Storage) > size) return false;
+
+		// write the data first, so that the table never points to an incomplete time step
+		const int64_t offset = mEndOffset;
+		if (!mFile.WriteAt(data, size, offset)) return false;
+		mSteps[timeStep] = Step{ offset, size, header };
+		mEndOffset = AlignUp(offset + size);
+		mNumSteps = std::max(mNumSteps, timeStep + 1);
+		return WriteTable(timeStep);
+	}
+
+	bool TimeSeriesContainer::AppendFile(int timeStep, const char* path)
+	{
+		RandomAccessFile file;
+		if (!file.Open(path)) return false;
+		std::vector<char> data(file.GetSize());
+		if (data.empty() || !file.ReadAt(data.data(), (int64_t)data.size(), 0)) return false;
+		return AppendStep(timeStep, data.data(), (int64_t)data.size());
+	}
+
+	bool TimeSeriesContainer::AppendScalarField(int timeStep, const char* fieldName, vtkImageData* imageData, Quantization::EStorage storage, double errorBound)
+	{
+		std::ostringstream stream(std::ios::out | std::ios::binary);
+		AmiraWriter::WriteScalarField(stream, fieldName, imageData, storage, errorBound);
+		const std::string data = stream.str();
+		return AppendStep(timeStep, data.data(), (int64_t)data.size());
+	}
+
+	bool TimeSeriesContainer::AppendVectorField(int timeStep, const char* fieldUName, const char* fieldVName, const char* fieldWName, vtkImageData* imageData)
+	{
+		std::ostringstream stream(std::ios::out | std::ios::binary);
+		AmiraWriter::WriteVectorField(stream, fieldUName, fieldVName, fieldWName, imageData);
+		const std::string data = stream.str();
+		return AppendStep(timeStep, data.data(), (int64_t)data.size());
+	}
+
+	bool TimeSeriesContainer::ReadTable()
+	{
+		FileHeader fileHeader;
+		if (!mFile.ReadAt(&fileHeader, sizeof(FileHeader), 0) || memcmp(fileHeader.Magic, ContainerMagic, 4) != 0 ||
+			fileHeader.Version != ContainerVersion || fileHeader.Capacity <= 0 || fileHeader.NumSteps < 0 || fileHeader.NumSteps > fileHeader.Capacity)
+			return false;
+
+		// the whole table is read at once
+		std::vector<StepRecord> records(fileHeader.Capacity);
+		if (!mFile.ReadAt(records.data(), (int64_t)(records.size() * sizeof(StepRecord)), sizeof(FileHeader))) return false;
+		mSteps.resize(records.size());
+		for (size_t i = 0; i < records.size(); ++i) {
+			const StepRecord& record = records[i];
+			Step& step = mSteps[i];
+			step.Offset = record.Offset;
+			step.Size = record.Size;
+			if (record.Offset == 0) continue;
+			AmiraReader::Header& header = step.Header;
+			header.Resolution = Eigen::Vector3i(record.Resolution[0], record.Resolution[1], record.Resolution[2]);
+			header.Bounds = Eigen::AlignedBox3d(Eigen::Vector3d(record.Min), Eigen::Vector3d(record.Max));
+			header.Spacing = (header.Bounds.max() - header.Bounds.min()).cwiseQuotient((header.Resolution - Eigen::Vector3i(1, 1, 1)).cast<double>());
+			header.NumComponents = record.NumComponents;
+			header.Storage = (Quantization::EStorage)record.Storage;
+			header.Scale = record.Scale;
+			header.Bias = record.Bias;
+			header.DataOffset = record.DataOffset;
+		}
+		mNumSteps = fileHeader.NumSteps;
+		mEndOffset = fileHeader.EndOffset;
+		return true;
+	}
+
+	bool TimeSeriesContainer::WriteTable(int timeStep)
+	{
+		if (timeStep >= 0) {
+			const Step& step = mSteps[timeStep];
+			const AmiraReader::Header& header = step.Header;
+			StepRecord record;
+			memset(&record, 0, sizeof(StepRecord));
+			record.Offset = step.Offset;
+			record.Size = step.Size;
+			record.DataOffset = header.DataOffset;
+			for (int i = 0; i < 3; ++i) {
+				record.Min[i] = header.Bounds.min()[i];
+				record.Max[i] = header.Bounds.max()[i];
+				record.Resolution[i] = header.Resolution[i];
+			}
+			record.NumComponents = header.NumComponents;
+			record.Storage = (int32_t)header.Storage;
+			record.Scale = header.Scale;
+			record.Bias = header.Bias;
+			if (!mFile.WriteAt(&record, sizeof(StepRecord), sizeof(FileHeader) + timeStep * (int64_t)sizeof(StepRecord))) return false;
+		}
+		FileHeader fileHeader;
+		memcpy(fileHeader.Magic, ContainerMagic, 4);
+		fileHeader.Version = ContainerVersion;
+		fileHeader.Capacity = (int32_t)mSteps.size();
+		fileHeader.NumSteps = mNumSteps;
+		fileHeader.EndOffset = mEndOffset;
+		return mFile.WriteAt(&fileHeader, sizeof(FileHeader), 0);
+	}
+}
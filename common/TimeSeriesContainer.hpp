@@ -0,0 +1,88 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include "AmiraReader.hpp"
+#include "RandomAccessFile.hpp"
+
+namespace vispro
+{
+	// Single file that holds all time steps of a field (*.ams). Each time step is a complete amira file that starts at an
+	// aligned offset, so it can be read with a single pread or mapped on its own. The offset table at the beginning of the
+	// file also stores the parsed headers, i.e., opening the container is enough to locate and interpret every time step.
+	// Time steps can be appended while they are produced. Replacing a time step appends the new data and leaves the old one unused.
+	class TimeSeriesContainer
+	{
+	public:
+		// Location and header of a stored time step.
+		struct Step {
+			int64_t Offset;					// byte offset of the embedded amira file (0 if the time step is missing)
+			int64_t Size;					// size of the embedded amira file in bytes
+			AmiraReader::Header Header;		// parsed header, the data offset is relative to the embedded file
+		};
+
+		// Alignment of the time steps in the file. This is the allocation granularity on Windows and a multiple of the page size elsewhere.
+		static constexpr int64_t Alignment = 65536;
+		// Default number of time steps that fit into the offset table of a new container.
+		static constexpr int DefaultCapacity = 1024;
+
+		// Constructor.
+		TimeSeriesContainer();
+
+		// Opens an existing container for reading.
+		bool Open(const char* path);
+		// Opens a container for appending time steps. A new container with the given capacity is created if it does not exist.
+		bool OpenForAppend(const char* path, int capacity = DefaultCapacity);
+		// Closes the container.
+		void Close();
+
+		// Gets the number of time steps, i.e., one past the last stored time step.
+		int GetNumSteps() const;
+		// Gets the maximum number of time steps.
+		int GetCapacity() const;
+		// Gets a stored time step or nullptr if it is missing.
+		const Step* Find(int timeStep) const;
+		// Gets the open file, e.g., to submit batched reads of time steps.
+		const RandomAccessFile& GetFile() const;
+
+		// Reads a time step into a vtkImageData.
+		vtkSmartPointer<vtkImageData> ReadStep(int timeStep, const char* fieldName) const;
+		// Reads a time step into a pre-allocated vtkFloatArray. Note that it needs to have the right size allocated!
+		bool ReadStep(int timeStep, vtkFloatArray* output) const;
+		// Reads the grid points in an index box of a time step into a pre-allocated vtkFloatArray with the size of the box.
+		bool ReadStepRegion(int timeStep, const Eigen::AlignedBox3i& region, vtkFloatArray* output) const;
+		// Maps a time step into a vtkImageData without copying it (see AmiraReader::ReadFieldMapped).
+		vtkSmartPointer<vtkImageData> ReadStepMapped(int timeStep, const char* fieldName) const;
+
+		// Appends a time step that is given as a complete amira file in memory.
+		bool AppendStep(int timeStep, const char* data, int64_t size);
+		// Appends a time step from an amira file (*.am).
+		bool AppendFile(int timeStep, const char* path);
+		// Appends a scalar field as time step (see AmiraWriter::WriteScalarField).
+		bool AppendScalarField(int timeStep, const char* fieldName, vtkImageData* imageData, Quantization::EStorage storage = Quantization::EStorage::Float, double errorBound = 0);
+		// Appends a vector field as time step (see AmiraWriter::WriteVectorField).
+		bool AppendVectorField(int timeStep, const char* fieldUName, const char* fieldVName, const char* fieldWName, vtkImageData* imageData);
+
+	private:
+		// Delete the copy-constructor.
+		TimeSeriesContainer(const TimeSeriesContainer& other) = delete;
+
+		// Reads the file header and the offset table.
+		bool ReadTable();
+		// Writes the entry of a time step to the offset table and updates the file header.
+		bool WriteTable(int timeStep);
+
+		// The open file.
+		RandomAccessFile mFile;
+		// Path of the file, which is needed to map time steps.
+		std::string mPath;
+		// Flag that is set if the container was opened for appending.
+		bool mWritable;
+		// Number of time steps.
+		int mNumSteps;
+		// End of the last time step, rounded up to the alignment. This is where the next time step goes.
+		int64_t mEndOffset;
+		// Entry of each time step in the offset table.
+		std::vector<Step> mSteps;
+	};
+}
@@ -0,0 +1,375 @@
+#include "TimeSeriesManifest.hpp"
+#include "Pyramid.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <vtkImageData.h>
+#include <vtkFloatArray.h>
+
+namespace vispro
+{
+	// Identifier and version of the manifest file. Bump the version whenever the layout of an entry changes.
+	static const char ManifestMagic[4] = { 'V', 'P', 'M', 'F' };
+	static const int32_t ManifestVersion = 2;
+	// Name of the manifest file in the data directory.
+	static const char* ManifestFileName = "halfcylinder.manifest";
+	// Parameters of the time series.
+	static const double StartTime = 0.0;
+	static const double TemporalSpacing = 0.1;
+
+	// Gets the size and modification time of a file. Returns false if the file does not exist.
+	static bool StatFile(const std::string& path, int64_t& fileSize, int64_t& modifiedTime) {
+		std::error_code error;
+		fileSize = (int64_t)std::filesystem::file_size(path, error);
+		if (error) return false;
+		modifiedTime = (int64_t)std::filesystem::last_write_time(path, error).time_since_epoch().count();
+		return !error;
+	}
+
+	// Splits a level name (see GetLevelName) into the field and the suffix of the level in file names.
+	static std::string SplitLevel(const std::string& name, std::string& suffix) {
+		const size_t separator = name.find('@');
+		if (separator == std::string::npos) {
+			suffix.clear();
+			return name;
+		}
+		suffix = "-" + name.substr(separator + 1);
+		return name.substr(0, separator);
+	}
+
+	// Helpers for reading and writing plain values.
+	template <typename T> static void WriteValue(FILE* fp, const T& value) { fwrite(&value, sizeof(T), 1, fp); }
+	template <typename T> static bool ReadValue(FILE* fp, T& value) { return fread(&value, sizeof(T), 1, fp) == 1; }
+
+	TimeSeriesManifest::TimeSeriesManifest(const std::string& basePath) : mBasePath(basePath), mNumTimeSteps(0), mDirty(false)
+	{
+		if (!Load()) {
+			Build();
+			Save();
+		}
+		// the time series may only be available as container
+		if (FindContainer("velocity", 0))
+			mNumTimeSteps = std::max(mNumTimeSteps, mContainers["velocity"].first->GetNumSteps());
+	}
+
+	TimeSeriesManifest::~TimeSeriesManifest()
+	{
+		if (mDirty) Save();
+	}
+
+	std::string TimeSeriesManifest::GetFileName(const std::string& name, int timeStep, const char* extension)
+	{
+		std::string suffix;
+		const std::string field = SplitLevel(name, suffix);
+		char filename[256];
+		if (field == "velocity")
+			sprintf(filename, "halfcylinder-%.2f%s%s", StartTime + timeStep * TemporalSpacing, suffix.c_str(), extension);
+		else sprintf(filename, "halfcylinder-%s-%.2f%s%s", field.c_str(), StartTime + timeStep * TemporalSpacing, suffix.c_str(), extension);
+		return filename;
+	}
+
+	std::string TimeSeriesManifest::GetContainerName(const std::string& name)
+	{
+		std::string suffix;
+		const std::string field = SplitLevel(name, suffix);
+		if (field == "velocity") return "halfcylinder" + suffix + ".ams";
+		return "halfcylinder-" + field + suffix + ".ams";
+	}
+
+	std::string TimeSeriesManifest::GetLevelName(const std::string& field, int level)
+	{
+		if (level <= 0) return field;
+		return field + "@" + Pyramid::GetLevelSuffix(level).substr(1);
+	}
+
+	const std::vector<std::string>& TimeSeriesManifest::GetFieldNames()
+	{
+		static const std::vector<std::string> fieldNames = { "velocity", "magnitude", "vorticity", "featureflow", "lic", "ftle" };
+		return fieldNames;
+	}
+
+	const TimeSeriesManifest::Entry* TimeSeriesManifest::Find(const std::string& field, int timeStep) const
+	{
+		auto it = mEntries.find(field);
+		if (it == mEntries.end() || timeStep < 0 || timeStep >= (int)it->second.size()) return nullptr;
+		const Entry& entry = it->second[timeStep];
+		return entry.FileSize > 0 ? &entry : nullptr;
+	}
+
+	const TimeSeriesManifest::Entry* TimeSeriesManifest::Update(const std::string& field, int timeStep)
+	{
+		if (timeStep < 0) return nullptr;
+		std::vector<Entry>& entries = mEntries[field];
+		if (timeStep >= (int)entries.size())
+			entries.resize(timeStep + 1, Entry{ AmiraReader::Header(), 0, 0, false });
+		Entry& entry = entries[timeStep];
+		entry.FileSize = 0;
+		entry.Validated = true;
+		mDirty = true;
+
+		std::string path = mBasePath + GetFileName(field, timeStep);
+		int64_t fileSize, modifiedTime;
+		if (!StatFile(path, fileSize, modifiedTime) || !AmiraReader::ReadHeader(path.c_str(), entry.Header)) return nullptr;
+		entry.FileSize = fileSize;
+		entry.ModifiedTime = modifiedTime;
+
+		// the velocity files define the length of the time series
+		if (field == "velocity" && timeStep >= mNumTimeSteps)
+			mNumTimeSteps = timeStep + 1;
+		return &entry;
+	}
+
+	const TimeSeriesManifest::Entry* TimeSeriesManifest::Validate(const std::string& field, int timeStep)
+	{
+		// missing files are remembered as well, so that neither costs a stat on later reads
+		auto it = mEntries.find(field);
+		if (it != mEntries.end() && timeStep >= 0 && timeStep < (int)it->second.size() && it->second[timeStep].Validated)
+			return Find(field, timeStep);
+
+		const Entry* entry = Find(field, timeStep);
+		int64_t fileSize, modifiedTime;
+		if (!entry || !StatFile(mBasePath + GetFileName(field, timeStep), fileSize, modifiedTime) ||
+			entry->FileSize != fileSize || entry->ModifiedTime != modifiedTime)
+			return Update(field, timeStep);
+		it->second[timeStep].Validated = true;
+		return entry;
+	}
+
+	int TimeSeriesManifest::Refresh()
+	{
+		for (auto& field : mEntries)
+			for (Entry& entry : field.second)
+				entry.Validated = false;
+		mContainers.clear();
+
+		Scan(mNumTimeSteps);
+		if (FindContainer("velocity", 0))
+			mNumTimeSteps = std::max(mNumTimeSteps, mContainers["velocity"].first->GetNumSteps());
+		return mNumTimeSteps;
+	}
+
+	const TimeSeriesContainer* TimeSeriesManifest::FindContainer(const std::string& field, int timeStep)
+	{
+		// containers are opened once, on first access
+		auto it = mContainers.find(field);
+		if (it == mContainers.end()) {
+			std::unique_ptr<TimeSeriesContainer> container(new TimeSeriesContainer());
+			std::string path = mBasePath + GetContainerName(field);
+			int64_t fileSize, modifiedTime = 0;
+			if (!StatFile(path, fileSize, modifiedTime) || !container->Open(path.c_str())) container.reset();
+			it = mContainers.emplace(field, std::make_pair(std::move(container), modifiedTime)).first;
+		}
+		const TimeSeriesContainer* container = it->second.first.get();
+		if (!container || !container->Find(timeStep)) return nullptr;
+		const Entry* entry = Find(field, timeStep);
+		if (entry && entry->ModifiedTime > it->second.second) return nullptr;
+		return container;
+	}
+
+	const AmiraReader::Header* TimeSeriesManifest::FindHeader(const std::string& field, int timeStep)
+	{
+		if (const TimeSeriesContainer* container = FindContainer(field, timeStep))
+			return &container->Find(timeStep)->Header;
+		const Entry* entry = Validate(field, timeStep);
+		return entry ? &entry->Header : nullptr;
+	}
+
+	vtkSmartPointer<vtkImageData> TimeSeriesManifest::ReadField(const std::string& field, int timeStep, const char* fieldName)
+	{
+		if (const TimeSeriesContainer* container = FindContainer(field, timeStep))
+			return container->ReadStep(timeStep, fieldName);
+		const Entry* entry = Validate(field, timeStep);
+		if (!entry) return nullptr;
+		return AmiraReader::ReadField((mBasePath + GetFileName(field, timeStep)).c_str(), entry->Header, fieldName);
+	}
+
+	vtkSmartPointer<vtkImageData> TimeSeriesManifest::ReadFieldMapped(const std::string& field, int timeStep, const char* fieldName)
+	{
+		if (const TimeSeriesContainer* container = FindContainer(field, timeStep))
+			return container->ReadStepMapped(timeStep, fieldName);
+		const Entry* entry = Validate(field, timeStep);
+		if (!entry) return nullptr;
+		return AmiraReader::ReadFieldMapped((mBasePath + GetFileName(field, timeStep)).c_str(), entry->Header, fieldName);
+	}
+
+	bool TimeSeriesManifest::ReadField(const std::string& field, int timeStep, vtkFloatArray* output)
+	{
+		if (const TimeSeriesContainer* container = FindContainer(field, timeStep))
+			return container->ReadStep(timeStep, output);
+		const Entry* entry = Validate(field, timeStep);
+		if (!entry) return false;
+		return AmiraReader::ReadField((mBasePath + GetFileName(field, timeStep)).c_str(), entry->Header, output);
+	}
+
+	bool TimeSeriesManifest::ReadFieldRegion(const std::string& field, int timeStep, const Eigen::AlignedBox3i& region, vtkFloatArray* output)
+	{
+		if (const TimeSeriesContainer* container = FindContainer(field, timeStep))
+			return container->ReadStepRegion(timeStep, region, output);
+		const Entry* entry = Validate(field, timeStep);
+		if (!entry) return false;
+		RandomAccessFile file;
+		if (!file.Open((mBasePath + GetFileName(field, timeStep)).c_str())) return false;
+		return AmiraReader::ReadFieldRegion(file, 0, entry->Header, region, output);
+	}
+
+	BatchReader::Ticket TimeSeriesManifest::SubmitFields(BatchReader& reader, const std::vector<BatchRead>& reads)
+	{
+		std::vector<BatchReader::Request> requests;
+		std::vector<BatchReader::FinishFunction> finishers;
+		std::vector<std::shared_ptr<RandomAccessFile>> files;
+		bool success = true;
+		for (const BatchRead& read : reads) {
+			// locate the embedded amira file, either in the container or as individual file
+			const RandomAccessFile* file = nullptr;
+			const AmiraReader::Header* header = nullptr;
+			int64_t offset = 0, size = 0;
+			if (const TimeSeriesContainer* container = FindContainer(read.Field, read.TimeStep)) {
+				const TimeSeriesContainer::Step* step = container->Find(read.TimeStep);
+				file = &container->GetFile();
+				header = &step->Header;
+				offset = step->Offset;
+				size = step->Size;
+			}
+			else if (const Entry* entry = Validate(read.Field, read.TimeStep)) {
+				// the individual files are owned by the batch and closed once it was waited for
+				auto individual = std::make_shared<RandomAccessFile>();
+				if (individual->Open((mBasePath + GetFileName(read.Field, read.TimeStep)).c_str())) {
+					files.push_back(individual);
+					file = individual.get();
+					header = &entry->Header;
+					size = entry->FileSize;
+				}
+			}
+			if (!file) {
+				success = false;
+				continue;
+			}
+
+			const Eigen::AlignedBox3i region = read.Region.isEmpty() ? Eigen::AlignedBox3i(Eigen::Vector3i(0, 0, 0), header->Resolution - Eigen::Vector3i(1, 1, 1)) : read.Region;
+			BatchReader::FinishFunction finish;
+			if (!AmiraReader::PlanReadRegion(*file, offset, size, *header, region, read.Output, requests, finish)) success = false;
+			else if (finish) finishers.push_back(std::move(finish));
+		}
+
+		return reader.Submit(requests, [success, finishers = std::move(finishers), files = std::move(files)]() {
+			bool finished = success;
+			for (const BatchReader::FinishFunction& finish : finishers)
+				finished = finish() && finished;
+			return finished;
+		});
+	}
+
+	bool TimeSeriesManifest::ReadFields(BatchReader& reader, const std::vector<BatchRead>& reads)
+	{
+		return reader.Wait(SubmitFields(reader, reads));
+	}
+
+	bool TimeSeriesManifest::Save()
+	{
+		FILE* fp = fopen(GetManifestPath().c_str(), "wb");
+		if (!fp) return false;
+		fwrite(ManifestMagic, sizeof(char), 4, fp);
+		WriteValue(fp, ManifestVersion);
+		WriteValue(fp, (int32_t)mNumTimeSteps);
+		WriteValue(fp, (int32_t)mEntries.size());
+		for (const auto& field : mEntries) {
+			WriteValue(fp, (int32_t)field.first.size());
+			fwrite(field.first.data(), sizeof(char), field.first.size(), fp);
+			WriteValue(fp, (int32_t)field.second.size());
+			for (const Entry& entry : field.second) {
+				const AmiraReader::Header& header = entry.Header;
+				WriteValue(fp, entry.FileSize);
+				WriteValue(fp, entry.ModifiedTime);
+				if (entry.FileSize == 0) continue;
+				for (int i = 0; i < 3; ++i) WriteValue(fp, (int32_t)header.Resolution[i]);
+				for (int i = 0; i < 3; ++i) WriteValue(fp, header.Bounds.min()[i]);
+				for (int i = 0; i < 3; ++i) WriteValue(fp, header.Bounds.max()[i]);
+				for (int i = 0; i < 3; ++i) WriteValue(fp, header.Spacing[i]);
+				WriteValue(fp, (int32_t)header.NumComponents);
+				WriteValue(fp, (int32_t)header.Storage);
+				WriteValue(fp, header.Scale);
+				WriteValue(fp, header.Bias);
+				WriteValue(fp, header.DataOffset);
+			}
+		}
+		bool success = ferror(fp) == 0;
+		fclose(fp);
+		if (success) mDirty = false;
+		return success;
+	}
+
+	bool TimeSeriesManifest::Load()
+	{
+		FILE* fp = fopen(GetManifestPath().c_str(), "rb");
+		if (!fp) return false;
+
+		char magic[4];
+		int32_t version, numTimeSteps, numFields;
+		bool success = fread(magic, sizeof(char), 4, fp) == 4 && memcmp(magic, ManifestMagic, 4) == 0 &&
+			ReadValue(fp, version) && version == ManifestVersion &&
+			ReadValue(fp, numTimeSteps) && ReadValue(fp, numFields);
+		std::map<std::string, std::vector<Entry>> entries;
+		for (int32_t iField = 0; success && iField < numFields; ++iField) {
+			int32_t nameLength, numEntries;
+			success = ReadValue(fp, nameLength) && nameLength > 0 && nameLength < 256;
+			if (!success) break;
+			std::string name(nameLength, '\0');
+			success = fread(&name[0], sizeof(char), nameLength, fp) == (size_t)nameLength && ReadValue(fp, numEntries) && numEntries >= 0;
+			std::vector<Entry>& fieldEntries = entries[name];
+			for (int32_t iEntry = 0; success && iEntry < numEntries; ++iEntry) {
+				Entry entry{ AmiraReader::Header(), 0, 0, false };
+				success = ReadValue(fp, entry.FileSize) && ReadValue(fp, entry.ModifiedTime);
+				if (success && entry.FileSize != 0) {
+					AmiraReader::Header& header = entry.Header;
+					int32_t resolution[3], numComponents, storage;
+					Eigen::Vector3d min, max;
+					for (int i = 0; i < 3; ++i) success &= ReadValue(fp, resolution[i]);
+					for (int i = 0; i < 3; ++i) success &= ReadValue(fp, min[i]);
+					for (int i = 0; i < 3; ++i) success &= ReadValue(fp, max[i]);
+					for (int i = 0; i < 3; ++i) success &= ReadValue(fp, header.Spacing[i]);
+					success &= ReadValue(fp, numComponents) && ReadValue(fp, storage) && ReadValue(fp, header.Scale) && ReadValue(fp, header.Bias) && ReadValue(fp, header.DataOffset);
+					header.Resolution = Eigen::Vector3i(resolution[0], resolution[1], resolution[2]);
+					header.Bounds = Eigen::AlignedBox3d(min, max);
+					header.NumComponents = numComponents;
+					header.Storage = (Quantization::EStorage)storage;
+				}
+				fieldEntries.push_back(entry);
+			}
+		}
+		fclose(fp);
+		if (!success) return false;
+		mEntries = std::move(entries);
+		mNumTimeSteps = numTimeSteps;
+		return true;
+	}
+
+	void TimeSeriesManifest::Build()
+	{
+		mEntries.clear();
+		mNumTimeSteps = 0;
+		Scan(0);
+	}
+
+	void TimeSeriesManifest::Scan(int firstTimeStep)
+	{
+		// the time series ends at the first missing velocity file
+		mNumTimeSteps = std::max(mNumTimeSteps, firstTimeStep);
+		while (Update("velocity", mNumTimeSteps)) {}
+		mEntries["velocity"].resize(mNumTimeSteps);
+
+		// derived fields may be missing for individual time steps
+		for (const std::string& field : GetFieldNames()) {
+			if (field == "velocity") continue;
+			for (int timeStep = firstTimeStep; timeStep < mNumTimeSteps; ++timeStep)
+				Update(field, timeStep);
+		}
+	}
+
+	std::string TimeSeriesManifest::GetManifestPath() const { return mBasePath + ManifestFileName; }
+
+	int TimeSeriesManifest::GetNumTimeSteps() const { return mNumTimeSteps; }
+	double TimeSeriesManifest::GetStartTime() const { return StartTime; }
+	double TimeSeriesManifest::GetTemporalSpacing() const { return TemporalSpacing; }
+	const std::string& TimeSeriesManifest::GetBasePath() const { return mBasePath; }
+}
\ No newline at end of file
@@ -0,0 +1,119 @@
+#pragma once
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include "AmiraReader.hpp"
+#include "TimeSeriesContainer.hpp"
+#include "BatchReader.hpp"
+
+namespace vispro
+{
+	// Binary cache of the headers of all files of a time series. It is built once by scanning the data directory and is
+	// stored next to the data, so that later runs can seek straight to the payload without opening or parsing headers.
+	// Fields that were packed into a TimeSeriesContainer (*.ams) are read from the container instead of the individual files.
+	// Each entry is checked against the file on disk once, on its first access. Files that are written or time steps that are
+	// appended afterwards are only seen after Update or Refresh.
+	class TimeSeriesManifest
+	{
+	public:
+		// A field that is read as part of a batch.
+		struct BatchRead {
+			std::string Field;				// name of the field, or of a pyramid level (see GetLevelName)
+			int TimeStep;					// time step to read
+			vtkFloatArray* Output;			// pre-allocated array with the size of the region
+			Eigen::AlignedBox3i Region;		// grid points to read, an empty box reads the full field
+		};
+
+		// Cached information about a single file.
+		struct Entry {
+			AmiraReader::Header Header;	// parsed header, including the offset of the data section
+			int64_t FileSize;			// size of the file in bytes (0 if the file does not exist)
+			int64_t ModifiedTime;		// last modification time of the file when the header was parsed
+			bool Validated;				// whether the entry was checked against the disk since loading, not stored
+		};
+
+		// Constructor. Loads the manifest from the base path or builds it, if it is missing or outdated.
+		TimeSeriesManifest(const std::string& basePath);
+		// Destructor. Stores the manifest if entries have changed.
+		~TimeSeriesManifest();
+
+		// Gets the file name of a field at a time step, e.g., "halfcylinder-vorticity-1.20.am". The velocity has no infix.
+		static std::string GetFileName(const std::string& field, int timeStep, const char* extension = ".am");
+		// Gets the file name of the container of a field, e.g., "halfcylinder-vorticity.ams". The velocity has no infix.
+		static std::string GetContainerName(const std::string& field);
+		// Gets the name under which a level of the resolution pyramid of a field is tracked, e.g., "vorticity@2x". Level 0 is the field itself.
+		// Level names can be used wherever a field name is expected. Their files carry the level suffix, e.g., "halfcylinder-vorticity-1.20-2x.am".
+		static std::string GetLevelName(const std::string& field, int level);
+		// Gets the names of all fields that are tracked by the manifest.
+		static const std::vector<std::string>& GetFieldNames();
+
+		// Gets the cached entry of a field at a time step or nullptr if the file does not exist.
+		const Entry* Find(const std::string& field, int timeStep) const;
+		// Re-reads the header of a file, for instance after it was written. Returns nullptr if the file is not readable.
+		const Entry* Update(const std::string& field, int timeStep);
+		// Picks up the time steps that were appended since the manifest was loaded, reopens the containers and checks all entries
+		// against the disk again on their next access. Must not be called while batches are in flight. Returns the number of time steps.
+		int Refresh();
+		// Gets the header of a field at a time step, either from the container or from the individual file. Returns nullptr if it does not exist.
+		const AmiraReader::Header* FindHeader(const std::string& field, int timeStep);
+
+		// Reads a field into a vtkImageData.
+		vtkSmartPointer<vtkImageData> ReadField(const std::string& field, int timeStep, const char* fieldName);
+		// Maps a field into a vtkImageData without copying it (see AmiraReader::ReadFieldMapped).
+		vtkSmartPointer<vtkImageData> ReadFieldMapped(const std::string& field, int timeStep, const char* fieldName);
+		// Reads a field into a pre-allocated vtkFloatArray. Note that it needs to have the right size allocated!
+		bool ReadField(const std::string& field, int timeStep, vtkFloatArray* output);
+		// Reads the grid points in an index box of a field into a pre-allocated vtkFloatArray with the size of the box (see AmiraReader::GetRegionHeader).
+		bool ReadFieldRegion(const std::string& field, int timeStep, const Eigen::AlignedBox3i& region, vtkFloatArray* output);
+
+		// Submits the reads of several fields, e.g., of upcoming time steps, to a batch reader, which reads them concurrently into the
+		// pre-allocated arrays. The arrays and the manifest have to stay alive until the ticket was waited for. Missing fields fail the batch.
+		BatchReader::Ticket SubmitFields(BatchReader& reader, const std::vector<BatchRead>& reads);
+		// Reads several fields at once, i.e., submits them and waits for the batch. Returns false if a field could not be read.
+		bool ReadFields(BatchReader& reader, const std::vector<BatchRead>& reads);
+
+		// Writes the manifest next to the data.
+		bool Save();
+
+		// Gets the number of time steps, which is determined by the available velocity files.
+		int GetNumTimeSteps() const;
+		// Gets the physical time of the first time step.
+		double GetStartTime() const;
+		// Gets the temporal distance between two time steps.
+		double GetTemporalSpacing() const;
+		// Gets the base path of the data set.
+		const std::string& GetBasePath() const;
+
+	private:
+		// Delete the copy-constructor.
+		TimeSeriesManifest(const TimeSeriesManifest& other) = delete;
+
+		// Reads the manifest file. Returns false if it is missing or has an unknown version.
+		bool Load();
+		// Scans the data directory and parses the headers of all files.
+		void Build();
+		// Checks an entry against the size and modification time on disk and re-reads the header if the file has changed.
+		// Entries that were checked before are returned right away.
+		const Entry* Validate(const std::string& field, int timeStep);
+		// Parses the headers of all fields from a time step on, until the first missing velocity file.
+		void Scan(int firstTimeStep);
+		// Gets the path of the manifest file.
+		std::string GetManifestPath() const;
+		// Gets the container that holds a time step, or nullptr if the time step has to be read from its individual file.
+		// A file that was written after the container was packed takes precedence.
+		const TimeSeriesContainer* FindContainer(const std::string& field, int timeStep);
+
+		// Base path to the data set.
+		std::string mBasePath;
+		// Entries for each field, indexed by time step.
+		std::map<std::string, std::vector<Entry>> mEntries;
+		// Opened containers and their modification times, indexed by field. Fields without container have a nullptr.
+		std::map<std::string, std::pair<std::unique_ptr<TimeSeriesContainer>, int64_t>> mContainers;
+		// Number of time steps.
+		int mNumTimeSteps;
+		// Flag that is set when entries have changed since the last save.
+		bool mDirty;
+	};
+}
\ No newline at end of file
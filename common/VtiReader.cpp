@@ -0,0 +1,277 @@
+#include "VtiReader.hpp"
+#include "MappedFile.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <vtkImageData.h>
+#include <vtkPointData.h>
+#include <vtkFloatArray.h>
+#include <vtkDataCompressor.h>
+#include <vtkLZ4DataCompressor.h>
+#include <vtkLZMADataCompressor.h>
+#include <vtkZLibDataCompressor.h>
+
+namespace vispro
+{
+	// Point data array that is stored in the appended data section.
+	struct AppendedArray {
+		std::string Name;				// name of the array
+		int NumComponents;				// number of components per point
+		int64_t Offset;					// offset of the array relative to the start of the appended data
+	};
+
+	// Everything that is needed to decode a file.
+	struct VtiLayout {
+		int Extent[6];					// whole extent of the image
+		double Origin[3];				// origin of the image
+		double Spacing[3];				// spacing of the image
+		int HeaderSize;					// size of the integers in the block headers (4 or 8 bytes)
+		std::string Compressor;			// class name of the compressor, empty if the data is not compressed
+		std::vector<AppendedArray> Arrays;
+		int64_t AppendedStart;			// byte offset of the appended data in the file
+	};
+
+	// Compressed block of an array.
+	struct CompressedBlock {
+		int Array;						// index of the array
+		int64_t Source;					// byte offset of the compressed block in the file
+		int64_t SourceSize;				// compressed size in bytes
+		int64_t Target;					// byte offset of the decoded block in the array
+		int64_t TargetSize;				// decoded size in bytes
+	};
+
+	// Gets the value of an attribute of the tag that starts at "tag". Returns false if the tag does not have the attribute.
+	static bool GetAttribute(const char* tag, const char* name, std::string& value) {
+		const char* tagEnd = strchr(tag, '>');
+		std::string pattern = std::string(" ") + name + "=\"";
+		const char* begin = strstr(tag, pattern.c_str());
+		if (!begin || (tagEnd && begin > tagEnd)) return false;
+		begin += pattern.size();
+		const char* end = strchr(begin, '"');
+		if (!end) return false;
+		value.assign(begin, end);
+		return true;
+	}
+
+	// Parses a number of whitespace separated values of an attribute.
+	template <typename T> static bool GetAttribute(const char* tag, const char* name, T* values, int count) {
+		std::string value;
+		if (!GetAttribute(tag, name, value)) return false;
+		std::istringstream stream(value);
+		for (int i = 0; i < count; ++i)
+			if (!(stream >> values[i])) return false;
+		return true;
+	}
+
+	// Reads an integer of the block headers, which is either 32 or 64 bit.
+	static int64_t ReadHeaderValue(const char* ptr, int headerSize) {
+		if (headerSize == 8) {
+			uint64_t value;
+			memcpy(&value, ptr, sizeof(uint64_t));
+			return (int64_t)value;
+		}
+		uint32_t value;
+		memcpy(&value, ptr, sizeof(uint32_t));
+		return (int64_t)value;
+	}
+
+	// Creates the decompressor for a compressor class name.
+	static vtkSmartPointer<vtkDataCompressor> CreateCompressor(const std::string& name) {
+		if (name == "vtkZLibDataCompressor") return vtkSmartPointer<vtkZLibDataCompressor>::New();
+		if (name == "vtkLZ4DataCompressor") return vtkSmartPointer<vtkLZ4DataCompressor>::New();
+		if (name == "vtkLZMADataCompressor") return vtkSmartPointer<vtkLZMADataCompressor>::New();
+		return nullptr;
+	}
+
+	// Parses the XML part of the file. The XML ends at the appended data, so the binary part is never scanned.
+	static bool ParseLayout(const MappedFile& file, VtiLayout& layout) {
+		const char* data = file.GetData();
+		const char* appended = nullptr;
+		for (const char* ptr = data; ptr + 13 < data + file.GetSize(); ++ptr)
+			if (*ptr == '<' && memcmp(ptr, "<AppendedData", 13) == 0) { appended = ptr; break; }
+		if (!appended) return false;
+		std::string xml(data, appended);
+		std::string encoding;
+		const char* appendedTagEnd = (const char*)memchr(appended, '>', data + file.GetSize() - appended);
+		if (!appendedTagEnd || !GetAttribute(std::string(appended, appendedTagEnd + 1).c_str(), "encoding", encoding) || encoding != "raw") return false;
+		// the binary data starts behind the underscore
+		const char* underscore = (const char*)memchr(appendedTagEnd, '_', data + file.GetSize() - appendedTagEnd);
+		if (!underscore) return false;
+		layout.AppendedStart = (int64_t)(underscore + 1 - data);
+
+		// file attributes
+		const char* vtkFile = strstr(xml.c_str(), "<VTKFile");
+		std::string type, byteOrder, headerType;
+		if (!vtkFile || !GetAttribute(vtkFile, "type", type) || type != "ImageData") return false;
+		if (GetAttribute(vtkFile, "byte_order", byteOrder) && byteOrder != "LittleEndian") return false;
+		layout.HeaderSize = GetAttribute(vtkFile, "header_type", headerType) && headerType == "UInt64" ? 8 : 4;
+		if (!GetAttribute(vtkFile, "compressor", layout.Compressor)) layout.Compressor.clear();
+		if (!layout.Compressor.empty() && !CreateCompressor(layout.Compressor)) return false;
+
+		// lattice
+		const char* imageData = strstr(xml.c_str(), "<ImageData");
+		if (!imageData || !GetAttribute(imageData, "WholeExtent", layout.Extent, 6) ||
+			!GetAttribute(imageData, "Origin", layout.Origin, 3) || !GetAttribute(imageData, "Spacing", layout.Spacing, 3)) return false;
+		const char* piece = strstr(xml.c_str(), "<Piece");
+		if (!piece || strstr(piece + 1, "<Piece")) return false;
+
+		// point data arrays
+		const char* pointData = strstr(piece, "<PointData");
+		const char* pointDataEnd = pointData ? strstr(pointData, "</PointData>") : nullptr;
+		if (!pointDataEnd) return false;
+		layout.Arrays.clear();
+		for (const char* dataArray = strstr(pointData, "<DataArray"); dataArray && dataArray < pointDataEnd; dataArray = strstr(dataArray + 1, "<DataArray")) {
+			AppendedArray array;
+			std::string arrayType, format;
+			if (!GetAttribute(dataArray, "type", arrayType) || arrayType != "Float32" ||
+				!GetAttribute(dataArray, "format", format) || format != "appended" ||
+				!GetAttribute(dataArray, "Name", array.Name) || !GetAttribute(dataArray, "offset", &array.Offset, 1)) return false;
+			if (!GetAttribute(dataArray, "NumberOfComponents", &array.NumComponents, 1)) array.NumComponents = 1;
+			layout.Arrays.push_back(array);
+		}
+		return !layout.Arrays.empty();
+	}
+
+	// Gets the number of bytes of a value of a VTK data type, 0 for unknown types.
+	static int64_t GetTypeSize(const std::string& type) {
+		if (type == "Float64" || type == "Int64" || type == "UInt64") return 8;
+		if (type == "Float32" || type == "Int32" || type == "UInt32") return 4;
+		if (type == "Int16" || type == "UInt16") return 2;
+		if (type == "Int8" || type == "UInt8") return 1;
+		return 0;
+	}
+
+	// Estimates the decoded size of the point data from the XML header, which works for all formats, e.g., inline or with other types than Float32.
+	// Returns 0 if the header does not have a whole extent or point data arrays of known types.
+	static int64_t EstimateDecodedSize(const MappedFile& file) {
+		// the header ends with the point data, whose end is searched without relying on a null terminator in the mapped file
+		const char* data = file.GetData();
+		const char* fileEnd = data + file.GetSize();
+		static const std::string pointDataTag = "</PointData>";
+		const char* pointDataEnd = std::search(data, fileEnd, pointDataTag.begin(), pointDataTag.end());
+		if (pointDataEnd == fileEnd) return 0;
+		std::string xml(data, pointDataEnd + pointDataTag.size());
+
+		int extent[6];
+		const char* imageData = strstr(xml.c_str(), "<ImageData");
+		const char* pointData = strstr(xml.c_str(), "<PointData");
+		if (!imageData || !pointData || !GetAttribute(imageData, "WholeExtent", extent, 6)) return 0;
+		int64_t bytesPerPoint = 0;
+		for (const char* dataArray = strstr(pointData, "<DataArray"); dataArray; dataArray = strstr(dataArray + 1, "<DataArray")) {
+			std::string type;
+			int numComponents = 1;
+			if (!GetAttribute(dataArray, "type", type) || GetTypeSize(type) == 0) return 0;
+			GetAttribute(dataArray, "NumberOfComponents", &numComponents, 1);
+			bytesPerPoint += GetTypeSize(type) * numComponents;
+		}
+		return (int64_t)(extent[1] - extent[0] + 1) * (extent[3] - extent[2] + 1) * (extent[5] - extent[4] + 1) * bytesPerPoint;
+	}
+
+	// Gets the number of points of the image.
+	static int64_t GetNumPoints(const VtiLayout& layout) {
+		return (int64_t)(layout.Extent[1] - layout.Extent[0] + 1) * (layout.Extent[3] - layout.Extent[2] + 1) * (layout.Extent[5] - layout.Extent[4] + 1);
+	}
+
+	// Collects the blocks of an array. Uncompressed arrays are a single block that is copied.
+	static bool CollectBlocks(const MappedFile& file, const VtiLayout& layout, int iArray, int64_t numBytes, std::vector<CompressedBlock>& blocks) {
+		const int64_t start = layout.AppendedStart + layout.Arrays[iArray].Offset;
+		const int h = layout.HeaderSize;
+		if (start + h > file.GetSize()) return false;
+		const char* header = file.GetData() + start;
+		if (layout.Compressor.empty()) {
+			if (ReadHeaderValue(header, h) != numBytes || start + h + numBytes > file.GetSize()) return false;
+			blocks.push_back(CompressedBlock{ iArray, start + h, numBytes, 0, numBytes });
+			return true;
+		}
+
+		// header of compressed arrays: number of blocks, block size, size of the last block (0 if it is full), compressed sizes
+		if (start + 3 * h > file.GetSize()) return false;
+		const int64_t numBlocks = ReadHeaderValue(header, h);
+		const int64_t blockSize = ReadHeaderValue(header + h, h);
+		const int64_t lastBlockSize = ReadHeaderValue(header + 2 * h, h);
+		if (numBlocks < 0 || start + (3 + numBlocks) * h > file.GetSize()) return false;
+		int64_t source = start + (3 + numBlocks) * h;
+		int64_t target = 0;
+		for (int64_t iBlock = 0; iBlock < numBlocks; ++iBlock) {
+			const int64_t sourceSize = ReadHeaderValue(header + (3 + iBlock) * h, h);
+			const int64_t targetSize = (iBlock == numBlocks - 1 && lastBlockSize != 0) ? lastBlockSize : blockSize;
+			if (source + sourceSize > file.GetSize() || target + targetSize > numBytes) return false;
+			blocks.push_back(CompressedBlock{ iArray, source, sourceSize, target, targetSize });
+			source += sourceSize;
+			target += targetSize;
+		}
+		return target == numBytes;
+	}
+
+	vtkSmartPointer<vtkImageData> VtiReader::ReadField(const char* path, int numThreads)
+	{
+		MappedFile file;
+		VtiLayout layout;
+		if (!file.Open(path) || !ParseLayout(file, layout)) return nullptr;
+		const int64_t numPoints = GetNumPoints(layout);
+		if (numPoints <= 0) return nullptr;
+
+		// allocate the arrays and gather the blocks of all arrays, so that they are decoded in one parallel loop
+		vtkNew<vtkImageData> field;
+		field->SetExtent(layout.Extent);
+		field->SetOrigin(layout.Origin);
+		field->SetSpacing(layout.Spacing);
+		std::vector<char*> targets;
+		std::vector<CompressedBlock> blocks;
+		for (int iArray = 0; iArray < (int)layout.Arrays.size(); ++iArray) {
+			const AppendedArray& appendedArray = layout.Arrays[iArray];
+			vtkNew<vtkFloatArray> mArray;
+			mArray->SetNumberOfComponents(appendedArray.NumComponents);
+			mArray->SetNumberOfTuples(numPoints);
+			mArray->SetName(appendedArray.Name.c_str());
+			field->GetPointData()->AddArray(mArray);
+			targets.push_back((char*)mArray->GetPointer(0));
+			if (!CollectBlocks(file, layout, iArray, numPoints * appendedArray.NumComponents * (int64_t)sizeof(float), blocks)) return nullptr;
+		}
+		if (layout.Arrays.size() == 1 && layout.Arrays[0].NumComponents == 3)
+			field->GetPointData()->SetActiveVectors(layout.Arrays[0].Name.c_str());
+		else field->GetPointData()->SetActiveScalars(layout.Arrays[0].Name.c_str());
+
+		// decode the blocks
+		if (numThreads <= 0) numThreads = std::max(1, (int)std::thread::hardware_concurrency());
+		std::atomic<bool> success(true);
+		const int64_t numBlocks = (int64_t)blocks.size();
+#ifndef _DEBUG
+#pragma omp parallel num_threads(numThreads)
+#endif
+		{
+			// each thread has its own decompressor
+			vtkSmartPointer<vtkDataCompressor> compressor = CreateCompressor(layout.Compressor);
+#ifndef _DEBUG
+#pragma omp for schedule(dynamic, 8)
+#endif
+			for (int64_t iBlock = 0; iBlock < numBlocks; ++iBlock) {
+				const CompressedBlock& block = blocks[iBlock];
+				const unsigned char* source = (const unsigned char*)file.GetData() + block.Source;
+				unsigned char* target = (unsigned char*)targets[block.Array] + block.Target;
+				if (!compressor)
+					memcpy(target, source, (size_t)block.TargetSize);
+				else if (compressor->Uncompress(source, (size_t)block.SourceSize, target, (size_t)block.TargetSize) != (size_t)block.TargetSize)
+					success = false;
+			}
+		}
+		if (!success) return nullptr;
+		return field.Get();
+	}
+
+	int64_t VtiReader::GetDecodedSize(const char* path)
+	{
+		MappedFile file;
+		VtiLayout layout;
+		if (!file.Open(path)) return 0;
+		if (!ParseLayout(file, layout)) return EstimateDecodedSize(file);
+		int64_t numComponents = 0;
+		for (const AppendedArray& array : layout.Arrays)
+			numComponents += array.NumComponents;
+		return GetNumPoints(layout) * numComponents * (int64_t)sizeof(float);
+	}
+}
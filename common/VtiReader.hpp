@@ -0,0 +1,23 @@
+#pragma once
+
+#include <vtkSmartPointer.h>
+
+class vtkImageData;
+
+namespace vispro
+{
+	// Reads VTK image data files (*.vti) with appended raw data without going through vtkXMLImageDataReader.
+	// The file is mapped into memory and the compressed blocks of all arrays (zlib, LZ4 or LZMA) are decoded in parallel.
+	// Only a single piece with Float32 point data is supported. Other files are rejected, so that the caller can fall back
+	// to vtkXMLImageDataReader.
+	class VtiReader
+	{
+	public:
+		// Reads all point data arrays of a file. Receives the number of threads that decode blocks, 0 uses all hardware threads.
+		// Returns nullptr if the file could not be read or uses a layout that is not supported.
+		static vtkSmartPointer<vtkImageData> ReadField(const char* path, int numThreads = 0);
+		// Gets the number of bytes of the decoded point data of a file without decoding it. For files that are not supported, the size is estimated
+		// from the whole extent and the types and components of the point data arrays in the XML header. Returns 0 if the header cannot be read.
+		static int64_t GetDecodedSize(const char* path);
+	};
+}
@@ -4,16 +4,28 @@
 #include <qformlayout.h>
 #include <qlabel.h>
 #include <qcheckbox.h>
+#include <qcombobox.h>
+#include <qtimer.h>
 #include <qvariant.h>
+#include <algorithm>
 #include <vtkXMLImageDataReader.h>
 #include <vtkXMLPolyDataReader.h>
 #include <vtkImageData.h>
 #include <vtkPolyData.h>
+#include <vtkPointData.h>
+#include <vtkFloatArray.h>
 #include "AmiraReader.hpp"
+#include "Pyramid.hpp"
 
 namespace vispro
 {
-	Data::Data(const char* basePath) : mBasePath(basePath)
+	// Names of the fields in the manifest. Use EField as index.
+	static const char* ManifestFieldNames[] = { "velocity", "magnitude", "featureflow", "vorticity", "lic", "ftle" };
+	// Time in milliseconds without a time change after which the requested level is read.
+	static const int IdleDelay = 250;
+
+	Data::Data(const char* basePath) : mBasePath(basePath), mManifest(basePath), mTime(0), mLevel(0), mScrubLevel(Pyramid::NumLevels - 1),
+		mDirection(1), mPrefetchTime(-1), mPrefetchLevel(0), mPrefetchTicket(0)
 	{
 		// Allolate data containers.
 		mFieldData.resize(NumFields);			// number of fields
@@ -38,12 +50,24 @@ namespace vispro
 		slider->setTickInterval(10);
 		slider->setSingleStep(1);
 		slider->setMinimum(0);
-		slider->setMaximum(150);
+		slider->setMaximum(std::max(0, mManifest.GetNumTimeSteps() - 1));
 		mTimeSliderWidget = slider;
 		connect(slider, &QSlider::valueChanged, this, &Data::SetTime);
 
+		// the requested level is read once the slider rests
+		mIdleTimer = new QTimer(this);
+		mIdleTimer->setSingleShot(true);
+		mIdleTimer->setInterval(IdleDelay);
+		connect(mIdleTimer, &QTimer::timeout, this, &Data::ReadRequestedLevel);
+
 		mBounds[0] = mBounds[2] = mBounds[4] = 0;
 		mBounds[1] = mBounds[3] = mBounds[5] = 1;
+		if (const AmiraReader::Header* header = mManifest.FindHeader("velocity", 0)) {
+			for (int i = 0; i < 3; i++) {
+				mBounds[2 * i + 0] = header->Bounds.min()[i];
+				mBounds[2 * i + 1] = header->Bounds.max()[i];
+			}
+		}
 
 		std::string fieldNames[NumFields];
 		fieldNames[(int)EField::Velocity] = "Velocity";
@@ -69,6 +93,22 @@ namespace vispro
 			connect(checkBox, &QCheckBox::stateChanged, this, &Data::CheckedParticlesChanged);
 			layout->addRow(new QLabel(tr("Read Particles:")), checkBox);
 		}
+		{
+			// levels of the resolution pyramid
+			QComboBox* levelBox = new QComboBox;
+			QComboBox* scrubLevelBox = new QComboBox;
+			for (int level = 0; level < Pyramid::NumLevels; ++level) {
+				QString name = level == 0 ? QString("Full") : QString("1/%1").arg(1 << level);
+				levelBox->addItem(name);
+				scrubLevelBox->addItem(name);
+			}
+			levelBox->setCurrentIndex(mLevel);
+			scrubLevelBox->setCurrentIndex(mScrubLevel);
+			connect(levelBox, qOverload<int>(&QComboBox::currentIndexChanged), this, &Data::SetLevel);
+			connect(scrubLevelBox, qOverload<int>(&QComboBox::currentIndexChanged), this, &Data::SetScrubLevel);
+			layout->addRow(new QLabel(tr("Resolution:")), levelBox);
+			layout->addRow(new QLabel(tr("Scrub Resolution:")), scrubLevelBox);
+		}
 		groupBox->setLayout(layout);
 		mWidget = groupBox;
 
@@ -76,42 +116,23 @@ namespace vispro
 	}
 
 	Data::~Data()
-	{}
+	{
+		TakePrefetch(-1, 0);
+		ReleaseStalePrefetches(true);
+	}
 	
 	void Data::SetTime(int time) 
 	{
-		for (int iField = 0; iField < NumFields; ++iField) {
-			if (mFieldEnabled[iField]) {
-				char filename[256];
-				switch (iField) {
-				case (int)EField::Velocity:
-					sprintf(filename, "halfcylinder-%.2f.am", time * 0.1);
-					break;
-				case (int)EField::Magnitude:
-					sprintf(filename, "halfcylinder-magnitude-%.2f.am", time * 0.1);
-					break;
-				case (int)EField::Vorticity:
-					sprintf(filename, "halfcylinder-vorticity-%.2f.am", time * 0.1);
-					break;
-				case (int)EField::FeatureFlow:
-					sprintf(filename, "halfcylinder-featureflow-%.2f.am", time * 0.1);
-					break;
-				case (int)EField::LIC:
-					sprintf(filename, "halfcylinder-lic-%.2f.am", time * 0.1);
-					break;
-				case (int)EField::FTLE:
-					sprintf(filename, "halfcylinder-ftle-%.2f.am", time * 0.1);
-					break;
-				default: 
-					throw std::logic_error("path for field not yet implemented!");
-				}
-				auto result = AmiraReader::ReadField((mBasePath + filename).c_str(), "field");
-				if (result != nullptr) {
-					mFieldData[iField] = result;
-					for (int i = 0; i < 6; i++)
-						mBounds[i] = result->GetBounds()[i];
-				}
-			}
+		if (time != mTime) mDirection = time < mTime ? -1 : 1;
+		mTime = time;
+		// the coarse level keeps scrubbing responsive, the requested level is read when the timer fires
+		if (mScrubLevel > mLevel) {
+			ReadFields(time, mScrubLevel);
+			mIdleTimer->start();
+		}
+		else {
+			mIdleTimer->stop();
+			ReadFields(time, mLevel);
 		}
 		if (mParticleEnabled) {
 			char filename[256];
@@ -130,6 +151,102 @@ namespace vispro
 		emit DataChanged();
 	}
 
+	void Data::SetLevel(int level)
+	{
+		mLevel = std::min(std::max(level, 0), Pyramid::NumLevels - 1);
+		mIdleTimer->stop();
+		ReadRequestedLevel();
+	}
+
+	int Data::GetLevel() const { return mLevel; }
+
+	void Data::SetScrubLevel(int level)
+	{
+		mScrubLevel = std::min(std::max(level, 0), Pyramid::NumLevels - 1);
+	}
+
+	void Data::ReadRequestedLevel()
+	{
+		ReadFields(mTime, mLevel);
+		emit DataChanged();
+	}
+
+	void Data::ReadFields(int time, int level)
+	{
+		std::vector<vtkSmartPointer<vtkImageData>> prefetched = TakePrefetch(time, level);
+		for (int iField = 0; iField < NumFields; ++iField) {
+			if (mFieldEnabled[iField]) {
+				vtkSmartPointer<vtkImageData> result = prefetched[iField];
+				if (result == nullptr)
+					result = mManifest.ReadFieldMapped(TimeSeriesManifest::GetLevelName(ManifestFieldNames[iField], level), time, "field");
+				if (result == nullptr && level > 0)
+					result = mManifest.ReadFieldMapped(ManifestFieldNames[iField], time, "field");
+				if (result != nullptr) {
+					mFieldData[iField] = result;
+					for (int i = 0; i < 6; i++)
+						mBounds[i] = result->GetBounds()[i];
+				}
+			}
+		}
+		Prefetch(time + mDirection, level);
+	}
+
+	void Data::Prefetch(int time, int level)
+	{
+		TakePrefetch(-1, 0);
+		if (time < 0 || time >= mManifest.GetNumTimeSteps()) return;
+
+		// the fields are allocated from their headers and read in one batch
+		std::vector<TimeSeriesManifest::BatchRead> reads;
+		mPrefetchData.assign(NumFields, nullptr);
+		for (int iField = 0; iField < NumFields; ++iField) {
+			if (!mFieldEnabled[iField]) continue;
+			std::string name = TimeSeriesManifest::GetLevelName(ManifestFieldNames[iField], level);
+			const AmiraReader::Header* header = mManifest.FindHeader(name, time);
+			if (header == nullptr && level > 0) {
+				name = ManifestFieldNames[iField];
+				header = mManifest.FindHeader(name, time);
+			}
+			if (header == nullptr) continue;
+			mPrefetchData[iField] = AmiraReader::AllocateField(*header, "field");
+			reads.push_back(TimeSeriesManifest::BatchRead{ name, time, vtkFloatArray::SafeDownCast(mPrefetchData[iField]->GetPointData()->GetArray(0)), Eigen::AlignedBox3i() });
+		}
+		if (reads.empty()) return;
+		mPrefetchTicket = mManifest.SubmitFields(mReader, reads);
+		mPrefetchTime = time;
+		mPrefetchLevel = level;
+	}
+
+	std::vector<vtkSmartPointer<vtkImageData>> Data::TakePrefetch(int time, int level)
+	{
+		std::vector<vtkSmartPointer<vtkImageData>> prefetched(NumFields);
+		ReleaseStalePrefetches(false);
+		if (mPrefetchTime < 0) return prefetched;
+		if (mPrefetchTime == time && mPrefetchLevel == level) {
+			if (mReader.Wait(mPrefetchTicket))
+				prefetched.swap(mPrefetchData);
+		}
+		else {
+			// a prefetch that is not needed, e.g., of the full resolution when scrubbing starts, must not delay the read of the requested level
+			mStalePrefetches.emplace_back(mPrefetchTicket, std::move(mPrefetchData));
+			ReleaseStalePrefetches(false);
+		}
+		mPrefetchData.clear();
+		mPrefetchTime = -1;
+		return prefetched;
+	}
+
+	void Data::ReleaseStalePrefetches(bool block)
+	{
+		// every ticket is waited for once, which returns right away if its reads arrived
+		auto end = std::remove_if(mStalePrefetches.begin(), mStalePrefetches.end(), [this, block](const auto& stale) {
+			if (!block && !mReader.IsReady(stale.first)) return false;
+			mReader.Wait(stale.first);
+			return true;
+		});
+		mStalePrefetches.erase(end, mStalePrefetches.end());
+	}
+
 	void Data::CheckedChanged(int state) {
 		mFieldEnabled[sender()->property("id").toInt()] = (bool)state;
 	}
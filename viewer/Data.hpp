@@ -3,8 +3,10 @@
 #include <vtkSmartPointer.h>
 #include <vector>
 #include <qobject.h>
+#include "TimeSeriesManifest.hpp"
 
 class QWidget;
+class QTimer;
 class vtkImageData;
 class vtkPolyData;
 class vtkXMLPolyDataReader;
@@ -33,8 +35,15 @@ namespace vispro
 		// Destructor.
 		~Data();
 
-		// Sets the time step which triggers loading of requested fields.
+		// Sets the time step which triggers loading of requested fields. While the time changes, the fields are read from the coarse
+		// scrubbing level of the resolution pyramid. The requested level follows once the time has not changed for a moment.
 		void SetTime(int time);
+		// Sets the level of the resolution pyramid that is read, 0 is the full resolution. Triggers loading of the current time step.
+		void SetLevel(int level);
+		// Gets the level of the resolution pyramid that is read when the time rests.
+		int GetLevel() const;
+		// Sets the level of the resolution pyramid that is read while the time changes. Levels that are not coarser than the requested level disable scrubbing.
+		void SetScrubLevel(int level);
 
 		// Gets a specific field.
 		vtkImageData* GetField(const EField& field);
@@ -61,13 +70,28 @@ namespace vispro
 		void CheckedChanged(int state);
 		// Slot for listening to checkbox clicks.
 		void CheckedParticlesChanged(int state);
+		// Slot for the idle timer, which reads the requested level after scrubbing.
+		void ReadRequestedLevel();
 
 	private:
 		// Delete copy-constructor.
 		Data(const Data& data) = delete;
 
+		// Reads the enabled fields of a time step from a level of the resolution pyramid. Fields without this level are read at full resolution.
+		// Fields that were prefetched are taken from the prefetch, the others are mapped. Afterwards, the next time step is prefetched.
+		void ReadFields(int time, int level);
+		// Submits the reads of the enabled fields of a time step to the batch reader, so that they arrive while the current time step is shown.
+		void Prefetch(int time, int level);
+		// Waits for the prefetch and returns its fields if it matches the time step and level. Fields that were not prefetched are nullptr.
+		// A prefetch that does not match is not waited for, but kept until its reads arrived (see ReleaseStalePrefetches).
+		std::vector<vtkSmartPointer<vtkImageData>> TakePrefetch(int time, int level);
+		// Releases the buffers of the prefetches that were not needed once their reads arrived. If block is set, they are waited for.
+		void ReleaseStalePrefetches(bool block);
+
 		// Base path to the data.
 		std::string mBasePath;
+		// Cached headers of all files in the data set.
+		TimeSeriesManifest mManifest;
 		// Vector that contains a flag for each field to indicate whether it is currently loaded. Use EField as index.
 		std::vector<bool> mFieldEnabled;
 		// Flag that indicates whether particle data is read.
@@ -78,6 +102,28 @@ namespace vispro
 		vtkSmartPointer<vtkXMLPolyDataReader> mParticleData;
 		// Bounds of the domain (xmin,xmax, ymin,ymax, zmin,zmax).
 		double mBounds[6];
+		// Current time step.
+		int mTime;
+		// Level of the resolution pyramid that is read when the time rests.
+		int mLevel;
+		// Level of the resolution pyramid that is read while the time changes.
+		int mScrubLevel;
+		// Single-shot timer that reads the requested level once the time rests.
+		QTimer* mIdleTimer;
+		// Direction in which the time changed last, which is where the next time step is prefetched.
+		int mDirection;
+		// Fields of the prefetched time step. Use EField as index.
+		std::vector<vtkSmartPointer<vtkImageData>> mPrefetchData;
+		// Time step that is prefetched, -1 if no prefetch is in flight.
+		int mPrefetchTime;
+		// Level of the resolution pyramid that is prefetched.
+		int mPrefetchLevel;
+		// Ticket of the prefetch.
+		BatchReader::Ticket mPrefetchTicket;
+		// Prefetches that were not needed, whose buffers are in use until their reads arrived.
+		std::vector<std::pair<BatchReader::Ticket, std::vector<vtkSmartPointer<vtkImageData>>>> mStalePrefetches;
+		// Reader of the prefetches. It is declared after the buffers, so that it stops before they are released.
+		BatchReader mReader;
 
 		// Widget to manipulate the fields to read.
 		QWidget* mWidget;